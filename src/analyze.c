@@ -18,65 +18,80 @@
 
 /*
 ** This routine generates code that opens the sqlite_stat1 table on cursor
-** iStatCur.
+** iStatCur and the sqlite_stat2 table on cursor iStatCur+1.
 **
-** If the sqlite_stat1 tables does not previously exist, it is created.
-** If it does previously exist, all entires associated with table zWhere
-** are removed.  If zWhere==0 then all entries are removed.
+** If the sqlite_stat1 and sqlite_stat2 tables do not previously exist,
+** they are created.  If they do previously exist, all entries associated
+** with table zWhere are removed.  If zWhere==0 then all entries are
+** removed.
 */
 static void openStatTable(
   Parse *pParse,          /* Parsing context */
   int iDb,                /* The database we are looking in */
-  int iStatCur,           /* Open the sqlite_stat1 table on this cursor */
+  int iStatCur,           /* First of the two cursors to open */
   const char *zWhere      /* Delete entries associated with this table */
 ){
+  static const struct {
+    const char *zName;    /* Name of the statistics table */
+    const char *zCols;    /* Columns of the table when it is created */
+    int nCol;             /* Number of columns */
+  } aTable[] = {
+    { "sqlite_stat1", "tbl,idx,stat", 3 },
+    { "sqlite_stat2", "tbl,idx,sampleno,sample", 4 },
+  };
   sqlite3 *db = pParse->db;
   Db *pDb;
-  int iRootPage;
-  u8 createStat1 = 0;
-  Table *pStat;
+  int aRoot[ArraySize(aTable)];
+  u8 aCreateTbl[ArraySize(aTable)];
+  int i;
   Vdbe *v = sqlite3GetVdbe(pParse);
 
   if( v==0 ) return;
   assert( sqlite3BtreeHoldsAllMutexes(db) );
   assert( sqlite3VdbeDb(v)==db );
   pDb = &db->aDb[iDb];
-  if( (pStat = sqlite3FindTable(db, "sqlite_stat1", pDb->zName))==0 ){
-    /* The sqlite_stat1 tables does not exist.  Create it.  
-    ** Note that a side-effect of the CREATE TABLE statement is to leave
-    ** the rootpage of the new table in register pParse->regRoot.  This is
-    ** important because the OpenWrite opcode below will be needing it. */
-    sqlite3NestedParse(pParse,
-      "CREATE TABLE %Q.sqlite_stat1(tbl,idx,stat)",
-      pDb->zName
-    );
-    iRootPage = pParse->regRoot;
-    createStat1 = 1;  /* Cause rootpage to be taken from top of stack */
-  }else if( zWhere ){
-    /* The sqlite_stat1 table exists.  Delete all entries associated with
-    ** the table zWhere. */
-    sqlite3NestedParse(pParse,
-       "DELETE FROM %Q.sqlite_stat1 WHERE tbl=%Q",
-       pDb->zName, zWhere
-    );
-    iRootPage = pStat->tnum;
-  }else{
-    /* The sqlite_stat1 table already exists.  Delete all rows. */
-    iRootPage = pStat->tnum;
-    sqlite3VdbeAddOp2(v, OP_Clear, pStat->tnum, iDb);
+  for(i=0; i<ArraySize(aTable); i++){
+    const char *zTab = aTable[i].zName;
+    Table *pStat;
+    if( (pStat = sqlite3FindTable(db, zTab, pDb->zName))==0 ){
+      /* The table does not exist.  Create it.  Note that a side-effect
+      ** of the CREATE TABLE statement is to leave the rootpage of the
+      ** new table in register pParse->regRoot.  This is important because
+      ** the OpenWrite opcode below will be needing it. */
+      sqlite3NestedParse(pParse,
+        "CREATE TABLE %Q.%s(%s)", pDb->zName, zTab, aTable[i].zCols
+      );
+      aRoot[i] = pParse->regRoot;
+      aCreateTbl[i] = 1;
+    }else{
+      /* The table exists.  Delete all entries associated with the table
+      ** zWhere, or all rows if zWhere==0. */
+      aRoot[i] = pStat->tnum;
+      aCreateTbl[i] = 0;
+      if( zWhere ){
+        sqlite3NestedParse(pParse,
+           "DELETE FROM %Q.%s WHERE tbl=%Q", pDb->zName, zTab, zWhere
+        );
+      }else{
+        sqlite3VdbeAddOp2(v, OP_Clear, aRoot[i], iDb);
+      }
+    }
   }
 
-  /* Open the sqlite_stat1 table for writing. Unless it was created
+  /* Open the statistics tables for writing. Unless a table was created
   ** by this vdbe program, lock it for writing at the shared-cache level. 
-  ** If this vdbe did create the sqlite_stat1 table, then it must have 
-  ** already obtained a schema-lock, making the write-lock redundant.
+  ** If this vdbe did create the table, then it must have already
+  ** obtained a schema-lock, making the write-lock redundant.
   */
-  if( !createStat1 ){
-    sqlite3TableLock(pParse, iDb, iRootPage, 1, "sqlite_stat1");
+  for(i=0; i<ArraySize(aTable); i++){
+    if( !aCreateTbl[i] ){
+      sqlite3TableLock(pParse, iDb, aRoot[i], 1, aTable[i].zName);
+    }
+    sqlite3VdbeAddOp3(v, OP_OpenWrite, iStatCur+i, aRoot[i], iDb);
+    sqlite3VdbeChangeP4(v, -1, (char*)SQLITE_INT_TO_PTR(aTable[i].nCol),
+                        P4_INT32);
+    sqlite3VdbeChangeP5(v, aCreateTbl[i]);
   }
-  sqlite3VdbeAddOp3(v, OP_OpenWrite, iStatCur, iRootPage, iDb);
-  sqlite3VdbeChangeP4(v, -1, (char *)3, P4_INT32);
-  sqlite3VdbeChangeP5(v, createStat1);
 }
 
 /*
@@ -86,7 +101,7 @@ static void openStatTable(
 static void analyzeOneTable(
   Parse *pParse,   /* Parser context */
   Table *pTab,     /* Table whose indices are to be analyzed */
-  int iStatCur,    /* Index of VdbeCursor that writes the sqlite_stat1 table */
+  int iStatCur,    /* Cursors that write the sqlite_stat1 and stat2 tables */
   int iMem         /* Available memory locations begin here */
 ){
   Index *pIdx;     /* An index to being analyzed */
@@ -98,6 +113,14 @@ static void analyzeOneTable(
   int endOfLoop;   /* The end of the loop */
   int addr;        /* The address of an instruction */
   int iDb;         /* Index of database containing pTab */
+#ifndef SQLITE_OMIT_BTREECOUNT
+  int regCount = iMem++;      /* Number of rows in the table */
+  int regSample = iMem;       /* First of 4 registers for a sqlite_stat2 row */
+  int regSamplePos = iMem+4;  /* Row number of the next sample */
+  int regRecno = iMem+5;      /* Row number of the current row */
+  int regSampleTemp = iMem+6; /* Temporary use register */
+  iMem += 7;
+#endif
 
   v = sqlite3GetVdbe(pParse);
   if( v==0 || pTab==0 || pTab->pIndex==0 ){
@@ -161,6 +184,32 @@ static void analyzeOneTable(
       sqlite3VdbeAddOp2(v, OP_Null, 0, iMem+nCol+i+1);
     }
 
+#ifndef SQLITE_OMIT_BTREECOUNT
+    /* Every index of the table has one entry per row, so the number of
+    ** rows only needs to be counted once.  The samples for the
+    ** sqlite_stat2 table are taken from the middle of each of the
+    ** SQLITE_INDEX_SAMPLES equal parts of the index:
+    **
+    **     sample K is row ((2*K+1)*N) / (2*SQLITE_INDEX_SAMPLES)
+    **
+    ** Tables with fewer than SQLITE_INDEX_SAMPLES rows are not sampled.
+    ** Register regSamplePos is left NULL for them.
+    */
+    if( pIdx==pTab->pIndex ){
+      sqlite3VdbeAddOp2(v, OP_Count, iIdxCur, regCount);
+    }
+    sqlite3VdbeAddOp4(v, OP_String8, 0, regSample, 0, pTab->zName, 0);
+    sqlite3VdbeAddOp4(v, OP_String8, 0, regSample+1, 0, pIdx->zName, 0);
+    sqlite3VdbeAddOp2(v, OP_Integer, 0, regSample+2);
+    sqlite3VdbeAddOp2(v, OP_Integer, 0, regRecno);
+    sqlite3VdbeAddOp2(v, OP_Null, 0, regSamplePos);
+    sqlite3VdbeAddOp2(v, OP_Integer, SQLITE_INDEX_SAMPLES, regSampleTemp);
+    addr = sqlite3VdbeAddOp3(v, OP_Lt, regSampleTemp, 0, regCount);
+    sqlite3VdbeAddOp2(v, OP_Integer, SQLITE_INDEX_SAMPLES*2, regSampleTemp);
+    sqlite3VdbeAddOp3(v, OP_Divide, regSampleTemp, regCount, regSamplePos);
+    sqlite3VdbeJumpHere(v, addr);
+#endif
+
     /* Do the analysis.
     */
     endOfLoop = sqlite3VdbeMakeLabel(v);
@@ -180,6 +229,28 @@ static void analyzeOneTable(
       sqlite3VdbeAddOp3(v, OP_Column, iIdxCur, i, iMem+nCol+i+1);
     }
     sqlite3VdbeResolveLabel(v, endOfLoop);
+#ifndef SQLITE_OMIT_BTREECOUNT
+    /* At this point register iMem+nCol+1 holds the first column of the
+    ** current row.  If this is the row chosen for the next sample, write
+    ** it to the sqlite_stat2 table and work out where the sample after
+    ** it lies.
+    */
+    addr = sqlite3VdbeAddOp3(v, OP_Ne, regRecno, 0, regSamplePos);
+    sqlite3VdbeChangeP5(v, SQLITE_JUMPIFNULL);
+    sqlite3VdbeAddOp2(v, OP_Copy, iMem+nCol+1, regSample+3);
+    sqlite3VdbeAddOp3(v, OP_MakeRecord, regSample, 4, regRec);
+    sqlite3VdbeAddOp2(v, OP_NewRowid, iStatCur+1, regRowid);
+    sqlite3VdbeAddOp3(v, OP_Insert, iStatCur+1, regRec, regRowid);
+    sqlite3VdbeChangeP5(v, OPFLAG_APPEND);
+    sqlite3VdbeAddOp2(v, OP_AddImm, regSample+2, 1);
+    sqlite3VdbeAddOp3(v, OP_Add, regSample+2, regSample+2, regSampleTemp);
+    sqlite3VdbeAddOp2(v, OP_AddImm, regSampleTemp, 1);
+    sqlite3VdbeAddOp3(v, OP_Multiply, regCount, regSampleTemp, regSampleTemp);
+    sqlite3VdbeAddOp2(v, OP_Integer, SQLITE_INDEX_SAMPLES*2, regSamplePos);
+    sqlite3VdbeAddOp3(v, OP_Divide, regSamplePos, regSampleTemp, regSamplePos);
+    sqlite3VdbeJumpHere(v, addr);
+    sqlite3VdbeAddOp2(v, OP_AddImm, regRecno, 1);
+#endif
     sqlite3VdbeAddOp2(v, OP_Next, iIdxCur, topOfLoop);
     sqlite3VdbeAddOp1(v, OP_Close, iIdxCur);
 
@@ -245,7 +316,8 @@ static void analyzeDatabase(Parse *pParse, int iDb){
   int iMem;
 
   sqlite3BeginWriteOperation(pParse, 0, iDb);
-  iStatCur = pParse->nTab++;
+  iStatCur = pParse->nTab;
+  pParse->nTab += 2;
   openStatTable(pParse, iDb, iStatCur, 0);
   iMem = pParse->nMem+1;
   for(k=sqliteHashFirst(&pSchema->tblHash); k; k=sqliteHashNext(k)){
@@ -267,7 +339,8 @@ static void analyzeTable(Parse *pParse, Table *pTab){
   assert( sqlite3BtreeHoldsAllMutexes(pParse->db) );
   iDb = sqlite3SchemaToIndex(pParse->db, pTab->pSchema);
   sqlite3BeginWriteOperation(pParse, 0, iDb);
-  iStatCur = pParse->nTab++;
+  iStatCur = pParse->nTab;
+  pParse->nTab += 2;
   openStatTable(pParse, iDb, iStatCur, pTab->zName);
   analyzeOneTable(pParse, pTab, iStatCur, pParse->nMem+1);
   loadAnalysis(pParse, iDb);
@@ -386,7 +459,98 @@ static int analysisLoader(void *pData, int argc, char **argv, char **NotUsed){
 }
 
 /*
-** Load the content of the sqlite_stat1 table into the index hash tables.
+** Free the samples loaded from the sqlite_stat2 table for index pIdx.
+*/
+void sqlite3DeleteIndexSamples(Index *pIdx){
+  if( pIdx->aSample ){
+    sqlite3 *dbMem = pIdx->pTable->dbMem;
+    int j;
+    for(j=0; j<SQLITE_INDEX_SAMPLES; j++){
+      IndexSample *p = &pIdx->aSample[j];
+      if( p->eType==SQLITE_TEXT || p->eType==SQLITE_BLOB ){
+        sqlite3DbFree(dbMem, p->u.z);
+      }
+    }
+    sqlite3DbFree(dbMem, pIdx->aSample);
+    pIdx->aSample = 0;
+  }
+}
+
+/*
+** Load the samples in the sqlite_stat2 table of database iDb into the
+** Index.aSample[] arrays.  An index gets an array as soon as one of its
+** samples is read.  Samples that are missing from the table are left
+** as SQLITE_NULL.
+*/
+static int loadSamples(sqlite3 *db, const char *zDb){
+  sqlite3_stmt *pStmt = 0;
+  char *zSql;
+  int rc;
+
+  zSql = sqlite3MPrintf(db,
+      "SELECT idx, sampleno, sample FROM %Q.sqlite_stat2", zDb);
+  if( zSql==0 ){
+    return SQLITE_NOMEM;
+  }
+  rc = sqlite3_prepare(db, zSql, -1, &pStmt, 0);
+  sqlite3DbFree(db, zSql);
+  if( rc!=SQLITE_OK ){
+    return rc;
+  }
+
+  while( sqlite3_step(pStmt)==SQLITE_ROW ){
+    const char *zIndex = (const char *)sqlite3_column_text(pStmt, 0);
+    int iSample = sqlite3_column_int(pStmt, 1);
+    int eType = sqlite3_column_type(pStmt, 2);
+    Index *pIdx;
+    IndexSample *pSample;
+    sqlite3 *dbMem;
+
+    if( zIndex==0 || iSample<0 || iSample>=SQLITE_INDEX_SAMPLES ) continue;
+    pIdx = sqlite3FindIndex(db, zIndex, zDb);
+    if( pIdx==0 ) continue;
+    dbMem = pIdx->pTable->dbMem;
+    if( pIdx->aSample==0 ){
+      int j;
+      pIdx->aSample = (IndexSample *)sqlite3DbMallocZero(dbMem,
+          sizeof(IndexSample)*SQLITE_INDEX_SAMPLES);
+      if( pIdx->aSample==0 ){
+        db->mallocFailed = 1;
+        break;
+      }
+      for(j=0; j<SQLITE_INDEX_SAMPLES; j++){
+        pIdx->aSample[j].eType = SQLITE_NULL;
+      }
+    }
+    pSample = &pIdx->aSample[iSample];
+    if( pSample->eType==SQLITE_TEXT || pSample->eType==SQLITE_BLOB ){
+      sqlite3DbFree(dbMem, pSample->u.z);
+    }
+    pSample->eType = (u8)eType;
+    if( eType==SQLITE_INTEGER || eType==SQLITE_FLOAT ){
+      pSample->u.r = sqlite3_column_double(pStmt, 2);
+    }else if( eType==SQLITE_TEXT || eType==SQLITE_BLOB ){
+      const char *z = (const char *)(eType==SQLITE_BLOB ?
+          sqlite3_column_blob(pStmt, 2) : sqlite3_column_text(pStmt, 2));
+      int n = sqlite3_column_bytes(pStmt, 2);
+      pSample->nByte = n;
+      pSample->u.z = sqlite3DbMallocRaw(dbMem, n>0 ? n : 1);
+      if( pSample->u.z==0 ){
+        pSample->eType = SQLITE_NULL;
+        db->mallocFailed = 1;
+        break;
+      }
+      if( n>0 ) memcpy(pSample->u.z, z, n);
+    }
+  }
+  rc = sqlite3_finalize(pStmt);
+  if( rc==SQLITE_OK && db->mallocFailed ) rc = SQLITE_NOMEM;
+  return rc;
+}
+
+/*
+** Load the content of the sqlite_stat1 and sqlite_stat2 tables into the
+** index hash tables.
 */
 int sqlite3AnalysisLoad(sqlite3 *db, int iDb){
   analysisInfo sInfo;
@@ -402,6 +566,7 @@ int sqlite3AnalysisLoad(sqlite3 *db, int iDb){
   for(i=sqliteHashFirst(&db->aDb[iDb].pSchema->idxHash);i;i=sqliteHashNext(i)){
     Index *pIdx = sqliteHashData(i);
     sqlite3DefaultRowEst(pIdx);
+    sqlite3DeleteIndexSamples(pIdx);
   }
 
   /* Check to make sure the sqlite_stat1 table existss */
@@ -424,6 +589,18 @@ int sqlite3AnalysisLoad(sqlite3 *db, int iDb){
     sqlite3DbFree(db, zSql);
     if( rc==SQLITE_NOMEM ) db->mallocFailed = 1;
   }
+
+  /* Load the samples out of the sqlite_stat2 table, if there is one.
+  ** Databases analyzed by older versions of SQLite only have
+  ** sqlite_stat1. */
+  if( rc==SQLITE_OK
+   && sqlite3FindTable(db, "sqlite_stat2", sInfo.zDatabase)!=0
+  ){
+    (void)sqlite3SafetyOff(db);
+    rc = loadSamples(db, sInfo.zDatabase);
+    (void)sqlite3SafetyOn(db);
+    if( rc==SQLITE_NOMEM ) db->mallocFailed = 1;
+  }
   return rc;
 }
 
@@ -223,6 +223,27 @@ static int backupOnePage(sqlite3_backup *p, Pgno iSrcPg, const u8 *zSrcData){
     rc = SQLITE_READONLY;
   }
 
+  /* BEGIN CRYPTO */
+#ifdef SQLITE_HAS_CODEC
+  /* Or where the destination is encrypted and its pages are laid out
+  ** differently. Its codec encrypts each page with the destination key as
+  ** it is written, which only works if source pages can be copied whole
+  ** and the bytes the codec reserves at the end of each page (for the IV
+  ** and any HMAC) are reserved in the source as well.
+  */
+  if( rc==SQLITE_OK ){
+    extern void sqlite3pager_get_codec(Pager*, void**);
+    void *pCodec;
+    sqlite3pager_get_codec(pDestPager, &pCodec);
+    if( pCodec && (nSrcPgsz!=nDestPgsz
+         || sqlite3BtreeGetReserve(p->pSrc)!=sqlite3BtreeGetReserve(p->pDest))
+    ){
+      rc = SQLITE_READONLY;
+    }
+  }
+#endif
+  /* END CRYPTO */
+
   /* This loop runs once for each destination page spanned by the source 
   ** page. For each iteration, variable iOff is set to the byte offset
   ** of the destination page.
@@ -254,6 +275,80 @@ static int backupOnePage(sqlite3_backup *p, Pgno iSrcPg, const u8 *zSrcData){
   return rc;
 }
 
+/* BEGIN CRYPTO */
+#ifdef SQLITE_HAS_CODEC
+/*
+** The largest number of pages read from an encrypted source database
+** with a single call to sqlite3PagerReadRun() by backupCopyRuns().
+*/
+#ifndef BACKUP_READ_BATCH
+# define BACKUP_READ_BATCH 64
+#endif
+
+/*
+** Return true if backup_step() should copy the pages of the source with
+** backupCopyRuns() instead of fetching them through the page cache. This
+** is done for encrypted source databases with a file, when the source is
+** not in a write transaction and not in WAL mode (so the file content is
+** up to date).
+*/
+static int backupUseRuns(sqlite3_backup *p){
+  extern void sqlite3pager_get_codec(Pager*, void**);
+  Pager * const pSrcPager = sqlite3BtreePager(p->pSrc);
+  void *pCodec;
+  sqlite3pager_get_codec(pSrcPager, &pCodec);
+  return pCodec!=0
+      && p->pSrc->pBt->inTransaction!=TRANS_WRITE
+      && sqlite3PagerFile(pSrcPager)->pMethods!=0
+      && sqlite3PagerJournalMode(pSrcPager, PAGER_JOURNALMODE_QUERY)
+                                          !=PAGER_JOURNALMODE_WAL;
+}
+
+/*
+** Copy up to nPage pages (all remaining pages if nPage is negative) of
+** the nSrcPage page source database to the destination, starting at
+** p->iNext. Pages are read straight from the source file in runs of up
+** to BACKUP_READ_BATCH pages and decrypted with the source codec into a
+** private buffer, then handed to the destination pager which encrypts
+** them with the destination key when they are written. Plaintext only
+** ever exists in memory and the source page cache is left alone.
+*/
+static int backupCopyRuns(sqlite3_backup *p, int nPage, int nSrcPage){
+  extern int sqlite3PagerReadRun(Pager*, Pgno, int, void*);
+  Pager * const pSrcPager = sqlite3BtreePager(p->pSrc);
+  const int nSrcPgsz = sqlite3BtreeGetPageSize(p->pSrc);
+  const Pgno iPending = PENDING_BYTE_PAGE(p->pSrc->pBt);
+  int rc = SQLITE_OK;
+  u8 *aBuf;
+
+  aBuf = sqlite3Malloc(BACKUP_READ_BATCH*nSrcPgsz);
+  if( aBuf==0 ){
+    return SQLITE_NOMEM;
+  }
+  while( rc==SQLITE_OK && nPage!=0 && p->iNext<=(Pgno)nSrcPage ){
+    int n = BACKUP_READ_BATCH;
+    int i;
+    if( p->iNext==iPending ){
+      p->iNext++;
+      if( nPage>0 ) nPage--;
+      continue;
+    }
+    if( nPage>0 && n>nPage ) n = nPage;
+    if( n>nSrcPage+1-(int)p->iNext ) n = nSrcPage+1-p->iNext;
+    if( p->iNext<iPending && p->iNext+n>iPending ) n = iPending-p->iNext;
+    rc = sqlite3PagerReadRun(pSrcPager, p->iNext, n, aBuf);
+    for(i=0; rc==SQLITE_OK && i<n; i++){
+      rc = backupOnePage(p, p->iNext, &aBuf[i*nSrcPgsz]);
+      p->iNext++;
+    }
+    if( nPage>0 ) nPage -= n;
+  }
+  sqlite3_free(aBuf);
+  return rc;
+}
+#endif
+/* END CRYPTO */
+
 /*
 ** If pFile is currently larger than iSize bytes, then truncate it to
 ** exactly iSize bytes. If pFile is not larger than iSize bytes, then
@@ -308,6 +403,17 @@ int sqlite3_backup_step(sqlite3_backup *p, int nPage){
       rc = sqlite3BtreeGetMeta(p->pDest, 1, &p->iDestSchema);
     }
 
+    /* A destination in WAL mode is only ever written through its log, so
+    ** the direct writes used to copy between page sizes are not possible.
+    */
+    if( rc==SQLITE_OK
+     && sqlite3PagerJournalMode(pDestPager, PAGER_JOURNALMODE_QUERY)
+                                          ==PAGER_JOURNALMODE_WAL
+     && sqlite3BtreeGetPageSize(p->pSrc)!=sqlite3BtreeGetPageSize(p->pDest)
+    ){
+      rc = SQLITE_READONLY;
+    }
+
     /* If there is no open read-transaction on the source database, open
     ** one now. If a transaction is opened here, then it will be closed
     ** before this function exits.
@@ -323,6 +429,14 @@ int sqlite3_backup_step(sqlite3_backup *p, int nPage){
     if( rc==SQLITE_OK ){
       rc = sqlite3PagerPagecount(pSrcPager, &nSrcPage);
     }
+    /* BEGIN CRYPTO */
+#ifdef SQLITE_HAS_CODEC
+    if( rc==SQLITE_OK && backupUseRuns(p) ){
+      rc = backupCopyRuns(p, nPage, nSrcPage);
+      nPage = 0;
+    }
+#endif
+    /* END CRYPTO */
     for(ii=0; (nPage<0 || ii<nPage) && p->iNext<=(Pgno)nSrcPage && !rc; ii++){
       const Pgno iSrcPg = p->iNext;                 /* Source page number */
       if( iSrcPg!=PENDING_BYTE_PAGE(p->pSrc->pBt) ){
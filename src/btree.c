@@ -1322,11 +1322,18 @@ static void releasePage(MemPage *pPage){
 **
 ** This routine needs to reset the extra data section at the end of the
 ** page to agree with the restored data.
+**
+** It is also called when the pager copies a memory mapped page into a
+** buffer of its own before the page is written, in which case the
+** content is unchanged but MemPage.aData has to follow it.
 */
 static void pageReinit(DbPage *pData){
   MemPage *pPage;
   pPage = (MemPage *)sqlite3PagerGetExtra(pData);
   assert( sqlite3PagerPageRefcount(pData)>0 );
+  if( pPage->pDbPage==pData ){
+    pPage->aData = sqlite3PagerGetData(pData);
+  }
   if( pPage->isInit ){
     assert( sqlite3_mutex_held(pPage->pBt->mutex) );
     pPage->isInit = 0;
@@ -1403,10 +1410,16 @@ int sqlite3BtreeOpen(
 #if !defined(SQLITE_OMIT_SHARED_CACHE) && !defined(SQLITE_OMIT_DISKIO)
   /*
   ** If this Btree is a candidate for shared cache, try to find an
-  ** existing BtShared object that we can share with
+  ** existing BtShared object that we can share with. A connection that
+  ** shares pages through the pager's read-only page store instead (see
+  ** SQLITE_OPEN_SHAREDPAGES) keeps a BtShared of its own, so that it
+  ** never waits on the BtShared mutex.
   */
   if( isMemdb==0 && zFilename && zFilename[0] ){
-    if( sqlite3GlobalConfig.sharedCacheEnabled ){
+    if( sqlite3GlobalConfig.sharedCacheEnabled
+     && (vfsFlags & (SQLITE_OPEN_SHAREDPAGES|SQLITE_OPEN_READONLY))
+              !=(SQLITE_OPEN_SHAREDPAGES|SQLITE_OPEN_READONLY)
+    ){
       int nFullPathname = pVfs->mxPathname+1;
       char *zFullPathname = sqlite3Malloc(nFullPathname);
       sqlite3_mutex *mutexShared;
@@ -1478,6 +1491,7 @@ int sqlite3BtreeOpen(
     pBt->pCursor = 0;
     pBt->pPage1 = 0;
     pBt->readOnly = sqlite3PagerIsreadonly(pBt->pPager);
+    pBt->fillFactor = 100;
     pBt->pageSize = get2byte(&zDbHeader[16]);
     if( pBt->pageSize<512 || pBt->pageSize>SQLITE_MAX_PAGE_SIZE
          || ((pBt->pageSize-1)&pBt->pageSize)!=0 ){
@@ -1836,6 +1850,23 @@ int sqlite3BtreeMaxPageCount(Btree *p, int mxPage){
 }
 #endif /* !defined(SQLITE_OMIT_PAGER_PRAGMAS) || !defined(SQLITE_OMIT_VACUUM) */
 
+/*
+** Get/set the percentage of a leaf page that is filled by rows appended
+** to a b-tree in key order before a new leaf is started for the rows
+** that follow (see sqlite3BtreeInsert()). Values between 10 and 100
+** change the setting. Return the setting in effect after the call.
+*/
+int sqlite3BtreeFillFactor(Btree *p, int fillFactor){
+  int n;
+  sqlite3BtreeEnter(p);
+  if( fillFactor>=10 && fillFactor<=100 ){
+    p->pBt->fillFactor = (u8)fillFactor;
+  }
+  n = p->pBt->fillFactor;
+  sqlite3BtreeLeave(p);
+  return n;
+}
+
 /*
 ** Change the 'auto-vacuum' property of the database. If the 'autoVacuum'
 ** parameter is non-zero, then auto-vacuum mode is enabled. If zero, it
@@ -1916,12 +1947,41 @@ static int lockBtree(BtShared *pBt){
     if( memcmp(page1, zMagicHeader, 16)!=0 ){
       goto page1_init_failed;
     }
+#ifdef SQLITE_OMIT_WAL
     if( page1[18]>1 ){
       pBt->readOnly = 1;
     }
     if( page1[19]>1 ){
       goto page1_init_failed;
     }
+#else
+    if( page1[18]>2 ){
+      pBt->readOnly = 1;
+    }
+    if( page1[19]>2 ){
+      goto page1_init_failed;
+    }
+
+    /* If the write version is set to 2, this database should be accessed
+    ** in WAL mode. If the log is not already open, open it now. Then 
+    ** return SQLITE_OK and return without populating BtShared.pPage1.
+    ** The caller detects this and calls this function again. This is
+    ** required as the version of page 1 currently in the page1 buffer
+    ** may not be the latest version - there may be a newer one in the log
+    ** file.
+    */
+    if( page1[19]==2 && pBt->doNotUseWAL==0 ){
+      int isOpen = 0;
+      rc = sqlite3PagerOpenWal(pBt->pPager, &isOpen);
+      if( rc!=SQLITE_OK ){
+        goto page1_init_failed;
+      }else if( isOpen==0 ){
+        releasePage(pPage1);
+        return SQLITE_OK;
+      }
+      rc = SQLITE_NOTADB;
+    }
+#endif
 
     /* The maximum embedded fraction must be exactly 25%.  And the minimum
     ** embedded fraction must be 12.5% for both leaf-data and non-leaf-data.
@@ -3749,6 +3809,7 @@ static int moveToRoot(BtCursor *pCur){
     sqlite3BtreeClearCursor(pCur);
   }
 
+  pCur->nLeafStep = 0;
   if( pCur->iPage>=0 ){
     int i;
     for(i=1; i<=pCur->iPage; i++){
@@ -4118,6 +4179,60 @@ sqlite3 *sqlite3BtreeCursorDb(const BtCursor *pCur){
 ** was already pointing to the last entry in the database before
 ** this routine was called, then set *pRes=1.
 */
+/*
+** This is called by sqlite3BtreeNext() each time the cursor moves on to
+** a new leaf page. From the second such move after the cursor was last
+** positioned, the cursor is taken to be scanning the table in order, and
+** the pager is asked to read ahead the leaves that follow. These are the
+** children of the current leaf's parent that come after it. Runs of
+** consecutive page numbers are passed to the pager as one request, and
+** a new batch is only requested when the cursor comes within half a
+** batch of the end of the last one.
+*/
+static void btreeReadahead(BtCursor *pCur){
+  Pager *pPager = pCur->pBt->pPager;
+  int nAhead = sqlite3PagerReadaheadLimit(pPager, -1);
+  MemPage *pParent;         /* Parent of the current leaf */
+  int iChild;               /* Index of the current leaf in pParent */
+  int iFirst, iEnd;         /* Children of pParent to read ahead */
+  Pgno pgnoRun = 0;         /* First page of the current run */
+  int nRun = 0;             /* Number of pages in the current run */
+  int i;
+
+  if( nAhead<=0 || pCur->iPage<1 ) return;
+  if( pCur->nLeafStep==0 ){
+    pCur->nLeafStep = 1;
+    return;
+  }
+  pParent = pCur->apPage[pCur->iPage-1];
+  iChild = pCur->aiIdx[pCur->iPage-1];
+  iFirst = iChild+1;
+  if( pCur->pgnoAhead==pParent->pgno && pCur->iAhead>iFirst ){
+    if( pCur->iAhead-iChild>nAhead/2 ) return;
+    iFirst = pCur->iAhead;
+  }
+  iEnd = iChild+1+nAhead;
+  if( iEnd>pParent->nCell+1 ) iEnd = pParent->nCell+1;
+  for(i=iFirst; i<iEnd; i++){
+    Pgno pgno;
+    if( i<pParent->nCell ){
+      pgno = get4byte(findCell(pParent, i));
+    }else{
+      pgno = get4byte(&pParent->aData[pParent->hdrOffset+8]);
+    }
+    if( nRun>0 && pgno==pgnoRun+nRun ){
+      nRun++;
+    }else{
+      if( nRun>0 ) sqlite3PagerReadahead(pPager, pgnoRun, nRun);
+      pgnoRun = pgno;
+      nRun = 1;
+    }
+  }
+  if( nRun>0 ) sqlite3PagerReadahead(pPager, pgnoRun, nRun);
+  pCur->pgnoAhead = pParent->pgno;
+  pCur->iAhead = (u16)iEnd;
+}
+
 int sqlite3BtreeNext(BtCursor *pCur, int *pRes){
   int rc;
   int idx;
@@ -4152,6 +4267,7 @@ int sqlite3BtreeNext(BtCursor *pCur, int *pRes){
       rc = moveToChild(pCur, get4byte(&pPage->aData[pPage->hdrOffset+8]));
       if( rc ) return rc;
       rc = moveToLeftmost(pCur);
+      if( rc==SQLITE_OK ) btreeReadahead(pCur);
       *pRes = 0;
       return rc;
     }
@@ -4177,6 +4293,7 @@ int sqlite3BtreeNext(BtCursor *pCur, int *pRes){
     return SQLITE_OK;
   }
   rc = moveToLeftmost(pCur);
+  if( rc==SQLITE_OK ) btreeReadahead(pCur);
   return rc;
 }
 
@@ -5065,6 +5182,25 @@ static void assemblePage(
 static int balance(BtCursor*, int);
 
 #ifndef SQLITE_OMIT_QUICKBALANCE
+/*
+** Return true if balance_quick() may be used to start a new leaf to the
+** right of the leaf pCur points to, for a cell that is appended after
+** the last cell of the leaf. Index leaves are only split this way when
+** the caller hinted that entries are being appended in key order (as
+** when copying an index by the transfer optimization); otherwise the
+** cells of the right-most leaves are redistributed as usual.
+*/
+static int quickBalanceOk(BtCursor *pCur){
+  MemPage *pPage = pCur->apPage[pCur->iPage];
+  MemPage *pParent;
+  if( pCur->iPage==0 ) return 0;
+  pParent = pCur->apPage[pCur->iPage-1];
+  return pPage->leaf
+      && pParent->pgno!=1
+      && get4byte(&pParent->aData[pParent->hdrOffset+8])==pPage->pgno
+      && (pPage->intKey || (pCur->isAppend && pPage->nCell>1));
+}
+
 /*
 ** This version of balance() handles the common special case where
 ** a new entry is being inserted on the extreme right-end of the
@@ -5081,6 +5217,11 @@ static int balance(BtCursor*, int);
 ** pPage is the leaf page which is the right-most page in the tree.
 ** pParent is its parent.  pPage must have a single overflow entry
 ** which is also the right-most entry on the page.
+**
+** In an index b-tree, where the dividers in the parent are entries
+** of their own, the right-most cell that remains on pPage is moved
+** up into the parent as the divider. pPage must have at least two
+** cells for this (see quickBalanceOk()).
 */
 static int balance_quick(BtCursor *pCur){
   int rc;
@@ -5126,23 +5267,47 @@ static int balance_quick(BtCursor *pCur){
     */
     assert( pPage->nCell>0 );
     pCell = findCell(pPage, pPage->nCell-1);
-    sqlite3BtreeParseCellPtr(pPage, pCell, &info);
-    fillInCell(pParent, parentCell, 0, info.nKey, 0, 0, 0, &parentSize);
-    assert( parentSize<64 );
     assert( sqlite3PagerIswriteable(pParent->pDbPage) );
-    insertCell(pParent, parentIdx, parentCell, parentSize, 0, 4);
-    put4byte(findOverflowCell(pParent,parentIdx), pPage->pgno);
-    put4byte(&pParent->aData[pParent->hdrOffset+8], pgnoNew);
+    if( pPage->intKey ){
+      sqlite3BtreeParseCellPtr(pPage, pCell, &info);
+      fillInCell(pParent, parentCell, 0, info.nKey, 0, 0, 0, &parentSize);
+      assert( parentSize<64 );
+      insertCell(pParent, parentIdx, parentCell, parentSize, 0, 4);
+    }else{
+      /* The overflow cell was copied out of pBt->pTmpSpace by the call
+      ** to assemblePage() above, so the divider can be built there. It
+      ** must remain valid until the parent has been balanced.
+      */
+      u8 *pDiv = pBt->pTmpSpace;
+      assert( pPage->nCell>1 );
+      szCell = cellSizePtr(pPage, pCell);
+      memcpy(&pDiv[4], pCell, szCell);
+      rc = sqlite3PagerWrite(pPage->pDbPage);
+      if( rc==SQLITE_OK ){
+        rc = dropCell(pPage, pPage->nCell-1, szCell);
+      }
+      if( rc==SQLITE_OK ){
+        parentSize = cellSizePtr(pParent, pDiv);
+        rc = insertCell(pParent, parentIdx, pDiv, parentSize, 0, 4);
+      }
+    }
+    if( rc==SQLITE_OK ){
+      put4byte(findOverflowCell(pParent,parentIdx), pPage->pgno);
+      put4byte(&pParent->aData[pParent->hdrOffset+8], pgnoNew);
+    }
   
     /* If this is an auto-vacuum database, update the pointer map
     ** with entries for the new page, and any pointer from the 
     ** cell on the page to an overflow page.
     */
-    if( ISAUTOVACUUM ){
+    if( ISAUTOVACUUM && rc==SQLITE_OK ){
       rc = ptrmapPut(pBt, pgnoNew, PTRMAP_BTREE, pParent->pgno);
       if( rc==SQLITE_OK ){
         rc = ptrmapPutOvfl(pNew, 0);
       }
+      if( rc==SQLITE_OK && !pPage->intKey ){
+        rc = ptrmapPutOvfl(pParent, parentIdx);
+      }
     }
 
     /* Release the reference to the new page. */
@@ -5265,20 +5430,16 @@ static int balance_nonroot(BtCursor *pCur){
 #ifndef SQLITE_OMIT_QUICKBALANCE
   /*
   ** A special case:  If a new entry has just been inserted into a
-  ** table (that is, a btree with integer keys and all data at the leaves)
-  ** and the new entry is the right-most entry in the tree (it has the
-  ** largest key) then use the special balance_quick() routine for
-  ** balancing.  balance_quick() is much faster and results in a tighter
-  ** packing of data in the common case.
+  ** table, or appended to an index (see quickBalanceOk()), and the new
+  ** entry is the right-most entry in the tree (it has the largest key)
+  ** then use the special balance_quick() routine for balancing.
+  ** balance_quick() is much faster and results in a tighter packing of
+  ** data in the common case.
   */
-  if( pPage->leaf &&
-      pPage->intKey &&
-      pPage->nOverflow==1 &&
+  if( pPage->nOverflow==1 &&
       pPage->aOvfl[0].idx==pPage->nCell &&
-      pParent->pgno!=1 &&
-      get4byte(&pParent->aData[pParent->hdrOffset+8])==pPage->pgno
+      quickBalanceOk(pCur)
   ){
-    assert( pPage->intKey );
     /*
     ** TODO: Check the siblings to the left of pPage. It may be that
     ** they are not full and no new page is required.
@@ -6156,6 +6317,24 @@ int sqlite3BtreeInsert(
   }else{
     assert( pPage->leaf );
   }
+#ifndef SQLITE_OMIT_QUICKBALANCE
+  /* If rows are being appended in key order and the right-most leaf is
+  ** already filled to BtShared.fillFactor percent, start a new leaf for
+  ** the new cell, as balance_quick() does when the leaf is full. The cell
+  ** is made the overflow cell of the page, just as insertCell() would if
+  ** it did not fit.
+  */
+  pCur->isAppend = (u8)appendBias;
+  if( appendBias && pBt->fillFactor<100 && idx==pPage->nCell
+   && pPage->nFree-szNew-2 < pBt->usableSize*(100-pBt->fillFactor)/100
+   && quickBalanceOk(pCur)
+  ){
+    pPage->aOvfl[0].pCell = newCell;
+    pPage->aOvfl[0].idx = (u16)idx;
+    pPage->nOverflow = 1;
+    pPage->nFree = 0;
+  }else
+#endif
   rc = insertCell(pPage, idx, newCell, szNew, 0, 0);
   if( rc==SQLITE_OK ){
     rc = balance(pCur, 1);
@@ -6164,6 +6343,7 @@ int sqlite3BtreeInsert(
   /* Must make sure nOverflow is reset to zero even if the balance()
   ** fails.  Internal data structure corruption will result otherwise. */
   pCur->apPage[pCur->iPage]->nOverflow = 0;
+  pCur->isAppend = 0;
 
   if( rc==SQLITE_OK ){
     moveToRoot(pCur);
@@ -7434,6 +7614,67 @@ int sqlite3BtreeIsInBackup(Btree *p){
   return p->nBackup!=0;
 }
 
+#ifndef SQLITE_OMIT_WAL
+/*
+** Run a checkpoint on the Btree passed as the first argument.
+**
+** Return SQLITE_LOCKED if this or any other connection has an open 
+** transaction on the shared-cache the argument Btree is connected to.
+*/
+int sqlite3BtreeCheckpoint(Btree *p){
+  int rc = SQLITE_OK;
+  if( p ){
+    BtShared *pBt = p->pBt;
+    sqlite3BtreeEnter(p);
+    if( pBt->inTransaction!=TRANS_NONE ){
+      rc = SQLITE_LOCKED;
+    }else{
+      rc = sqlite3PagerCheckpoint(pBt->pPager);
+    }
+    sqlite3BtreeLeave(p);
+  }
+  return rc;
+}
+
+/*
+** Set both the "read version" (single byte at byte offset 18) and 
+** "write version" (single byte at byte offset 19) fields in the database
+** header to iVersion. 1 means a rollback journal is used, 2 a
+** write-ahead log. The write transaction this opens is left for the
+** caller to commit.
+*/
+int sqlite3BtreeSetVersion(Btree *pBtree, int iVersion){
+  BtShared *pBt = pBtree->pBt;
+  int rc;                         /* Return code */
+ 
+  assert( pBtree->inTrans==TRANS_NONE );
+  assert( iVersion==1 || iVersion==2 );
+
+  /* If setting the version fields to 1, do not automatically open the
+  ** WAL connection, even if the version fields are currently set to 2.
+  */
+  pBt->doNotUseWAL = (u8)(iVersion==1);
+
+  rc = sqlite3BtreeBeginTrans(pBtree, 0);
+  if( rc==SQLITE_OK ){
+    u8 *aData = pBt->pPage1->aData;
+    if( aData[18]!=(u8)iVersion || aData[19]!=(u8)iVersion ){
+      rc = sqlite3BtreeBeginTrans(pBtree, 2);
+      if( rc==SQLITE_OK ){
+        rc = sqlite3PagerWrite(pBt->pPage1->pDbPage);
+        if( rc==SQLITE_OK ){
+          aData[18] = (u8)iVersion;
+          aData[19] = (u8)iVersion;
+        }
+      }
+    }
+  }
+
+  pBt->doNotUseWAL = 0;
+  return rc;
+}
+#endif
+
 /*
 ** This function returns a pointer to a blob of memory associated with
 ** a single shared-btree. The memory is used by client code for its own
@@ -37,14 +37,40 @@
 #include <openssl/evp.h>
 #include <openssl/rand.h>
 #include <openssl/hmac.h>
+#include <openssl/crypto.h>
 #include "sqliteInt.h"
 #include "btreeInt.h"
 #include "crypto.h"
+#include <time.h>
+#if SQLITE_THREADSAFE && SQLITE_OS_UNIX
+#include <pthread.h>
+#endif
+#if SQLITE_OS_UNIX
+#include <sys/mman.h>
+#endif
 
 
+/* cipher and key derivation settings of a database */
 typedef struct {
+  const EVP_CIPHER *evp_cipher; /* page cipher */
+  const EVP_MD *kdf_md;         /* PRF used by PBKDF2 */
+  int kdf_iter;                 /* PBKDF2 iterations */
+  const EVP_MD *hmac_md;        /* page HMAC digest, NULL if pages are not authenticated */
+  int hmac_check;               /* true if the page HMAC is verified on read */
+} codec_settings;
+
+typedef struct {
+  const EVP_CIPHER *evp_cipher;
+  const EVP_MD *kdf_md;
+  int kdf_iter;
+  const EVP_MD *hmac_md;
+  int hmac_check;
   int key_sz;
   int iv_sz;
+  int hmac_sz; /* size of the page HMAC stored after the iv, 0 if none */
+  int decrypt_inplace; /* true if pages are decrypted over their own ciphertext */
+  int pages_coded;     /* true once a page has been encrypted or decrypted */
+  int buffer_sz;       /* size of buffer, at least the page size */
   int pass_sz;
   int rekey_plaintext;
   void *key;
@@ -52,12 +78,335 @@ typedef struct {
   void *rekey;
   void *salt;
   void *pass;
+  void *hmac_key;   /* key authenticating pages, derived from key */
+  void *hmac_rekey; /* key authenticating pages written during a rekey */
+  EVP_CIPHER_CTX *ectx; /* persistent encryption context, keyed with rekey if set, else key */
+  EVP_CIPHER_CTX *dctx; /* persistent decryption context, keyed with key */
+  /* an online rekey (sqlite3_rekey_step) in progress moves pages from the
+  ** last one down to page 1 over to new_key. Pages numbered rekey_pgno 
+  ** and above already use it. */
+  Pgno rekey_pgno;      /* first page encrypted with new_key, 0 if none */
+  void *new_key;
+  void *new_hmac_key;
+  void *new_pass;
+  int new_pass_sz;
+  EVP_CIPHER_CTX *new_ectx;
+  EVP_CIPHER_CTX *new_dctx;
   Btree *pBt;
 } codec_ctx;
 
-static void codec_prepare_key(sqlite3 *db, const void *zKey, int nKey, void *salt, int nSalt, void *out, int *nOut) {
-  /* if key data lenth is exactly 256 bits / 32 bytes use the data directly */
-  if (nKey == 67 && sqlite3StrNICmp(zKey ,"x'", 2) == 0) { 
+/*
+ * ciphers that can be selected with PRAGMA cipher or sqlite3_key_v2. 
+ * CFB and CTR are stream modes. XTS is a block mode, but it handles a
+ * partial last block by ciphertext stealing, so none of them needs
+ * padding and the ciphertext is exactly the size of the plaintext. 
+ * Only the stream modes are decrypted in place (see decrypt_inplace). 
+ * OpenSSL dispatches each of them to AES-NI when the CPU supports it.
+ */
+static const struct {
+  const char *zName;
+  const EVP_CIPHER *(*xCipher)(void);
+} aCodecCipher[] = {
+  { "aes-256-cfb", EVP_aes_256_cfb },
+  { "aes-256-ctr", EVP_aes_256_ctr },
+  { "aes-256-xts", EVP_aes_256_xts },
+};
+
+static const EVP_CIPHER *codec_find_cipher(const char *zCipher) {
+  int i;
+  for(i = 0; i < ArraySize(aCodecCipher); i++) {
+    if(sqlite3StrICmp(zCipher, aCodecCipher[i].zName) == 0) return aCodecCipher[i].xCipher();
+  }
+  return NULL;
+}
+
+static const char *codec_cipher_name(const EVP_CIPHER *cipher) {
+  int i;
+  for(i = 0; i < ArraySize(aCodecCipher); i++) {
+    if(aCodecCipher[i].xCipher() == cipher) return aCodecCipher[i].zName;
+  }
+  return NULL;
+}
+
+/* PRFs that can be selected for PBKDF2 with PRAGMA kdf_algorithm */
+static const struct {
+  const char *zName;
+  const EVP_MD *(*xMd)(void);
+} aCodecKdf[] = {
+  { "PBKDF2-SHA1",   EVP_sha1 },
+  { "PBKDF2-SHA256", EVP_sha256 },
+  { "PBKDF2-SHA512", EVP_sha512 },
+};
+
+static const EVP_MD *codec_find_kdf(const char *zKdf) {
+  int i;
+  for(i = 0; i < ArraySize(aCodecKdf); i++) {
+    if(sqlite3StrICmp(zKdf, aCodecKdf[i].zName) == 0) return aCodecKdf[i].xMd();
+  }
+  return NULL;
+}
+
+static const char *codec_kdf_name(const EVP_MD *md) {
+  int i;
+  for(i = 0; i < ArraySize(aCodecKdf); i++) {
+    if(aCodecKdf[i].xMd() == md) return aCodecKdf[i].zName;
+  }
+  return NULL;
+}
+
+/* 
+ * digests that can be selected with PRAGMA cipher_hmac to authenticate 
+ * each page. The HMAC is stored in the reserved area after the IV.
+ */
+static const struct {
+  const char *zName;
+  const EVP_MD *(*xMd)(void);
+} aCodecHmac[] = {
+  { "off",         NULL },
+  { "HMAC-SHA1",   EVP_sha1 },
+  { "HMAC-SHA256", EVP_sha256 },
+};
+
+static int codec_find_hmac(const char *zHmac, const EVP_MD **pMd) {
+  int i;
+  for(i = 0; i < ArraySize(aCodecHmac); i++) {
+    if(sqlite3StrICmp(zHmac, aCodecHmac[i].zName) == 0) {
+      *pMd = aCodecHmac[i].xMd ? aCodecHmac[i].xMd() : NULL;
+      return SQLITE_OK;
+    }
+  }
+  return SQLITE_ERROR;
+}
+
+static const char *codec_hmac_name(const EVP_MD *md) {
+  int i;
+  for(i = 0; i < ArraySize(aCodecHmac); i++) {
+    if((aCodecHmac[i].xMd ? aCodecHmac[i].xMd() : NULL) == md) return aCodecHmac[i].zName;
+  }
+  return NULL;
+}
+
+/* bytes reserved at the end of each page for the iv and hmac */
+static int codec_reserve_sz(const codec_settings *p) {
+  return EVP_CIPHER_iv_length(p->evp_cipher) + (p->hmac_md ? EVP_MD_size(p->hmac_md) : 0);
+}
+
+static codec_ctx *codec_get_ctx(sqlite3 *db, int nDb) {
+  codec_ctx *ctx = NULL;
+  struct Db *pDb = &db->aDb[nDb];
+  if(pDb->pBt) sqlite3pager_get_codec(pDb->pBt->pBt->pPager, (void **) &ctx);
+  return ctx;
+}
+
+/*
+ * the settings to use when a key is attached without naming them: keep 
+ * the settings already in use on this database, otherwise inherit those
+ * of the main database (ATTACH), otherwise fall back to the defaults
+ */
+static void codec_default_settings(sqlite3 *db, int nDb, codec_settings *p) {
+  codec_ctx *ctx = codec_get_ctx(db, nDb);
+  if(ctx == NULL && nDb != 0) ctx = codec_get_ctx(db, 0);
+  if(ctx) {
+    p->evp_cipher = ctx->evp_cipher;
+    p->kdf_md = ctx->kdf_md;
+    p->kdf_iter = ctx->kdf_iter;
+    p->hmac_md = ctx->hmac_md;
+    p->hmac_check = ctx->hmac_check;
+  } else {
+    p->evp_cipher = codec_find_cipher(CIPHER);
+    p->kdf_md = codec_find_kdf(PBKDF2_ALGORITHM);
+    p->kdf_iter = PBKDF2_ITER;
+    codec_find_hmac(CIPHER_HMAC, &p->hmac_md);
+    p->hmac_check = 1;
+  }
+}
+
+/*
+ * key a persistent cipher context once so that the key schedule is
+ * not recomputed for every page. Only the IV is reset per page
+ * in codec_cipher.
+ */
+static int codec_key_cipher_ctx(EVP_CIPHER_CTX *ectx, const EVP_CIPHER *cipher, void *key, int mode) {
+  if(!EVP_CipherInit_ex(ectx, cipher, NULL, key, NULL, mode)) return SQLITE_ERROR;
+  EVP_CIPHER_CTX_set_padding(ectx, 0);
+  return SQLITE_OK;
+}
+
+/*
+ * Cache of derived keys.
+ *
+ * Deriving a key from a passphrase takes kdf_iter rounds of PBKDF2, and
+ * this is repeated for every database every time it is keyed. The cache
+ * remembers recently derived keys for the whole process, so reopening a
+ * database with the same passphrase skips the derivation. It is enabled
+ * with sqlite3_config(SQLITE_CONFIG_CODEC_KDF_CACHE, nEntry, nTtl).
+ *
+ * Entries are found by an HMAC-SHA256 tag over the derivation parameters
+ * and the passphrase, keyed with a random per-process secret, so neither 
+ * passphrases nor a fast hash of them are stored. Entries and the secret
+ * live in one allocation that is locked in memory where the OS allows it,
+ * and keys are zeroed when they are evicted, expire, or the cache is freed.
+ */
+#define KDF_TAG_SZ 32 /* size of an HMAC-SHA256 tag */
+
+typedef struct {
+  unsigned char tag[KDF_TAG_SZ];          /* identifies salt, passphrase, etc. */
+  unsigned char key[EVP_MAX_KEY_LENGTH];  /* the derived key */
+  time_t tAdded;                          /* time the key was derived */
+  unsigned int iUsed;                     /* lru counter of the last use, 0 if empty */
+} KdfCacheEntry;
+
+static struct {
+  int nEntry;                 /* number of slots in aEntry[] */
+  int nByte;                  /* size of the allocation holding aEntry[] */
+  unsigned int iClock;        /* lru clock, advanced on every use */
+  unsigned char *secret;      /* random key for the tags, KDF_TAG_SZ bytes */
+  KdfCacheEntry *aEntry;      /* slots, followed by the secret */
+} kdfCache;
+
+#ifdef SQLITE_TEST
+int sqlite3_codec_kdf_hit_count = 0;
+#endif
+
+static void codec_kdf_cache_free(void);
+
+/* allocate the cache. Called with the master mutex held */
+static int codec_kdf_cache_init(void) {
+  int n = sqlite3GlobalConfig.nKdfCache;
+  int nByte = n * sizeof(KdfCacheEntry) + KDF_TAG_SZ;
+  void *p;
+#if SQLITE_OS_UNIX
+  p = mmap(0, nByte, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANON, -1, 0);
+  if(p == MAP_FAILED) return SQLITE_NOMEM;
+  mlock(p, nByte); /* best effort, RLIMIT_MEMLOCK may not allow it */
+#else
+  p = sqlite3Malloc(nByte);
+  if(p == NULL) return SQLITE_NOMEM;
+#endif
+  memset(p, 0, nByte);
+  kdfCache.aEntry = (KdfCacheEntry *) p;
+  kdfCache.secret = ((unsigned char *) p) + n * sizeof(KdfCacheEntry);
+  kdfCache.nEntry = n;
+  kdfCache.nByte = nByte;
+  if(RAND_bytes(kdfCache.secret, KDF_TAG_SZ) != 1) {
+    codec_kdf_cache_free();
+    return SQLITE_ERROR;
+  }
+  return SQLITE_OK;
+}
+
+static void codec_kdf_cache_free(void) {
+  if(kdfCache.aEntry) {
+    memset(kdfCache.aEntry, 0, kdfCache.nByte);
+#if SQLITE_OS_UNIX
+    munlock(kdfCache.aEntry, kdfCache.nByte);
+    munmap(kdfCache.aEntry, kdfCache.nByte);
+#else
+    sqlite3_free(kdfCache.aEntry);
+#endif
+  }
+  memset(&kdfCache, 0, sizeof(kdfCache));
+}
+
+static int codec_kdf_tag(const void *zKey, int nKey, const void *salt, int nSalt, const EVP_MD *md, int iter, int key_sz, unsigned char *tag) {
+  unsigned int tag_sz = KDF_TAG_SZ;
+  int nData = 12 + nSalt + nKey;
+  unsigned char *data = sqlite3Malloc(nData);
+  if(data == NULL) return SQLITE_NOMEM;
+  sqlite3Put4byte(data, iter);
+  sqlite3Put4byte(&data[4], key_sz);
+  sqlite3Put4byte(&data[8], EVP_MD_type(md));
+  memcpy(&data[12], salt, nSalt);
+  memcpy(&data[12+nSalt], zKey, nKey);
+  HMAC(EVP_sha256(), kdfCache.secret, KDF_TAG_SZ, data, nData, tag, &tag_sz);
+  memset(data, 0, nData); /* cleanup copy of passphrase */
+  sqlite3_free(data);
+  return SQLITE_OK;
+}
+
+/* 
+ * look up the key for tag, copying it to out if found. Expired entries
+ * are cleared along the way. Called with the master mutex held
+ */
+static int codec_kdf_cache_get(const unsigned char *tag, int key_sz, void *out) {
+  int i;
+  time_t now = time(NULL);
+  for(i = 0; i < kdfCache.nEntry; i++) {
+    KdfCacheEntry *p = &kdfCache.aEntry[i];
+    if(p->iUsed == 0) continue;
+    if(sqlite3GlobalConfig.nKdfCacheTtl > 0 && now - p->tAdded >= sqlite3GlobalConfig.nKdfCacheTtl) {
+      memset(p, 0, sizeof(*p));
+    } else if(memcmp(p->tag, tag, KDF_TAG_SZ) == 0) {
+      memcpy(out, p->key, key_sz);
+      p->iUsed = ++kdfCache.iClock;
+      return 1;
+    }
+  }
+  return 0;
+}
+
+/* add a key, evicting the least recently used one. Master mutex held */
+static void codec_kdf_cache_put(const unsigned char *tag, int key_sz, const void *key) {
+  int i;
+  KdfCacheEntry *pLru = NULL;
+  for(i = 0; i < kdfCache.nEntry; i++) {
+    KdfCacheEntry *p = &kdfCache.aEntry[i];
+    if(pLru == NULL || p->iUsed < pLru->iUsed) pLru = p;
+  }
+  if(pLru == NULL) return;
+  memset(pLru, 0, sizeof(*pLru));
+  memcpy(pLru->tag, tag, KDF_TAG_SZ);
+  memcpy(pLru->key, key, key_sz);
+  pLru->tAdded = time(NULL);
+  pLru->iUsed = ++kdfCache.iClock;
+}
+
+/*
+ * derive a key of key_sz bytes from a passphrase, using the cache when 
+ * it is enabled. The derivation itself runs without the mutex held.
+ */
+static void codec_kdf(const void *zKey, int nKey, void *salt, int nSalt, const EVP_MD *md, int iter, int key_sz, void *out) {
+  unsigned char tag[KDF_TAG_SZ];
+  sqlite3_mutex *mutex;
+  int found = 0;
+  int cached = 0;
+
+  if(sqlite3GlobalConfig.nKdfCache <= 0) {
+    PKCS5_PBKDF2_HMAC(zKey, nKey, salt, nSalt, iter, md, key_sz, out);
+    return;
+  }
+
+  mutex = sqlite3MutexAlloc(SQLITE_MUTEX_STATIC_MASTER);
+  sqlite3_mutex_enter(mutex);
+  if((kdfCache.aEntry != NULL || codec_kdf_cache_init() == SQLITE_OK)
+     && codec_kdf_tag(zKey, nKey, salt, nSalt, md, iter, key_sz, tag) == SQLITE_OK) {
+    cached = 1;
+    found = codec_kdf_cache_get(tag, key_sz, out);
+  }
+  sqlite3_mutex_leave(mutex);
+
+  if(found) {
+#ifdef SQLITE_TEST
+    sqlite3_codec_kdf_hit_count++;
+#endif
+    memset(tag, 0, KDF_TAG_SZ);
+    return;
+  }
+
+  PKCS5_PBKDF2_HMAC(zKey, nKey, salt, nSalt, iter, md, key_sz, out);
+
+  if(cached) {
+    sqlite3_mutex_enter(mutex);
+    if(kdfCache.aEntry != NULL) codec_kdf_cache_put(tag, key_sz, out);
+    sqlite3_mutex_leave(mutex);
+  }
+  memset(tag, 0, KDF_TAG_SZ);
+}
+
+static void codec_prepare_key(sqlite3 *db, codec_ctx *ctx, const void *zKey, int nKey, void *salt, int nSalt, void *out, int *nOut) {
+  int key_sz = ctx->key_sz;
+  /* if key data is provided as a hex blob of exactly key_sz bytes use the data directly */
+  if (nKey == (key_sz * 2) + 3 && sqlite3StrNICmp(zKey ,"x'", 2) == 0) { 
     int n = nKey - 3; /* adjust for leading x' and tailing ' */
     int half_n = n/2;
     const char *z = zKey + 2; /* adjust lead offset of x' */ 
@@ -68,23 +417,53 @@ static void codec_prepare_key(sqlite3 *db, const void *zKey, int nKey, void *sal
     sqlite3DbFree(db, key);
   /* otherwise the key is provided as a string so hash it to get key data */
   } else {
-    *nOut = KEY_LENGTH;
-    PKCS5_PBKDF2_HMAC_SHA1(zKey, nKey, salt, nSalt, PBKDF2_ITER, KEY_LENGTH, out);
+    *nOut = key_sz;
+    codec_kdf(zKey, nKey, salt, nSalt, ctx->kdf_md, ctx->kdf_iter, key_sz, out);
+  }
+}
+
+/*
+ * derive the key used to authenticate pages from a page encryption key,
+ * so that the two are never the same. The salt is the file salt with each
+ * byte masked, and a couple of iterations are enough as the input is
+ * already a full strength key.
+ */
+static void codec_prepare_hmac_key(codec_ctx *ctx, const void *key, void *out) {
+  unsigned char salt[FILE_HEADER_SZ];
+  int i;
+  for(i = 0; i < FILE_HEADER_SZ; i++) {
+    salt[i] = ((unsigned char *) ctx->salt)[i] ^ HMAC_SALT_MASK;
   }
+  PKCS5_PBKDF2_HMAC(key, ctx->key_sz, salt, FILE_HEADER_SZ, HMAC_KDF_ITER, ctx->kdf_md, ctx->key_sz, out);
+}
+
+/*
+ * compute the HMAC of a page over the n bytes of ciphertext and iv at
+ * data, followed by the page number so that pages can not be swapped. The
+ * page number is written into the HMAC slot following the data to make the
+ * input contiguous; the slot is overwritten by the caller afterwards.
+ */
+static void codec_hmac(codec_ctx *ctx, const void *key, Pgno pgno, unsigned char *data, int n, unsigned char *out) {
+  unsigned int out_sz;
+  sqlite3Put4byte(&data[n], pgno);
+  HMAC(ctx->hmac_md, key, ctx->key_sz, data, n + 4, out, &out_sz);
+  assert(out_sz == (unsigned int) ctx->hmac_sz);
 }
 
 /*
  * ctx - codec context
+ * ectx - keyed cipher context for this operation
+ * rekeyed - true if the page uses the new key of an online rekey
  * pgno - page number in database
  * size - size in bytes of input and output buffers
  * mode - 1 to encrypt, 0 to decrypt
  * in - pointer to input bytes
  * out - pouter to output bytes
  */
-static int codec_cipher(codec_ctx *ctx, Pgno pgno, int mode, int size, void *in, void *out) {
-  EVP_CIPHER_CTX ectx;
+static int codec_cipher(codec_ctx *ctx, EVP_CIPHER_CTX *ectx, int rekeyed, Pgno pgno, int mode, int size, void *in, void *out) {
   void *iv;
   int tmp_csz, csz;
+  unsigned char hmac[EVP_MAX_MD_SIZE];
 
   /* when this is an encryption operation and rekey is not null, we will actually encrypt
   ** data with the new rekey data */
@@ -95,43 +474,168 @@ static int codec_cipher(codec_ctx *ctx, Pgno pgno, int mode, int size, void *in,
   ** 2. this is a decrypt operation and rekey_plaintext is true
   */ 
   if(key == NULL || (mode==CIPHER_DECRYPT && ctx->rekey_plaintext)) {
-    memcpy(out, in, size);
+    if(out != in) memcpy(out, in, size);
     return SQLITE_OK;
   } 
 
-  size = size - ctx->iv_sz; /* adjust size to useable size and memset reserve at end of page */
+  size = size - ctx->iv_sz - ctx->hmac_sz; /* adjust size to useable size, the reserve holds the iv and hmac */
   iv = out + size;
+
+  /* authenticate the ciphertext before it is decrypted, possibly over itself */
+  if(mode == CIPHER_DECRYPT && ctx->hmac_md && ctx->hmac_check) {
+    unsigned char *hmac_in = (unsigned char *) in + size + ctx->iv_sz;
+    unsigned char stored[EVP_MAX_MD_SIZE];
+    memcpy(stored, hmac_in, ctx->hmac_sz);
+    codec_hmac(ctx, rekeyed ? ctx->new_hmac_key : ctx->hmac_key, pgno, in, size + ctx->iv_sz, hmac);
+    memcpy(hmac_in, stored, ctx->hmac_sz); /* leave the input intact */
+    if(CRYPTO_memcmp(stored, hmac, ctx->hmac_sz) != 0) return SQLITE_ERROR;
+  }
+
   if(mode == CIPHER_ENCRYPT) {
     RAND_pseudo_bytes(iv, ctx->iv_sz);
-  } else {
+  } else if(out != in) {
     memcpy(iv, in+size, ctx->iv_sz);
   } 
   
-  EVP_CipherInit(&ectx, CIPHER, NULL, NULL, mode);
-  EVP_CIPHER_CTX_set_padding(&ectx, 0);
-  EVP_CipherInit(&ectx, NULL, key, iv, mode);
-  EVP_CipherUpdate(&ectx, out, &tmp_csz, in, size);
+  /* the context is already keyed, so only reset the IV for this page */
+  EVP_CipherInit_ex(ectx, NULL, NULL, NULL, iv, mode);
+  EVP_CipherUpdate(ectx, out, &tmp_csz, in, size);
   csz = tmp_csz;  
-  out += tmp_csz;
-  EVP_CipherFinal(&ectx, out, &tmp_csz);
+  EVP_CipherFinal_ex(ectx, out + csz, &tmp_csz);
   csz += tmp_csz;
-  EVP_CIPHER_CTX_cleanup(&ectx);
   assert(size == csz);
 
+  if(mode == CIPHER_ENCRYPT && ctx->hmac_md) {
+    void *hmac_key = rekeyed ? ctx->new_hmac_key : ctx->hmac_rekey != NULL ? ctx->hmac_rekey : ctx->hmac_key;
+    codec_hmac(ctx, hmac_key, pgno, out, size + ctx->iv_sz, hmac);
+    memcpy(out + size + ctx->iv_sz, hmac, ctx->hmac_sz);
+  }
+
   return SQLITE_OK;
 }
 
+/*
+ * encrypt or decrypt a whole page from in to out. out must hold pg_sz 
+ * bytes and must not overlap in, except that out may be in itself when
+ * decrypting with ctx->decrypt_inplace set. On page 1 the salt takes the
+ * place of the file header and is not encrypted. Returns SQLITE_ERROR if
+ * a page being decrypted fails its HMAC check.
+ */
+static int codec_page(codec_ctx *ctx, EVP_CIPHER_CTX *ectx, int rekeyed, Pgno pgno, int emode, int pg_sz, void *in, void *out) {
+  if(pgno == 1) { 
+    /* if this is a read & decrypt operation on the first page then copy the 
+       first 16 bytes off the page into the context's random salt buffer
+    */
+    if(emode == CIPHER_ENCRYPT) {
+      memcpy(out, ctx->salt, FILE_HEADER_SZ);
+    } else {
+      memcpy(out, SQLITE_FILE_HEADER, FILE_HEADER_SZ);
+    }
+    
+    /* adjust starting pointers in data page for header offset */
+    return codec_cipher(ctx, ectx, rekeyed, pgno, emode, pg_sz - FILE_HEADER_SZ, in + FILE_HEADER_SZ, out + FILE_HEADER_SZ);
+  }
+  return codec_cipher(ctx, ectx, rekeyed, pgno, emode, pg_sz, in, out);
+}
+
+/* true if page pgno is encrypted with the new key of an online rekey */
+static int codec_page_rekeyed(codec_ctx *ctx, Pgno pgno) {
+  return ctx->rekey_pgno != 0 && pgno >= ctx->rekey_pgno;
+}
+
+static EVP_CIPHER_CTX *codec_cipher_ctx(codec_ctx *ctx, int rekeyed, int emode) {
+  if(rekeyed) return (emode == CIPHER_ENCRYPT) ? ctx->new_ectx : ctx->new_dctx;
+  return (emode == CIPHER_ENCRYPT) ? ctx->ectx : ctx->dctx;
+}
+
+static void codec_free_new_key(codec_ctx *ctx) {
+  if(ctx->new_ectx) EVP_CIPHER_CTX_free(ctx->new_ectx);
+  if(ctx->new_dctx) EVP_CIPHER_CTX_free(ctx->new_dctx);
+  if(ctx->new_key) {
+    memset(ctx->new_key, 0, ctx->key_sz);
+    sqlite3_free(ctx->new_key);
+  }
+  if(ctx->new_hmac_key) {
+    memset(ctx->new_hmac_key, 0, ctx->key_sz);
+    sqlite3_free(ctx->new_hmac_key);
+  }
+  if(ctx->new_pass) {
+    memset(ctx->new_pass, 0, ctx->new_pass_sz);
+    sqlite3_free(ctx->new_pass);
+  }
+  ctx->new_ectx = ctx->new_dctx = NULL;
+  ctx->new_key = ctx->new_hmac_key = ctx->new_pass = NULL;
+  ctx->new_pass_sz = 0;
+}
+
+/* 
+ * once every page has been moved over by an online rekey, its key 
+ * becomes the current key of the database
+ */
+static void codec_rekey_done(codec_ctx *ctx) {
+  EVP_CIPHER_CTX *tmp_ctx;
+  void *tmp_pass;
+  int tmp_sz;
+
+  memcpy(ctx->key, ctx->new_key, ctx->key_sz);
+  if(ctx->hmac_key) memcpy(ctx->hmac_key, ctx->new_hmac_key, ctx->key_sz);
+  tmp_ctx = ctx->ectx; ctx->ectx = ctx->new_ectx; ctx->new_ectx = tmp_ctx;
+  tmp_ctx = ctx->dctx; ctx->dctx = ctx->new_dctx; ctx->new_dctx = tmp_ctx;
+  tmp_pass = ctx->pass; ctx->pass = ctx->new_pass; ctx->new_pass = tmp_pass;
+  tmp_sz = ctx->pass_sz; ctx->pass_sz = ctx->new_pass_sz; ctx->new_pass_sz = tmp_sz;
+  codec_free_new_key(ctx);
+  ctx->rekey_pgno = 0;
+}
+
+/*
+ * decrypt page 1, which also holds the progress of an online rekey. As
+ * page 1 is the last page moved to the new key, a page 1 that does not
+ * decrypt with the key expected may mean that another connection has
+ * finished the rekey, so the new key is tried as well. The header bytes
+ * 21 to 23 are constant, and stand in for the HMAC when there is none.
+ */
+static void *codec_decrypt_page1(codec_ctx *ctx, void *pData, int pg_sz) {
+  unsigned char *page = ctx->buffer;
+  int rekeyed = codec_page_rekeyed(ctx, 1);
+  int rc = codec_page(ctx, codec_cipher_ctx(ctx, rekeyed, CIPHER_DECRYPT), rekeyed, 1, CIPHER_DECRYPT, pg_sz, pData, page);
+
+  if(ctx->new_key && (rc != SQLITE_OK || page[21] != 64 || page[22] != 32 || page[23] != 32)) {
+    rekeyed = !rekeyed;
+    rc = codec_page(ctx, codec_cipher_ctx(ctx, rekeyed, CIPHER_DECRYPT), rekeyed, 1, CIPHER_DECRYPT, pg_sz, pData, page);
+  }
+
+  if(rc == SQLITE_OK) {
+    Pgno marker = sqlite3Get4byte(&page[REKEY_MARKER_OFFSET]);
+    if(rekeyed) {
+      codec_rekey_done(ctx);
+    } else if(marker != 0 && ctx->new_key == NULL) {
+      rc = SQLITE_ERROR; /* part way through an online rekey, the new key is needed as well */
+    } else {
+      ctx->rekey_pgno = marker;
+    }
+  }
+
+  if(rc != SQLITE_OK) {
+    memset(pData, 0, pg_sz);
+    return NULL;
+  }
+  memcpy(pData, page, pg_sz);
+  return pData;
+}
+
 /*
  * sqlite3Codec can be called in multiple modes.
  * encrypt mode - expected to return a pointer to the 
  *   encrypted data without altering pData.
  * decrypt mode - expected to return a pointer to pData, with
- *   the data decrypted in the input buffer
+ *   the data decrypted in the input buffer, or NULL with pData 
+ *   zeroed if the page fails its HMAC check
  */
 void* sqlite3Codec(void *iCtx, void *pData, Pgno pgno, int mode) {
   int emode;
   codec_ctx *ctx = (codec_ctx *) iCtx;
   int pg_sz = sqlite3BtreeGetPageSize(ctx->pBt);
+  int rekeyed = codec_page_rekeyed(ctx, pgno);
  
   switch(mode) {
     case 0: /* decrypt */
@@ -148,20 +652,25 @@ void* sqlite3Codec(void *iCtx, void *pData, Pgno pgno, int mode) {
       break;
   }
 
-  if(pgno == 1) { 
-    /* if this is a read & decrypt operation on the first page then copy the 
-       first 16 bytes off the page into the context's random salt buffer
-    */
-    if(emode == CIPHER_ENCRYPT) {
-      memcpy(ctx->buffer, ctx->salt, FILE_HEADER_SZ);
-    } else {
-      memcpy(ctx->buffer, SQLITE_FILE_HEADER, FILE_HEADER_SZ);
+  ctx->pages_coded = 1;
+
+  if(emode == CIPHER_DECRYPT && pgno == 1) {
+    return codec_decrypt_page1(ctx, pData, pg_sz);
+  }
+
+  if(emode == CIPHER_DECRYPT && ctx->decrypt_inplace) {
+    /* CFB and CTR can decrypt over their input, saving the page copy. 
+    ** XTS pages go through ctx->buffer below */
+    if(codec_page(ctx, codec_cipher_ctx(ctx, rekeyed, emode), rekeyed, pgno, emode, pg_sz, pData, pData) != SQLITE_OK) {
+      memset(pData, 0, pg_sz);
+      return NULL;
     }
-    
-    /* adjust starting pointers in data page for header offset */
-    codec_cipher(ctx, pgno, emode, pg_sz - FILE_HEADER_SZ, pData + FILE_HEADER_SZ, ctx->buffer + FILE_HEADER_SZ);
-  } else {
-    codec_cipher(ctx, pgno, emode, pg_sz, pData, ctx->buffer);
+    return pData;
+  }
+
+  if(codec_page(ctx, codec_cipher_ctx(ctx, rekeyed, emode), rekeyed, pgno, emode, pg_sz, pData, ctx->buffer) != SQLITE_OK) {
+    memset(pData, 0, pg_sz); /* only decryption fails, never hand garbage to the btree */
+    return NULL;
   }
  
   if(emode == CIPHER_ENCRYPT) {
@@ -172,13 +681,209 @@ void* sqlite3Codec(void *iCtx, void *pData, Pgno pgno, int mode) {
   }
 }
 
-int sqlite3CodecAttach(sqlite3* db, int nDb, const void *zKey, int nKey) {
+/*
+ * Codec worker pool. 
+ *
+ * sqlite3CodecBatch() queues a job describing a run of pages to encrypt,
+ * wakes the workers and then works on the job itself. Pages are claimed
+ * a few at a time under the pool mutex, so any number of committing 
+ * connections can share the pool. Each thread encrypts with its own copy 
+ * of the codec's keyed encryption context, as EVP contexts can not be 
+ * shared between threads, and writes into the caller's per-page output 
+ * slots, so nothing in the codec_ctx is modified while a job runs.
+ */
+#define CODEC_CLAIM_PAGES 8 /* pages claimed by a thread at a time */
+
+typedef struct CodecJob CodecJob;
+struct CodecJob {
+  codec_ctx *ctx;       /* codec the pages belong to */
+  int pg_sz;            /* page size */
+  int nPage;            /* number of pages in the job */
+  void **apData;        /* plaintext of each page */
+  Pgno *aPgno;          /* page number of each page */
+  char *aOut;           /* nPage output slots of pg_sz bytes */
+  int iNext;            /* next page to be claimed */
+  int nDone;            /* pages encrypted so far */
+  int nWorker;          /* pool threads currently working on the job */
+  CodecJob *pNext;      /* next job in the queue */
+};
+
+/* 
+ * encrypt pages i to i+n-1 of pJob with ectx, or with the codec's own 
+ * contexts if ectx is NULL
+ */
+static void codec_job_pages(CodecJob *pJob, EVP_CIPHER_CTX *ectx, int i, int n) {
+  for(n += i; i < n; i++) {
+    int rekeyed = codec_page_rekeyed(pJob->ctx, pJob->aPgno[i]);
+    codec_page(pJob->ctx, ectx ? ectx : codec_cipher_ctx(pJob->ctx, rekeyed, CIPHER_ENCRYPT), rekeyed,
+               pJob->aPgno[i], CIPHER_ENCRYPT, pJob->pg_sz, pJob->apData[i], &pJob->aOut[i*pJob->pg_sz]);
+  }
+}
+
+#if SQLITE_THREADSAFE && SQLITE_OS_UNIX
+static struct {
+  pthread_mutex_t mutex;   /* protects everything below and all queued jobs */
+  pthread_cond_t work;     /* signalled when a job is queued or on shutdown */
+  pthread_cond_t done;     /* signalled when a thread finishes with a job */
+  int nThread;             /* number of threads in aThread[] */
+  pthread_t *aThread;      /* the worker threads */
+  CodecJob *pJob;          /* queue of jobs with pages left to claim */
+  int shutdown;            /* true when the workers should exit */
+} codecPool = { PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, PTHREAD_COND_INITIALIZER };
+
+/*
+ * encrypt pages of pJob until there are none left to claim. Must be 
+ * called with the pool mutex held, it is released while encrypting
+ */
+static void codec_job_run(CodecJob *pJob, EVP_CIPHER_CTX *ectx) {
+  EVP_CIPHER_CTX_copy(ectx, pJob->ctx->ectx);
+  while(pJob->iNext < pJob->nPage) {
+    int i = pJob->iNext;
+    int n = pJob->nPage - i;
+    if(n > CODEC_CLAIM_PAGES) n = CODEC_CLAIM_PAGES;
+    pJob->iNext += n;
+    if(pJob->iNext == pJob->nPage) {
+      /* every page is claimed, take the job off the queue */
+      CodecJob **pp;
+      for(pp = &codecPool.pJob; *pp != pJob; pp = &(*pp)->pNext);
+      *pp = pJob->pNext;
+    }
+    pthread_mutex_unlock(&codecPool.mutex);
+    codec_job_pages(pJob, ectx, i, n);
+    pthread_mutex_lock(&codecPool.mutex);
+    pJob->nDone += n;
+  }
+}
+
+static void *codec_worker_main(void *NotUsed) {
+  EVP_CIPHER_CTX *ectx = EVP_CIPHER_CTX_new();
+  UNUSED_PARAMETER(NotUsed);
+  pthread_mutex_lock(&codecPool.mutex);
+  while(!codecPool.shutdown) {
+    CodecJob *pJob = codecPool.pJob;
+    if(pJob == NULL || ectx == NULL) {
+      pthread_cond_wait(&codecPool.work, &codecPool.mutex);
+      continue;
+    }
+    pJob->nWorker++;
+    codec_job_run(pJob, ectx);
+    pJob->nWorker--;
+    pthread_cond_broadcast(&codecPool.done);
+  }
+  pthread_mutex_unlock(&codecPool.mutex);
+  if(ectx) EVP_CIPHER_CTX_free(ectx);
+  return NULL;
+}
+
+/* start the configured number of workers. Called with the pool mutex held */
+static void codec_pool_start(void) {
+  int i, n = sqlite3GlobalConfig.nCodecThread;
+  codecPool.aThread = sqlite3Malloc(n * sizeof(pthread_t));
+  if(codecPool.aThread == NULL) return;
+  codecPool.shutdown = 0;
+  for(i = 0; i < n; i++) {
+    if(pthread_create(&codecPool.aThread[i], NULL, codec_worker_main, NULL) != 0) break;
+  }
+  codecPool.nThread = i;
+}
+
+static void codec_pool_shutdown(void) {
+  int i;
+  pthread_mutex_lock(&codecPool.mutex);
+  codecPool.shutdown = 1;
+  pthread_cond_broadcast(&codecPool.work);
+  pthread_mutex_unlock(&codecPool.mutex);
+  for(i = 0; i < codecPool.nThread; i++) {
+    pthread_join(codecPool.aThread[i], NULL);
+  }
+  sqlite3_free(codecPool.aThread);
+  codecPool.aThread = NULL;
+  codecPool.nThread = 0;
+}
+#endif
+
+/*
+ * stop the codec worker pool and clear the derived key cache. Called from
+ * sqlite3_shutdown()
+ */
+void sqlite3CodecShutdown(void) {
+#if SQLITE_THREADSAFE && SQLITE_OS_UNIX
+  codec_pool_shutdown();
+#endif
+  codec_kdf_cache_free();
+}
+
+/*
+ * called by the pager before its page size changes to pg_sz, which
+ * PRAGMA page_size may still do after the key is set, and when the page
+ * size of an existing database is read from page 1. The page buffer is 
+ * grown to match; on failure the page size is left unchanged.
+ */
+int sqlite3CodecPageSize(void *iCtx, int pg_sz) {
+  codec_ctx *ctx = (codec_ctx *) iCtx;
+  void *buffer;
+  if(pg_sz <= ctx->buffer_sz) return SQLITE_OK;
+  buffer = sqlite3Malloc(pg_sz);
+  if(buffer == NULL) return SQLITE_NOMEM;
+  memset(ctx->buffer, 0, ctx->buffer_sz);
+  sqlite3_free(ctx->buffer);
+  ctx->buffer = buffer;
+  ctx->buffer_sz = pg_sz;
+  return SQLITE_OK;
+}
+
+/*
+ * encrypt nPage pages, apData[i] being the content of page aPgno[i], into
+ * consecutive page sized slots of aOut, spreading the work over the codec 
+ * worker pool. apData is left intact, as the pager requires.
+ */
+int sqlite3CodecBatch(void *iCtx, int nPage, void **apData, Pgno *aPgno, void *aOut) {
+  codec_ctx *ctx = (codec_ctx *) iCtx;
+  CodecJob job;
+
+  ctx->pages_coded = 1;
+  memset(&job, 0, sizeof(job));
+  job.ctx = ctx;
+  job.pg_sz = sqlite3BtreeGetPageSize(ctx->pBt);
+  job.nPage = nPage;
+  job.apData = apData;
+  job.aPgno = aPgno;
+  job.aOut = aOut;
+
+#if SQLITE_THREADSAFE && SQLITE_OS_UNIX
+  /* during an online rekey pages use one of two keys, do them in place */
+  if(nPage > CODEC_CLAIM_PAGES && ctx->new_key == NULL) {
+    EVP_CIPHER_CTX *ectx = EVP_CIPHER_CTX_new();
+    if(ectx == NULL) return SQLITE_NOMEM;
+    pthread_mutex_lock(&codecPool.mutex);
+    if(codecPool.aThread == NULL) codec_pool_start();
+    job.pNext = codecPool.pJob;
+    codecPool.pJob = &job;
+    pthread_cond_broadcast(&codecPool.work);
+    codec_job_run(&job, ectx);
+    while(job.nDone < job.nPage || job.nWorker > 0) {
+      pthread_cond_wait(&codecPool.done, &codecPool.mutex);
+    }
+    pthread_mutex_unlock(&codecPool.mutex);
+    EVP_CIPHER_CTX_free(ectx);
+    return SQLITE_OK;
+  }
+#endif
+
+  /* too few pages to be worth sharing out, or no threads available */
+  codec_job_pages(&job, NULL, 0, nPage);
+  return SQLITE_OK;
+}
+
+static int codec_attach(sqlite3* db, int nDb, const void *zKey, int nKey, const codec_settings *settings) {
+  const EVP_CIPHER *cipher = settings->evp_cipher;
   struct Db *pDb = &db->aDb[nDb];
   
   if(nKey && zKey && pDb->pBt) {
-    codec_ctx *ctx;
+    codec_ctx *ctx, *old_ctx;
     Pager *pPager = pDb->pBt->pBt->pPager;
     int prepared_key_sz;
+    int rc = SQLITE_NOMEM;
 
     ctx = sqlite3Malloc(sizeof(codec_ctx));
     if(ctx == NULL) return SQLITE_NOMEM;
@@ -188,24 +893,33 @@ int sqlite3CodecAttach(sqlite3* db, int nDb, const void *zKey, int nKey) {
     
     /* pre-allocate a page buffer of PageSize bytes. This will
        be used as a persistent buffer for encryption and decryption 
-       operations to avoid overhead of multiple memory allocations*/
-    ctx->buffer = sqlite3Malloc(sqlite3BtreeGetPageSize(ctx->pBt));
-    if(ctx->buffer == NULL) return SQLITE_NOMEM;
+       operations to avoid overhead of multiple memory allocations.
+       If the page size grows later, sqlite3CodecPageSize() grows it */
+    ctx->buffer_sz = sqlite3BtreeGetPageSize(ctx->pBt);
+    ctx->buffer = sqlite3Malloc(ctx->buffer_sz);
+    if(ctx->buffer == NULL) goto attach_failed;
        
-    ctx->key_sz = EVP_CIPHER_key_length(CIPHER);
-    ctx->iv_sz = EVP_CIPHER_iv_length(CIPHER);
+    ctx->evp_cipher = cipher;
+    ctx->kdf_md = settings->kdf_md;
+    ctx->kdf_iter = settings->kdf_iter;
+    ctx->hmac_md = settings->hmac_md;
+    ctx->hmac_check = settings->hmac_check;
+    ctx->key_sz = EVP_CIPHER_key_length(cipher);
+    ctx->iv_sz = EVP_CIPHER_iv_length(cipher);
+    ctx->hmac_sz = ctx->hmac_md ? EVP_MD_size(ctx->hmac_md) : 0;
+    ctx->decrypt_inplace = (EVP_CIPHER_mode(cipher) == EVP_CIPH_CFB_MODE || EVP_CIPHER_mode(cipher) == EVP_CIPH_CTR_MODE);
     
     /* allocate space for salt data */
     ctx->salt = sqlite3Malloc(FILE_HEADER_SZ);
-    if(ctx->salt == NULL) return SQLITE_NOMEM;
+    if(ctx->salt == NULL) goto attach_failed;
     
     /* allocate space for salt data */
     ctx->key = sqlite3Malloc(ctx->key_sz);
-    if(ctx->key == NULL) return SQLITE_NOMEM;
+    if(ctx->key == NULL) goto attach_failed;
    
     /* allocate space for raw key data */
     ctx->pass = sqlite3Malloc(nKey);
-    if(ctx->pass == NULL) return SQLITE_NOMEM;
+    if(ctx->pass == NULL) goto attach_failed;
     memcpy(ctx->pass, zKey, nKey);
     ctx->pass_sz = nKey;
 
@@ -216,19 +930,154 @@ int sqlite3CodecAttach(sqlite3* db, int nDb, const void *zKey, int nKey) {
       RAND_pseudo_bytes(ctx->salt, FILE_HEADER_SZ);
     }
     
-    codec_prepare_key(db, zKey, nKey, ctx->salt, FILE_HEADER_SZ, ctx->key, &prepared_key_sz);
+    codec_prepare_key(db, ctx, zKey, nKey, ctx->salt, FILE_HEADER_SZ, ctx->key, &prepared_key_sz);
     assert(prepared_key_sz == ctx->key_sz);
+
+    if(ctx->hmac_md) {
+      ctx->hmac_key = sqlite3Malloc(ctx->key_sz);
+      if(ctx->hmac_key == NULL) goto attach_failed;
+      codec_prepare_hmac_key(ctx, ctx->key, ctx->hmac_key);
+    }
+
+    /* allocate and key the persistent encryption and decryption contexts */
+    ctx->ectx = EVP_CIPHER_CTX_new();
+    ctx->dctx = EVP_CIPHER_CTX_new();
+    if(ctx->ectx == NULL || ctx->dctx == NULL) goto attach_failed;
+    if(codec_key_cipher_ctx(ctx->ectx, cipher, ctx->key, CIPHER_ENCRYPT) != SQLITE_OK
+       || codec_key_cipher_ctx(ctx->dctx, cipher, ctx->key, CIPHER_DECRYPT) != SQLITE_OK) {
+      rc = SQLITE_ERROR;
+      goto attach_failed;
+    }
     
-    sqlite3BtreeSetPageSize(ctx->pBt, sqlite3BtreeGetPageSize(ctx->pBt), ctx->iv_sz, 0);
+    /* a codec attached by an earlier key or setting is replaced. If it
+       needs a different reserve, the page layout must still be open to
+       change, or pages would be authenticated over their own content */
+    sqlite3pager_get_codec(pPager, (void **) &old_ctx);
+
+    rc = sqlite3BtreeSetPageSize(ctx->pBt, sqlite3BtreeGetPageSize(ctx->pBt), codec_reserve_sz(settings), 0);
+    if(rc != SQLITE_OK && old_ctx && sqlite3BtreeGetReserve(ctx->pBt) != codec_reserve_sz(settings)) {
+      goto attach_failed;
+    }
     sqlite3PagerSetCodec(sqlite3BtreePager(pDb->pBt), sqlite3Codec, (void *) ctx);
+    sqlite3FreeCodecArg(old_ctx);
     return SQLITE_OK;
+
+attach_failed:
+    /* release whatever was allocated so far, leaving any old codec in place */
+    sqlite3FreeCodecArg(ctx);
+    return rc;
   }
   return SQLITE_ERROR;
 }
 
+int sqlite3CodecAttach(sqlite3* db, int nDb, const void *zKey, int nKey) {
+  codec_settings settings;
+  codec_default_settings(db, nDb, &settings);
+  return codec_attach(db, nDb, zKey, nKey, &settings);
+}
+
+/*
+ * re-attach the codec of database nDb with the passphrase already 
+ * supplied and new settings. This must happen after the key is set
+ * and before any pages are read: once a page has passed through the
+ * codec, pages written later would use a different key or layout from 
+ * those already in the file, so the change is refused.
+ */
+static int codec_reattach(sqlite3 *db, int nDb, const codec_settings *settings) {
+  codec_ctx *ctx = codec_get_ctx(db, nDb);
+  if(ctx == NULL) return SQLITE_ERROR;
+  if(ctx->evp_cipher == settings->evp_cipher && ctx->kdf_md == settings->kdf_md
+     && ctx->kdf_iter == settings->kdf_iter && ctx->hmac_md == settings->hmac_md) {
+    ctx->hmac_check = settings->hmac_check; /* does not change the keys or page layout */
+    return SQLITE_OK;
+  }
+  if(ctx->pages_coded) return SQLITE_ERROR;
+  return codec_attach(db, nDb, ctx->pass, ctx->pass_sz, settings);
+}
+
+/* switch the cipher used by database nDb */
+int sqlite3CodecSetCipher(sqlite3 *db, int nDb, const char *zCipher) {
+  codec_settings settings;
+  codec_default_settings(db, nDb, &settings);
+  settings.evp_cipher = codec_find_cipher(zCipher);
+  if(settings.evp_cipher == NULL) return SQLITE_ERROR;
+  return codec_reattach(db, nDb, &settings);
+}
+
+const char *sqlite3CodecGetCipher(sqlite3 *db, int nDb) {
+  codec_ctx *ctx = codec_get_ctx(db, nDb);
+  return ctx ? codec_cipher_name(ctx->evp_cipher) : NULL;
+}
+
+/* set the number of PBKDF2 iterations used to derive the key of nDb */
+int sqlite3CodecSetKdfIter(sqlite3 *db, int nDb, int iter) {
+  codec_settings settings;
+  if(iter <= 0) return SQLITE_ERROR;
+  codec_default_settings(db, nDb, &settings);
+  settings.kdf_iter = iter;
+  return codec_reattach(db, nDb, &settings);
+}
+
+int sqlite3CodecGetKdfIter(sqlite3 *db, int nDb) {
+  codec_ctx *ctx = codec_get_ctx(db, nDb);
+  return ctx ? ctx->kdf_iter : 0;
+}
+
+/* set the PBKDF2 PRF used to derive the key of nDb */
+int sqlite3CodecSetKdfAlgorithm(sqlite3 *db, int nDb, const char *zKdf) {
+  codec_settings settings;
+  codec_default_settings(db, nDb, &settings);
+  settings.kdf_md = codec_find_kdf(zKdf);
+  if(settings.kdf_md == NULL) return SQLITE_ERROR;
+  return codec_reattach(db, nDb, &settings);
+}
+
+const char *sqlite3CodecGetKdfAlgorithm(sqlite3 *db, int nDb) {
+  codec_ctx *ctx = codec_get_ctx(db, nDb);
+  return ctx ? codec_kdf_name(ctx->kdf_md) : NULL;
+}
+
+/* 
+ * set the digest used to authenticate the pages of nDb, or "off". As it
+ * changes the space reserved on each page, it must be chosen before the
+ * database is created and used every time the database is opened.
+ */
+int sqlite3CodecSetHmac(sqlite3 *db, int nDb, const char *zHmac) {
+  codec_settings settings;
+  codec_default_settings(db, nDb, &settings);
+  if(codec_find_hmac(zHmac, &settings.hmac_md) != SQLITE_OK) return SQLITE_ERROR;
+  return codec_reattach(db, nDb, &settings);
+}
+
+const char *sqlite3CodecGetHmac(sqlite3 *db, int nDb) {
+  codec_ctx *ctx = codec_get_ctx(db, nDb);
+  return ctx ? codec_hmac_name(ctx->hmac_md) : NULL;
+}
+
+/* 
+ * turn verification of the page HMAC on read on or off. Pages written
+ * are always authenticated, so turning the check back on later is safe.
+ */
+int sqlite3CodecSetHmacCheck(sqlite3 *db, int nDb, int check) {
+  codec_settings settings;
+  codec_default_settings(db, nDb, &settings);
+  settings.hmac_check = check;
+  return codec_reattach(db, nDb, &settings);
+}
+
+int sqlite3CodecGetHmacCheck(sqlite3 *db, int nDb) {
+  codec_ctx *ctx = codec_get_ctx(db, nDb);
+  return ctx ? ctx->hmac_check : -1;
+}
+
 int sqlite3FreeCodecArg(void *pCodecArg) {
   codec_ctx *ctx = (codec_ctx *) pCodecArg;
   if(pCodecArg == NULL) return SQLITE_OK;
+
+  /* EVP_CIPHER_CTX_free clears the key schedule held by the contexts */
+  if(ctx->ectx) EVP_CIPHER_CTX_free(ctx->ectx);
+  if(ctx->dctx) EVP_CIPHER_CTX_free(ctx->dctx);
+  codec_free_new_key(ctx);
   
   if(ctx->key) {
     memset(ctx->key, 0, ctx->key_sz);
@@ -239,9 +1088,14 @@ int sqlite3FreeCodecArg(void *pCodecArg) {
     memset(ctx->rekey, 0, ctx->key_sz);
     sqlite3_free(ctx->rekey);
   }
+
+  if(ctx->hmac_key) {
+    memset(ctx->hmac_key, 0, ctx->key_sz);
+    sqlite3_free(ctx->hmac_key);
+  }
   
   if(ctx->buffer) {
-    memset(ctx->buffer, 0, sqlite3BtreeGetPageSize(ctx->pBt));
+    memset(ctx->buffer, 0, ctx->buffer_sz);
     sqlite3_free(ctx->buffer);
   }
   
@@ -276,6 +1130,23 @@ int sqlite3_key(sqlite3 *db, const void *pKey, int nKey) {
   return SQLITE_ERROR;
 }
 
+int sqlite3_key_v2(sqlite3 *db, const void *pKey, int nKey, const char *zCipher) {
+  /* attach key and cipher if db and pKey are not null and nKey is > 0 */
+  if(db && pKey && nKey) {
+    int i;
+    codec_settings settings;
+    const EVP_CIPHER *cipher = codec_find_cipher(zCipher ? zCipher : CIPHER);
+    if(cipher == NULL) return SQLITE_ERROR;
+    for(i=0; i<db->nDb; i++){
+      codec_default_settings(db, i, &settings);
+      settings.evp_cipher = cipher;
+      codec_attach(db, i, pKey, nKey, &settings);
+    }
+    return SQLITE_OK;
+  }
+  return SQLITE_ERROR;
+}
+
 /* sqlite3_rekey 
 ** Given a database, this will reencrypt the database using a new key.
 ** There are two possible modes of operation. The first is rekeying
@@ -293,9 +1164,19 @@ int sqlite3_key(sqlite3 *db, const void *pKey, int nKey) {
 int sqlite3_rekey(sqlite3 *db, const void *pKey, int nKey) {
   if(db && pKey && nKey) {
     int i, prepared_key_sz;
-    int key_sz =  EVP_CIPHER_key_length(CIPHER);
-    void *key = sqlite3Malloc(key_sz);
-    if(key == NULL) return SQLITE_NOMEM;
+    int key_sz = EVP_MAX_KEY_LENGTH; /* large enough for the key of any cipher */
+    void *key, *hmac_key;
+    for(i=0; i<db->nDb; i++){
+      codec_ctx *ctx = codec_get_ctx(db, i);
+      if(ctx && ctx->new_key) return SQLITE_BUSY; /* finish the online rekey first */
+    }
+    key = sqlite3Malloc(key_sz);
+    hmac_key = sqlite3Malloc(key_sz);
+    if(key == NULL || hmac_key == NULL) {
+      sqlite3_free(key);
+      sqlite3_free(hmac_key);
+      return SQLITE_NOMEM;
+    }
     
     for(i=0; i<db->nDb; i++){
       struct Db *pDb = &db->aDb[i];
@@ -311,9 +1192,11 @@ int sqlite3_rekey(sqlite3 *db, const void *pKey, int nKey) {
         if(ctx == NULL) { 
           /* there was no codec attached to this database,so attach one now with a null password */
           char *error;
+          codec_settings settings;
           db->nextPagesize =  sqlite3BtreeGetPageSize(pDb->pBt);
           pDb->pBt->pBt->pageSizeFixed = 0; /* required for sqlite3BtreeSetPageSize to modify pagesize setting */
-          sqlite3BtreeSetPageSize(pDb->pBt, db->nextPagesize, EVP_CIPHER_iv_length(CIPHER), 0);
+          codec_default_settings(db, i, &settings);
+          sqlite3BtreeSetPageSize(pDb->pBt, db->nextPagesize, codec_reserve_sz(&settings), 0);
           sqlite3RunVacuum(&error, db);
           sqlite3CodecAttach(db, i, pKey, nKey);
           sqlite3pager_get_codec(pDb->pBt->pBt->pPager, (void **) &ctx);
@@ -322,10 +1205,15 @@ int sqlite3_rekey(sqlite3 *db, const void *pKey, int nKey) {
           ctx->rekey_plaintext = 1;
         }
         
-        codec_prepare_key(db, pKey, nKey, ctx->salt, FILE_HEADER_SZ, key, &prepared_key_sz);  
-        assert(prepared_key_sz == key_sz);
+        codec_prepare_key(db, ctx, pKey, nKey, ctx->salt, FILE_HEADER_SZ, key, &prepared_key_sz);  
+        assert(prepared_key_sz == ctx->key_sz);
         
         ctx->rekey = key; /* set rekey to new key data - note that ctx->key is original encryption key */
+        if(ctx->hmac_md) {
+          codec_prepare_hmac_key(ctx, ctx->rekey, hmac_key);
+          ctx->hmac_rekey = hmac_key; /* pages are authenticated with the new key as well */
+        }
+        codec_key_cipher_ctx(ctx->ectx, ctx->evp_cipher, ctx->rekey, CIPHER_ENCRYPT); /* pages are written with the new key from here on */
       
         /* do stuff here to rewrite the database 
         ** 1. Create a transaction on the database
@@ -351,7 +1239,9 @@ int sqlite3_rekey(sqlite3 *db, const void *pKey, int nKey) {
         /* if commit was successful commit and copy the rekey data to current key, else rollback to release locks */
         if(rc == SQLITE_OK) { 
           rc = sqlite3BtreeCommit(pDb->pBt); 
-          memcpy(ctx->key, ctx->rekey, key_sz); 
+          memcpy(ctx->key, ctx->rekey, ctx->key_sz); 
+          if(ctx->hmac_rekey) memcpy(ctx->hmac_key, ctx->hmac_rekey, ctx->key_sz);
+          codec_key_cipher_ctx(ctx->dctx, ctx->evp_cipher, ctx->key, CIPHER_DECRYPT); /* ectx is already keyed with the new key */
           if(ctx->pass) {
             memset(ctx->pass, 0, ctx->pass_sz);
             sqlite3_free(ctx->pass);
@@ -364,10 +1254,12 @@ int sqlite3_rekey(sqlite3 *db, const void *pKey, int nKey) {
         } else {
           printf("error\n");
           sqlite3BtreeRollback(pDb->pBt);
+          codec_key_cipher_ctx(ctx->ectx, ctx->evp_cipher, ctx->key, CIPHER_ENCRYPT); /* restore original key for writes */
         }
 
         /* cleanup rekey data, make sure to overwrite rekey_plaintext or read errors will ensue */
         ctx->rekey = NULL; 
+        ctx->hmac_rekey = NULL;
         ctx->rekey_plaintext = 0;
       }
     }
@@ -375,11 +1267,218 @@ int sqlite3_rekey(sqlite3 *db, const void *pKey, int nKey) {
     /* clear and free temporary key data */
     memset(key, 0, key_sz); 
     sqlite3_free(key);
+    memset(hmac_key, 0, key_sz); 
+    sqlite3_free(hmac_key);
     return SQLITE_OK;
   }
   return SQLITE_ERROR;
 }
 
+/*
+ * Online rekey.
+ *
+ * Rather than rewriting the whole database in one transaction like
+ * sqlite3_rekey(), sqlite3_rekey_step() moves a few pages at a time over
+ * to the new key, each step in a transaction of its own, so other writers
+ * only wait for one step. Pages are moved from the last one down, and the
+ * first page using the new key is recorded in page 1, which is moved last.
+ * Every connection keyed with both keys can therefore tell which key any
+ * page uses, and a rekey interrupted by a crash or a close is resumed by
+ * calling sqlite3_rekey_init() again with the same key. While a database
+ * is part way through, connections that only know the old key get
+ * SQLITE_NOTADB.
+ */
+struct sqlite3_rekey_op {
+  sqlite3 *db;          /* database connection */
+  int iDb;              /* index of the database being rekeyed */
+  int rc;               /* error code of the last step */
+  Pgno nRemaining;      /* pages left on the old key after the last step */
+  Pgno nPagecount;      /* database size at the last step */
+};
+
+static int codec_rekey_fatal(int rc) {
+  return (rc != SQLITE_OK && rc != SQLITE_BUSY && rc != SQLITE_LOCKED);
+}
+
+/* derive the new key of an online rekey and key its cipher contexts */
+static int codec_set_new_key(sqlite3 *db, codec_ctx *ctx, const void *pKey, int nKey) {
+  codec_ctx tmp;
+  int prepared_key_sz;
+
+  memset(&tmp, 0, sizeof(tmp));
+  tmp.key_sz = ctx->key_sz;
+  tmp.new_key = sqlite3Malloc(ctx->key_sz);
+  tmp.new_pass = sqlite3Malloc(nKey);
+  tmp.new_ectx = EVP_CIPHER_CTX_new();
+  tmp.new_dctx = EVP_CIPHER_CTX_new();
+  if(ctx->hmac_md) tmp.new_hmac_key = sqlite3Malloc(ctx->key_sz);
+  if(tmp.new_key == NULL || tmp.new_pass == NULL || tmp.new_ectx == NULL || tmp.new_dctx == NULL
+     || (ctx->hmac_md && tmp.new_hmac_key == NULL)) {
+    codec_free_new_key(&tmp);
+    return SQLITE_NOMEM;
+  }
+  memcpy(tmp.new_pass, pKey, nKey);
+  tmp.new_pass_sz = nKey;
+
+  codec_prepare_key(db, ctx, pKey, nKey, ctx->salt, FILE_HEADER_SZ, tmp.new_key, &prepared_key_sz);
+  assert(prepared_key_sz == ctx->key_sz);
+  if(ctx->hmac_md) codec_prepare_hmac_key(ctx, tmp.new_key, tmp.new_hmac_key);
+  if(codec_key_cipher_ctx(tmp.new_ectx, ctx->evp_cipher, tmp.new_key, CIPHER_ENCRYPT) != SQLITE_OK
+     || codec_key_cipher_ctx(tmp.new_dctx, ctx->evp_cipher, tmp.new_key, CIPHER_DECRYPT) != SQLITE_OK) {
+    codec_free_new_key(&tmp);
+    return SQLITE_ERROR;
+  }
+
+  /* the position of a rekey already under way is kept */
+  codec_free_new_key(ctx);
+  ctx->new_key = tmp.new_key;
+  ctx->new_hmac_key = tmp.new_hmac_key;
+  ctx->new_pass = tmp.new_pass;
+  ctx->new_pass_sz = tmp.new_pass_sz;
+  ctx->new_ectx = tmp.new_ectx;
+  ctx->new_dctx = tmp.new_dctx;
+  return SQLITE_OK;
+}
+
+sqlite3_rekey_op *sqlite3_rekey_init(sqlite3 *db, const char *zDb, const void *pKey, int nKey) {
+  sqlite3_rekey_op *p = 0;
+  codec_ctx *ctx;
+  int iDb, rc;
+
+  sqlite3_mutex_enter(db->mutex);
+  if(zDb == NULL) zDb = "main";
+  iDb = sqlite3FindDbName(db, zDb);
+  if(iDb < 0) {
+    sqlite3Error(db, SQLITE_ERROR, "unknown database %s", zDb);
+  } else if((ctx = codec_get_ctx(db, iDb)) == NULL) {
+    sqlite3Error(db, SQLITE_ERROR, "database %s is not encrypted", zDb);
+  } else if(pKey == NULL || nKey <= 0) {
+    sqlite3Error(db, SQLITE_ERROR, "no key given");
+  } else if((p = (sqlite3_rekey_op *) sqlite3_malloc(sizeof(*p))) == NULL) {
+    sqlite3Error(db, SQLITE_NOMEM, 0);
+  } else if((rc = codec_set_new_key(db, ctx, pKey, nKey)) != SQLITE_OK) {
+    sqlite3Error(db, rc, 0);
+    sqlite3_free(p);
+    p = 0;
+  } else {
+    memset(p, 0, sizeof(*p));
+    p->db = db;
+    p->iDb = iDb;
+  }
+  sqlite3_mutex_leave(db->mutex);
+  return p;
+}
+
+/*
+ * move up to nPage more pages over to the new key, or all of the remaining
+ * pages if nPage is negative. Returns SQLITE_DONE once page 1 has been
+ * moved and the new key is the key of the database. The pages of a step
+ * are kept referenced until they are written, so none of them can be 
+ * written out with the old key before the new position is recorded.
+ */
+int sqlite3_rekey_step(sqlite3_rekey_op *p, int nPage) {
+  sqlite3 *db = p->db;
+  int rc;
+
+  sqlite3_mutex_enter(db->mutex);
+  rc = p->rc;
+  if(!codec_rekey_fatal(rc) && rc != SQLITE_DONE) {
+    Btree *pBt = db->aDb[p->iDb].pBt;
+    Pager *pPager = sqlite3BtreePager(pBt);
+    codec_ctx *ctx = codec_get_ctx(db, p->iDb);
+    DbPage **apPage = NULL;
+    int bTrans = 0;
+    int nPin = 0;
+    int page_count = 0;
+    u32 marker = 0;
+    Pgno iOld, iNew, pgno;
+
+    sqlite3BtreeEnter(pBt);
+    if(ctx == NULL) {
+      rc = SQLITE_ERROR;
+    } else if(sqlite3BtreeIsInReadTrans(pBt)) {
+      rc = SQLITE_BUSY; /* never commit a transaction of the caller */
+    } else if((rc = sqlite3BtreeBeginTrans(pBt, 1)) == SQLITE_OK) {
+      bTrans = 1;
+    }
+    if(rc == SQLITE_OK) rc = sqlite3BtreeGetMeta(pBt, REKEY_META, &marker);
+    if(rc == SQLITE_OK) rc = sqlite3PagerPagecount(pPager, &page_count);
+
+    if(rc == SQLITE_OK && ctx->new_key == NULL) {
+      /* reading page 1 showed that another connection finished the rekey */
+      sqlite3BtreeRollback(pBt);
+      rc = SQLITE_DONE;
+    } else if(rc == SQLITE_OK) {
+      iOld = marker ? marker : (Pgno) page_count + 1;
+      if(iOld > (Pgno) page_count + 1) iOld = page_count + 1;
+      iNew = (nPage < 0 || (int) iOld - 2 <= nPage) ? 1 : iOld - nPage;
+
+      apPage = sqlite3Malloc(sizeof(DbPage *) * (iOld - iNew + 1));
+      if(apPage == NULL) rc = SQLITE_NOMEM;
+      for(pgno = iOld - 1; rc == SQLITE_OK && pgno >= iNew && pgno > 1; pgno--) {
+        if(sqlite3pager_is_mj_pgno(pPager, pgno)) continue;
+        rc = sqlite3PagerGet(pPager, pgno, &apPage[nPin]);
+        if(rc == SQLITE_OK) rc = sqlite3PagerWrite(apPage[nPin++]);
+      }
+
+      /* pages are journalled with the old key, and written with the new
+      ** key once rekey_pgno moves down. Page 1 itself goes last. */
+      if(rc == SQLITE_OK) rc = sqlite3BtreeUpdateMeta(pBt, REKEY_META, iNew == 1 ? 0 : iNew);
+      if(rc == SQLITE_OK) {
+        ctx->rekey_pgno = iNew;
+        rc = sqlite3BtreeCommitPhaseOne(pBt, 0);
+      }
+      while(nPin > 0) sqlite3PagerUnref(apPage[--nPin]);
+      sqlite3_free(apPage);
+
+      if(rc == SQLITE_OK) rc = sqlite3BtreeCommitPhaseTwo(pBt);
+      if(rc == SQLITE_OK) {
+        p->nRemaining = iNew - 1;
+        if(iNew == 1) {
+          codec_rekey_done(ctx);
+          p->nRemaining = 0;
+          rc = SQLITE_DONE;
+        }
+      } else {
+        ctx->rekey_pgno = marker; /* the rollback restores the pages with the old key */
+        sqlite3BtreeRollback(pBt);
+      }
+      p->nPagecount = page_count;
+    } else if(bTrans) {
+      sqlite3BtreeRollback(pBt);
+    }
+    sqlite3BtreeLeave(pBt);
+    p->rc = rc;
+  }
+  sqlite3_mutex_leave(db->mutex);
+  return rc;
+}
+
+/*
+ * release the rekey handle. A rekey that is not done stays recorded in
+ * the database, and this connection keeps both keys until it is closed.
+ */
+int sqlite3_rekey_finish(sqlite3_rekey_op *p) {
+  sqlite3 *db;
+  int rc;
+  if(p == 0) return SQLITE_OK;
+  db = p->db;
+  sqlite3_mutex_enter(db->mutex);
+  rc = (p->rc == SQLITE_DONE) ? SQLITE_OK : p->rc;
+  sqlite3Error(db, rc, 0);
+  sqlite3_mutex_leave(db->mutex);
+  sqlite3_free(p);
+  return rc;
+}
+
+int sqlite3_rekey_remaining(sqlite3_rekey_op *p) {
+  return p->nRemaining;
+}
+
+int sqlite3_rekey_pagecount(sqlite3_rekey_op *p) {
+  return p->nPagecount;
+}
+
 void sqlite3CodecGetKey(sqlite3* db, int nDb, void **zKey, int *nKey) {
   codec_ctx *ctx;
   struct Db *pDb = &db->aDb[nDb];
@@ -37,20 +37,48 @@
 
 #define FILE_HEADER_SZ 16
 
-#define CIPHER EVP_aes_256_cfb()
+/* default cipher, used for any database that does not select one with
+** PRAGMA cipher or sqlite3_key_v2. Databases created before cipher
+** selection was available were all written with this cipher */
+#define CIPHER "aes-256-cfb"
 #define CIPHER_DECRYPT 0
 #define CIPHER_ENCRYPT 1
 
-#define KEY_LENGTH 32
-
+/* default key derivation, may be changed per database with PRAGMA kdf_iter
+** and PRAGMA kdf_algorithm */
 #ifndef PBKDF2_ITER
 #define PBKDF2_ITER 4000
 #endif
+#define PBKDF2_ALGORITHM "PBKDF2-SHA1"
+
+/* default page authentication, may be changed per database with PRAGMA
+** cipher_hmac. Off by default so that existing databases, which have no
+** room reserved for an HMAC, can still be opened */
+#define CIPHER_HMAC "off"
+#define HMAC_SALT_MASK 0x3a /* applied to the file salt to derive the hmac key */
+#define HMAC_KDF_ITER 2
+
+/* an online rekey records the first page encrypted with the new key in 
+** this (otherwise unused) btree meta value, stored in page 1 */
+#define REKEY_META 9
+#define REKEY_MARKER_OFFSET (36 + REKEY_META*4)
 
 void sqlite3pager_get_codec(Pager *pPager, void **ctx);
 int sqlite3pager_is_mj_pgno(Pager *pPager, Pgno pgno);
 sqlite3_file *sqlite3Pager_get_fd(Pager *pPager);
 
+int sqlite3FreeCodecArg(void *pCodecArg);
+int sqlite3CodecSetCipher(sqlite3 *db, int nDb, const char *zCipher);
+const char *sqlite3CodecGetCipher(sqlite3 *db, int nDb);
+int sqlite3CodecSetKdfIter(sqlite3 *db, int nDb, int iter);
+int sqlite3CodecGetKdfIter(sqlite3 *db, int nDb);
+int sqlite3CodecSetKdfAlgorithm(sqlite3 *db, int nDb, const char *zKdf);
+const char *sqlite3CodecGetKdfAlgorithm(sqlite3 *db, int nDb);
+int sqlite3CodecSetHmac(sqlite3 *db, int nDb, const char *zHmac);
+const char *sqlite3CodecGetHmac(sqlite3 *db, int nDb);
+int sqlite3CodecSetHmacCheck(sqlite3 *db, int nDb, int check);
+int sqlite3CodecGetHmacCheck(sqlite3 *db, int nDb);
+
 #endif
 #endif
 /* END CRYPTO */
@@ -151,8 +151,15 @@ SQLITE_WSD struct Sqlite3Config sqlite3Config = {
    (void*)0,                  /* pPage */
    0,                         /* szPage */
    0,                         /* nPage */
+   0,                         /* bMapPage */
    0,                         /* mxParserStack */
    0,                         /* sharedCacheEnabled */
+   SQLITE_PCACHE_POLICY_LRU,  /* ePcachePolicy */
+#ifdef SQLITE_HAS_CODEC
+   0,                         /* nCodecThread */
+   0,                         /* nKdfCache */
+   0,                         /* nKdfCacheTtl */
+#endif
    /* All the rest need to always be zero */
    0,                         /* isInit */
    0,                         /* inProgress */
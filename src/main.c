@@ -215,7 +215,14 @@ int sqlite3_initialize(void){
 */
 int sqlite3_shutdown(void){
   sqlite3GlobalConfig.isMallocInit = 0;
+#ifdef SQLITE_HAS_CODEC
+  {
+    extern void sqlite3CodecShutdown(void);
+    sqlite3CodecShutdown();
+  }
+#endif
   sqlite3PcacheShutdown();
+  sqlite3PCacheBufferSetup(0, 0, 0);
   if( sqlite3GlobalConfig.isInit ){
     sqlite3_os_end();
   }
@@ -310,6 +317,15 @@ int sqlite3_config(int op, ...){
       sqlite3GlobalConfig.pPage = va_arg(ap, void*);
       sqlite3GlobalConfig.szPage = va_arg(ap, int);
       sqlite3GlobalConfig.nPage = va_arg(ap, int);
+      sqlite3GlobalConfig.bMapPage = 0;
+      break;
+    }
+    case SQLITE_CONFIG_PAGECACHE_MAP: {
+      /* Have page cache memory mapped when the library is initialized */
+      sqlite3GlobalConfig.pPage = 0;
+      sqlite3GlobalConfig.szPage = va_arg(ap, int);
+      sqlite3GlobalConfig.nPage = va_arg(ap, int);
+      sqlite3GlobalConfig.bMapPage = 1;
       break;
     }
 
@@ -327,6 +343,17 @@ int sqlite3_config(int op, ...){
       break;
     }
 
+    case SQLITE_CONFIG_PCACHE_POLICY: {
+      /* Replacement policy of the default page cache */
+      int ePolicy = va_arg(ap, int);
+      if( ePolicy!=SQLITE_PCACHE_POLICY_LRU && ePolicy!=SQLITE_PCACHE_POLICY_2Q ){
+        rc = SQLITE_ERROR;
+      }else{
+        sqlite3GlobalConfig.ePcachePolicy = ePolicy;
+      }
+      break;
+    }
+
 #if defined(SQLITE_ENABLE_MEMSYS3) || defined(SQLITE_ENABLE_MEMSYS5)
     case SQLITE_CONFIG_HEAP: {
       /* Designate a buffer for heap memory space */
@@ -364,6 +391,20 @@ int sqlite3_config(int op, ...){
       break;
     }
 
+#ifdef SQLITE_HAS_CODEC
+    case SQLITE_CONFIG_CODEC_THREADS: {
+      /* Number of worker threads that encrypt pages at commit */
+      sqlite3GlobalConfig.nCodecThread = va_arg(ap, int);
+      break;
+    }
+    case SQLITE_CONFIG_CODEC_KDF_CACHE: {
+      /* Size and lifetime of the process wide derived key cache */
+      sqlite3GlobalConfig.nKdfCache = va_arg(ap, int);
+      sqlite3GlobalConfig.nKdfCacheTtl = va_arg(ap, int);
+      break;
+    }
+#endif
+
     default: {
       rc = SQLITE_ERROR;
       break;
@@ -1157,6 +1198,34 @@ void *sqlite3_rollback_hook(
   return pRet;
 }
 
+/*
+** Return true if temporary databases and files should be held in
+** memory rather than on disk, according to the values of the
+** SQLITE_TEMP_STORE compile-time macro and the db->temp_store
+** variable (see the chart above sqlite3BtreeFactory() below).
+*/
+int sqlite3TempInMemory(const sqlite3 *db){
+#ifdef SQLITE_OMIT_MEMORYDB
+  UNUSED_PARAMETER(db);
+  return 0;
+#else
+#if SQLITE_TEMP_STORE==1
+  return ( db->temp_store==2 );
+#endif
+#if SQLITE_TEMP_STORE==2
+  return ( db->temp_store!=1 );
+#endif
+#if SQLITE_TEMP_STORE==3
+  UNUSED_PARAMETER(db);
+  return 1;
+#endif
+#if SQLITE_TEMP_STORE<1 || SQLITE_TEMP_STORE>3
+  UNUSED_PARAMETER(db);
+  return 0;
+#endif
+#endif /* SQLITE_OMIT_MEMORYDB */
+}
+
 /*
 ** This routine is called to create a connection to a database BTree
 ** driver.  If zFilename is the name of a file, then that file is
@@ -1201,21 +1270,8 @@ int sqlite3BtreeFactory(
   if( db->flags & SQLITE_NoReadlock ){
     btFlags |= BTREE_NO_READLOCK;
   }
-  if( zFilename==0 ){
-#if SQLITE_TEMP_STORE==0
-    /* Do nothing */
-#endif
-#ifndef SQLITE_OMIT_MEMORYDB
-#if SQLITE_TEMP_STORE==1
-    if( db->temp_store==2 ) zFilename = ":memory:";
-#endif
-#if SQLITE_TEMP_STORE==2
-    if( db->temp_store!=1 ) zFilename = ":memory:";
-#endif
-#if SQLITE_TEMP_STORE==3
+  if( zFilename==0 && sqlite3TempInMemory(db) ){
     zFilename = ":memory:";
-#endif
-#endif /* SQLITE_OMIT_MEMORYDB */
   }
 
   if( (vfsFlags & SQLITE_OPEN_MAIN_DB)!=0 && (zFilename==0 || *zFilename==0) ){
@@ -1552,12 +1608,16 @@ static int openDatabase(
   db->autoCommit = 1;
   db->nextAutovac = -1;
   db->nextPagesize = 0;
+  db->nWorker = SQLITE_DEFAULT_WORKER_THREADS;
   db->flags |= SQLITE_ShortColNames
 #if SQLITE_DEFAULT_FILE_FORMAT<4
                  | SQLITE_LegacyFileFmt
 #endif
 #ifdef SQLITE_ENABLE_LOAD_EXTENSION
                  | SQLITE_LoadExtension
+#endif
+#ifndef SQLITE_OMIT_AUTOMATIC_INDEX
+                 | SQLITE_AutoIndex
 #endif
       ;
   sqlite3HashInit(&db->aCollSeq, 0);
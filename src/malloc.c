@@ -142,7 +142,10 @@ int sqlite3MallocInit(void){
                   [sqlite3GlobalConfig.szPage*sqlite3GlobalConfig.nPage];
     for(i=0; i<sqlite3GlobalConfig.nPage; i++){ mem0.aPageFree[i] = i; }
     mem0.nPageFree = sqlite3GlobalConfig.nPage;
-  }else{
+  }else if( !sqlite3GlobalConfig.bMapPage || sqlite3GlobalConfig.szPage<512
+         || sqlite3GlobalConfig.nPage<1 ){
+    /* Keep the size and count if SQLITE_CONFIG_PAGECACHE_MAP asked for
+    ** the buffer to be mapped by sqlite3PCacheBufferSetup(). */
     sqlite3GlobalConfig.pPage = 0;
     sqlite3GlobalConfig.szPage = 0;
   }
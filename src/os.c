@@ -32,6 +32,7 @@
 **     sqlite3OsOpen()
 **     sqlite3OsRead()
 **     sqlite3OsWrite()
+**     sqlite3OsWritev()
 **     sqlite3OsSync()
 **     sqlite3OsLock()
 **
@@ -68,6 +69,25 @@ int sqlite3OsWrite(sqlite3_file *id, const void *pBuf, int amt, i64 offset){
   DO_OS_MALLOC_TEST;
   return id->pMethods->xWrite(id, pBuf, amt, offset);
 }
+int sqlite3OsWritev(
+  sqlite3_file *id,               /* File to write to */
+  int nBuf,                       /* Number of buffers */
+  const void **apBuf,             /* The buffers, written in order */
+  const int *anBuf,               /* Size of each buffer in bytes */
+  i64 offset                      /* Offset of the first byte written */
+){
+  int rc = SQLITE_OK;
+  int i;
+  DO_OS_MALLOC_TEST;
+  if( id->pMethods->iVersion>=4 && id->pMethods->xWritev ){
+    return id->pMethods->xWritev(id, nBuf, apBuf, anBuf, offset);
+  }
+  for(i=0; rc==SQLITE_OK && i<nBuf; i++){
+    rc = id->pMethods->xWrite(id, apBuf[i], anBuf[i], offset);
+    offset += anBuf[i];
+  }
+  return rc;
+}
 int sqlite3OsTruncate(sqlite3_file *id, i64 size){
   return id->pMethods->xTruncate(id, size);
 }
@@ -100,6 +120,32 @@ int sqlite3OsSectorSize(sqlite3_file *id){
 int sqlite3OsDeviceCharacteristics(sqlite3_file *id){
   return id->pMethods->xDeviceCharacteristics(id);
 }
+int sqlite3OsShmMap(
+  sqlite3_file *id,               /* Database file handle */
+  int iPage,                      /* Index of the shared-memory region */
+  int pgsz,                       /* Size of each region in bytes */
+  int bExtend,                    /* True to extend the file if required */
+  void volatile **pp              /* OUT: Pointer to the mapping */
+){
+  DO_OS_MALLOC_TEST;
+  return id->pMethods->xShmMap(id, iPage, pgsz, bExtend, pp);
+}
+int sqlite3OsShmLock(sqlite3_file *id, int offset, int n, int flags){
+  return id->pMethods->xShmLock(id, offset, n, flags);
+}
+void sqlite3OsShmBarrier(sqlite3_file *id){
+  id->pMethods->xShmBarrier(id);
+}
+int sqlite3OsShmUnmap(sqlite3_file *id, int deleteFlag){
+  return id->pMethods->xShmUnmap(id, deleteFlag);
+}
+int sqlite3OsFetch(sqlite3_file *id, i64 iOff, int iAmt, void **pp){
+  DO_OS_MALLOC_TEST;
+  return id->pMethods->xFetch(id, iOff, iAmt, pp);
+}
+int sqlite3OsUnfetch(sqlite3_file *id, i64 iOff, void *p){
+  return id->pMethods->xUnfetch(id, iOff, p);
+}
 
 /*
 ** The next group of routines are convenience wrappers around the
@@ -121,6 +121,22 @@
 #include <time.h>
 #include <sys/time.h>
 #include <errno.h>
+#if !defined(SQLITE_OMIT_WAL) || !defined(SQLITE_OMIT_MMAP)
+#include <sys/mman.h>
+#endif
+
+/*
+** The xWritev method uses pwritev() where the C library is known to
+** provide it, and otherwise writes each buffer separately. Compile with
+** -DHAVE_PWRITEV=1 to use it on other systems that have it.
+*/
+#if !defined(HAVE_PWRITEV) && defined(__GLIBC__) \
+ && (__GLIBC__>2 || (__GLIBC__==2 && __GLIBC_MINOR__>=10))
+# define HAVE_PWRITEV 1
+#endif
+#if HAVE_PWRITEV
+# include <sys/uio.h>
+#endif
 
 #if SQLITE_ENABLE_LOCKING_STYLE
 # include <sys/ioctl.h>
@@ -183,6 +199,15 @@ struct unixFile {
   unsigned char locktype;          /* The type of lock held on this fd */
   int lastErrno;                   /* The unix errno from the last I/O error */
   void *lockingContext;            /* Locking style specific state */
+  const char *zPath;               /* Name of the file */
+  struct unixShm *pShm;            /* Shared memory segment information */
+#ifndef SQLITE_OMIT_MMAP
+  u8 *pMapRegion;                  /* Read-only mapping of the file, or NULL */
+  i64 mmapSize;                    /* Usable size of the mapping */
+  i64 mmapSizeActual;              /* Size of the mapping in bytes */
+  i64 mmapSizeMax;                 /* Limit set by SQLITE_FCNTL_MMAP_SIZE */
+  int nFetchOut;                   /* Pointers from xFetch not yet returned */
+#endif
 #if SQLITE_ENABLE_LOCKING_STYLE
   int openFlags;                   /* The flags specified at open() */
 #endif
@@ -270,6 +295,11 @@ static void unixEnterMutex(void){
 static void unixLeaveMutex(void){
   sqlite3_mutex_leave(sqlite3MutexAlloc(SQLITE_MUTEX_STATIC_MASTER));
 }
+#ifdef SQLITE_DEBUG
+static int unixMutexHeld(void) {
+  return sqlite3_mutex_held(sqlite3MutexAlloc(SQLITE_MUTEX_STATIC_MASTER));
+}
+#endif
 
 
 #ifdef SQLITE_DEBUG
@@ -740,6 +770,7 @@ struct unixOpenCnt {
   int nLock;                  /* Number of outstanding locks */
   int nPending;               /* Number of pending close() operations */
   int *aPending;            /* Malloced space holding fd's awaiting a close() */
+  struct unixShmNode *pShmNode;        /* Shared memory associated with inode */
 #if OS_VXWORKS
   sem_t *pSem;                     /* Named POSIX semaphore */
   char aSemName[MAX_PATHNAME+1];   /* Name of that semaphore */
@@ -1006,6 +1037,7 @@ static int findLockInfo(
       pOpen->nLock = 0;
       pOpen->nPending = 0;
       pOpen->aPending = 0;
+      pOpen->pShmNode = 0;
       pOpen->pNext = openList;
       pOpen->pPrev = 0;
       if( openList ) openList->pPrev = pOpen;
@@ -1534,9 +1566,16 @@ end_unlock:
 ** even on VxWorks.  A mutex will be acquired on VxWorks by the
 ** vxworksReleaseFileId() routine.
 */
+#ifndef SQLITE_OMIT_MMAP
+static void unixUnmapfile(unixFile*);
+#endif
+
 static int closeUnixFile(sqlite3_file *id){
   unixFile *pFile = (unixFile*)id;
   if( pFile ){
+#ifndef SQLITE_OMIT_MMAP
+    unixUnmapfile(pFile);
+#endif
     if( pFile->dirfd>=0 ){
       int err = close(pFile->dirfd);
       if( err ){
@@ -1569,6 +1608,10 @@ static int closeUnixFile(sqlite3_file *id){
   return SQLITE_OK;
 }
 
+#ifndef SQLITE_OMIT_WAL
+static int unixShmUnmap(sqlite3_file*, int);
+#endif
+
 /*
 ** Close a file.
 */
@@ -1576,6 +1619,9 @@ static int unixClose(sqlite3_file *id){
   int rc = SQLITE_OK;
   if( id ){
     unixFile *pFile = (unixFile *)id;
+#ifndef SQLITE_OMIT_WAL
+    unixShmUnmap(id, 0);
+#endif
     unixUnlock(id, NO_LOCK);
     unixEnterMutex();
     if( pFile->pOpen && pFile->pOpen->nLock ){
@@ -2816,6 +2862,112 @@ static int unixWrite(
   return SQLITE_OK;
 }
 
+/*
+** The maximum number of buffers passed to a single pwritev() call by
+** unixWritev(). Larger requests are split.
+*/
+#define UNIX_WRITEV_MAX 64
+
+/*
+** Write nBuf buffers to the file one after another, starting at offset,
+** with as few system calls as possible. Return SQLITE_OK on success or
+** some other error code on failure, as for unixWrite().
+*/
+static int unixWritev(
+  sqlite3_file *id,
+  int nBuf,
+  const void **apBuf,
+  const int *anBuf,
+  sqlite3_int64 offset
+){
+#if HAVE_PWRITEV
+  unixFile *pFile = (unixFile*)id;
+  struct iovec aIov[UNIX_WRITEV_MAX];
+  int iBuf = 0;                   /* First buffer not completely written */
+  int iDone = 0;                  /* Bytes of apBuf[iBuf] already written */
+  int got = 0;
+  int n;
+
+#ifndef NDEBUG
+  {
+    /* Check the locking range and record changes to the transaction
+    ** counter exactly as unixWrite() would for each buffer. */
+    i64 iOfst = offset;
+    int i;
+    for(i=0; i<nBuf; i++){
+      const char *z = (const char *)apBuf[i];
+      assert( anBuf[i]>0 );
+      assert( pFile->isLockable==0
+              || iOfst>=PENDING_BYTE+512
+              || iOfst+anBuf[i]<=PENDING_BYTE );
+      if( pFile->inNormalWrite ){
+        pFile->dbUpdate = 1;
+        if( iOfst<=24 && iOfst+anBuf[i]>=27 ){
+          int rc;
+          char oldCntr[4];
+          SimulateIOErrorBenign(1);
+          rc = seekAndRead(pFile, 24, oldCntr, 4);
+          SimulateIOErrorBenign(0);
+          if( rc!=4 || memcmp(oldCntr, &z[24-iOfst], 4)!=0 ){
+            pFile->transCntrChng = 1;
+          }
+        }
+      }
+      iOfst += anBuf[i];
+    }
+  }
+#endif
+
+  while( iBuf<nBuf ){
+    for(n=0; n<UNIX_WRITEV_MAX && iBuf+n<nBuf; n++){
+      int iSkip = (n==0 ? iDone : 0);
+      aIov[n].iov_base = (void*)&((const char*)apBuf[iBuf+n])[iSkip];
+      aIov[n].iov_len = anBuf[iBuf+n] - iSkip;
+    }
+    TIMER_START;
+    got = (int)pwritev(pFile->h, aIov, n, offset);
+    TIMER_END;
+    OSTRACE5("WRITEV  %-3d %5d %7lld %llu\n", pFile->h, got, offset,
+             TIMER_ELAPSED);
+    if( got<=0 ){
+      if( got<0 ) pFile->lastErrno = errno;
+      break;
+    }
+    offset += got;
+    while( got>0 ){
+      if( got>=anBuf[iBuf]-iDone ){
+        got -= anBuf[iBuf]-iDone;
+        iBuf++;
+        iDone = 0;
+      }else{
+        iDone += got;
+        got = 0;
+      }
+    }
+  }
+  SimulateIOError(( got=(-1), iBuf=0 ));
+  SimulateDiskfullError(( got=0, iBuf=0 ));
+  if( iBuf<nBuf ){
+    if( got<0 ){
+      /* lastErrno set above */
+      return SQLITE_IOERR_WRITE;
+    }else{
+      pFile->lastErrno = 0; /* not a system error */
+      return SQLITE_FULL;
+    }
+  }
+  return SQLITE_OK;
+#else
+  int rc = SQLITE_OK;
+  int i;
+  for(i=0; rc==SQLITE_OK && i<nBuf; i++){
+    rc = unixWrite(id, apBuf[i], anBuf[i], offset);
+    offset += anBuf[i];
+  }
+  return rc;
+#endif
+}
+
 #ifdef SQLITE_TEST
 /*
 ** Count the number of fullsyncs and normal syncs.  This is used to test
@@ -3017,6 +3169,13 @@ static int unixTruncate(sqlite3_file *id, i64 nByte){
     ((unixFile*)id)->lastErrno = errno;
     return SQLITE_IOERR_TRUNCATE;
   }else{
+#ifndef SQLITE_OMIT_MMAP
+    /* Pages past the new end of the file must not be handed out by
+    ** unixFetch(). Touching them would raise SIGBUS. */
+    if( ((unixFile*)id)->mmapSize>nByte ){
+      ((unixFile*)id)->mmapSize = nByte;
+    }
+#endif
     return SQLITE_OK;
   }
 }
@@ -3070,6 +3229,32 @@ static int unixFileControl(sqlite3_file *id, int op, void *pArg){
       *(int*)pArg = ((unixFile*)id)->lastErrno;
       return SQLITE_OK;
     }
+    case SQLITE_FCNTL_WILLNEED: {
+#ifdef POSIX_FADV_WILLNEED
+      i64 *aRange = (i64*)pArg;
+      if( posix_fadvise(((unixFile*)id)->h, (off_t)aRange[0],
+                        (off_t)aRange[1], POSIX_FADV_WILLNEED) ){
+        return SQLITE_ERROR;
+      }
+      return SQLITE_OK;
+#else
+      return SQLITE_ERROR;
+#endif
+    }
+#ifndef SQLITE_OMIT_MMAP
+    case SQLITE_FCNTL_MMAP_SIZE: {
+      unixFile *pFile = (unixFile*)id;
+      i64 newLimit = *(i64*)pArg;
+      *(i64*)pArg = pFile->mmapSizeMax;
+      if( newLimit>=0 ){
+        pFile->mmapSizeMax = newLimit;
+        if( pFile->nFetchOut==0 && pFile->mmapSize>newLimit ){
+          unixUnmapfile(pFile);
+        }
+      }
+      return SQLITE_OK;
+    }
+#endif
 #ifndef NDEBUG
     /* The pager calls this method to signal that it has done
     ** a rollback and that the database is therefore unchanged and
@@ -3114,6 +3299,549 @@ static int unixDeviceCharacteristics(sqlite3_file *NotUsed){
   return 0;
 }
 
+#ifndef SQLITE_OMIT_WAL
+
+/*
+** Object used to represent a shared memory segment.
+**
+** There is one instance of this object for each open database file
+** that uses shared memory in this process. It hangs off the unixOpenCnt
+** of the database inode, so all connections to the same file share it.
+** Each connection additionally owns a unixShm object that records the
+** locks it holds.
+**
+** unixMutexHeld() must be true when creating or destroying this object
+** or when reading or writing the unixOpenCnt.pShmNode pointer. The
+** fields of this object other than nRef are protected by
+** unixShmNode.mutex.
+**
+** The shared memory is held in a file named after the database file
+** with a "-shm" suffix. Lock slot i is a posix advisory lock on byte
+** UNIX_SHM_BASE+i of that file, and byte UNIX_SHM_DMS is the
+** "dead-man switch" that tells the first connection to open the file
+** that whatever the file holds was left behind by a dead process.
+*/
+typedef struct unixShmNode unixShmNode;
+typedef struct unixShm unixShm;
+struct unixShmNode {
+  struct unixOpenCnt *pOpen; /* unixOpenCnt of the database file */
+  sqlite3_mutex *mutex;      /* Mutex to access this object */
+  char *zFilename;           /* Name of the mmapped file */
+  int h;                     /* Open file descriptor */
+  int szRegion;              /* Size of shared-memory regions */
+  int nRegion;               /* Size of array apRegion */
+  char **apRegion;           /* Array of mapped shared-memory regions */
+  int nRef;                  /* Number of unixShm objects pointing to this */
+  unixShm *pFirst;           /* All unixShm objects pointing to this */
+};
+
+/*
+** Structure used internally by this VFS to record the state of an
+** open shared memory connection. Both masks are protected by
+** unixShmNode.mutex.
+*/
+struct unixShm {
+  unixShmNode *pShmNode;     /* The underlying unixShmNode object */
+  unixShm *pNext;            /* Next unixShm with the same unixShmNode */
+  u16 sharedMask;            /* Mask of shared locks held */
+  u16 exclMask;              /* Mask of exclusive locks held */
+};
+
+#define UNIX_SHM_BASE   ((22+SQLITE_SHM_NLOCK)*4)   /* First lock byte */
+#define UNIX_SHM_DMS    (UNIX_SHM_BASE+SQLITE_SHM_NLOCK)  /* deadman switch */
+
+/*
+** Apply posix advisory locks for all bytes from ofst through ofst+n-1
+** of the shared memory file. Return SQLITE_BUSY if some other process
+** holds a conflicting lock.
+*/
+static int unixShmSystemLock(
+  unixShmNode *pShmNode, /* Apply locks to this open shared-memory segment */
+  int lockType,          /* F_UNLCK, F_RDLCK, or F_WRLCK */
+  int ofst,              /* First byte of the locking range */
+  int n                  /* Number of bytes to lock */
+){
+  struct flock f;
+  int rc = SQLITE_OK;
+
+  assert( sqlite3_mutex_held(pShmNode->mutex) || pShmNode->nRef==0 );
+  memset(&f, 0, sizeof(f));
+  f.l_type = (short)lockType;
+  f.l_whence = SEEK_SET;
+  f.l_start = ofst;
+  f.l_len = n;
+  if( fcntl(pShmNode->h, F_SETLK, &f)==-1 ){
+    rc = (errno==EACCES || errno==EAGAIN) ? SQLITE_BUSY : SQLITE_IOERR_SHMLOCK;
+  }
+  OSTRACE5("SHM-LOCK %d type=%d ofst=%d rc=%d\n", pShmNode->h,lockType,ofst,rc);
+  return rc;
+}
+
+/*
+** Purge the unixShmNode belonging to pOpen if it has no more
+** references. The caller must hold the unix master mutex.
+*/
+static void unixShmPurge(struct unixOpenCnt *pOpen){
+  unixShmNode *p = pOpen->pShmNode;
+  assert( unixMutexHeld() );
+  if( p && p->nRef==0 ){
+    int i;
+    for(i=0; i<p->nRegion; i++){
+      munmap(p->apRegion[i], p->szRegion);
+    }
+    sqlite3_free(p->apRegion);
+    if( p->h>=0 ) close(p->h);
+    sqlite3_mutex_free(p->mutex);
+    pOpen->pShmNode = 0;
+    sqlite3_free(p);
+  }
+}
+
+/*
+** Open the shared-memory area associated with database file pDbFd,
+** creating the "-shm" file if it does not exist. If this is the first
+** connection to the file in any process, truncate the file to zero
+** bytes so that stale content left over from a crash is ignored.
+*/
+static int unixOpenSharedMemory(unixFile *pDbFd){
+  struct unixShm *p = 0;
+  struct unixShmNode *pShmNode;
+  struct unixOpenCnt *pOpen;
+  int rc = SQLITE_OK;
+
+  p = sqlite3_malloc( sizeof(*p) );
+  if( p==0 ) return SQLITE_NOMEM;
+  memset(p, 0, sizeof(*p));
+  assert( pDbFd->pShm==0 && pDbFd->zPath!=0 );
+
+  unixEnterMutex();
+  pOpen = pDbFd->pOpen;
+  pShmNode = pOpen->pShmNode;
+  if( pShmNode==0 ){
+    int nPath = sqlite3Strlen30(pDbFd->zPath);
+    pShmNode = sqlite3_malloc( sizeof(*pShmNode) + nPath + 5 );
+    if( pShmNode==0 ){
+      rc = SQLITE_NOMEM;
+      goto shm_open_err;
+    }
+    memset(pShmNode, 0, sizeof(*pShmNode));
+    pShmNode->zFilename = (char*)&pShmNode[1];
+    memcpy(pShmNode->zFilename, pDbFd->zPath, nPath);
+    memcpy(&pShmNode->zFilename[nPath], "-shm", 5);
+    pShmNode->h = -1;
+    pOpen->pShmNode = pShmNode;
+    pShmNode->pOpen = pOpen;
+    pShmNode->mutex = sqlite3_mutex_alloc(SQLITE_MUTEX_FAST);
+    if( pShmNode->mutex==0 && sqlite3GlobalConfig.bCoreMutex ){
+      rc = SQLITE_NOMEM;
+      goto shm_open_err;
+    }
+
+    pShmNode->h = open(pShmNode->zFilename, O_RDWR|O_CREAT,
+                       SQLITE_DEFAULT_FILE_PERMISSIONS);
+    if( pShmNode->h<0 ){
+      rc = SQLITE_CANTOPEN;
+      goto shm_open_err;
+    }
+
+    /* Check to see if another process is holding the dead-man switch.
+    ** If not, truncate the file to zero length. 
+    */
+    rc = SQLITE_OK;
+    if( unixShmSystemLock(pShmNode, F_WRLCK, UNIX_SHM_DMS, 1)==SQLITE_OK ){
+      if( ftruncate(pShmNode->h, 0) ){
+        rc = SQLITE_IOERR_SHMOPEN;
+      }
+    }
+    if( rc==SQLITE_OK ){
+      rc = unixShmSystemLock(pShmNode, F_RDLCK, UNIX_SHM_DMS, 1);
+    }
+    if( rc ) goto shm_open_err;
+  }
+
+  /* Make the new connection a child of the unixShmNode */
+  p->pShmNode = pShmNode;
+  pShmNode->nRef++;
+  pDbFd->pShm = p;
+  unixLeaveMutex();
+
+  /* The reference count on pShmNode has already been incremented under
+  ** the cover of the unixEnterMutex() mutex and the pointer from the
+  ** new (struct unixShm) object to the pShmNode has been set. All that is
+  ** left to do is to link the new object into the linked list starting
+  ** at pShmNode->pFirst. This must be done while holding the pShmNode->mutex 
+  ** mutex.
+  */
+  sqlite3_mutex_enter(pShmNode->mutex);
+  p->pNext = pShmNode->pFirst;
+  pShmNode->pFirst = p;
+  sqlite3_mutex_leave(pShmNode->mutex);
+  return SQLITE_OK;
+
+shm_open_err:
+  unixShmPurge(pOpen);
+  sqlite3_free(p);
+  unixLeaveMutex();
+  return rc;
+}
+
+/*
+** Map region iRegion of the shared memory into this process and write
+** a pointer to it to *pp. Every region is szRegion bytes in size. If the
+** shared memory file is not yet large enough and bExtend is false, set
+** *pp to NULL and return SQLITE_OK. Otherwise grow the file first.
+*/
+static int unixShmMap(
+  sqlite3_file *fd,               /* Handle open on database file */
+  int iRegion,                    /* Region to retrieve */
+  int szRegion,                   /* Size of regions */
+  int bExtend,                    /* True to extend file if necessary */
+  void volatile **pp              /* OUT: Mapped memory */
+){
+  unixFile *pDbFd = (unixFile*)fd;
+  unixShm *p;
+  unixShmNode *pShmNode;
+  int rc = SQLITE_OK;
+
+  /* If the shared-memory file has not yet been opened, open it now. */
+  if( pDbFd->pShm==0 ){
+    rc = unixOpenSharedMemory(pDbFd);
+    if( rc!=SQLITE_OK ) return rc;
+  }
+
+  p = pDbFd->pShm;
+  pShmNode = p->pShmNode;
+  sqlite3_mutex_enter(pShmNode->mutex);
+  assert( szRegion==pShmNode->szRegion || pShmNode->nRegion==0 );
+
+  if( pShmNode->nRegion<=iRegion ){
+    char **apNew;                      /* New apRegion[] array */
+    int nByte = (iRegion+1)*szRegion;  /* Minimum required file size */
+    struct stat sStat;                 /* Used by fstat() */
+
+    pShmNode->szRegion = szRegion;
+
+    /* The requested region is not mapped into this processes address space.
+    ** Check to see if it has been allocated (i.e. if the wal-index file is
+    ** large enough to contain the requested region).
+    */
+    if( fstat(pShmNode->h, &sStat) ){
+      rc = SQLITE_IOERR_SHMSIZE;
+      goto shmpage_out;
+    }
+    if( sStat.st_size<nByte ){
+      /* The requested memory region does not exist. If bExtend is set to
+      ** false, exit early. *pp will be set to NULL and SQLITE_OK returned.
+      */
+      if( !bExtend ) goto shmpage_out;
+      if( ftruncate(pShmNode->h, nByte) ){
+        rc = SQLITE_IOERR_SHMSIZE;
+        goto shmpage_out;
+      }
+    }
+
+    /* Map the requested memory region into this processes address space. */
+    apNew = (char **)sqlite3_realloc(
+        pShmNode->apRegion, (iRegion+1)*sizeof(char *)
+    );
+    if( !apNew ){
+      rc = SQLITE_IOERR_NOMEM;
+      goto shmpage_out;
+    }
+    pShmNode->apRegion = apNew;
+    while( pShmNode->nRegion<=iRegion ){
+      void *pMem = mmap(0, szRegion, PROT_READ|PROT_WRITE, MAP_SHARED,
+          pShmNode->h, pShmNode->nRegion*(i64)szRegion
+      );
+      if( pMem==MAP_FAILED ){
+        rc = SQLITE_IOERR_SHMOPEN;
+        goto shmpage_out;
+      }
+      pShmNode->apRegion[pShmNode->nRegion] = pMem;
+      pShmNode->nRegion++;
+    }
+  }
+
+shmpage_out:
+  if( pShmNode->nRegion>iRegion ){
+    *pp = pShmNode->apRegion[iRegion];
+  }else{
+    *pp = 0;
+  }
+  sqlite3_mutex_leave(pShmNode->mutex);
+  return rc;
+}
+
+/*
+** Change the lock state for a shared-memory segment.
+**
+** Locks held by other connections in this process are tracked in the
+** unixShm masks, because posix advisory locks do not conflict between
+** file descriptors of one process. The posix lock is only taken when
+** no other connection in the process holds the slot, and only
+** released when the last in-process holder lets go of it.
+*/
+static int unixShmLock(
+  sqlite3_file *fd,          /* Database file holding the shared memory */
+  int ofst,                  /* First lock to acquire or release */
+  int n,                     /* Number of locks to acquire or release */
+  int flags                  /* What to do with the lock */
+){
+  unixFile *pDbFd = (unixFile*)fd;      /* Connection holding shared memory */
+  unixShm *p = pDbFd->pShm;             /* The shared memory being locked */
+  unixShm *pX;                          /* For looping over all siblings */
+  unixShmNode *pShmNode = p->pShmNode;  /* The underlying file iNode */
+  int rc = SQLITE_OK;                   /* Result code */
+  u16 mask;                             /* Mask of locks to take or release */
+
+  assert( ofst>=0 && ofst+n<=SQLITE_SHM_NLOCK );
+  assert( n>=1 );
+  assert( flags==(SQLITE_SHM_LOCK | SQLITE_SHM_SHARED)
+       || flags==(SQLITE_SHM_LOCK | SQLITE_SHM_EXCLUSIVE)
+       || flags==(SQLITE_SHM_UNLOCK | SQLITE_SHM_SHARED)
+       || flags==(SQLITE_SHM_UNLOCK | SQLITE_SHM_EXCLUSIVE) );
+  assert( n==1 || (flags & SQLITE_SHM_EXCLUSIVE)!=0 );
+
+  mask = (u16)((1<<(ofst+n)) - (1<<ofst));
+  sqlite3_mutex_enter(pShmNode->mutex);
+  if( flags & SQLITE_SHM_UNLOCK ){
+    u16 allMask = 0; /* Mask of locks held by siblings */
+
+    /* See if any siblings hold this same lock */
+    for(pX=pShmNode->pFirst; pX; pX=pX->pNext){
+      if( pX==p ) continue;
+      assert( (pX->exclMask & (p->exclMask|p->sharedMask))==0 );
+      allMask |= pX->sharedMask;
+    }
+
+    /* Unlock the system-level locks */
+    if( (mask & allMask)==0 ){
+      rc = unixShmSystemLock(pShmNode, F_UNLCK, ofst+UNIX_SHM_BASE, n);
+    }
+
+    /* Undo the local locks */
+    if( rc==SQLITE_OK ){
+      p->exclMask &= ~mask;
+      p->sharedMask &= ~mask;
+    } 
+  }else if( flags & SQLITE_SHM_SHARED ){
+    u16 allShared = 0;  /* Union of locks held by connections other than "p" */
+
+    /* Find out which shared locks are already held by sibling connections.
+    ** If any sibling already holds an exclusive lock, go ahead and return
+    ** SQLITE_BUSY.
+    */
+    for(pX=pShmNode->pFirst; pX; pX=pX->pNext){
+      if( (pX->exclMask & mask)!=0 ){
+        rc = SQLITE_BUSY;
+        break;
+      }
+      allShared |= pX->sharedMask;
+    }
+
+    /* Get shared locks at the system level, if necessary */
+    if( rc==SQLITE_OK ){
+      if( (allShared & mask)==0 ){
+        rc = unixShmSystemLock(pShmNode, F_RDLCK, ofst+UNIX_SHM_BASE, n);
+      }
+    }
+
+    /* Get the local shared locks */
+    if( rc==SQLITE_OK ){
+      p->sharedMask |= mask;
+    }
+  }else{
+    /* Make sure no sibling connections hold locks that will block this
+    ** lock.  If any do, return SQLITE_BUSY right away.
+    */
+    for(pX=pShmNode->pFirst; pX; pX=pX->pNext){
+      if( (pX->exclMask & mask)!=0 || (pX->sharedMask & mask)!=0 ){
+        rc = SQLITE_BUSY;
+        break;
+      }
+    }
+  
+    /* Get the exclusive locks at the system level.  Then if successful
+    ** also mark the local connection as being locked.
+    */
+    if( rc==SQLITE_OK ){
+      rc = unixShmSystemLock(pShmNode, F_WRLCK, ofst+UNIX_SHM_BASE, n);
+      if( rc==SQLITE_OK ){
+        assert( (p->sharedMask & mask)==0 );
+        p->exclMask |= mask;
+      }
+    }
+  }
+  sqlite3_mutex_leave(pShmNode->mutex);
+  return rc;
+}
+
+/*
+** Implement a memory barrier or memory fence on shared memory.  
+**
+** All loads and stores begun before the barrier must complete before
+** any load or store begun after the barrier.
+*/
+static void unixShmBarrier(
+  sqlite3_file *fd                /* Database file holding the shared memory */
+){
+  UNUSED_PARAMETER(fd);
+  unixEnterMutex();
+  unixLeaveMutex();
+}
+
+/*
+** Close a connection to shared-memory.  Delete the underlying 
+** storage if deleteFlag is true and this was the last connection
+** to the shared memory in this process.
+*/
+static int unixShmUnmap(
+  sqlite3_file *fd,               /* The underlying database file */
+  int deleteFlag                  /* Delete shared-memory if true */
+){
+  unixShm *p;                     /* The connection to be closed */
+  unixShmNode *pShmNode;          /* The underlying shared-memory file */
+  unixShm **pp;                   /* For looping over sibling connections */
+  unixFile *pDbFd;                /* The underlying database file */
+
+  pDbFd = (unixFile*)fd;
+  p = pDbFd->pShm;
+  if( p==0 ) return SQLITE_OK;
+  pShmNode = p->pShmNode;
+
+  assert( pShmNode==pDbFd->pOpen->pShmNode );
+  assert( pShmNode->pOpen==pDbFd->pOpen );
+
+  /* Remove connection p from the set of connections associated
+  ** with pShmNode */
+  sqlite3_mutex_enter(pShmNode->mutex);
+  for(pp=&pShmNode->pFirst; (*pp)!=p; pp = &(*pp)->pNext){}
+  *pp = p->pNext;
+
+  /* Free the connection p */
+  sqlite3_free(p);
+  pDbFd->pShm = 0;
+  sqlite3_mutex_leave(pShmNode->mutex);
+
+  /* If pShmNode->nRef has reached 0, then close the underlying
+  ** shared-memory file, too */
+  unixEnterMutex();
+  assert( pShmNode->nRef>0 );
+  pShmNode->nRef--;
+  if( pShmNode->nRef==0 ){
+    if( deleteFlag ) unlink(pShmNode->zFilename);
+    unixShmPurge(pDbFd->pOpen);
+  }
+  unixLeaveMutex();
+
+  return SQLITE_OK;
+}
+
+#else
+# define unixShmMap     0
+# define unixShmLock    0
+# define unixShmBarrier 0
+# define unixShmUnmap   0
+#endif /* #ifndef SQLITE_OMIT_WAL */
+
+#ifndef SQLITE_OMIT_MMAP
+/*
+** If it is currently mapped, unmap the database file. The caller must
+** make sure that no pointer returned by unixFetch() is still in use.
+*/
+static void unixUnmapfile(unixFile *pFd){
+  if( pFd->pMapRegion ){
+    munmap(pFd->pMapRegion, (size_t)pFd->mmapSizeActual);
+    pFd->pMapRegion = 0;
+    pFd->mmapSize = 0;
+    pFd->mmapSizeActual = 0;
+  }
+}
+
+/*
+** Map the first min(file-size, mmapSizeMax) bytes of the file into
+** memory, replacing any existing mapping. No pointers into an existing
+** mapping may be outstanding.
+**
+** Failure to map the file is not an error. The mapping limit is set to
+** zero so that no further attempt is made, and the file is read with
+** unixRead() instead. Only an error from fstat() is returned.
+*/
+static int unixMapfile(unixFile *pFd){
+  struct stat statbuf;
+  i64 nMap;
+  void *pNew;
+
+  assert( pFd->nFetchOut==0 );
+  unixUnmapfile(pFd);
+  if( fstat(pFd->h, &statbuf) ){
+    pFd->lastErrno = errno;
+    return SQLITE_IOERR_FSTAT;
+  }
+  nMap = statbuf.st_size;
+  if( nMap>pFd->mmapSizeMax ) nMap = pFd->mmapSizeMax;
+  if( nMap<=0 || (i64)(size_t)nMap!=nMap ){
+    return SQLITE_OK;
+  }
+  pNew = mmap(0, (size_t)nMap, PROT_READ, MAP_SHARED, pFd->h, 0);
+  if( pNew==MAP_FAILED ){
+    pFd->mmapSizeMax = 0;
+    return SQLITE_OK;
+  }
+  pFd->pMapRegion = (u8*)pNew;
+  pFd->mmapSize = nMap;
+  pFd->mmapSizeActual = nMap;
+  return SQLITE_OK;
+}
+
+/*
+** If possible, set *pp to point to the iAmt bytes at offset iOff of the
+** file, within a read-only mapping. Otherwise set *pp to NULL. If the
+** file has grown past the end of the current mapping and no pointer into
+** the mapping is outstanding, the file is mapped again first.
+**
+** A non-NULL pointer must be released with unixUnfetch().
+*/
+static int unixFetch(sqlite3_file *fd, i64 iOff, int iAmt, void **pp){
+  unixFile *pFd = (unixFile *)fd;
+  *pp = 0;
+  if( pFd->mmapSizeMax>0 ){
+    if( iOff+iAmt>pFd->mmapSize && pFd->nFetchOut==0
+     && pFd->mmapSize<pFd->mmapSizeMax
+    ){
+      int rc = unixMapfile(pFd);
+      if( rc!=SQLITE_OK ) return rc;
+    }
+    if( iOff+iAmt<=pFd->mmapSize ){
+      *pp = &pFd->pMapRegion[iOff];
+      pFd->nFetchOut++;
+    }
+  }
+  return SQLITE_OK;
+}
+
+/*
+** Release a pointer obtained from unixFetch(). If p is NULL, the mapping
+** is no longer needed by the caller and is unmapped, provided that no
+** other pointer into it is outstanding.
+*/
+static int unixUnfetch(sqlite3_file *fd, i64 iOff, void *p){
+  unixFile *pFd = (unixFile *)fd;
+  UNUSED_PARAMETER(iOff);
+  if( p ){
+    assert( pFd->nFetchOut>0 );
+    assert( (u8*)p==&pFd->pMapRegion[iOff] );
+    pFd->nFetchOut--;
+  }else if( pFd->nFetchOut==0 ){
+    unixUnmapfile(pFd);
+  }
+  return SQLITE_OK;
+}
+#else
+# define unixFetch   0
+# define unixUnfetch 0
+#endif /* #ifndef SQLITE_OMIT_MMAP */
+
 /*
 ** Here ends the implementation of all sqlite3_file methods.
 **
@@ -3149,14 +3877,18 @@ static int unixDeviceCharacteristics(sqlite3_file *NotUsed){
 ** Each instance of this macro generates two objects:
 **
 **   *  A constant sqlite3_io_methods object call METHOD that has locking
-**      methods CLOSE, LOCK, UNLOCK, CKRESLOCK.
+**      methods CLOSE, LOCK, UNLOCK, CKRESLOCK. Only objects of VERSION 2
+**      or greater offer the shared-memory methods used by WAL mode, and
+**      only objects of VERSION 3 offer the memory-mapped reads of xFetch.
+**      Objects of VERSION 4 also write several buffers at once with
+**      xWritev.
 **
 **   *  An I/O method finder function called FINDER that returns a pointer
 **      to the METHOD object in the previous bullet.
 */
-#define IOMETHODS(FINDER, METHOD, CLOSE, LOCK, UNLOCK, CKLOCK)               \
+#define IOMETHODS(FINDER, METHOD, VERSION, CLOSE, LOCK, UNLOCK, CKLOCK)      \
 static const sqlite3_io_methods METHOD = {                                   \
-   1,                          /* iVersion */                                \
+   VERSION,                    /* iVersion */                                \
    CLOSE,                      /* xClose */                                  \
    unixRead,                   /* xRead */                                   \
    unixWrite,                  /* xWrite */                                  \
@@ -3168,7 +3900,14 @@ static const sqlite3_io_methods METHOD = {                                   \
    CKLOCK,                     /* xCheckReservedLock */                      \
    unixFileControl,            /* xFileControl */                            \
    unixSectorSize,             /* xSectorSize */                             \
-   unixDeviceCharacteristics   /* xDeviceCapabilities */                     \
+   unixDeviceCharacteristics,  /* xDeviceCapabilities */                     \
+   unixShmMap,                 /* xShmMap */                                 \
+   unixShmLock,                /* xShmLock */                                \
+   unixShmBarrier,             /* xShmBarrier */                             \
+   unixShmUnmap,               /* xShmUnmap */                               \
+   unixFetch,                  /* xFetch */                                  \
+   unixUnfetch,                /* xUnfetch */                                \
+   unixWritev                  /* xWritev */                                 \
 };                                                                           \
 static const sqlite3_io_methods *FINDER##Impl(const char *z, int h){         \
   UNUSED_PARAMETER(z); UNUSED_PARAMETER(h);                                  \
@@ -3185,6 +3924,7 @@ static const sqlite3_io_methods *(*const FINDER)(const char*,int)            \
 IOMETHODS(
   posixIoFinder,            /* Finder function name */
   posixIoMethods,           /* sqlite3_io_methods object name */
+  4,                        /* iVersion */
   unixClose,                /* xClose method */
   unixLock,                 /* xLock method */
   unixUnlock,               /* xUnlock method */
@@ -3193,6 +3933,7 @@ IOMETHODS(
 IOMETHODS(
   nolockIoFinder,           /* Finder function name */
   nolockIoMethods,          /* sqlite3_io_methods object name */
+  1,                        /* iVersion */
   nolockClose,              /* xClose method */
   nolockLock,               /* xLock method */
   nolockUnlock,             /* xUnlock method */
@@ -3201,6 +3942,7 @@ IOMETHODS(
 IOMETHODS(
   dotlockIoFinder,          /* Finder function name */
   dotlockIoMethods,         /* sqlite3_io_methods object name */
+  1,                        /* iVersion */
   dotlockClose,             /* xClose method */
   dotlockLock,              /* xLock method */
   dotlockUnlock,            /* xUnlock method */
@@ -3211,6 +3953,7 @@ IOMETHODS(
 IOMETHODS(
   flockIoFinder,            /* Finder function name */
   flockIoMethods,           /* sqlite3_io_methods object name */
+  1,                        /* iVersion */
   flockClose,               /* xClose method */
   flockLock,                /* xLock method */
   flockUnlock,              /* xUnlock method */
@@ -3222,6 +3965,7 @@ IOMETHODS(
 IOMETHODS(
   semIoFinder,              /* Finder function name */
   semIoMethods,             /* sqlite3_io_methods object name */
+  1,                        /* iVersion */
   semClose,                 /* xClose method */
   semLock,                  /* xLock method */
   semUnlock,                /* xUnlock method */
@@ -3233,6 +3977,7 @@ IOMETHODS(
 IOMETHODS(
   afpIoFinder,              /* Finder function name */
   afpIoMethods,             /* sqlite3_io_methods object name */
+  1,                        /* iVersion */
   afpClose,                 /* xClose method */
   afpLock,                  /* xLock method */
   afpUnlock,                /* xUnlock method */
@@ -3257,6 +4002,7 @@ static int proxyCheckReservedLock(sqlite3_file*, int*);
 IOMETHODS(
   proxyIoFinder,            /* Finder function name */
   proxyIoMethods,           /* sqlite3_io_methods object name */
+  1,                        /* iVersion */
   proxyClose,               /* xClose method */
   proxyLock,                /* xLock method */
   proxyUnlock,              /* xUnlock method */
@@ -3412,6 +4158,7 @@ static int fillInUnixFile(
   OSTRACE3("OPEN    %-3d %s\n", h, zFilename);    
   pNew->h = h;
   pNew->dirfd = dirfd;
+  pNew->zPath = zFilename;
   SET_THREADID(pNew);
 
 #if OS_VXWORKS
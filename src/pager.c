@@ -22,6 +22,7 @@
 */
 #ifndef SQLITE_OMIT_DISKIO
 #include "sqliteInt.h"
+#include "wal.h"
 
 /*
 ** Macros for troubleshooting.  Normally turned off
@@ -100,13 +101,16 @@ int sqlite3PagerTrace=1;  /* True to enable tracing */
 #define PAGER_SYNCED      5
 
 /*
-** A macro used for invoking the codec if there is one
+** A macro used for invoking the codec if there is one. When decoding
+** in place with CODEC1, the codec returns NULL if the page fails its
+** integrity check, in which case statement E is run.
 */
 #ifdef SQLITE_HAS_CODEC
-# define CODEC1(P,D,N,X) if( P->xCodec!=0 ){ P->xCodec(P->pCodecArg,D,N,X); }
+# define CODEC1(P,D,N,X,E) \
+    if( P->xCodec!=0 && P->xCodec(P->pCodecArg,D,N,X)==0 ){ E; }
 # define CODEC2(P,D,N,X) ((char*)(P->xCodec!=0?P->xCodec(P->pCodecArg,D,N,X):D))
 #else
-# define CODEC1(P,D,N,X) /* NO-OP */
+# define CODEC1(P,D,N,X,E) /* NO-OP */
 # define CODEC2(P,D,N,X) ((char*)D)
 #endif
 
@@ -131,6 +135,7 @@ int sqlite3PagerTrace=1;  /* True to enable tracing */
 ** journal before the journal-header. This is required during savepoint
 ** rollback (see pagerPlaybackSavepoint()).
 */
+typedef struct PagerStore PagerStore;
 typedef struct PagerSavepoint PagerSavepoint;
 struct PagerSavepoint {
   i64 iOffset;                 /* Starting offset in main journal */
@@ -138,6 +143,9 @@ struct PagerSavepoint {
   Bitvec *pInSavepoint;        /* Set of pages in this savepoint */
   Pgno nOrig;                  /* Original number of pages in file */
   Pgno iSubRec;                /* Index of first record in sub-journal */
+#ifndef SQLITE_OMIT_WAL
+  u32 aWalData[WAL_SAVEPOINT_NDATA];        /* WAL savepoint context */
+#endif
 };
 
 /*
@@ -288,8 +296,10 @@ struct Pager {
   char *zJournal;             /* Name of the journal file */
   int (*xBusyHandler)(void*); /* Function to call when busy */
   void *pBusyHandlerArg;      /* Context argument for xBusyHandler */
-#ifdef SQLITE_TEST
   int nHit, nMiss;            /* Cache hits and missing */
+  int nLookupHit;             /* Pages found by sqlite3PagerLookup() */
+  int nSpill;                 /* Dirty pages written out by pagerStress() */
+#ifdef SQLITE_TEST
   int nRead, nWrite;          /* Database pages read/written */
 #endif
   void (*xReiniter)(DbPage*); /* Call this routine when reloading pages */
@@ -301,6 +311,22 @@ struct Pager {
   i64 journalSizeLimit;       /* Size limit for persistent journal files */
   PCache *pPCache;            /* Pointer to page cache object */
   sqlite3_backup *pBackup;    /* Pointer to list of ongoing backup processes */
+#ifndef SQLITE_OMIT_WAL
+  Wal *pWal;                  /* Write-ahead log used by "journal_mode=wal" */
+  char *zWal;                 /* File name for write-ahead log */
+  int nCkptPages;             /* Auto-checkpoint threshold, in WAL frames */
+  int nGroupUsec;             /* Group commit window, in microseconds */
+  int nCommitWait, mxCommitWait;    /* Time the last commit waited to sync */
+  int nCommitBatch, mxCommitBatch;  /* Size of the group it was synced with */
+#endif
+  int nReadahead;             /* Pages to read ahead of a table scan */
+#ifndef SQLITE_OMIT_MMAP
+  u8 bUseFetch;               /* True to read pages with xFetch() */
+  u8 bSharedPages;            /* Opened with SQLITE_OPEN_SHAREDPAGES */
+  i64 szMmap;                 /* Limit set by "PRAGMA mmap_size" */
+  int nMmapOut;               /* Number of PGHDR_MMAP pages in the cache */
+  PagerStore *pStore;         /* Shared read-only page store, or NULL */
+#endif
 };
 
 /*
@@ -312,6 +338,9 @@ struct Pager {
 int sqlite3_pager_readdb_count = 0;    /* Number of full pages read from DB */
 int sqlite3_pager_writedb_count = 0;   /* Number of full pages written to DB */
 int sqlite3_pager_writej_count = 0;    /* Number of pages written to journal */
+int sqlite3_pager_readahead_count = 0; /* Number of pages hinted for reading */
+int sqlite3_pager_writev_count = 0;    /* Number of DB writes of page runs */
+int sqlite3_pager_shared_count = 0;    /* Pages found in a PagerStore */
 # define PAGER_INCR(v)  v++
 #else
 # define PAGER_INCR(v)
@@ -393,6 +422,326 @@ static int assert_pager_state(Pager *pPager){
 }
 #endif
 
+/*
+** Return true if this pager uses a write-ahead log instead of the usual
+** rollback journal. Otherwise false.
+*/
+#ifndef SQLITE_OMIT_WAL
+static int pagerUseWal(Pager *pPager){
+  return (pPager->pWal!=0);
+}
+#else
+# define pagerUseWal(x) 0
+# define pagerRollbackWal(x) 0
+# define pagerWalFrames(v,w,x,y,z) 0
+# define pagerOpenWalIfPresent(z) SQLITE_OK
+# define pagerBeginReadTransaction(z) SQLITE_OK
+#endif
+
+/*
+** The USEFETCH macro is true if pages of the database file may be read
+** through the xFetch() method of the VFS, so that PgHdr.pData points
+** into a read-only mapping of the file instead of at a copy. Encrypted
+** pages have to be decoded into a private buffer, so a database with a
+** codec attached is always read with xRead().
+*/
+#if defined(SQLITE_OMIT_MMAP)
+# define USEFETCH(x) 0
+/* BEGIN CRYPTO */
+#elif defined(SQLITE_HAS_CODEC)
+# define USEFETCH(x) ((x)->bUseFetch && (x)->xCodec==0)
+/* END CRYPTO */
+#else
+# define USEFETCH(x) ((x)->bUseFetch)
+#endif
+
+#ifndef SQLITE_OMIT_MMAP
+/*
+** Page pPg has the PGHDR_MMAP flag set, so its pData points into memory
+** mapped from the database file. Return that memory to the VFS and point
+** pData at the buffer allocated for the page by the page cache again.
+** If bCopy is true, the content of the page is copied into the buffer
+** first.
+*/
+static void pagerReleaseMapPage(PgHdr *pPg, int bCopy){
+  Pager *pPager = pPg->pPager;
+  void *pMap = pPg->pData;
+
+  assert( pPg->flags&PGHDR_MMAP );
+  assert( pPager->nMmapOut>0 );
+  pPg->pData = sqlite3PcachePageBuffer(pPg);
+  if( bCopy ){
+    memcpy(pPg->pData, pMap, pPager->pageSize);
+  }
+  pPg->flags &= ~PGHDR_MMAP;
+  pPager->nMmapOut--;
+  if( pPager->pStore==0 ){
+    sqlite3OsUnfetch(pPager->fd, (pPg->pgno-1)*(i64)pPager->pageSize, pMap);
+  }
+}
+
+/*
+** This is called before page pPg, which is held in memory mapped from
+** the database file, is modified. The mapping is read-only, so the page
+** is copied into its own buffer. The content does not change, but its
+** address does, so the b-tree layer is told to reload the page.
+*/
+static void pagerUnmapPage(PgHdr *pPg){
+  Pager *pPager = pPg->pPager;
+  pagerReleaseMapPage(pPg, 1);
+  if( pPager->xReiniter ){
+    /* With a second reference held, the b-tree layer initializes the
+    ** page again at once rather than discarding its state. */
+    sqlite3PcacheRef(pPg);
+    pPager->xReiniter(pPg);
+    sqlite3PcacheRelease(pPg);
+  }
+}
+
+/*
+** Return true if page pgno of pager pPager, which is not yet in the
+** cache, may be read by pointing it at memory mapped from the database
+** file.
+**
+** Pages are only mapped by read transactions. A mapped page that is
+** still referenced when a write transaction modifies it is copied first
+** (see pagerUnmapPage()), and every mapped page is dropped from the cache
+** along with its last reference. Page 1 is never mapped, as the b-tree
+** layer holds it for as long as any transaction is open.
+**
+** Pages taken from a PagerStore are handled in exactly the same way,
+** except that the memory belongs to the store instead of the VFS.
+*/
+static int pagerUseMmap(Pager *pPager, Pgno pgno){
+  return (USEFETCH(pPager) || pPager->pStore)
+      && pgno>1
+      && pPager->state<PAGER_RESERVED
+      && !pPager->tempFile
+      && !pagerUseWal(pPager);
+}
+
+/*
+** A PagerStore holds immutable images of the pages of one version of a
+** database file. It is shared by all pagers in the process that opened
+** the file read-only with SQLITE_OPEN_SHAREDPAGES. The first pager to
+** read a page publishes its image in aPage[]. After that, every pager
+** attached to the store points PgHdr.pData at the published image, as
+** it would at a page mapped from the file, instead of reading the file.
+**
+** Each slot of aPage[] changes only once, from NULL to the image, and
+** the image is never modified, so pagers look pages up without taking
+** a mutex. A version of the file is identified by the 16 bytes at
+** offset 24 of the database header (see Pager.dbFileVers). When the file
+** changes, each pager attaches to a store for the new version as it
+** starts its next read transaction. A store, and every image published
+** in it, is freed when the last pager attached to it moves on or closes,
+** so an image is never freed while a pager might still be using it.
+**
+** The list of stores and the nRef field of each are protected by the
+** STATIC_MASTER mutex.
+*/
+struct PagerStore {
+  char *zFilename;            /* Full path of the database file */
+  sqlite3_vfs *pVfs;          /* VFS the file was opened with */
+  int szPage;                 /* Page size */
+  char aVers[16];             /* Pager.dbFileVers of this version */
+  Pgno nPage;                 /* Pages in this version of the file */
+  int nRef;                   /* Number of pagers attached */
+  void *volatile *aPage;      /* aPage[pgno-1] is the image of page pgno */
+  PagerStore *pNext;          /* Next store in pagerStoreList */
+};
+static PagerStore *SQLITE_WSD pagerStoreList = 0;
+
+/*
+** Store pNew in the empty slot *pp, unless another thread has filled the
+** slot first. Return the content of the slot afterwards.
+**
+** Readers load slots without a memory barrier. The image is written
+** before it is published, and a reader only reaches it through the
+** pointer it loaded, so this is safe on all hardware except the DEC
+** Alpha, which does not order dependent loads.
+*/
+static void *pagerStorePublish(void *volatile *pp, void *pNew){
+#if SQLITE_THREADSAFE && defined(__GNUC__) \
+    && (__GNUC__>4 || (__GNUC__==4 && __GNUC_MINOR__>=1))
+  void *pOld = __sync_val_compare_and_swap(pp, (void *)0, pNew);
+  return pOld ? pOld : pNew;
+#else
+  sqlite3_mutex *pMaster = sqlite3MutexAlloc(SQLITE_MUTEX_STATIC_MASTER);
+  void *p;
+  sqlite3_mutex_enter(pMaster);
+  p = *pp;
+  if( p==0 ){
+    *pp = p = pNew;
+  }
+  sqlite3_mutex_leave(pMaster);
+  return p;
+#endif
+}
+
+/*
+** Detach pager pPager from its PagerStore, if any, freeing the store if
+** no other pager is attached to it.
+*/
+static void pagerStoreDetach(Pager *pPager){
+  PagerStore *p = pPager->pStore;
+  if( p ){
+    sqlite3_mutex *pMaster = sqlite3MutexAlloc(SQLITE_MUTEX_STATIC_MASTER);
+    int bFree;
+
+    assert( pPager->nMmapOut==0 );
+    sqlite3_mutex_enter(pMaster);
+    bFree = (--p->nRef)==0;
+    if( bFree ){
+      PagerStore **pp;
+      for(pp=&GLOBAL(PagerStore*,pagerStoreList); *pp!=p; pp=&(*pp)->pNext);
+      *pp = p->pNext;
+    }
+    sqlite3_mutex_leave(pMaster);
+    if( bFree ){
+      Pgno i;
+      for(i=0; i<p->nPage; i++){
+        sqlite3_free(p->aPage[i]);
+      }
+      sqlite3_free((void *)p->aPage);
+      sqlite3_free(p);
+    }
+    pPager->pStore = 0;
+  }
+}
+
+/*
+** This is called when a read transaction is opened by a pager that was
+** opened with SQLITE_OPEN_SHAREDPAGES. Attach the pager to the store for
+** the current version of the database file, creating the store if it
+** does not exist yet.
+**
+** If the database is encrypted, in WAL mode or empty, or if a store
+** cannot be allocated, the pager is left detached and reads pages from
+** the file as usual. SQLITE_OK is returned unless the database header
+** cannot be read.
+*/
+static int pagerStoreAttach(Pager *pPager){
+  sqlite3_mutex *pMaster;
+  PagerStore *p;
+  char aVers[16];
+  int nPage = 0;
+  int rc;
+
+  assert( pPager->readOnly && pPager->state>=PAGER_SHARED );
+  assert( pPager->nMmapOut==0 );
+  rc = sqlite3PagerPagecount(pPager, &nPage);
+  if( rc!=SQLITE_OK ) return rc;
+  if( nPage<=1 || pagerUseWal(pPager)
+/* BEGIN CRYPTO */
+#ifdef SQLITE_HAS_CODEC
+   || pPager->xCodec
+#endif
+/* END CRYPTO */
+  ){
+    pagerStoreDetach(pPager);
+    return SQLITE_OK;
+  }
+  rc = sqlite3OsRead(pPager->fd, aVers, sizeof(aVers), 24);
+  if( rc!=SQLITE_OK ) return rc;
+
+  p = pPager->pStore;
+  if( p && p->szPage==pPager->pageSize
+   && memcmp(p->aVers, aVers, sizeof(aVers))==0
+  ){
+    return SQLITE_OK;
+  }
+  pagerStoreDetach(pPager);
+
+  pMaster = sqlite3MutexAlloc(SQLITE_MUTEX_STATIC_MASTER);
+  sqlite3_mutex_enter(pMaster);
+  for(p=GLOBAL(PagerStore*,pagerStoreList); p; p=p->pNext){
+    if( p->pVfs==pPager->pVfs
+     && p->szPage==pPager->pageSize
+     && p->nPage==(Pgno)nPage
+     && memcmp(p->aVers, aVers, sizeof(aVers))==0
+     && strcmp(p->zFilename, pPager->zFilename)==0
+    ){
+      break;
+    }
+  }
+  if( p==0 ){
+    int nName = sqlite3Strlen30(pPager->zFilename);
+    sqlite3BeginBenignMalloc();
+    p = (PagerStore *)sqlite3MallocZero(sizeof(PagerStore) + nName + 1);
+    if( p ){
+      p->aPage = (void *volatile *)sqlite3MallocZero(nPage*sizeof(void *));
+      if( p->aPage==0 ){
+        sqlite3_free(p);
+        p = 0;
+      }
+    }
+    sqlite3EndBenignMalloc();
+    if( p ){
+      p->zFilename = (char *)&p[1];
+      memcpy(p->zFilename, pPager->zFilename, nName+1);
+      p->pVfs = pPager->pVfs;
+      p->szPage = pPager->pageSize;
+      memcpy(p->aVers, aVers, sizeof(aVers));
+      p->nPage = (Pgno)nPage;
+      p->pNext = GLOBAL(PagerStore*,pagerStoreList);
+      GLOBAL(PagerStore*,pagerStoreList) = p;
+    }
+  }
+  if( p ){
+    p->nRef++;
+    pPager->pStore = p;
+  }
+  sqlite3_mutex_leave(pMaster);
+  return SQLITE_OK;
+}
+
+/*
+** Set *ppData to the image of page pgno in the store attached to pPager.
+** If no pager has read the page yet, read it from the database file and
+** publish it first. *ppData is set to NULL if the page cannot be added
+** to the store, in which case the caller reads it into its own buffer.
+*/
+static int pagerStoreFetch(Pager *pPager, Pgno pgno, void **ppData){
+  PagerStore *p = pPager->pStore;
+  void *pData;
+  int rc;
+
+  assert( p && p->szPage==pPager->pageSize );
+  *ppData = 0;
+  if( pgno>p->nPage ){
+    return SQLITE_OK;
+  }
+  pData = p->aPage[pgno-1];
+  if( pData ){
+    PAGER_INCR(sqlite3_pager_shared_count);
+    *ppData = pData;
+    return SQLITE_OK;
+  }
+
+  sqlite3BeginBenignMalloc();
+  pData = sqlite3Malloc(p->szPage);
+  sqlite3EndBenignMalloc();
+  if( pData==0 ){
+    return SQLITE_OK;
+  }
+  rc = sqlite3OsRead(pPager->fd, pData, p->szPage, (pgno-1)*(i64)p->szPage);
+  if( rc==SQLITE_OK ){
+    *ppData = pagerStorePublish(&p->aPage[pgno-1], pData);
+  }else if( rc==SQLITE_IOERR_SHORT_READ ){
+    rc = SQLITE_OK;
+  }
+  if( *ppData!=pData ){
+    sqlite3_free(pData);
+  }
+  return rc;
+}
+#else
+# define pagerReleaseMapPage(x,y)
+# define pagerUnmapPage(x)
+# define pagerUseMmap(x,y) 0
+#endif
+
 /*
 ** Return true if it is necessary to write page *pPg into the sub-journal.
 ** A page needs to be written into the sub-journal if there exists one
@@ -1113,7 +1462,29 @@ static void pager_unlock(Pager *pPager){
     */
     pPager->dbSizeValid = 0;
 
-    rc = osUnlock(pPager->fd, NO_LOCK);
+    if( pagerUseWal(pPager) ){
+      /* In WAL mode the SHARED lock on the database file is held for as
+      ** long as the WAL is open; it is what tells sqlite3WalClose() in
+      ** other connections that the WAL is still in use. Only the WAL
+      ** locks are released here. This is also when a WAL that has grown
+      ** past the auto-checkpoint threshold is copied back into the
+      ** database file, as no snapshot is held any longer. A failed
+      ** checkpoint is harmless, the next one picks up where it stopped.
+      */
+      rc = SQLITE_OK;
+      sqlite3WalEndWriteTransaction(pPager->pWal);
+      sqlite3WalEndReadTransaction(pPager->pWal);
+      if( pPager->errCode==SQLITE_OK && pPager->nCkptPages>0
+       && sqlite3WalCallback(pPager->pWal)>=pPager->nCkptPages
+      ){
+        (void)sqlite3WalCheckpoint(pPager->pWal,
+            (pPager->noSync ? 0 : pPager->sync_flags),
+            pPager->pageSize, (u8 *)pPager->pTmpSpace
+        );
+      }
+    }else{
+      rc = osUnlock(pPager->fd, NO_LOCK);
+    }
     if( rc ){
       pPager->errCode = rc;
     }
@@ -1316,9 +1687,17 @@ static int pager_end_transaction(Pager *pPager, int hasMaster){
     sqlite3BitvecDestroy(pPager->pInJournal);
     pPager->pInJournal = 0;
     pPager->nRec = 0;
+  }else if( pagerUseWal(pPager) ){
+    /* The transaction was committed (or its frames discarded) by the
+    ** caller. Drop the WAL write lock but keep the read snapshot. */
+    rc = sqlite3WalEndWriteTransaction(pPager->pWal);
+    sqlite3PcacheCleanAll(pPager->pPCache);
   }
 
-  if( !pPager->exclusiveMode ){
+  if( pagerUseWal(pPager) ){
+    pPager->state = PAGER_SHARED;
+    pPager->changeCountDone = 0;
+  }else if( !pPager->exclusiveMode ){
     rc2 = osUnlock(pPager->fd, SHARED_LOCK);
     pPager->state = PAGER_SHARED;
     pPager->changeCountDone = 0;
@@ -1497,8 +1876,17 @@ static int pager_playback_one_page(
   ** 2008-04-14:  When attempting to vacuum a corrupt database file, it
   ** is possible to fail a statement on a database that does not yet exist.
   ** Do not attempt to write if database file has never been opened.
+  **
+  ** In WAL mode the database file is never written here. Every page
+  ** restored from the sub-journal is loaded into the cache and marked
+  ** dirty, even if a copy is already cached, because the log frames that
+  ** may have held its newer content were discarded by the caller.
   */
-  pPg = pager_lookup(pPager, pgno);
+  if( pagerUseWal(pPager) ){
+    pPg = 0;
+  }else{
+    pPg = pager_lookup(pPager, pgno);
+  }
   assert( pPg || !MEMDB );
   PAGERTRACE(("PLAYBACK %d page %d hash(%08x) %s\n",
                PAGERID(pPager), pgno, pager_datahash(pPager->pageSize, aData),
@@ -1508,12 +1896,28 @@ static int pager_playback_one_page(
    && (pPg==0 || 0==(pPg->flags&PGHDR_NEED_SYNC))
    && isOpen(pPager->fd)
    && !isUnsync
+   && !pagerUseWal(pPager)
   ){
     i64 ofst = (pgno-1)*(i64)pPager->pageSize;
     rc = sqlite3OsWrite(pPager->fd, aData, pPager->pageSize, ofst);
     if( pgno>pPager->dbFileSize ){
       pPager->dbFileSize = pgno;
     }
+    /* BEGIN CRYPTO */
+#ifdef SQLITE_HAS_CODEC
+    /* The journal holds encoded pages. Decode this one for the backup
+    ** objects, then encode it again for the code below. */
+    if( pPager->pBackup && pPager->xCodec ){
+      if( rc==SQLITE_OK ){
+        CODEC1(pPager, aData, pgno, 3, rc = SQLITE_CORRUPT_BKPT);
+      }
+      if( rc==SQLITE_OK ){
+        sqlite3BackupUpdate(pPager->pBackup, pgno, aData);
+        memcpy(aData, CODEC2(pPager, aData, pgno, 7), pPager->pageSize);
+      }
+    }else
+#endif
+    /* END CRYPTO */
     sqlite3BackupUpdate(pPager->pBackup, pgno, aData);
   }else if( !isMainJrnl && pPg==0 ){
     /* If this is a rollback of a savepoint and data was not written to
@@ -1547,6 +1951,9 @@ static int pager_playback_one_page(
     ** sqlite3PagerRollback().
     */
     void *pData;
+    if( pPg->flags&PGHDR_MMAP ){
+      pagerUnmapPage(pPg);
+    }
     pData = pPg->pData;
     memcpy(pData, aData, pPager->pageSize);
     if( pPager->xReiniter ){
@@ -1583,7 +1990,7 @@ static int pager_playback_one_page(
     }
 
     /* Decode the page just read from disk */
-    CODEC1(pPager, pData, pPg->pgno, 3);
+    CODEC1(pPager, pData, pPg->pgno, 3, rc = SQLITE_CORRUPT_BKPT);
     sqlite3PcacheRelease(pPg);
   }
   return rc;
@@ -2084,6 +2491,108 @@ end_playback:
   return rc;
 }
 
+#ifndef SQLITE_OMIT_WAL
+static int readDbPage(PgHdr *pPg);
+
+/*
+** This function is invoked once for each page that has already been 
+** written into the log file when a WAL transaction is rolled back.
+** Parameter iPg is the page number of said page. The pCtx argument 
+** is actually a pointer to the Pager structure.
+**
+** If page iPg is present in the cache, and has no outstanding references,
+** it is discarded. Otherwise, if there are one or more outstanding
+** references, the page content is reloaded from the database. If the
+** attempt to reload content from the database is required and fails, 
+** return an SQLite error code. Otherwise, SQLITE_OK.
+*/
+static int pagerUndoCallback(void *pCtx, Pgno iPg){
+  int rc = SQLITE_OK;
+  Pager *pPager = (Pager *)pCtx;
+  PgHdr *pPg;
+
+  pPg = sqlite3PagerLookup(pPager, iPg);
+  if( pPg ){
+    if( sqlite3PcachePageRefcount(pPg)==1 ){
+      sqlite3PcacheDrop(pPg);
+    }else{
+      rc = readDbPage(pPg);
+      if( rc==SQLITE_OK && pPager->xReiniter ){
+        pPager->xReiniter(pPg);
+      }
+      sqlite3PagerUnref(pPg);
+    }
+  }
+
+  /* Normally, if a transaction is rolled back, any backup processes are
+  ** updated as data is copied out of the rollback journal and into the
+  ** database. This is not generally possible with a WAL database, as
+  ** rollback involves simply truncating the log file. Therefore, if one
+  ** or more frames have already been written to the log (and therefore 
+  ** also copied into the backup databases) as part of this transaction,
+  ** the backups must be restarted.
+  */
+  sqlite3BackupRestart(pPager->pBackup);
+
+  return rc;
+}
+
+/*
+** This function is called to rollback a transaction on a WAL database.
+*/
+static int pagerRollbackWal(Pager *pPager){
+  int rc;                         /* Return Code */
+  PgHdr *pList;                   /* List of dirty pages to revert */
+
+  /* For all pages in the cache that are currently dirty or have already
+  ** been written (but not committed) to the log file, do one of the 
+  ** following:
+  **
+  **   + Discard the cached page (if refcount==0), or
+  **   + Reload page content from the database (if refcount>0).
+  */
+  pPager->dbSize = pPager->dbOrigSize;
+  rc = sqlite3WalUndo(pPager->pWal, pagerUndoCallback, (void *)pPager);
+  pList = sqlite3PcacheDirtyList(pPager->pPCache);
+  while( pList && rc==SQLITE_OK ){
+    PgHdr *pNext = pList->pDirty;
+    rc = pagerUndoCallback((void *)pPager, pList->pgno);
+    pList = pNext;
+  }
+
+  return rc;
+}
+
+/*
+** This function is a wrapper around sqlite3WalFrames(). As well as logging
+** the contents of the list of pages headed by pList (connected by pDirty),
+** this function notifies any active backup processes that the pages have
+** changed. The backups are handed the page content, not the encoded copy
+** written to the log.
+*/ 
+static int pagerWalFrames(
+  Pager *pPager,                  /* Pager object */
+  PgHdr *pList,                   /* List of frames to log */
+  Pgno nTruncate,                 /* Database size after this commit */
+  int isCommit,                   /* True if this is a commit */
+  int sync_flags                  /* Flags to pass to OsSync() (or 0) */
+){
+  int rc;                         /* Return code */
+
+  assert( pPager->pWal );
+  rc = sqlite3WalFrames(pPager->pWal, 
+      pPager->pageSize, pList, nTruncate, isCommit, sync_flags
+  );
+  if( rc==SQLITE_OK && pPager->pBackup ){
+    PgHdr *p;
+    for(p=pList; p; p=p->pDirty){
+      sqlite3BackupUpdate(pPager->pBackup, p->pgno, (u8 *)p->pData);
+    }
+  }
+  return rc;
+}
+#endif
+
 /*
 ** Playback savepoint pSavepoint. Or, if pSavepoint==NULL, then playback
 ** the entire master journal file. The case pSavepoint==NULL occurs when 
@@ -2141,6 +2650,13 @@ static int pagerPlaybackSavepoint(Pager *pPager, PagerSavepoint *pSavepoint){
   */
   pPager->dbSize = pSavepoint ? pSavepoint->nOrig : pPager->dbOrigSize;
 
+  /* In WAL mode there is no main journal. The whole transaction is rolled
+  ** back by discarding the frames it wrote to the log. */
+  if( !pSavepoint && pagerUseWal(pPager) ){
+    sqlite3BitvecDestroy(pDone);
+    return pagerRollbackWal(pPager);
+  }
+
   /* Use pPager->journalOff as the effective size of the main rollback
   ** journal.  The actual file might be larger than this in
   ** PAGER_JOURNALMODE_TRUNCATE or PAGER_JOURNALMODE_PERSIST.  But anything
@@ -2155,7 +2671,7 @@ static int pagerPlaybackSavepoint(Pager *pPager, PagerSavepoint *pSavepoint){
   ** will be skipped automatically.  Pages are added to pDone as they
   ** are played back.
   */
-  if( pSavepoint ){
+  if( pSavepoint && !pagerUseWal(pPager) ){
     iHdrOff = pSavepoint->iHdrOffset ? pSavepoint->iHdrOffset : szJ;
     pPager->journalOff = pSavepoint->iOffset;
     while( rc==SQLITE_OK && pPager->journalOff<iHdrOff ){
@@ -2207,6 +2723,11 @@ static int pagerPlaybackSavepoint(Pager *pPager, PagerSavepoint *pSavepoint){
   if( pSavepoint ){
     u32 ii;            /* Loop counter */
     i64 offset = pSavepoint->iSubRec*(4+pPager->pageSize);
+#ifndef SQLITE_OMIT_WAL
+    if( pagerUseWal(pPager) ){
+      rc = sqlite3WalSavepointUndo(pPager->pWal, pSavepoint->aWalData);
+    }
+#endif
     for(ii=pSavepoint->iSubRec; rc==SQLITE_OK && ii<pPager->nSubRec; ii++){
       assert( offset==ii*(4+pPager->pageSize) );
       rc = pager_playback_one_page(pPager, 0, 0, &offset, 1, pDone);
@@ -2228,6 +2749,24 @@ void sqlite3PagerSetCachesize(Pager *pPager, int mxPage){
   sqlite3PcacheSetCachesize(pPager->pPCache, mxPage);
 }
 
+#ifndef SQLITE_OMIT_MMAP
+/*
+** Pass the current value of Pager.szMmap to the VFS as the limit on the
+** size of the mapping of the database file. Mapped reads are only used
+** if the VFS supports them (version 3 or later) and the limit is not
+** zero.
+*/
+static void pagerFixMaplimit(Pager *pPager){
+  sqlite3_file *fd = pPager->fd;
+  pPager->bUseFetch = 0;
+  if( isOpen(fd) && fd->pMethods->iVersion>=3 && fd->pMethods->xFetch ){
+    sqlite3_int64 sz = pPager->szMmap;
+    pPager->bUseFetch = (sz>0);
+    sqlite3OsFileControl(fd, SQLITE_FCNTL_MMAP_SIZE, &sz);
+  }
+}
+#endif
+
 /*
 ** Adjust the robustness of the database to damage due to OS crashes
 ** or power failures by changing the number of syncs()s when writing
@@ -2386,6 +2925,17 @@ int sqlite3PagerSetPagesize(Pager *pPager, u16 *pPageSize){
      && sqlite3PcacheRefCount(pPager->pPCache)==0 
     ){
       char *pNew = (char *)sqlite3PageMalloc(pageSize);
+      /* BEGIN CRYPTO */
+#ifdef SQLITE_HAS_CODEC
+      if( pNew && pPager->xCodec ){
+        extern int sqlite3CodecPageSize(void*, int);
+        if( sqlite3CodecPageSize(pPager->pCodecArg, pageSize)!=SQLITE_OK ){
+          sqlite3PageFree(pNew);
+          pNew = 0;
+        }
+      }
+#endif
+      /* END CRYPTO */
       if( !pNew ){
         rc = SQLITE_NOMEM;
       }else{
@@ -2510,15 +3060,20 @@ int sqlite3PagerPagecount(Pager *pPager, int *pnPage){
     int rc;                 /* Error returned by OsFileSize() */
     i64 n = 0;              /* File size in bytes returned by OsFileSize() */
 
-    assert( isOpen(pPager->fd) || pPager->tempFile );
-    if( isOpen(pPager->fd) && (0 != (rc = sqlite3OsFileSize(pPager->fd, &n))) ){
-      pager_error(pPager, rc);
-      return rc;
-    }
-    if( n>0 && n<pPager->pageSize ){
-      nPage = 1;
-    }else{
-      nPage = (Pgno)(n / pPager->pageSize);
+    /* In WAL mode the size of the database is recorded by the last commit
+    ** in the log. It is only taken from the file when the log is empty. */
+    nPage = pagerUseWal(pPager) ? sqlite3WalDbsize(pPager->pWal) : 0;
+    if( nPage==0 ){
+      assert( isOpen(pPager->fd) || pPager->tempFile );
+      if( isOpen(pPager->fd) && (0 != (rc = sqlite3OsFileSize(pPager->fd, &n))) ){
+        pager_error(pPager, rc);
+        return rc;
+      }
+      if( n>0 && n<pPager->pageSize ){
+        nPage = 1;
+      }else{
+        nPage = (Pgno)(n / pPager->pageSize);
+      }
     }
     if( pPager->state!=PAGER_UNLOCK ){
       pPager->dbSize = nPage;
@@ -2637,6 +3192,18 @@ int sqlite3PagerClose(Pager *pPager){
     pPager->journalHdr = -1;
     pagerUnlockAndRollback(pPager);
   }
+#ifndef SQLITE_OMIT_MMAP
+  pagerStoreDetach(pPager);
+#endif
+#ifndef SQLITE_OMIT_WAL
+  /* If this is the last connection to the WAL, it is checkpointed and
+  ** deleted while the database file is still open. */
+  sqlite3WalClose(pPager->pWal,
+    (pPager->noSync ? 0 : pPager->sync_flags), 
+    pPager->pageSize, (u8 *)pPager->pTmpSpace
+  );
+  pPager->pWal = 0;
+#endif
   sqlite3EndBenignMalloc();
   enable_simulated_io_errors();
   PAGERTRACE(("CLOSE %d\n", PAGERID(pPager)));
@@ -2821,8 +3388,10 @@ static int syncJournal(Pager *pPager){
 ** written out.
 **
 ** Once the lock has been upgraded and, if necessary, the file opened,
-** the pages are written out to the database file in list order. Writing
-** a page is skipped if it meets either of the following criteria:
+** the pages are written out to the database file in list order. Runs of
+** pages with adjacent page numbers are written with a single call to
+** sqlite3OsWritev(). Writing a page is skipped if it meets either of the
+** following criteria:
 **
 **   * The page number is greater than Pager.dbSize, or
 **   * The PGHDR_DONT_WRITE flag is set on the page.
@@ -2836,12 +3405,92 @@ static int syncJournal(Pager *pPager){
 ** occurs, an IO error code is returned. Or, if the EXCLUSIVE lock cannot
 ** be obtained, SQLITE_BUSY is returned.
 */
+/*
+** The maximum number of adjacent pages that pager_write_pagelist() writes
+** to the database file with a single call to sqlite3OsWritev().
+*/
+#ifndef PAGER_WRITEV_MAX
+# define PAGER_WRITEV_MAX 64
+#endif
+
+/*
+** Write the nRun page images in apRun[] to the database file, starting
+** with page pgno. Each anRun[] entry holds the page size.
+*/
+static int pagerWriteRun(
+  Pager *pPager,                  /* Pager to write to */
+  Pgno pgno,                      /* Page number of apRun[0] */
+  int nRun,                       /* Number of pages */
+  const void **apRun,             /* Page images to write */
+  const int *anRun                /* Size of each page image */
+){
+  i64 offset = (pgno-1)*(i64)pPager->pageSize;
+  assert( nRun>0 && nRun<=PAGER_WRITEV_MAX );
+  if( nRun==1 ){
+    return sqlite3OsWrite(pPager->fd, apRun[0], anRun[0], offset);
+  }
+  PAGER_INCR(sqlite3_pager_writev_count);
+  return sqlite3OsWritev(pPager->fd, nRun, apRun, anRun, offset);
+}
+
+/* BEGIN CRYPTO */
+#ifdef SQLITE_HAS_CODEC
+/*
+** The maximum number of pages handed to the codec worker pool at once
+** by pager_write_pagelist(). Each batch needs this many page sized
+** output buffers.
+*/
+#ifndef PAGER_CODEC_BATCH
+# define PAGER_CODEC_BATCH 256
+#endif
+
+/*
+** Encrypt up to PAGER_CODEC_BATCH of the pages that pager_write_pagelist()
+** will write, starting at pList, into consecutive page sized slots of
+** aOut using the codec worker pool. The pages are selected with the
+** same criteria that pager_write_pagelist() uses, so the i'th page it
+** writes from pList onwards is found in the i'th slot. *pnPage is set
+** to the number of pages encrypted.
+*/
+static int pagerCodecBatch(PgHdr *pList, char *aOut, int *pnPage){
+  extern int sqlite3CodecBatch(void*, int, void**, Pgno*, void*);
+  Pager *pPager = pList->pPager;
+  void *apData[PAGER_CODEC_BATCH];
+  Pgno aPgno[PAGER_CODEC_BATCH];
+  int n = 0;
+
+  for(; pList && n<PAGER_CODEC_BATCH; pList=pList->pDirty){
+    if( pList->pgno<=pPager->dbSize && 0==(pList->flags&PGHDR_DONT_WRITE) ){
+      apData[n] = pList->pData;
+      aPgno[n] = pList->pgno;
+      n++;
+    }
+  }
+  *pnPage = n;
+  return sqlite3CodecBatch(pPager->pCodecArg, n, apData, aPgno, aOut);
+}
+#endif
+/* END CRYPTO */
+
 static int pager_write_pagelist(PgHdr *pList){
   Pager *pPager;                       /* Pager object */
   int rc;                              /* Return code */
+  const void *apRun[PAGER_WRITEV_MAX]; /* Adjacent pages not yet written */
+  int anRun[PAGER_WRITEV_MAX];         /* Size of each apRun[] entry */
+  int nRun = 0;                        /* Number of pages in apRun[] */
+  Pgno pgnoRun = 0;                    /* Page number of apRun[0] */
+#ifdef SQLITE_HAS_CODEC
+  void *apCopy[PAGER_WRITEV_MAX];      /* Encrypted pages of the run */
+  char *aBatch = 0;                    /* Pages encrypted by the worker pool */
+  int nBatch = 0;                      /* Number of pages in aBatch */
+  int iBatch = 0;                      /* Next page to write from aBatch */
+#endif
 
   if( pList==0 ) return SQLITE_OK;
   pPager = pList->pPager;
+#ifdef SQLITE_HAS_CODEC
+  memset(apCopy, 0, sizeof(apCopy));
+#endif
 
   /* At this point there may be either a RESERVED or EXCLUSIVE lock on the
   ** database file. If there is already an EXCLUSIVE lock, the following
@@ -2883,14 +3532,87 @@ static int pager_write_pagelist(PgHdr *pList){
     ** set (set by sqlite3PagerDontWrite()).
     */
     if( pgno<=pPager->dbSize && 0==(pList->flags&PGHDR_DONT_WRITE) ){
-      i64 offset = (pgno-1)*(i64)pPager->pageSize;         /* Offset to write */
-      char *pData = CODEC2(pPager, pList->pData, pgno, 6); /* Data to write */
+      char *pData;                                         /* Data to write */
+      int bStable = 1;            /* True if pData outlives the next page */
+
+      /* Write out the pages collected so far if this one does not extend
+      ** the run. */
+      if( nRun>0 && (pgno!=pgnoRun+nRun || nRun==PAGER_WRITEV_MAX) ){
+        rc = pagerWriteRun(pPager, pgnoRun, nRun, apRun, anRun);
+        nRun = 0;
+        if( rc!=SQLITE_OK ) break;
+      }
 
-      /* Write out the page data. */
-      rc = sqlite3OsWrite(pPager->fd, pData, pPager->pageSize, offset);
+      /* BEGIN CRYPTO */
+#ifdef SQLITE_HAS_CODEC
+      /* When a codec worker pool is configured, encrypt the pages ahead
+      ** of the writes a batch at a time, in parallel. Pages of the previous
+      ** batch still in apRun[] are written before their buffer is reused. */
+      if( iBatch==nBatch && pPager->xCodec && sqlite3GlobalConfig.nCodecThread>0 ){
+        if( aBatch==0 ){
+          aBatch = sqlite3Malloc(PAGER_CODEC_BATCH*pPager->pageSize);
+          if( aBatch==0 ){
+            rc = SQLITE_NOMEM;
+            break;
+          }
+        }
+        if( nRun>0 ){
+          rc = pagerWriteRun(pPager, pgnoRun, nRun, apRun, anRun);
+          nRun = 0;
+          if( rc!=SQLITE_OK ) break;
+        }
+        rc = pagerCodecBatch(pList, aBatch, &nBatch);
+        iBatch = 0;
+        if( rc!=SQLITE_OK ) break;
+      }
+      if( iBatch<nBatch ){
+        pData = &aBatch[(iBatch++)*pPager->pageSize];
+      }else{
+        pData = CODEC2(pPager, pList->pData, pgno, 6);
+
+        /* The codec encrypts into a buffer of its own, which the next page
+        ** overwrites. Copy its output to apCopy[] so that it can join the
+        ** run. Each slot is one page, allocated the first time a run grows
+        ** that long, so no allocation is larger than a page. If there is 
+        ** no memory for a slot the page is written by itself. */
+        if( pData!=(char*)pList->pData ){
+          if( apCopy[nRun]==0 ){
+            sqlite3BeginBenignMalloc();
+            apCopy[nRun] = sqlite3Malloc(pPager->pageSize);
+            sqlite3EndBenignMalloc();
+          }
+          if( apCopy[nRun] ){
+            memcpy(apCopy[nRun], pData, pPager->pageSize);
+            pData = (char*)apCopy[nRun];
+          }else{
+            bStable = 0;
+          }
+        }
+      }
+#else
+      pData = CODEC2(pPager, pList->pData, pgno, 6);
+#endif
+      /* END CRYPTO */
+
+      /* Write out the page data, or add it to the run. */
+      if( bStable ){
+        if( nRun==0 ) pgnoRun = pgno;
+        apRun[nRun] = pData;
+        anRun[nRun] = pPager->pageSize;
+        nRun++;
+      }else{
+        if( nRun>0 ){
+          rc = pagerWriteRun(pPager, pgnoRun, nRun, apRun, anRun);
+          nRun = 0;
+        }
+        if( rc==SQLITE_OK ){
+          rc = sqlite3OsWrite(pPager->fd, pData, pPager->pageSize,
+                              (pgno-1)*(i64)pPager->pageSize);
+        }
+      }
 
-      /* If page 1 was just written, update Pager.dbFileVers to match
-      ** the value now stored in the database file. If writing this 
+      /* If page 1 is being written, update Pager.dbFileVers to match
+      ** the value now stored in the database file. If writing this
       ** page caused the database file to grow, update dbFileSize. 
       */
       if( pgno==1 ){
@@ -2900,8 +3622,9 @@ static int pager_write_pagelist(PgHdr *pList){
         pPager->dbFileSize = pgno;
       }
 
-      /* Update any backup objects copying the contents of this pager. */
-      sqlite3BackupUpdate(pPager->pBackup, pgno, (u8 *)pData);
+      /* Update any backup objects copying the contents of this pager.
+      ** They are handed the page content, not the encoded copy written. */
+      sqlite3BackupUpdate(pPager->pBackup, pgno, (u8 *)pList->pData);
 
       PAGERTRACE(("STORE %d page %d hash(%08x)\n",
                    PAGERID(pPager), pgno, pager_pagehash(pList)));
@@ -2916,7 +3639,19 @@ static int pager_write_pagelist(PgHdr *pList){
 #endif
     pList = pList->pDirty;
   }
+  if( rc==SQLITE_OK && nRun>0 ){
+    rc = pagerWriteRun(pPager, pgnoRun, nRun, apRun, anRun);
+  }
 
+#ifdef SQLITE_HAS_CODEC
+  {
+    int i;
+    for(i=0; i<PAGER_WRITEV_MAX && apCopy[i]; i++){
+      sqlite3_free(apCopy[i]);
+    }
+  }
+  sqlite3_free(aBatch);
+#endif
   return rc;
 }
 
@@ -2940,14 +3675,18 @@ static int subjournalPage(PgHdr *pPg){
     void *pData = pPg->pData;
     i64 offset = pPager->nSubRec*(4+pPager->pageSize);
     char *pData2 = CODEC2(pPager, pData, pPg->pgno, 7);
+    char aPgno[4];
+    const void *apRec[2];
+    int anRec[2];
   
     PAGERTRACE(("STMT-JOURNAL %d page %d\n", PAGERID(pPager), pPg->pgno));
   
-    assert( pageInJournal(pPg) || pPg->pgno>pPager->dbOrigSize );
-    rc = write32bits(pPager->sjfd, offset, pPg->pgno);
-    if( rc==SQLITE_OK ){
-      rc = sqlite3OsWrite(pPager->sjfd, pData2, pPager->pageSize, offset+4);
-    }
+    assert( pagerUseWal(pPager)
+         || pageInJournal(pPg) || pPg->pgno>pPager->dbOrigSize );
+    put32bits(aPgno, pPg->pgno);
+    apRec[0] = aPgno;   anRec[0] = 4;
+    apRec[1] = pData2;  anRec[1] = pPager->pageSize;
+    rc = sqlite3OsWritev(pPager->sjfd, 2, apRec, anRec, offset);
   }
   if( rc==SQLITE_OK ){
     pPager->nSubRec++;
@@ -3002,6 +3741,21 @@ static int pagerStress(void *p, PgHdr *pPg){
     return SQLITE_OK;
   }
 
+  if( pagerUseWal(pPager) ){
+    /* Write a single, non-commit frame for this page to the log. If a
+    ** savepoint is rolled back later on, the frame is discarded. So the
+    ** current content of the page must be in the sub-journal first.
+    */
+    if( subjRequiresPage(pPg) ){
+      rc = subjournalPage(pPg);
+    }
+    if( rc==SQLITE_OK ){
+      pPg->pDirty = 0;
+      rc = pagerWalFrames(pPager, pPg, 0, 0, 0);
+    }
+    goto stress_out;
+  }
+
   /* Sync the journal file if required. */
   if( pPg->flags&PGHDR_NEED_SYNC ){
     rc = syncJournal(pPager);
@@ -3051,9 +3805,11 @@ static int pagerStress(void *p, PgHdr *pPg){
     rc = pager_write_pagelist(pPg);
   }
 
+ stress_out:
   /* Mark the page as clean. */
   if( rc==SQLITE_OK ){
     PAGERTRACE(("STRESS %d page %d\n", PAGERID(pPager), pPg->pgno));
+    pPager->nSpill++;
     sqlite3PcacheMakeClean(pPg);
   }
 
@@ -3178,6 +3934,7 @@ int sqlite3PagerOpen(
   **     Main journal file handle        (journalFileSize bytes)
   **     Database file name              (nPathname+1 bytes)
   **     Journal file name               (nPathname+8+1 bytes)
+  **     WAL file name                   (nPathname+4+1 bytes)
   */
   pPtr = (u8 *)sqlite3MallocZero(
     ROUND8(sizeof(*pPager)) +      /* Pager structure */
@@ -3186,6 +3943,9 @@ int sqlite3PagerOpen(
     journalFileSize * 2 +          /* The two journal files */ 
     nPathname + 1 +                /* zFilename */
     nPathname + 8 + 1              /* zJournal */
+#ifndef SQLITE_OMIT_WAL
+    + nPathname + 4 + 1            /* zWal */
+#endif
   );
   assert( EIGHT_BYTE_ALIGNMENT(journalFileSize) );
   if( !pPtr ){
@@ -3206,9 +3966,18 @@ int sqlite3PagerOpen(
     memcpy(pPager->zFilename, zPathname, nPathname);
     memcpy(pPager->zJournal, zPathname, nPathname);
     memcpy(&pPager->zJournal[nPathname], "-journal", 8);
+#ifndef SQLITE_OMIT_WAL
+    pPager->zWal = &pPager->zJournal[nPathname+8+1];
+    memcpy(pPager->zWal, zPathname, nPathname);
+    memcpy(&pPager->zWal[nPathname], "-wal", 4);
+#endif
     sqlite3_free(zPathname);
   }
   pPager->pVfs = pVfs;
+#ifndef SQLITE_OMIT_MMAP
+  pPager->bSharedPages = (vfsFlags & SQLITE_OPEN_SHAREDPAGES)!=0;
+#endif
+  vfsFlags &= ~SQLITE_OPEN_SHAREDPAGES;
   pPager->vfsFlags = vfsFlags;
 
   /* Open the pager file.
@@ -3301,6 +4070,9 @@ int sqlite3PagerOpen(
   /* pPager->stmtJSize = 0; */
   /* pPager->nPage = 0; */
   pPager->mxPgno = SQLITE_MAX_PAGE_COUNT;
+#ifndef SQLITE_OMIT_WAL
+  pPager->nCkptPages = SQLITE_DEFAULT_WAL_AUTOCHECKPOINT;
+#endif
   /* pPager->state = PAGER_UNLOCK; */
   assert( pPager->state == (tempFile ? PAGER_EXCLUSIVE : PAGER_UNLOCK) );
   /* pPager->errMask = 0; */
@@ -3312,6 +4084,9 @@ int sqlite3PagerOpen(
   pPager->changeCountDone = pPager->tempFile;
   pPager->memDb = (u8)memDb;
   pPager->readOnly = (u8)readOnly;
+#ifndef SQLITE_OMIT_MMAP
+  if( !readOnly || tempFile ) pPager->bSharedPages = 0;
+#endif
   /* pPager->needSync = 0; */
   pPager->noSync = (pPager->tempFile || !useJournal) ?1:0;
   pPager->fullSync = pPager->noSync ?0:1;
@@ -3321,6 +4096,11 @@ int sqlite3PagerOpen(
   /* pPager->pLast = 0; */
   pPager->nExtra = nExtra;
   pPager->journalSizeLimit = SQLITE_DEFAULT_JOURNAL_SIZE_LIMIT;
+  pPager->nReadahead = SQLITE_DEFAULT_READ_AHEAD;
+#ifndef SQLITE_OMIT_MMAP
+  pPager->szMmap = SQLITE_DEFAULT_MMAP_SIZE;
+  pagerFixMaplimit(pPager);
+#endif
   assert( isOpen(pPager->fd) || tempFile );
   setSectorSize(pPager);
   if( memDb ){
@@ -3432,7 +4212,8 @@ static int hasHotJournal(Pager *pPager, int *pExists){
 static int readDbPage(PgHdr *pPg){
   Pager *pPager = pPg->pPager; /* Pager object associated with page pPg */
   Pgno pgno = pPg->pgno;       /* Page number to read */
-  int rc;                      /* Return code */
+  int rc = SQLITE_OK;          /* Return code */
+  int isInWal = 0;             /* True if page is in log file */
   i64 iOffset;                 /* Byte offset of file to read from */
 
   assert( pPager->state>=PAGER_SHARED && !MEMDB );
@@ -3442,16 +4223,46 @@ static int readDbPage(PgHdr *pPg){
     memset(pPg->pData, 0, pPager->pageSize);
     return SQLITE_OK;
   }
-  iOffset = (pgno-1)*(i64)pPager->pageSize;
-  rc = sqlite3OsRead(pPager->fd, pPg->pData, pPager->pageSize, iOffset);
-  if( rc==SQLITE_IOERR_SHORT_READ ){
-    rc = SQLITE_OK;
+
+  /* Pages committed to the WAL but not yet checkpointed are newer than
+  ** the copy in the database file. Frames hold the same (encoded) bytes
+  ** as the database file would, so they are decoded below either way. */
+  if( pagerUseWal(pPager) ){
+    rc = sqlite3WalRead(pPager->pWal, pgno, &isInWal, pPager->pageSize,
+                        (u8 *)pPg->pData);
+  }
+  if( rc==SQLITE_OK && !isInWal ){
+    void *pMap = 0;
+    iOffset = (pgno-1)*(i64)pPager->pageSize;
+    if( pagerUseMmap(pPager, pgno) && (pPg->flags&PGHDR_MMAP)==0 ){
+#ifndef SQLITE_OMIT_MMAP
+      if( pPager->pStore ){
+        rc = pagerStoreFetch(pPager, pgno, &pMap);
+      }else
+#endif
+      rc = sqlite3OsFetch(pPager->fd, iOffset, pPager->pageSize, &pMap);
+    }
+    if( pMap ){
+      pPg->pData = pMap;
+      pPg->flags |= PGHDR_MMAP;
+#ifndef SQLITE_OMIT_MMAP
+      pPager->nMmapOut++;
+#endif
+    }else if( rc==SQLITE_OK ){
+      rc = sqlite3OsRead(pPager->fd, pPg->pData, pPager->pageSize, iOffset);
+      if( rc==SQLITE_IOERR_SHORT_READ ){
+        rc = SQLITE_OK;
+      }
+    }
   }
   if( pgno==1 ){
     u8 *dbFileVers = &((u8*)pPg->pData)[24];
     memcpy(&pPager->dbFileVers, dbFileVers, sizeof(pPager->dbFileVers));
   }
-  CODEC1(pPager, pPg->pData, pgno, 3);
+  if( rc==SQLITE_OK ){
+    CODEC1(pPager, pPg->pData, pgno, 3,
+           rc = (pgno==1 ? SQLITE_NOTADB : SQLITE_CORRUPT_BKPT));
+  }
 
   PAGER_INCR(sqlite3_pager_readdb_count);
   PAGER_INCR(pPager->nRead);
@@ -3462,6 +4273,89 @@ static int readDbPage(PgHdr *pPg){
   return rc;
 }
 
+#ifndef SQLITE_OMIT_WAL
+/*
+** Begin a read transaction on the WAL.
+**
+** This routine used to be called "pagerOpenSnapshot()" because it 
+** essentially makes a snapshot of the database at the current point
+** in time and assumes that the database will not change again until
+** the read transaction ends. If the snapshot differs from the one the
+** page cache was loaded from, the cache is discarded.
+*/
+static int pagerBeginReadTransaction(Pager *pPager){
+  int rc;                         /* Return code */
+  int changed = 0;                /* True if cache must be reset */
+
+  assert( pagerUseWal(pPager) );
+
+  /* sqlite3WalEndReadTransaction() was not called for the previous
+  ** transaction in locking_mode=EXCLUSIVE.  So call it now.  If we
+  ** are in locking_mode=NORMAL and EndRead() was previously called,
+  ** the duplicate call is harmless.
+  */
+  sqlite3WalEndReadTransaction(pPager->pWal);
+
+  rc = sqlite3WalBeginReadTransaction(pPager->pWal, &changed);
+  pPager->dbSizeValid = 0;
+  if( rc==SQLITE_OK && changed ){
+    pager_reset(pPager);
+  }
+
+  return rc;
+}
+
+/*
+** Check if the *-wal file that corresponds to the database opened by pPager
+** exists if the database is not empy, or verify that the *-wal file does
+** not exist (by deleting it) if the database file is empty.
+**
+** If the database is not empty and the *-wal file exists, open the pager
+** in WAL mode.  If the database is empty or if no *-wal file exists and
+** if no error occurs, make sure Pager.journalMode is not set to
+** PAGER_JOURNALMODE_WAL.
+**
+** Return SQLITE_OK or an error code.
+**
+** The caller must hold a SHARED lock on the database file to call this
+** function. Because an EXCLUSIVE lock on the db file is required to delete 
+** a WAL on a none-empty database, this ensures there is no race condition 
+** between the xAccess() below and an xDelete() being executed by some 
+** other connection.
+*/
+static int pagerOpenWalIfPresent(Pager *pPager){
+  int rc = SQLITE_OK;
+  if( !pPager->tempFile ){
+    int isWal;                    /* True if WAL file exists */
+    int nPage;                    /* Size of the database file */
+
+    assert( pPager->state>=SHARED_LOCK );
+    rc = sqlite3PagerPagecount(pPager, &nPage);
+    if( rc ) return rc;
+    if( nPage==0 ){
+      rc = sqlite3OsDelete(pPager->pVfs, pPager->zWal, 0);
+      isWal = 0;
+    }else{
+      rc = sqlite3OsAccess(
+          pPager->pVfs, pPager->zWal, SQLITE_ACCESS_EXISTS, &isWal
+      );
+    }
+    if( rc==SQLITE_OK ){
+      if( isWal ){
+        pager_reset(pPager);
+        rc = sqlite3PagerOpenWal(pPager, 0);
+        if( rc==SQLITE_OK ){
+          rc = pagerBeginReadTransaction(pPager);
+        }
+      }else if( pPager->journalMode==PAGER_JOURNALMODE_WAL ){
+        pPager->journalMode = PAGER_JOURNALMODE_DELETE;
+      }
+    }
+  }
+  return rc;
+}
+#endif
+
 /*
 ** This function is called whenever the upper layer requests a database
 ** page is requested, before the cache is checked for a suitable page
@@ -3519,7 +4413,23 @@ static int pagerSharedLock(Pager *pPager){
     return pPager->errCode;
   }
 
-  if( pPager->state==PAGER_UNLOCK || isErrorReset ){
+  if( pagerUseWal(pPager) ){
+    /* In WAL mode there is no hot journal and the change-counter is not
+    ** used. Instead, a new snapshot is opened on the WAL each time the
+    ** pager leaves the UNLOCK state. In exclusive mode the pager is never
+    ** unlocked, so the snapshot is refreshed whenever no pages are in use.
+    */
+    if( pPager->state==PAGER_UNLOCK
+     || (pPager->state==PAGER_SHARED
+          && sqlite3PcacheRefCount(pPager->pPCache)==0)
+    ){
+      rc = pager_wait_on_lock(pPager, SHARED_LOCK);
+      if( rc!=SQLITE_OK ){
+        return pager_error(pPager, rc);
+      }
+      rc = pagerBeginReadTransaction(pPager);
+    }
+  }else if( pPager->state==PAGER_UNLOCK || isErrorReset ){
     sqlite3_vfs * const pVfs = pPager->pVfs;
     int isHotJournal = 0;
     assert( !MEMDB );
@@ -3659,6 +4569,15 @@ static int pagerSharedLock(Pager *pPager){
       }
     }
     assert( pPager->exclusiveMode || pPager->state==PAGER_SHARED );
+
+    /* If there is a WAL file in the file-system, open this database in
+    ** WAL mode. */
+    rc = pagerOpenWalIfPresent(pPager);
+#ifndef SQLITE_OMIT_MMAP
+    if( rc==SQLITE_OK && pPager->bSharedPages ){
+      rc = pagerStoreAttach(pPager);
+    }
+#endif
   }
 
  failed:
@@ -3687,6 +4606,9 @@ static void pagerUnlockIfUnused(Pager *pPager){
 */
 static void pagerDropPage(DbPage *pPg){
   Pager *pPager = pPg->pPager;
+  if( pPg->flags&PGHDR_MMAP ){
+    pagerReleaseMapPage(pPg, 0);
+  }
   sqlite3PcacheDrop(pPg);
   pagerUnlockIfUnused(pPager);
 }
@@ -3794,7 +4716,7 @@ int sqlite3PagerAcquire(
     ** be initialized.
     */
     int nMax;
-    PAGER_INCR(pPager->nMiss);
+    pPager->nMiss++;
     pPg->pPager = pPager;
 
     rc = sqlite3PagerPagecount(pPager, &nMax);
@@ -3840,7 +4762,7 @@ int sqlite3PagerAcquire(
 #endif
   }else{
     /* The requested page is in the page cache. */
-    PAGER_INCR(pPager->nHit);
+    pPager->nHit++;
   }
 
   *ppPage = pPg;
@@ -3869,11 +4791,50 @@ DbPage *sqlite3PagerLookup(Pager *pPager, Pgno pgno){
    && (pPager->errCode==SQLITE_OK || pPager->errCode==SQLITE_FULL)
   ){
     sqlite3PcacheFetch(pPager->pPCache, pgno, 0, &pPg);
+    if( pPg ) pPager->nLookupHit++;
   }
 
   return pPg;
 }
 
+/*
+** Tell the VFS that pages pgno to pgno+nPage-1 of the database file are
+** likely to be read soon, so that it can start reading them into the
+** operating system cache in the background. Pages past the end of the
+** database are left out, as are pages at the start of the range that are
+** already in the page cache. This is only a hint. Nothing is read into
+** the page cache, and any error is ignored.
+*/
+void sqlite3PagerReadahead(Pager *pPager, Pgno pgno, int nPage){
+  int nDb = (int)pPager->dbSize;
+  i64 aRange[2];
+
+  if( !isOpen(pPager->fd) || MEMDB || pPager->state==PAGER_UNLOCK
+   || pPager->errCode || !pPager->dbSizeValid || pgno==0 || (int)pgno>nDb
+  ){
+    return;
+  }
+  if( nPage>nDb-(int)pgno+1 ){
+    nPage = nDb-(int)pgno+1;
+  }
+  while( nPage>0 ){
+    PgHdr *pPg = 0;
+    sqlite3PcacheFetch(pPager->pPCache, pgno, 0, &pPg);
+    if( pPg==0 ) break;
+    sqlite3PcacheRelease(pPg);
+    pgno++;
+    nPage--;
+  }
+  if( nPage>0 ){
+    aRange[0] = (pgno-1)*(i64)pPager->pageSize;
+    aRange[1] = nPage*(i64)pPager->pageSize;
+    sqlite3OsFileControl(pPager->fd, SQLITE_FCNTL_WILLNEED, aRange);
+#ifdef SQLITE_TEST
+    sqlite3_pager_readahead_count += nPage;
+#endif
+  }
+}
+
 /*
 ** Release a page reference.
 **
@@ -3885,7 +4846,14 @@ DbPage *sqlite3PagerLookup(Pager *pPager, Pgno pgno){
 void sqlite3PagerUnref(DbPage *pPg){
   if( pPg ){
     Pager *pPager = pPg->pPager;
-    sqlite3PcacheRelease(pPg);
+    if( (pPg->flags&PGHDR_MMAP) && sqlite3PcachePageRefcount(pPg)==1 ){
+      /* Mapped pages are not kept in the cache once unused. The next
+      ** reader fetches the page from the mapping again. */
+      pagerReleaseMapPage(pPg, 0);
+      sqlite3PcacheDrop(pPg);
+    }else{
+      sqlite3PcacheRelease(pPg);
+    }
     pagerUnlockIfUnused(pPager);
   }
 }
@@ -3901,7 +4869,7 @@ void sqlite3PagerUnref(DbPage *pPg){
 */
 static int openSubJournal(Pager *pPager){
   int rc = SQLITE_OK;
-  if( isOpen(pPager->jfd) && !isOpen(pPager->sjfd) ){
+  if( (isOpen(pPager->jfd) || pagerUseWal(pPager)) && !isOpen(pPager->sjfd) ){
     if( pPager->journalMode==PAGER_JOURNALMODE_MEMORY ){
       sqlite3MemJournalOpen(pPager->sjfd);
     }else{
@@ -4029,26 +4997,44 @@ int sqlite3PagerBegin(Pager *pPager, int exFlag){
     assert( pPager->pInJournal==0 );
     assert( !MEMDB && !pPager->tempFile );
 
-    /* Obtain a RESERVED lock on the database file. If the exFlag parameter
-    ** is true, then immediately upgrade this to an EXCLUSIVE lock. The
-    ** busy-handler callback can be used when upgrading to the EXCLUSIVE
-    ** lock, but not when obtaining the RESERVED lock.
-    */
-    rc = sqlite3OsLock(pPager->fd, RESERVED_LOCK);
-    if( rc==SQLITE_OK ){
-      pPager->state = PAGER_RESERVED;
-      if( exFlag ){
-        rc = pager_wait_on_lock(pPager, EXCLUSIVE_LOCK);
+    if( pagerUseWal(pPager) ){
+      /* Take the write lock on the log instead of locking the database
+      ** file, so that readers carry on while this transaction runs. The
+      ** exFlag parameter is ignored. The busy-handler is not invoked here
+      ** if another connection holds the write lock, the layer above
+      ** invokes it if appropriate.
+      */
+      rc = sqlite3PagerPagecount(pPager, 0);
+      if( rc==SQLITE_OK ){
+        rc = sqlite3WalBeginWriteTransaction(pPager->pWal);
+      }
+      if( rc==SQLITE_OK ){
+        pPager->dbOrigSize = pPager->dbSize;
+        pPager->state = PAGER_RESERVED;
+        pPager->journalOff = 0;
+      }
+    }else{
+      /* Obtain a RESERVED lock on the database file. If the exFlag parameter
+      ** is true, then immediately upgrade this to an EXCLUSIVE lock. The
+      ** busy-handler callback can be used when upgrading to the EXCLUSIVE
+      ** lock, but not when obtaining the RESERVED lock.
+      */
+      rc = sqlite3OsLock(pPager->fd, RESERVED_LOCK);
+      if( rc==SQLITE_OK ){
+        pPager->state = PAGER_RESERVED;
+        if( exFlag ){
+          rc = pager_wait_on_lock(pPager, EXCLUSIVE_LOCK);
+        }
       }
-    }
 
-    /* If the required locks were successfully obtained, open the journal
-    ** file and write the first journal-header to it.
-    */
-    if( rc==SQLITE_OK && pPager->useJournal
-     && pPager->journalMode!=PAGER_JOURNALMODE_OFF 
-    ){
-      rc = pager_open_journal(pPager);
+      /* If the required locks were successfully obtained, open the journal
+      ** file and write the first journal-header to it.
+      */
+      if( rc==SQLITE_OK && pPager->useJournal
+       && pPager->journalMode!=PAGER_JOURNALMODE_OFF 
+      ){
+        rc = pager_open_journal(pPager);
+      }
     }
   }else if( isOpen(pPager->jfd) && pPager->journalOff==0 ){
     /* This happens when the pager was in exclusive-access mode the last
@@ -4076,10 +5062,15 @@ int sqlite3PagerBegin(Pager *pPager, int exFlag){
 ** of any open savepoints as appropriate.
 */
 static int pager_write(PgHdr *pPg){
-  void *pData = pPg->pData;
+  void *pData;
   Pager *pPager = pPg->pPager;
   int rc = SQLITE_OK;
 
+  if( pPg->flags&PGHDR_MMAP ){
+    pagerUnmapPage(pPg);
+  }
+  pData = pPg->pData;
+
   /* Check for errors
   */
   if( pPager->errCode ){ 
@@ -4114,7 +5105,7 @@ static int pager_write(PgHdr *pPg){
       return rc;
     }
     assert( pPager->state>=PAGER_RESERVED );
-    if( !isOpen(pPager->jfd) && pPager->useJournal
+    if( !isOpen(pPager->jfd) && pPager->useJournal && !pagerUseWal(pPager)
           && pPager->journalMode!=PAGER_JOURNALMODE_OFF ){
       rc = pager_open_journal(pPager);
       if( rc!=SQLITE_OK ) return rc;
@@ -4129,6 +5120,9 @@ static int pager_write(PgHdr *pPg){
       if( pPg->pgno<=pPager->dbOrigSize ){
         u32 cksum;
         char *pData2;
+        char aPgno[4], aCksum[4];
+        const void *apRec[3];
+        int anRec[3];
 
         /* We should never write to the journal file the page that
         ** contains the database locks.  The following assert verifies
@@ -4136,15 +5130,17 @@ static int pager_write(PgHdr *pPg){
         assert( pPg->pgno!=PAGER_MJ_PGNO(pPager) );
         pData2 = CODEC2(pPager, pData, pPg->pgno, 7);
         cksum = pager_cksum(pPager, (u8*)pData2);
-        rc = write32bits(pPager->jfd, pPager->journalOff, pPg->pgno);
-        if( rc==SQLITE_OK ){
-          rc = sqlite3OsWrite(pPager->jfd, pData2, pPager->pageSize,
-                              pPager->journalOff + 4);
-          pPager->journalOff += pPager->pageSize+4;
-        }
+
+        /* The page number, page image and checksum that make up the
+        ** journal record are appended with a single write. */
+        put32bits(aPgno, pPg->pgno);
+        put32bits(aCksum, cksum);
+        apRec[0] = aPgno;   anRec[0] = 4;
+        apRec[1] = pData2;  anRec[1] = pPager->pageSize;
+        apRec[2] = aCksum;  anRec[2] = 4;
+        rc = sqlite3OsWritev(pPager->jfd, 3, apRec, anRec, pPager->journalOff);
         if( rc==SQLITE_OK ){
-          rc = write32bits(pPager->jfd, pPager->journalOff, cksum);
-          pPager->journalOff += 4;
+          pPager->journalOff += pPager->pageSize+8;
         }
         IOTRACE(("JOUT %p %d %lld %d\n", pPager, pPg->pgno, 
                  pPager->journalOff, pPager->pageSize));
@@ -4233,7 +5229,7 @@ int sqlite3PagerWrite(DbPage *pDbPage){
   Pager *pPager = pPg->pPager;
   Pgno nPagePerSector = (pPager->sectorSize/pPager->pageSize);
 
-  if( nPagePerSector>1 ){
+  if( nPagePerSector>1 && !pagerUseWal(pPager) ){
     Pgno nPageCount;          /* Total number of pages in database file */
     Pgno pg1;                 /* First page of the sector pPg is located on. */
     int nPage;                /* Number of pages starting at pg1 to journal */
@@ -4493,6 +5489,41 @@ int sqlite3PagerCommitPhaseOne(
   */
   if( MEMDB && pPager->dbModified ){
     sqlite3BackupRestart(pPager->pBackup);
+  }else if( pPager->state!=PAGER_SYNCED && pPager->dbModified
+         && pagerUseWal(pPager) ){
+    /* In WAL mode the dirty pages are appended to the log, the last one
+    ** carrying the commit marker. There is no journal to sync and the
+    ** change-counter is not used. Pages past the end of the database and
+    ** pages whose content does not matter are left out. If nothing is
+    ** left, page 1 is logged so that there is a frame for the commit.
+    */
+    PgHdr *pList = sqlite3PcacheDirtyList(pPager->pPCache);
+    PgHdr **ppNext = &pList;
+    PgHdr *pPage1 = 0;
+    PgHdr *p;
+    for(p=pList; p; p=p->pDirty){
+      if( p->pgno<=pPager->dbSize && 0==(p->flags&PGHDR_DONT_WRITE) ){
+        *ppNext = p;
+        ppNext = &p->pDirty;
+      }
+    }
+    *ppNext = 0;
+    if( pList==0 ){
+      rc = sqlite3PagerGet(pPager, 1, &pPage1);
+      if( rc!=SQLITE_OK ) goto commit_phase_one_exit;
+      pList = pPage1;
+      pList->pDirty = 0;
+    }
+    sqlite3WalGroupCommit(pPager->pWal, pPager->nGroupUsec);
+    rc = pagerWalFrames(pPager, pList, pPager->dbSize, 1,
+        (pPager->fullSync && !noSync ? pPager->sync_flags : 0)
+    );
+    if( pPage1 ){
+      sqlite3PagerUnref(pPage1);
+    }
+    if( rc!=SQLITE_OK ) goto commit_phase_one_exit;
+    sqlite3PcacheCleanAll(pPager->pPCache);
+    pPager->state = PAGER_SYNCED;
   }else if( pPager->state!=PAGER_SYNCED && pPager->dbModified ){
 
     /* The following block updates the change-counter. Exactly how it
@@ -4682,7 +5713,26 @@ int sqlite3PagerCommitPhaseTwo(Pager *pPager){
   PAGERTRACE(("COMMIT %d\n", PAGERID(pPager)));
   assert( pPager->state==PAGER_SYNCED || MEMDB || !pPager->dbModified );
   rc = pager_end_transaction(pPager, pPager->setMaster);
-  return pager_error(pPager, rc);
+  rc = pager_error(pPager, rc);
+
+#ifndef SQLITE_OMIT_WAL
+  /* With group commit, the transaction is now visible to other connections
+  ** but the log may not have been synced yet. Wait until it has. This
+  ** happens after the WAL locks are released by pager_end_transaction(),
+  ** so that other connections can commit while this one waits.
+  */
+  if( rc==SQLITE_OK && pPager->pWal ){
+    int nBatch, nUsec;
+    rc = sqlite3WalGroupSync(pPager->pWal, &nBatch, &nUsec);
+    if( nBatch>0 ){
+      pPager->nCommitWait = nUsec;
+      pPager->nCommitBatch = nBatch;
+      if( nUsec>pPager->mxCommitWait ) pPager->mxCommitWait = nUsec;
+      if( nBatch>pPager->mxCommitBatch ) pPager->mxCommitBatch = nBatch;
+    }
+  }
+#endif
+  return rc;
 }
 
 /*
@@ -4731,7 +5781,17 @@ int sqlite3PagerCommitPhaseTwo(Pager *pPager){
 int sqlite3PagerRollback(Pager *pPager){
   int rc = SQLITE_OK;                  /* Return code */
   PAGERTRACE(("ROLLBACK %d\n", PAGERID(pPager)));
-  if( !pPager->dbModified || !isOpen(pPager->jfd) ){
+  if( pagerUseWal(pPager) ){
+    int rc2;
+    if( pPager->state>=PAGER_RESERVED ){
+      rc = pagerPlaybackSavepoint(pPager, 0);
+    }
+    rc2 = pager_end_transaction(pPager, pPager->setMaster);
+    if( rc==SQLITE_OK ){
+      rc = rc2;
+    }
+    rc = pager_error(pPager, rc);
+  }else if( !pPager->dbModified || !isOpen(pPager->jfd) ){
     rc = pager_end_transaction(pPager, pPager->setMaster);
   }else if( pPager->errCode && pPager->errCode!=SQLITE_FULL ){
     if( pPager->state>=PAGER_EXCLUSIVE ){
@@ -4864,6 +5924,11 @@ int sqlite3PagerOpenSavepoint(Pager *pPager, int nSavepoint){
       if( !aNew[ii].pInSavepoint ){
         return SQLITE_NOMEM;
       }
+#ifndef SQLITE_OMIT_WAL
+      if( pagerUseWal(pPager) ){
+        sqlite3WalSavepoint(pPager->pWal, aNew[ii].aWalData);
+      }
+#endif
     }
 
     /* Open the sub-journal, if it is not already opened. */
@@ -4928,7 +5993,7 @@ int sqlite3PagerSavepoint(Pager *pPager, int op, int iSavepoint){
     ** not yet been opened. In this case there have been no changes to
     ** the database file, so the playback operation can be skipped.
     */
-    if( op==SAVEPOINT_ROLLBACK && isOpen(pPager->jfd) ){
+    if( op==SAVEPOINT_ROLLBACK && (isOpen(pPager->jfd) || pagerUseWal(pPager)) ){
       PagerSavepoint *pSavepoint = (nNew==0)?0:&pPager->aSavepoint[nNew-1];
       rc = pagerPlaybackSavepoint(pPager, pSavepoint);
       assert(rc!=SQLITE_DONE);
@@ -5030,6 +6095,9 @@ int sqlite3PagerMovepage(Pager *pPager, DbPage *pPg, Pgno pgno, int isCommit){
   Pgno origPgno;               /* The original page number */
 
   assert( pPg->nRef>0 );
+  if( pPg->flags&PGHDR_MMAP ){
+    pagerUnmapPage(pPg);
+  }
 
   /* If the page being moved is dirty and has not been saved by the latest
   ** savepoint, then save the current contents of the page into the 
@@ -5084,6 +6152,9 @@ int sqlite3PagerMovepage(Pager *pPager, DbPage *pPg, Pgno pgno, int isCommit){
   assert( !pPgOld || pPgOld->nRef==1 );
   if( pPgOld ){
     pPg->flags |= (pPgOld->flags&PGHDR_NEED_SYNC);
+    if( pPgOld->flags&PGHDR_MMAP ){
+      pagerReleaseMapPage(pPgOld, 0);
+    }
     sqlite3PcacheDrop(pPgOld);
   }
 
@@ -5121,6 +6192,9 @@ int sqlite3PagerMovepage(Pager *pPager, DbPage *pPg, Pgno pgno, int isCommit){
     }
     pPager->needSync = 1;
     assert( pPager->noSync==0 && !MEMDB );
+    if( pPgHdr->flags&PGHDR_MMAP ){
+      pagerUnmapPage(pPgHdr);
+    }
     pPgHdr->flags |= PGHDR_NEED_SYNC;
     sqlite3PcacheMakeDirty(pPgHdr);
     sqlite3PagerUnref(pPgHdr);
@@ -5196,7 +6270,9 @@ int sqlite3PagerLockingMode(Pager *pPager, int eMode){
 ** value specified.  Except, an in-memory database can only have its
 ** journal mode set to _OFF or _MEMORY.  Attempts to change the journal
 ** mode of an in-memory database to something other than _OFF or _MEMORY
-** are silently ignored.
+** are silently ignored. So are attempts to change the journal mode while
+** a write-ahead log is open: a pager enters and leaves WAL mode by way of
+** sqlite3PagerOpenWal() and sqlite3PagerCloseWal() only.
 **
 ** The returned indicate the current (possibly updated) journal-mode.
 */
@@ -5208,8 +6284,9 @@ int sqlite3PagerJournalMode(Pager *pPager, int eMode){
             || eMode==PAGER_JOURNALMODE_OFF 
             || eMode==PAGER_JOURNALMODE_MEMORY );
   assert( PAGER_JOURNALMODE_QUERY<0 );
-  if( eMode>=0 && (!MEMDB || eMode==PAGER_JOURNALMODE_MEMORY 
-                          || eMode==PAGER_JOURNALMODE_OFF) ){
+  if( eMode>=0 && !pagerUseWal(pPager)
+   && (!MEMDB || eMode==PAGER_JOURNALMODE_MEMORY 
+              || eMode==PAGER_JOURNALMODE_OFF) ){
     pPager->journalMode = (u8)eMode;
   }
   return (int)pPager->journalMode;
@@ -5228,6 +6305,68 @@ i64 sqlite3PagerJournalSizeLimit(Pager *pPager, i64 iLimit){
   return pPager->journalSizeLimit;
 }
 
+/*
+** Get/set the number of pages that the b-tree layer asks to have read
+** ahead of a cursor scanning a table (see sqlite3PagerReadahead()). If
+** nPage is negative the limit is not changed. Zero disables read-ahead.
+** Return the limit in effect after the call.
+*/
+int sqlite3PagerReadaheadLimit(Pager *pPager, int nPage){
+  if( nPage>=0 ){
+    pPager->nReadahead = nPage;
+  }
+  return pPager->nReadahead;
+}
+
+/*
+** Return one of the page cache counters of the pager for
+** sqlite3_db_status(): the number of cache hits, cache misses, pages
+** evicted from the cache or dirty pages spilled to disk to make room
+** for others. If resetFlag is true, the counter is then set to zero.
+*/
+int sqlite3PagerCacheStat(Pager *pPager, int op, int resetFlag){
+  int n;
+  switch( op ){
+    case SQLITE_DBSTATUS_CACHE_HIT:
+      n = pPager->nHit + pPager->nLookupHit;
+      if( resetFlag ) pPager->nHit = pPager->nLookupHit = 0;
+      break;
+    case SQLITE_DBSTATUS_CACHE_MISS:
+      n = pPager->nMiss;
+      if( resetFlag ) pPager->nMiss = 0;
+      break;
+    case SQLITE_DBSTATUS_CACHE_EVICT:
+      n = sqlite3PcacheEvicted(pPager->pPCache, resetFlag);
+      break;
+    default:
+      assert( op==SQLITE_DBSTATUS_CACHE_SPILL );
+      n = pPager->nSpill;
+      if( resetFlag ) pPager->nSpill = 0;
+      break;
+  }
+  return n;
+}
+
+/*
+** Get/set the number of bytes of the database file that may be memory
+** mapped and read without copying (see readDbPage()). If szMmap is
+** negative the limit is not changed. Zero disables memory mapped reads.
+** Return the limit in effect after the call.
+*/
+i64 sqlite3PagerMmapLimit(Pager *pPager, i64 szMmap){
+#ifndef SQLITE_OMIT_MMAP
+  if( szMmap>=0 ){
+    pPager->szMmap = szMmap;
+    pagerFixMaplimit(pPager);
+  }
+  return pPager->szMmap;
+#else
+  UNUSED_PARAMETER(pPager);
+  UNUSED_PARAMETER(szMmap);
+  return 0;
+#endif
+}
+
 /*
 ** Return a pointer to the pPager->pBackup variable. The backup module
 ** in backup.c maintains the content of this variable. This module
@@ -5238,6 +6377,164 @@ sqlite3_backup **sqlite3PagerBackupPtr(Pager *pPager){
   return &pPager->pBackup;
 }
 
+#ifndef SQLITE_OMIT_WAL
+/*
+** This function is called when the user invokes "PRAGMA wal_checkpoint",
+** or when a connection using the b-tree layer decides to checkpoint.
+** If the pager is not in WAL mode, it is a no-op.
+*/
+int sqlite3PagerCheckpoint(Pager *pPager){
+  int rc = SQLITE_OK;
+  if( pPager->pWal ){
+    u8 *zBuf = (u8 *)pPager->pTmpSpace;
+    rc = sqlite3WalCheckpoint(pPager->pWal,
+        (pPager->noSync ? 0 : pPager->sync_flags),
+        pPager->pageSize, zBuf
+    );
+  }
+  return rc;
+}
+
+/*
+** Get/set the number of frames the log may hold before it is checkpointed
+** automatically. A negative argument queries the value without changing
+** it. Zero disables automatic checkpoints.
+*/
+int sqlite3PagerWalAutocheckpoint(Pager *pPager, int nFrame){
+  if( nFrame>=0 ){
+    pPager->nCkptPages = nFrame;
+  }
+  return pPager->nCkptPages;
+}
+
+/*
+** Get/set the group commit window, in microseconds. A negative argument
+** queries the value without changing it. Zero disables group commit.
+*/
+int sqlite3PagerGroupCommit(Pager *pPager, int nUsec){
+  if( nUsec>=0 ){
+    pPager->nGroupUsec = nUsec;
+  }
+  return pPager->nGroupUsec;
+}
+
+/*
+** Report the SQLITE_DBSTATUS_COMMIT_WAIT or SQLITE_DBSTATUS_COMMIT_BATCH
+** figures of the pager for sqlite3_db_status().
+*/
+void sqlite3PagerCommitStatus(
+  Pager *pPager,                  /* Pager to report on */
+  int op,                         /* SQLITE_DBSTATUS_COMMIT_WAIT or _BATCH */
+  int *pCur,                      /* OUT: Figure for the last commit */
+  int *pHiwtr,                    /* OUT: Largest figure seen */
+  int resetFlag                   /* True to reset the highwater mark */
+){
+  int *pnCur, *pnMax;
+  if( op==SQLITE_DBSTATUS_COMMIT_WAIT ){
+    pnCur = &pPager->nCommitWait;
+    pnMax = &pPager->mxCommitWait;
+  }else{
+    assert( op==SQLITE_DBSTATUS_COMMIT_BATCH );
+    pnCur = &pPager->nCommitBatch;
+    pnMax = &pPager->mxCommitBatch;
+  }
+  *pCur = *pnCur;
+  *pHiwtr = *pnMax;
+  if( resetFlag ){
+    *pnMax = *pnCur;
+  }
+}
+
+/*
+** Return true if the underlying VFS for the given pager supports the
+** primitives necessary for write-ahead logging.
+*/
+int sqlite3PagerWalSupported(Pager *pPager){
+  const sqlite3_io_methods *pMethods;
+  if( MEMDB || pPager->tempFile || !isOpen(pPager->fd) ) return 0;
+  pMethods = pPager->fd->pMethods;
+  return pMethods->iVersion>=2 && pMethods->xShmMap!=0;
+}
+
+/*
+** The caller must be holding a SHARED lock on the database file to call
+** this function.
+**
+** If the pager passed as the first argument is open on a real database
+** file (not a temp file or an in-memory database), and the WAL file
+** is not already open, make an attempt to open it now. If successful,
+** return SQLITE_OK. If an error occurs or the VFS used by the pager does 
+** not support the xShmXXX() methods, return an error code. *pisOpen is
+** not modified in either case.
+**
+** If the pager is open on a temp-file (or in-memory database), or if
+** the WAL file is already open, set *pisOpen to 1 and return SQLITE_OK
+** without doing anything. pisOpen may be NULL if the caller knows that
+** the WAL is not yet open.
+*/
+int sqlite3PagerOpenWal(Pager *pPager, int *pisOpen){
+  int rc = SQLITE_OK;
+
+  assert( pPager->state>=PAGER_SHARED );
+  assert( (pisOpen==0 && !pPager->tempFile && !pPager->pWal)
+       || (pisOpen!=0 && *pisOpen==0) );
+
+  if( !pPager->tempFile && !pPager->pWal ){
+    if( !sqlite3PagerWalSupported(pPager) ) return SQLITE_CANTOPEN;
+
+    /* Open the connection to the log file. If this operation fails, 
+    ** (e.g. due to malloc() failure), unlock the database file and 
+    ** return an error code.
+    */
+    rc = sqlite3WalOpen(pPager->pVfs, pPager->fd, pPager->zWal, &pPager->pWal);
+    if( rc==SQLITE_OK ){
+      pPager->journalMode = PAGER_JOURNALMODE_WAL;
+    }
+  }else{
+    *pisOpen = 1;
+  }
+
+  return rc;
+}
+
+/*
+** This function is called to close the connection to the log file prior
+** to switching from WAL to normal mode.
+**
+** Before closing the log file, this function attempts to take an 
+** EXCLUSIVE lock on the database file. If this cannot be obtained, an
+** error (SQLITE_BUSY) is returned and the log connection is not closed.
+** If successful, the log is checkpointed and deleted, the database file
+** is unlocked and the pager left in the UNLOCK state, ready for the
+** journal mode to be changed.
+*/
+int sqlite3PagerCloseWal(Pager *pPager){
+  int rc = SQLITE_OK;
+
+  assert( pPager->journalMode==PAGER_JOURNALMODE_WAL );
+  assert( pPager->state<PAGER_RESERVED );
+  assert( sqlite3PcacheRefCount(pPager->pPCache)==0 );
+
+  if( pPager->pWal ){
+    rc = sqlite3OsLock(pPager->fd, EXCLUSIVE_LOCK);
+    if( rc==SQLITE_OK ){
+      rc = sqlite3WalClose(pPager->pWal,
+        (pPager->noSync ? 0 : pPager->sync_flags), 
+        pPager->pageSize, (u8 *)pPager->pTmpSpace
+      );
+      pPager->pWal = 0;
+      osUnlock(pPager->fd, NO_LOCK);
+      pPager->state = PAGER_UNLOCK;
+      pPager->dbSizeValid = 0;
+      pager_reset(pPager);
+    }else{
+      osUnlock(pPager->fd, SHARED_LOCK);
+    }
+  }
+  return rc;
+}
+#endif
+
 #endif /* SQLITE_OMIT_DISKIO */
 
 /* BEGIN CRYPTO */
@@ -5254,6 +6551,54 @@ sqlite3_file *sqlite3Pager_get_fd(Pager *pPager) {
   return (isOpen(pPager->fd)) ? pPager->fd : NULL;
 }
 
+/*
+** Return the encoded copy of page pPg, as it is written to the database
+** file. The write-ahead log stores pages in this form so that frames are
+** never plaintext on disk. The buffer returned is owned by the codec and
+** is only valid until the next page is encoded.
+*/
+void *sqlite3PagerCodec(PgHdr *pPg){
+  Pager *pPager = pPg->pPager;
+  return CODEC2(pPager, pPg->pData, pPg->pgno, 6);
+}
+
+/*
+** Read the nPage consecutive pages that start at page iFirst from the
+** database file into aBuf and decode each of them in place, bypassing
+** the page cache. The backup module copies encrypted databases this
+** way, so that a large export neither pushes the source connection's
+** working set out of its cache nor pays for a cache lookup per page.
+**
+** The caller must hold at least a SHARED lock with no write transaction
+** open, so that the file content matches any cached pages, and the run
+** must not include the pending-byte page. Pages past the end of the
+** file are read as zeroes, as readDbPage() does.
+*/
+int sqlite3PagerReadRun(Pager *pPager, Pgno iFirst, int nPage, void *aBuf){
+  const int szPage = pPager->pageSize;
+  u8 *a = (u8 *)aBuf;
+  int rc;
+  int i;
+
+  assert( pPager->state>=PAGER_SHARED && !MEMDB && isOpen(pPager->fd) );
+  assert( iFirst>PAGER_MJ_PGNO(pPager)
+       || iFirst+nPage<=PAGER_MJ_PGNO(pPager) );
+
+  rc = sqlite3OsRead(pPager->fd, a, nPage*szPage, (iFirst-1)*(i64)szPage);
+  if( rc==SQLITE_IOERR_SHORT_READ ){
+    rc = SQLITE_OK;
+  }
+  for(i=0; rc==SQLITE_OK && i<nPage; i++){
+    Pgno pgno = iFirst+i;
+    CODEC1(pPager, &a[i*szPage], pgno, 3,
+           rc = (pgno==1 ? SQLITE_NOTADB : SQLITE_CORRUPT_BKPT));
+    PAGER_INCR(sqlite3_pager_readdb_count);
+    PAGER_INCR(pPager->nRead);
+    IOTRACE(("PGIN %p %d\n", pPager, pgno));
+  }
+  return rc;
+}
+
 #endif
 /* END CRYPTO */
 
@@ -28,6 +28,35 @@
   #define SQLITE_DEFAULT_JOURNAL_SIZE_LIMIT -1
 #endif
 
+/*
+** Default number of frames a write-ahead log may hold before a connection
+** ending a read transaction checkpoints it. Zero or a negative value
+** disables automatic checkpoints. This value may be overridden using the
+** sqlite3PagerWalAutocheckpoint() API. See also "PRAGMA wal_autocheckpoint".
+*/
+#ifndef SQLITE_DEFAULT_WAL_AUTOCHECKPOINT
+  #define SQLITE_DEFAULT_WAL_AUTOCHECKPOINT 1000
+#endif
+
+/*
+** Default number of bytes of a database file that may be memory mapped
+** for reading. Zero, the default, means pages are always read with the
+** xRead() method of the VFS. This value may be overridden using the
+** sqlite3PagerMmapLimit() API. See also "PRAGMA mmap_size".
+*/
+#ifndef SQLITE_DEFAULT_MMAP_SIZE
+  #define SQLITE_DEFAULT_MMAP_SIZE 0
+#endif
+
+/*
+** Default number of pages read ahead of a b-tree cursor that is scanning
+** a table in order. Zero disables read-ahead. This value may be overridden
+** using the sqlite3PagerReadaheadLimit() API. See also "PRAGMA read_ahead".
+*/
+#ifndef SQLITE_DEFAULT_READ_AHEAD
+  #define SQLITE_DEFAULT_READ_AHEAD 32
+#endif
+
 /*
 ** The type used to represent a page number.  The first page in a file
 ** is called page 1.  0 is used to represent "not a page".
@@ -78,6 +107,7 @@ typedef struct PgHdr DbPage;
 #define PAGER_JOURNALMODE_OFF         2   /* Journal omitted.  */
 #define PAGER_JOURNALMODE_TRUNCATE    3   /* Commit by truncating journal */
 #define PAGER_JOURNALMODE_MEMORY      4   /* In-memory journal file */
+#define PAGER_JOURNALMODE_WAL         5   /* Use write-ahead logging */
 
 /*
 ** The remainder of this file contains the declarations of the functions
@@ -100,12 +130,27 @@ void sqlite3PagerSetSafetyLevel(Pager*,int,int);
 int sqlite3PagerLockingMode(Pager *, int);
 int sqlite3PagerJournalMode(Pager *, int);
 i64 sqlite3PagerJournalSizeLimit(Pager *, i64);
+i64 sqlite3PagerMmapLimit(Pager *, i64);
+int sqlite3PagerReadaheadLimit(Pager *, int);
+int sqlite3PagerCacheStat(Pager *, int op, int resetFlag);
 sqlite3_backup **sqlite3PagerBackupPtr(Pager*);
 
+/* Functions used to manage the write-ahead log. */
+#ifndef SQLITE_OMIT_WAL
+int sqlite3PagerWalSupported(Pager *pPager);
+int sqlite3PagerOpenWal(Pager *pPager, int *pisOpen);
+int sqlite3PagerCloseWal(Pager *pPager);
+int sqlite3PagerCheckpoint(Pager *pPager);
+int sqlite3PagerWalAutocheckpoint(Pager *pPager, int nFrame);
+int sqlite3PagerGroupCommit(Pager *pPager, int nUsec);
+void sqlite3PagerCommitStatus(Pager*, int op, int*, int*, int);
+#endif
+
 /* Functions used to obtain and release page references. */ 
 int sqlite3PagerAcquire(Pager *pPager, Pgno pgno, DbPage **ppPage, int clrFlag);
 #define sqlite3PagerGet(A,B,C) sqlite3PagerAcquire(A,B,C,0)
 DbPage *sqlite3PagerLookup(Pager *pPager, Pgno pgno);
+void sqlite3PagerReadahead(Pager *pPager, Pgno pgno, int nPage);
 void sqlite3PagerRef(DbPage*);
 void sqlite3PagerUnref(DbPage*);
 
@@ -144,6 +189,7 @@ void sqlite3PagerTruncateImage(Pager*,Pgno);
 /* Used by encryption extensions. */
 #ifdef SQLITE_HAS_CODEC
   void sqlite3PagerSetCodec(Pager*,void*(*)(void*,void*,Pgno,int),void*);
+  void *sqlite3PagerCodec(DbPage*);
 #endif
 
 /* Functions to support testing and debugging. */
@@ -537,6 +537,15 @@ int sqlite3PcachePageRefcount(PgHdr *p){
   return p->nRef;
 }
 
+/*
+** Return a pointer to the buffer allocated for the content of page p.
+** This is where PgHdr.pData points unless the pager has redirected it
+** to a memory mapped copy of the page (see PGHDR_MMAP).
+*/
+void *sqlite3PcachePageBuffer(PgHdr *p){
+  return (void *)&((char *)p)[sizeof(PgHdr) + p->pCache->szExtra];
+}
+
 /* 
 ** Return the total number of pages in the cache.
 */
@@ -548,6 +557,20 @@ int sqlite3PcachePagecount(PCache *pCache){
   return nPage;
 }
 
+/*
+** Return the number of pages recycled from the cache to make room for
+** others, optionally resetting the count to zero. This is only known
+** for the default page cache implementation. Zero is returned if
+** another implementation is configured.
+*/
+int sqlite3PcacheEvicted(PCache *pCache, int resetFlag){
+  int nEvict = 0;
+  if( pCache->pCache ){
+    nEvict = sqlite3Pcache1Evicted(pCache->pCache, resetFlag);
+  }
+  return nEvict;
+}
+
 #ifdef SQLITE_TEST
 /*
 ** Get the suggested cache-size value.
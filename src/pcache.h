@@ -53,6 +53,7 @@ struct PgHdr {
 #define PGHDR_NEED_READ         0x008  /* Content is unread */
 #define PGHDR_REUSE_UNLIKELY    0x010  /* A hint that reuse is unlikely */
 #define PGHDR_DONT_WRITE        0x020  /* Do not write content to disk */
+#define PGHDR_MMAP              0x040  /* pData points into a file mapping */
 
 /* Initialize and shutdown the page cache subsystem */
 int sqlite3PcacheInitialize(void);
@@ -121,9 +122,18 @@ void sqlite3PcacheRef(PgHdr*);
 
 int sqlite3PcachePageRefcount(PgHdr*);
 
+/* Return the buffer allocated for the page content */
+void *sqlite3PcachePageBuffer(PgHdr*);
+
 /* Return the total number of pages stored in the cache */
 int sqlite3PcachePagecount(PCache*);
 
+/* Return the number of pages recycled from the cache, optionally
+** resetting the count. sqlite3Pcache1Evicted() is the implementation
+** for caches created by the default page cache module. */
+int sqlite3PcacheEvicted(PCache*, int resetFlag);
+int sqlite3Pcache1Evicted(sqlite3_pcache*, int resetFlag);
+
 #ifdef SQLITE_CHECK_PAGES
 /* Iterate through all dirty pages currently stored in the cache. This
 ** interface is only available if SQLITE_CHECK_PAGES is defined when the 
@@ -152,6 +162,10 @@ int sqlite3PcacheReleaseMemory(int);
 void sqlite3PcacheStats(int*,int*,int*,int*);
 #endif
 
+/* Return one of the SQLITE_STATUS_PCACHE_* counters of the default
+** page cache, optionally resetting it to zero. */
+int sqlite3PcacheCounter(int op, int resetFlag);
+
 void sqlite3PCacheSetDefault(void);
 
 #endif /* _PCACHE_H_ */
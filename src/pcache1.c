@@ -21,9 +21,96 @@
 
 #include "sqliteInt.h"
 
+/*
+** On unix, a page cache slab requested with a NULL buffer passed to
+** SQLITE_CONFIG_PAGECACHE is mapped with mmap(), using huge pages when
+** the system has them (see pcache1MapSlab()). Elsewhere no slab is
+** allocated and each page is obtained from sqlite3Malloc().
+*/
+#if SQLITE_OS_UNIX && !defined(SQLITE_OMIT_PAGECACHE_MAP)
+# include <sys/mman.h>
+# if !defined(MAP_ANONYMOUS) && defined(MAP_ANON)
+#  define MAP_ANONYMOUS MAP_ANON
+# endif
+# ifdef MAP_ANONYMOUS
+#  define PCACHE1_MAP_SLAB 1
+# endif
+#endif
+
+/*
+** Size and alignment of the pages a mapped slab is made of. This is
+** the huge page size of x86-64.
+*/
+#define PCACHE1_HUGEPAGE (2*1024*1024)
+
 typedef struct PCache1 PCache1;
 typedef struct PgHdr1 PgHdr1;
 typedef struct PgFreeslot PgFreeslot;
+typedef struct PGroup PGroup;
+typedef struct PGhost PGhost;
+
+/* Each page cache belongs to a PGroup. A PGroup is a set of one or more
+** caches that are able to recycle each other's unpinned pages when they
+** are under memory pressure. This implementation works in one of two
+** modes:
+**
+**   (1)  Every cache is the sole member of its own PGroup. The caches
+**        cannot rob each other of unused pages, but the PGroup needs
+**        no mutex: the caller already serializes all calls made on a
+**        single cache, so fetching and unpinning a page takes no lock.
+**
+**   (2)  There is a single global PGroup (pcache1.grp) that all caches
+**        are a member of. Its LRU list and page counts are protected
+**        by the SQLITE_MUTEX_STATIC_LRU mutex.
+**
+** Mode (1) is used when the library is multi-threaded, as a single LRU
+** list shared by every connection in the process is then a point of
+** contention. Mode (2) is used by single-threaded applications and
+** whenever SQLITE_ENABLE_MEMORY_MANAGEMENT is defined, since only the
+** global list can be purged by sqlite3_release_memory(). In mode (1)
+** each group enforces the cache_size limit of its own cache, so the sum
+** of all cache_size values remains an upper bound (give or take pinned
+** pages) on the number of pages allocated, just as it is in mode (2).
+**
+** Unpinned pages are recycled according to the policy selected with
+** SQLITE_CONFIG_PCACHE_POLICY:
+**
+**   LRU  All unpinned pages are kept on the LRU list (pLruHead). The
+**        least recently used page is recycled first.
+**
+**   2Q   Pages are loaded into the "A1in" queue, and unpinned A1in pages
+**        are kept on a list of their own (pInHead). A page recycled from
+**        A1in leaves its key behind in the "A1out" ghost list of its
+**        cache (see struct PGhost). If the page is loaded again while
+**        its key is still there, it goes onto the main LRU list instead,
+**        as a page that is used repeatedly over time. A1in pages are
+**        recycled first once they are more than a quarter of the pages
+**        in the PGroup. So the pages read once by a large scan pass
+**        through A1in without disturbing the pages on the LRU list.
+*/
+struct PGroup {
+  sqlite3_mutex *mutex;               /* MUTEX_STATIC_LRU or NULL */
+  int nMaxPage;                       /* Sum of nMax for purgeable caches */
+  int nMinPage;                       /* Sum of nMin for purgeable caches */
+  int nCurrentPage;                   /* Number of purgeable pages allocated */
+  PgHdr1 *pLruHead, *pLruTail;        /* LRU list of unpinned pages */
+  PgHdr1 *pInHead, *pInTail;          /* Unpinned pages in queue A1in (2Q) */
+  int nIn;                            /* Pages in queue A1in, incl. pinned */
+};
+
+/*
+** An entry in the A1out ghost list of a cache that uses the 2Q policy.
+** The ghost list of a cache is a ring buffer (PCache1.aGhost[]) holding
+** the keys of the last PCache1.nGhost pages recycled from its A1in
+** queue, oldest first after PCache1.iGhost. Entries are also chained
+** into a hash table by key (PCache1.aGhostHash[]). Hash slots and
+** iNext hold an index into aGhost[] plus one, or zero for the end of a
+** chain. An entry with iKey==0 is unused.
+*/
+struct PGhost {
+  unsigned int iKey;                  /* Key of recycled page, or 0 */
+  unsigned int iNext;                 /* Next entry in the same hash chain */
+};
 
 /* Pointers to structures of this type are cast and returned as 
 ** opaque sqlite3_pcache* handles
@@ -32,15 +119,16 @@ struct PCache1 {
   /* Cache configuration parameters. Page size (szPage) and the purgeable
   ** flag (bPurgeable) are set when the cache is created. nMax may be 
   ** modified at any time by a call to the pcache1CacheSize() method.
-  ** The global mutex must be held when accessing nMax.
+  ** The PGroup mutex must be held when accessing nMax.
   */
+  PGroup *pGroup;                     /* PGroup this cache belongs to */
   int szPage;                         /* Size of allocated pages in bytes */
   int bPurgeable;                     /* True if cache is purgeable */
   unsigned int nMin;                  /* Minimum number of pages reserved */
   unsigned int nMax;                  /* Configured "cache_size" value */
 
   /* Hash table of all pages. The following variables may only be accessed
-  ** when the accessor is holding the global mutex (see pcache1EnterMutex() 
+  ** when the accessor is holding the PGroup mutex (see pcache1EnterMutex() 
   ** and pcache1LeaveMutex()).
   */
   unsigned int nRecyclable;           /* Number of pages in the LRU list */
@@ -49,8 +137,36 @@ struct PCache1 {
   PgHdr1 **apHash;                    /* Hash table for fast lookup by key */
 
   unsigned int iMaxKey;               /* Largest key seen since xTruncate() */
+
+  /* The A1out ghost list used by the 2Q policy, allocated along with
+  ** the nMax setting. Protected by the PGroup mutex.
+  */
+  unsigned int nGhost;                /* Number of entries in aGhost[] */
+  unsigned int iGhost;                /* Next entry of aGhost[] to reuse */
+  PGhost *aGhost;                     /* Ring buffer of ghost entries */
+  unsigned int *aGhostHash;           /* Hash table of nGhost slots */
+
+  /* Counters reported by sqlite3_status(). They are updated with the
+  ** PGroup mutex held, and read without it. The pNextCache list is
+  ** protected by the MUTEX_STATIC_PMEM mutex.
+  */
+  int aCount[3];                      /* Hits, misses and ghost hits */
+  PCache1 *pNextCache;                /* Next cache in pcache1.pCacheList */
+
+  /* Number of pages of this cache recycled to make room, reported by
+  ** sqlite3_db_status(). Protected by the PGroup mutex.
+  */
+  int nEvict;
 };
 
+/*
+** Indexes of PCache1.aCount[]. These are in the same order as the
+** SQLITE_STATUS_PCACHE_* codes.
+*/
+#define PCACHE1_HIT        0
+#define PCACHE1_MISS       1
+#define PCACHE1_GHOST_HIT  2
+
 /*
 ** Each cache entry is represented by an instance of the following 
 ** structure. A buffer of PgHdr1.pCache->szPage bytes is allocated 
@@ -59,6 +175,7 @@ struct PCache1 {
 */
 struct PgHdr1 {
   unsigned int iKey;             /* Key value (page number) */
+  u8 isA1in;                     /* True if page is in queue A1in (2Q) */
   PgHdr1 *pNext;                 /* Next in hash table chain */
   PCache1 *pCache;               /* Cache that currently owns this page */
   PgHdr1 *pLruNext;              /* Next in LRU list of unpinned pages */
@@ -77,17 +194,33 @@ struct PgFreeslot {
 ** Global data used by this cache.
 */
 static SQLITE_WSD struct PCacheGlobal {
-  sqlite3_mutex *mutex;               /* static mutex MUTEX_STATIC_LRU */
+  PGroup grp;                         /* The global PGroup for mode (2) */
 
-  int nMaxPage;                       /* Sum of nMaxPage for purgeable caches */
-  int nMinPage;                       /* Sum of nMinPage for purgeable caches */
-  int nCurrentPage;                   /* Number of purgeable pages allocated */
-  PgHdr1 *pLruHead, *pLruTail;        /* LRU list of unpinned pages */
-
-  /* Variables related to SQLITE_CONFIG_PAGECACHE settings. */
+  /* Variables related to SQLITE_CONFIG_PAGECACHE settings. The pFree
+  ** list is protected by the static mutex MUTEX_STATIC_PMEM.
+  */
+  sqlite3_mutex *mutex;               /* static mutex MUTEX_STATIC_PMEM */
   int szSlot;                         /* Size of each free slot */
   void *pStart, *pEnd;                /* Bounds of pagecache malloc range */
   PgFreeslot *pFree;                  /* Free page blocks */
+
+  /* A slab mapped by sqlite3PCacheBufferSetup(). Pages in its slots have
+  ** their PgHdr1 in the dense array aHdr[], at the start of the mapping,
+  ** instead of next to the page buffer. So the hash chains walked by
+  ** pcache1Fetch() touch few cache lines and TLB entries.
+  */
+  void *pMap;                         /* Start of the mapping, or NULL */
+  sqlite3_int64 nMap;                 /* Size of the mapping in bytes */
+  PgHdr1 *aHdr;                       /* Headers of the nSlot slots */
+  int nSlot;                          /* Number of slots in the slab */
+
+  /* The replacement policy, and the counters of all caches. The list of
+  ** caches and the two arrays are protected by MUTEX_STATIC_PMEM.
+  */
+  int ePolicy;                        /* SQLITE_PCACHE_POLICY_* value */
+  PCache1 *pCacheList;                /* All caches that exist */
+  int aRetired[3];                    /* Counters of destroyed caches */
+  int aBase[3];                       /* Counter values at the last reset */
 } pcache1_g;
 
 /*
@@ -100,36 +233,114 @@ static SQLITE_WSD struct PCacheGlobal {
 /*
 ** When a PgHdr1 structure is allocated, the associated PCache1.szPage
 ** bytes of data are located directly after it in memory (i.e. the total
-** size of the allocation is sizeof(PgHdr1)+PCache1.szPage byte). The
-** PGHDR1_TO_PAGE() macro takes a pointer to a PgHdr1 structure as
-** an argument and returns a pointer to the associated block of szPage
-** bytes. The PAGE_TO_PGHDR1() macro does the opposite: its argument is
-** a pointer to a block of szPage bytes of data and the return value is
-** a pointer to the associated PgHdr1 structure.
+** size of the allocation is sizeof(PgHdr1)+PCache1.szPage byte), unless
+** the page is in a slot of a mapped slab, whose header is the entry of
+** pcache1.aHdr[] with the same index as the slot. The PGHDR1_TO_PAGE()
+** macro takes a pointer to a PgHdr1 structure as an argument and returns
+** a pointer to the associated block of szPage bytes. The PAGE_TO_PGHDR1()
+** macro does the opposite: its argument is a pointer to a block of szPage
+** bytes of data and the return value is a pointer to the associated PgHdr1
+** structure.
 **
 **   assert( PGHDR1_TO_PAGE(PAGE_TO_PGHDR1(X))==X );
 */
-#define PGHDR1_TO_PAGE(p) (void *)(&((unsigned char *)p)[sizeof(PgHdr1)])
-#define PAGE_TO_PGHDR1(p) (PgHdr1 *)(&((unsigned char *)p)[-1*(int)sizeof(PgHdr1)])
+#define PGHDR1_IN_SLAB(p) \
+  ((p)>=pcache1.aHdr && (p)<&pcache1.aHdr[pcache1.nSlot])
+#define PAGE_IN_SLAB(p) \
+  (pcache1.aHdr && (void*)(p)>=pcache1.pStart && (void*)(p)<pcache1.pEnd)
+#define PGHDR1_TO_PAGE(p) (PGHDR1_IN_SLAB(p) ? \
+  (void *)&((unsigned char *)pcache1.pStart)[((p)-pcache1.aHdr)*pcache1.szSlot] \
+  : (void *)(&((unsigned char *)p)[sizeof(PgHdr1)]))
+#define PAGE_TO_PGHDR1(p) (PAGE_IN_SLAB(p) ? \
+  &pcache1.aHdr[((unsigned char *)(p)-(unsigned char *)pcache1.pStart)/pcache1.szSlot] \
+  : (PgHdr1 *)(&((unsigned char *)p)[-1*(int)sizeof(PgHdr1)]))
 
 /*
-** Macros to enter and leave the global LRU mutex.
+** Macros to enter and leave the mutex of a PGroup. These are no-ops for
+** the private PGroup of a mode (1) cache, which has no mutex.
 */
-#define pcache1EnterMutex() sqlite3_mutex_enter(pcache1.mutex)
-#define pcache1LeaveMutex() sqlite3_mutex_leave(pcache1.mutex)
+#define pcache1EnterMutex(X) sqlite3_mutex_enter((X)->mutex)
+#define pcache1LeaveMutex(X) sqlite3_mutex_leave((X)->mutex)
 
 /******************************************************************************/
 /******** Page Allocation/SQLITE_CONFIG_PCACHE Related Functions **************/
 
+#ifdef PCACHE1_MAP_SLAB
+/*
+** Map nByte bytes of anonymous memory for a page cache slab. Reserved
+** huge pages (MAP_HUGETLB) are tried first. If there are none, ordinary
+** memory aligned to PCACHE1_HUGEPAGE is mapped instead, and the kernel
+** is asked to back it with transparent huge pages. Return the start of
+** the mapping and set *pnMap to its size, or return NULL if no memory
+** could be mapped at all.
+*/
+static void *pcache1MapSlab(sqlite3_int64 nByte, sqlite3_int64 *pnMap){
+  size_t nMap = (size_t)((nByte+PCACHE1_HUGEPAGE-1) & ~(PCACHE1_HUGEPAGE-1));
+  char *p;
+  char *pAligned;
+  size_t nHead;
+
+#ifdef MAP_HUGETLB
+  p = mmap(0, nMap, PROT_READ|PROT_WRITE, 
+           MAP_PRIVATE|MAP_ANONYMOUS|MAP_HUGETLB, -1, 0);
+  if( p!=MAP_FAILED ){
+    *pnMap = nMap;
+    return p;
+  }
+#endif
+
+  p = mmap(0, nMap+PCACHE1_HUGEPAGE, PROT_READ|PROT_WRITE,
+           MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+  if( p==MAP_FAILED ){
+    return 0;
+  }
+  nHead = PCACHE1_HUGEPAGE - (size_t)(p-(char*)0)%PCACHE1_HUGEPAGE;
+  if( nHead==PCACHE1_HUGEPAGE ) nHead = 0;
+  pAligned = &p[nHead];
+  if( nHead ) munmap(p, nHead);
+  munmap(&pAligned[nMap], PCACHE1_HUGEPAGE-nHead);
+#ifdef MADV_HUGEPAGE
+  madvise(pAligned, nMap, MADV_HUGEPAGE);
+#endif
+  *pnMap = nMap;
+  return pAligned;
+}
+#endif /* PCACHE1_MAP_SLAB */
+
 /*
 ** This function is called during initialization if a static buffer is 
 ** supplied to use for the page-cache by passing the SQLITE_CONFIG_PAGECACHE
 ** verb to sqlite3_config(). Parameter pBuf points to an allocation large
 ** enough to contain 'n' buffers of 'sz' bytes each.
+**
+** If the SQLITE_CONFIG_PAGECACHE_MAP verb was used instead, pBuf is NULL
+** and a slab of n slots is mapped here, where the system supports it. The headers of the pages in it
+** are kept in a separate array (see PGHDR1_TO_PAGE()), so each slot only
+** needs to hold the page buffer itself. It is unmapped when this function
+** is called again, with n set to zero, by sqlite3_shutdown().
 */
 void sqlite3PCacheBufferSetup(void *pBuf, int sz, int n){
   PgFreeslot *p;
   sz = ROUNDDOWN8(sz);
+#ifdef PCACHE1_MAP_SLAB
+  if( pcache1.pMap ){
+    munmap(pcache1.pMap, (size_t)pcache1.nMap);
+    pcache1.pMap = 0;
+    pcache1.nMap = 0;
+  }
+  pcache1.aHdr = 0;
+  pcache1.nSlot = 0;
+  if( pBuf==0 && sz>0 && n>0 && sqlite3GlobalConfig.bMapPage ){
+    sqlite3_int64 nHdr = ((sqlite3_int64)n*sizeof(PgHdr1) + 4095) & ~4095;
+    pcache1.pMap = pcache1MapSlab(nHdr + (sqlite3_int64)sz*n, &pcache1.nMap);
+    if( pcache1.pMap ){
+      pcache1.aHdr = (PgHdr1 *)pcache1.pMap;
+      pcache1.nSlot = n;
+      pBuf = (void*)&((char*)pcache1.pMap)[nHdr];
+    }
+  }
+#endif
+  if( pBuf==0 ) n = 0;
   pcache1.szSlot = sz;
   pcache1.pStart = pBuf;
   pcache1.pFree = 0;
@@ -142,6 +353,45 @@ void sqlite3PCacheBufferSetup(void *pBuf, int sz, int n){
   pcache1.pEnd = pBuf;
 }
 
+/*
+** Allocate nByte bytes from a free slot of the buffer configured using the
+** sqlite3_config(SQLITE_CONFIG_PAGECACHE) option. Return NULL if there is
+** no such buffer, no slot is free or nByte is larger than a slot.
+*/
+static void *pcache1AllocSlot(int nByte){
+  void *p = 0;
+  assert( sqlite3_mutex_notheld(pcache1.grp.mutex) );
+  if( nByte<=pcache1.szSlot ){
+    sqlite3_mutex_enter(pcache1.mutex);
+    p = (PgHdr1 *)pcache1.pFree;
+    if( p ){
+      pcache1.pFree = pcache1.pFree->pNext;
+      sqlite3StatusSet(SQLITE_STATUS_PAGECACHE_SIZE, nByte);
+      sqlite3StatusAdd(SQLITE_STATUS_PAGECACHE_USED, 1);
+    }
+    sqlite3_mutex_leave(pcache1.mutex);
+  }
+  return p;
+}
+
+/*
+** Allocate a new buffer using sqlite3Malloc. The global LRU mutex is
+** not held at this point. This is so that if the attempt to allocate
+** a new buffer causes the the configured soft-heap-limit to be
+** breached, it will be possible to reclaim memory from the global
+** LRU list.
+*/
+static void *pcache1AllocHeap(int nByte){
+  void *p = sqlite3Malloc(nByte);
+  if( p ){
+    int sz = sqlite3MallocSize(p);
+    sqlite3_mutex_enter(pcache1.mutex);
+    sqlite3StatusAdd(SQLITE_STATUS_PAGECACHE_OVERFLOW, sz);
+    sqlite3_mutex_leave(pcache1.mutex);
+  }
+  return p;
+}
+
 /*
 ** Malloc function used within this file to allocate space from the buffer
 ** configured using sqlite3_config(SQLITE_CONFIG_PAGECACHE) option. If no 
@@ -149,28 +399,9 @@ void sqlite3PCacheBufferSetup(void *pBuf, int sz, int n){
 ** back to sqlite3Malloc().
 */
 static void *pcache1Alloc(int nByte){
-  void *p;
-  assert( sqlite3_mutex_held(pcache1.mutex) );
-  if( nByte<=pcache1.szSlot && pcache1.pFree ){
-    p = (PgHdr1 *)pcache1.pFree;
-    pcache1.pFree = pcache1.pFree->pNext;
-    sqlite3StatusSet(SQLITE_STATUS_PAGECACHE_SIZE, nByte);
-    sqlite3StatusAdd(SQLITE_STATUS_PAGECACHE_USED, 1);
-  }else{
-
-    /* Allocate a new buffer using sqlite3Malloc. Before doing so, exit the
-    ** global pcache mutex and unlock the pager-cache object pCache. This is 
-    ** so that if the attempt to allocate a new buffer causes the the 
-    ** configured soft-heap-limit to be breached, it will be possible to
-    ** reclaim memory from this pager-cache.
-    */
-    pcache1LeaveMutex();
-    p = sqlite3Malloc(nByte);
-    pcache1EnterMutex();
-    if( p ){
-      int sz = sqlite3MallocSize(p);
-      sqlite3StatusAdd(SQLITE_STATUS_PAGECACHE_OVERFLOW, sz);
-    }
+  void *p = pcache1AllocSlot(nByte);
+  if( p==0 ){
+    p = pcache1AllocHeap(nByte);
   }
   return p;
 }
@@ -179,30 +410,49 @@ static void *pcache1Alloc(int nByte){
 ** Free an allocated buffer obtained from pcache1Alloc().
 */
 static void pcache1Free(void *p){
-  assert( sqlite3_mutex_held(pcache1.mutex) );
   if( p==0 ) return;
   if( p>=pcache1.pStart && p<pcache1.pEnd ){
     PgFreeslot *pSlot;
+    sqlite3_mutex_enter(pcache1.mutex);
     sqlite3StatusAdd(SQLITE_STATUS_PAGECACHE_USED, -1);
     pSlot = (PgFreeslot*)p;
     pSlot->pNext = pcache1.pFree;
     pcache1.pFree = pSlot;
+    sqlite3_mutex_leave(pcache1.mutex);
   }else{
     int iSize = sqlite3MallocSize(p);
+    sqlite3_mutex_enter(pcache1.mutex);
     sqlite3StatusAdd(SQLITE_STATUS_PAGECACHE_OVERFLOW, -iSize);
+    sqlite3_mutex_leave(pcache1.mutex);
     sqlite3_free(p);
   }
 }
 
 /*
 ** Allocate a new page object initially associated with cache pCache.
+**
+** The PGroup mutex must be held when this function is called. It is
+** released while the buffer is allocated.
 */
 static PgHdr1 *pcache1AllocPage(PCache1 *pCache){
   int nByte = sizeof(PgHdr1) + pCache->szPage;
-  PgHdr1 *p = (PgHdr1 *)pcache1Alloc(nByte);
+  PGroup *pGroup = pCache->pGroup;
+  PgHdr1 *p;
+
+  assert( sqlite3_mutex_held(pGroup->mutex) );
+  pcache1LeaveMutex(pGroup);
+  if( pcache1.aHdr ){
+    /* A slot of a mapped slab only holds the page buffer. If none is
+    ** free, allocate the header and the buffer together as usual. */
+    void *pBuf = pcache1AllocSlot(pCache->szPage);
+    p = pBuf ? PAGE_TO_PGHDR1(pBuf) : (PgHdr1 *)pcache1AllocHeap(nByte);
+  }else{
+    p = (PgHdr1 *)pcache1Alloc(nByte);
+  }
+  pcache1EnterMutex(pGroup);
   if( p ){
     if( pCache->bPurgeable ){
-      pcache1.nCurrentPage++;
+      pGroup->nCurrentPage++;
     }
   }
   return p;
@@ -210,13 +460,20 @@ static PgHdr1 *pcache1AllocPage(PCache1 *pCache){
 
 /*
 ** Free a page object allocated by pcache1AllocPage().
+**
+** The PGroup mutex must be held when this function is called.
 */
 static void pcache1FreePage(PgHdr1 *p){
   if( p ){
-    if( p->pCache->bPurgeable ){
-      pcache1.nCurrentPage--;
+    PCache1 *pCache = p->pCache;
+    assert( sqlite3_mutex_held(pCache->pGroup->mutex) );
+    if( pCache->bPurgeable ){
+      pCache->pGroup->nCurrentPage--;
+    }
+    if( p->isA1in ){
+      pCache->pGroup->nIn--;
     }
-    pcache1Free(p);
+    pcache1Free(PGHDR1_IN_SLAB(p) ? PGHDR1_TO_PAGE(p) : (void *)p);
   }
 }
 
@@ -226,20 +483,14 @@ static void pcache1FreePage(PgHdr1 *p){
 ** exists, this function falls back to sqlite3Malloc().
 */
 void *sqlite3PageMalloc(int sz){
-  void *p;
-  pcache1EnterMutex();
-  p = pcache1Alloc(sz);
-  pcache1LeaveMutex();
-  return p;
+  return pcache1Alloc(sz);
 }
 
 /*
 ** Free an allocated buffer obtained from sqlite3PageMalloc().
 */
 void sqlite3PageFree(void *p){
-  pcache1EnterMutex();
   pcache1Free(p);
-  pcache1LeaveMutex();
 }
 
 /******************************************************************************/
@@ -249,25 +500,25 @@ void sqlite3PageFree(void *p){
 ** This function is used to resize the hash table used by the cache passed
 ** as the first argument.
 **
-** The global mutex must be held when this function is called.
+** The PGroup mutex must be held when this function is called.
 */
 static int pcache1ResizeHash(PCache1 *p){
   PgHdr1 **apNew;
   unsigned int nNew;
   unsigned int i;
 
-  assert( sqlite3_mutex_held(pcache1.mutex) );
+  assert( sqlite3_mutex_held(p->pGroup->mutex) );
 
   nNew = p->nHash*2;
   if( nNew<256 ){
     nNew = 256;
   }
 
-  pcache1LeaveMutex();
+  pcache1LeaveMutex(p->pGroup);
   if( p->nHash ){ sqlite3BeginBenignMalloc(); }
   apNew = (PgHdr1 **)sqlite3_malloc(sizeof(PgHdr1 *)*nNew);
   if( p->nHash ){ sqlite3EndBenignMalloc(); }
-  pcache1EnterMutex();
+  pcache1EnterMutex(p->pGroup);
   if( apNew ){
     memset(apNew, 0, sizeof(PgHdr1 *)*nNew);
     for(i=0; i<p->nHash; i++){
@@ -290,25 +541,36 @@ static int pcache1ResizeHash(PCache1 *p){
 
 /*
 ** This function is used internally to remove the page pPage from the 
-** global LRU list, if is part of it. If pPage is not part of the global
+** PGroup LRU list, if is part of it. If pPage is not part of the PGroup
 ** LRU list, then this function is a no-op.
 **
-** The global mutex must be held when this function is called.
+** The PGroup mutex must be held when this function is called.
 */
 static void pcache1PinPage(PgHdr1 *pPage){
-  assert( sqlite3_mutex_held(pcache1.mutex) );
-  if( pPage && (pPage->pLruNext || pPage==pcache1.pLruTail) ){
+  PGroup *pGroup;
+  PgHdr1 **ppHead, **ppTail;
+  if( pPage==0 ) return;
+  pGroup = pPage->pCache->pGroup;
+  assert( sqlite3_mutex_held(pGroup->mutex) );
+  if( pPage->isA1in ){
+    ppHead = &pGroup->pInHead;
+    ppTail = &pGroup->pInTail;
+  }else{
+    ppHead = &pGroup->pLruHead;
+    ppTail = &pGroup->pLruTail;
+  }
+  if( pPage->pLruNext || pPage==*ppTail ){
     if( pPage->pLruPrev ){
       pPage->pLruPrev->pLruNext = pPage->pLruNext;
     }
     if( pPage->pLruNext ){
       pPage->pLruNext->pLruPrev = pPage->pLruPrev;
     }
-    if( pcache1.pLruHead==pPage ){
-      pcache1.pLruHead = pPage->pLruNext;
+    if( *ppHead==pPage ){
+      *ppHead = pPage->pLruNext;
     }
-    if( pcache1.pLruTail==pPage ){
-      pcache1.pLruTail = pPage->pLruPrev;
+    if( *ppTail==pPage ){
+      *ppTail = pPage->pLruPrev;
     }
     pPage->pLruNext = 0;
     pPage->pLruPrev = 0;
@@ -321,7 +583,7 @@ static void pcache1PinPage(PgHdr1 *pPage){
 ** Remove the page supplied as an argument from the hash table 
 ** (PCache1.apHash structure) that it is currently stored in.
 **
-** The global mutex must be held when this function is called.
+** The PGroup mutex must be held when this function is called.
 */
 static void pcache1RemoveFromHash(PgHdr1 *pPage){
   unsigned int h;
@@ -336,15 +598,108 @@ static void pcache1RemoveFromHash(PgHdr1 *pPage){
 }
 
 /*
-** If there are currently more than pcache.nMaxPage pages allocated, try
-** to recycle pages to reduce the number allocated to pcache.nMaxPage.
+** Remove entry i of the ghost list of cache pCache from its hash chain
+** and mark it unused.
+**
+** The PGroup mutex must be held when this function is called.
+*/
+static void pcache1GhostUnlink(PCache1 *pCache, unsigned int i){
+  unsigned int *pi;
+  assert( pCache->aGhost[i].iKey!=0 );
+  pi = &pCache->aGhostHash[pCache->aGhost[i].iKey % pCache->nGhost];
+  while( *pi!=i+1 ){
+    pi = &pCache->aGhost[*pi-1].iNext;
+  }
+  *pi = pCache->aGhost[i].iNext;
+  pCache->aGhost[i].iKey = 0;
+}
+
+/*
+** Add key iKey to the ghost list of cache pCache, replacing the oldest
+** entry if the list is full.
+**
+** The PGroup mutex must be held when this function is called.
 */
-static void pcache1EnforceMaxPage(void){
-  assert( sqlite3_mutex_held(pcache1.mutex) );
-  while( pcache1.nCurrentPage>pcache1.nMaxPage && pcache1.pLruTail ){
-    PgHdr1 *p = pcache1.pLruTail;
-    pcache1PinPage(p);
-    pcache1RemoveFromHash(p);
+static void pcache1GhostAdd(PCache1 *pCache, unsigned int iKey){
+  unsigned int i = pCache->iGhost;
+  unsigned int h;
+  if( pCache->nGhost==0 ) return;
+  if( pCache->aGhost[i].iKey ){
+    pcache1GhostUnlink(pCache, i);
+  }
+  h = iKey % pCache->nGhost;
+  pCache->aGhost[i].iKey = iKey;
+  pCache->aGhost[i].iNext = pCache->aGhostHash[h];
+  pCache->aGhostHash[h] = i+1;
+  pCache->iGhost = (i+1) % pCache->nGhost;
+}
+
+/*
+** If key iKey is in the ghost list of cache pCache, remove it and return
+** true. Otherwise return false.
+**
+** The PGroup mutex must be held when this function is called.
+*/
+static int pcache1GhostRemove(PCache1 *pCache, unsigned int iKey){
+  unsigned int i;
+  if( pCache->nGhost==0 ) return 0;
+  for(i=pCache->aGhostHash[iKey % pCache->nGhost]; i; ){
+    if( pCache->aGhost[i-1].iKey==iKey ){
+      pcache1GhostUnlink(pCache, i-1);
+      return 1;
+    }
+    i = pCache->aGhost[i-1].iNext;
+  }
+  return 0;
+}
+
+/*
+** Return the unpinned page that should be recycled next from PGroup
+** pGroup, or NULL if there are no unpinned pages. Pages in queue A1in
+** are recycled first if the queue has outgrown its share of the PGroup
+** (see the comment above struct PGroup), or if there are no unpinned
+** pages on the LRU list.
+**
+** The PGroup mutex must be held when this function is called.
+*/
+static PgHdr1 *pcache1Victim(PGroup *pGroup){
+  assert( sqlite3_mutex_held(pGroup->mutex) );
+  if( pGroup->pInTail
+   && (pGroup->pLruTail==0 || pGroup->nIn>pGroup->nMaxPage/4)
+  ){
+    return pGroup->pInTail;
+  }
+  return pGroup->pLruTail;
+}
+
+/*
+** Remove page pPage, returned by pcache1Victim(), from its list and from
+** the hash table of its cache so that it can be freed or reused. The
+** key of a page recycled from queue A1in is added to the ghost list.
+**
+** The PGroup mutex must be held when this function is called.
+*/
+static void pcache1RemoveVictim(PgHdr1 *pPage){
+  pcache1PinPage(pPage);
+  pcache1RemoveFromHash(pPage);
+  pPage->pCache->nEvict++;
+  if( pPage->isA1in ){
+    pcache1GhostAdd(pPage->pCache, pPage->iKey);
+  }
+}
+
+/*
+** If there are currently more than nMaxPage pages allocated to the caches
+** in PGroup pGroup, try to recycle pages to reduce the number allocated
+** to nMaxPage.
+*/
+static void pcache1EnforceMaxPage(PGroup *pGroup){
+  PgHdr1 *p;
+  assert( sqlite3_mutex_held(pGroup->mutex) );
+  while( pGroup->nCurrentPage>pGroup->nMaxPage
+      && (p = pcache1Victim(pGroup))!=0
+  ){
+    pcache1RemoveVictim(p);
     pcache1FreePage(p);
   }
 }
@@ -354,14 +709,14 @@ static void pcache1EnforceMaxPage(void){
 ** greater than or equal to iLimit. Any pinned pages that meet this 
 ** criteria are unpinned before they are discarded.
 **
-** The global mutex must be held when this function is called.
+** The PGroup mutex must be held when this function is called.
 */
 static void pcache1TruncateUnsafe(
   PCache1 *pCache, 
   unsigned int iLimit 
 ){
   unsigned int h;
-  assert( sqlite3_mutex_held(pcache1.mutex) );
+  assert( sqlite3_mutex_held(pCache->pGroup->mutex) );
   for(h=0; h<pCache->nHash; h++){
     PgHdr1 **pp = &pCache->apHash[h]; 
     PgHdr1 *pPage;
@@ -375,6 +730,11 @@ static void pcache1TruncateUnsafe(
       }
     }
   }
+  for(h=0; h<pCache->nGhost; h++){
+    if( pCache->aGhost[h].iKey && pCache->aGhost[h].iKey>=iLimit ){
+      pcache1GhostUnlink(pCache, h);
+    }
+  }
 }
 
 /******************************************************************************/
@@ -386,8 +746,10 @@ static void pcache1TruncateUnsafe(
 static int pcache1Init(void *NotUsed){
   UNUSED_PARAMETER(NotUsed);
   memset(&pcache1, 0, sizeof(pcache1));
+  pcache1.ePolicy = sqlite3GlobalConfig.ePcachePolicy;
   if( sqlite3GlobalConfig.bCoreMutex ){
-    pcache1.mutex = sqlite3_mutex_alloc(SQLITE_MUTEX_STATIC_LRU);
+    pcache1.grp.mutex = sqlite3_mutex_alloc(SQLITE_MUTEX_STATIC_LRU);
+    pcache1.mutex = sqlite3_mutex_alloc(SQLITE_MUTEX_STATIC_PMEM);
   }
   return SQLITE_OK;
 }
@@ -406,19 +768,43 @@ static void pcache1Shutdown(void *NotUsed){
 ** Allocate a new cache.
 */
 static sqlite3_pcache *pcache1Create(int szPage, int bPurgeable){
-  PCache1 *pCache;
+  PCache1 *pCache;              /* The new cache */
+  PGroup *pGroup;               /* The PGroup the new cache belongs to */
+  int sz;                       /* Bytes to allocate for the new cache */
+
+  /* If separateCache is true, the new cache gets a private PGroup with
+  ** no mutex (mode (1) in the comment above struct PGroup). This is the
+  ** case in multi-threaded applications, unless the global LRU list is
+  ** required by sqlite3_release_memory().
+  */
+#if defined(SQLITE_ENABLE_MEMORY_MANAGEMENT) || SQLITE_THREADSAFE==0
+  const int separateCache = 0;
+#else
+  int separateCache = sqlite3GlobalConfig.bCoreMutex>0;
+#endif
 
-  pCache = (PCache1 *)sqlite3_malloc(sizeof(PCache1));
+  sz = sizeof(PCache1) + sizeof(PGroup)*separateCache;
+  pCache = (PCache1 *)sqlite3_malloc(sz);
   if( pCache ){
-    memset(pCache, 0, sizeof(PCache1));
+    memset(pCache, 0, sz);
+    if( separateCache ){
+      pGroup = (PGroup*)&pCache[1];
+    }else{
+      pGroup = &pcache1.grp;
+    }
+    pCache->pGroup = pGroup;
     pCache->szPage = szPage;
     pCache->bPurgeable = (bPurgeable ? 1 : 0);
     if( bPurgeable ){
       pCache->nMin = 10;
-      pcache1EnterMutex();
-      pcache1.nMinPage += pCache->nMin;
-      pcache1LeaveMutex();
+      pcache1EnterMutex(pGroup);
+      pGroup->nMinPage += pCache->nMin;
+      pcache1LeaveMutex(pGroup);
     }
+    sqlite3_mutex_enter(pcache1.mutex);
+    pCache->pNextCache = pcache1.pCacheList;
+    pcache1.pCacheList = pCache;
+    sqlite3_mutex_leave(pcache1.mutex);
   }
   return (sqlite3_pcache *)pCache;
 }
@@ -431,11 +817,38 @@ static sqlite3_pcache *pcache1Create(int szPage, int bPurgeable){
 static void pcache1Cachesize(sqlite3_pcache *p, int nMax){
   PCache1 *pCache = (PCache1 *)p;
   if( pCache->bPurgeable ){
-    pcache1EnterMutex();
-    pcache1.nMaxPage += (nMax - pCache->nMax);
+    PGroup *pGroup = pCache->pGroup;
+    PGhost *aGhost = 0;
+    unsigned int nGhost = 0;
+
+    /* With the 2Q policy, the ghost list remembers as many keys as half
+    ** the cache_size. It is allocated before the mutex is taken, and if
+    ** that fails the cache works without it. */
+    if( pcache1.ePolicy==SQLITE_PCACHE_POLICY_2Q && nMax>1 ){
+      nGhost = (unsigned int)nMax/2;
+      if( nGhost!=pCache->nGhost ){
+        sqlite3BeginBenignMalloc();
+        aGhost = (PGhost *)sqlite3MallocZero(
+            nGhost*(sizeof(PGhost)+sizeof(unsigned int)));
+        sqlite3EndBenignMalloc();
+        if( aGhost==0 ) nGhost = 0;
+      }
+    }
+
+    pcache1EnterMutex(pGroup);
+    pGroup->nMaxPage += (nMax - pCache->nMax);
     pCache->nMax = nMax;
-    pcache1EnforceMaxPage();
-    pcache1LeaveMutex();
+    if( aGhost || nGhost==0 ){
+      PGhost *aOld = pCache->aGhost;
+      pCache->aGhost = aGhost;
+      pCache->aGhostHash = (unsigned int *)&aGhost[nGhost];
+      pCache->nGhost = nGhost;
+      pCache->iGhost = 0;
+      aGhost = aOld;
+    }
+    pcache1EnforceMaxPage(pGroup);
+    pcache1LeaveMutex(pGroup);
+    sqlite3_free(aGhost);
   }
 }
 
@@ -444,9 +857,10 @@ static void pcache1Cachesize(sqlite3_pcache *p, int nMax){
 */
 static int pcache1Pagecount(sqlite3_pcache *p){
   int n;
-  pcache1EnterMutex();
-  n = ((PCache1 *)p)->nPage;
-  pcache1LeaveMutex();
+  PCache1 *pCache = (PCache1 *)p;
+  pcache1EnterMutex(pCache->pGroup);
+  n = pCache->nPage;
+  pcache1LeaveMutex(pCache->pGroup);
   return n;
 }
 
@@ -474,8 +888,8 @@ static int pcache1Pagecount(sqlite3_pcache *p){
 **       (a) the number of pages pinned by the cache is greater than
 **           PCache1.nMax, or
 **       (b) the number of pages pinned by the cache is greater than
-**           the sum of nMax for all purgeable caches, less the sum of 
-**           nMin for all other purgeable caches. 
+**           the sum of nMax for all purgeable caches in the PGroup, less
+**           the sum of nMin for all other purgeable caches in the PGroup.
 **
 **   4. If none of the first three conditions apply and the cache is marked
 **      as purgeable, and if one of the following is true:
@@ -483,9 +897,9 @@ static int pcache1Pagecount(sqlite3_pcache *p){
 **       (a) The number of pages allocated for the cache is already 
 **           PCache1.nMax, or
 **
-**       (b) The number of pages allocated for all purgeable caches is
-**           already equal to or greater than the sum of nMax for all
-**           purgeable caches,
+**       (b) The number of pages allocated for all purgeable caches in the
+**           PGroup is already equal to or greater than the sum of nMax for
+**           all purgeable caches in the PGroup,
 **
 **      then attempt to recycle a page from the LRU list. If it is the right
 **      size, return the recycled buffer. Otherwise, free the buffer and
@@ -496,9 +910,10 @@ static int pcache1Pagecount(sqlite3_pcache *p){
 static void *pcache1Fetch(sqlite3_pcache *p, unsigned int iKey, int createFlag){
   unsigned int nPinned;
   PCache1 *pCache = (PCache1 *)p;
+  PGroup *pGroup = pCache->pGroup;
   PgHdr1 *pPage = 0;
 
-  pcache1EnterMutex();
+  pcache1EnterMutex(pGroup);
   if( createFlag==1 ) sqlite3BeginBenignMalloc();
 
   /* Search the hash table for an existing entry. */
@@ -508,6 +923,7 @@ static void *pcache1Fetch(sqlite3_pcache *p, unsigned int iKey, int createFlag){
   }
 
   if( pPage || createFlag==0 ){
+    if( pPage ) pCache->aCount[PCACHE1_HIT]++;
     pcache1PinPage(pPage);
     goto fetch_out;
   }
@@ -515,7 +931,7 @@ static void *pcache1Fetch(sqlite3_pcache *p, unsigned int iKey, int createFlag){
   /* Step 3 of header comment. */
   nPinned = pCache->nPage - pCache->nRecyclable;
   if( createFlag==1 && pCache->bPurgeable && (
-        nPinned>=(pcache1.nMaxPage+pCache->nMin-pcache1.nMinPage)
+        nPinned>=(pGroup->nMaxPage+pCache->nMin-pGroup->nMinPage)
      || nPinned>=(pCache->nMax * 9 / 10)
   )){
     goto fetch_out;
@@ -526,17 +942,20 @@ static void *pcache1Fetch(sqlite3_pcache *p, unsigned int iKey, int createFlag){
   }
 
   /* Step 4. Try to recycle a page buffer if appropriate. */
-  if( pCache->bPurgeable && pcache1.pLruTail && (
-      pCache->nPage>=pCache->nMax-1 || pcache1.nCurrentPage>=pcache1.nMaxPage
+  if( pCache->bPurgeable && (pGroup->pLruTail || pGroup->pInTail) && (
+      pCache->nPage>=pCache->nMax-1 || pGroup->nCurrentPage>=pGroup->nMaxPage
   )){
-    pPage = pcache1.pLruTail;
-    pcache1RemoveFromHash(pPage);
-    pcache1PinPage(pPage);
+    pPage = pcache1Victim(pGroup);
+    pcache1RemoveVictim(pPage);
     if( pPage->pCache->szPage!=pCache->szPage ){
       pcache1FreePage(pPage);
       pPage = 0;
     }else{
-      pcache1.nCurrentPage -= (pPage->pCache->bPurgeable - pCache->bPurgeable);
+      pGroup->nCurrentPage -= (pPage->pCache->bPurgeable - pCache->bPurgeable);
+      if( pPage->isA1in ){
+        pPage->isA1in = 0;
+        pGroup->nIn--;
+      }
     }
   }
 
@@ -551,6 +970,16 @@ static void *pcache1Fetch(sqlite3_pcache *p, unsigned int iKey, int createFlag){
     unsigned int h = iKey % pCache->nHash;
     *(void **)(PGHDR1_TO_PAGE(pPage)) = 0;
     pCache->nPage++;
+    pCache->aCount[PCACHE1_MISS]++;
+    pPage->isA1in = 0;
+    if( pcache1.ePolicy==SQLITE_PCACHE_POLICY_2Q && pCache->bPurgeable ){
+      if( pcache1GhostRemove(pCache, iKey) ){
+        pCache->aCount[PCACHE1_GHOST_HIT]++;
+      }else{
+        pPage->isA1in = 1;
+        pGroup->nIn++;
+      }
+    }
     pPage->iKey = iKey;
     pPage->pNext = pCache->apHash[h];
     pPage->pCache = pCache;
@@ -564,7 +993,7 @@ fetch_out:
     pCache->iMaxKey = iKey;
   }
   if( createFlag==1 ) sqlite3EndBenignMalloc();
-  pcache1LeaveMutex();
+  pcache1LeaveMutex(pGroup);
   return (pPage ? PGHDR1_TO_PAGE(pPage) : 0);
 }
 
@@ -576,37 +1005,41 @@ fetch_out:
 */
 static void pcache1Unpin(sqlite3_pcache *p, void *pPg, int reuseUnlikely){
   PCache1 *pCache = (PCache1 *)p;
+  PGroup *pGroup = pCache->pGroup;
   PgHdr1 *pPage = PAGE_TO_PGHDR1(pPg);
 
-  pcache1EnterMutex();
+  pcache1EnterMutex(pGroup);
 
   /* It is an error to call this function if the page is already 
-  ** part of the global LRU list.
+  ** part of the PGroup LRU list.
   */
   assert( pPage->pLruPrev==0 && pPage->pLruNext==0 );
-  assert( pcache1.pLruHead!=pPage && pcache1.pLruTail!=pPage );
+  assert( pGroup->pLruHead!=pPage && pGroup->pLruTail!=pPage );
+  assert( pGroup->pInHead!=pPage && pGroup->pInTail!=pPage );
 
-  if( reuseUnlikely || pcache1.nCurrentPage>pcache1.nMaxPage ){
+  if( reuseUnlikely || pGroup->nCurrentPage>pGroup->nMaxPage ){
     pcache1RemoveFromHash(pPage);
     pcache1FreePage(pPage);
   }else{
-    /* Add the page to the global LRU list. Normally, the page is added to
-    ** the head of the list (last page to be recycled). However, if the 
-    ** reuseUnlikely flag passed to this function is true, the page is added
-    ** to the tail of the list (first page to be recycled).
+    /* Add the page to the head of the PGroup LRU list, or of the A1in
+    ** list if it is in that queue, to be the last page recycled from it.
     */
-    if( pcache1.pLruHead ){
-      pcache1.pLruHead->pLruPrev = pPage;
-      pPage->pLruNext = pcache1.pLruHead;
-      pcache1.pLruHead = pPage;
+    PgHdr1 **ppHead = pPage->isA1in ? &pGroup->pInHead : &pGroup->pLruHead;
+    if( *ppHead ){
+      (*ppHead)->pLruPrev = pPage;
+      pPage->pLruNext = *ppHead;
+      *ppHead = pPage;
+    }else if( pPage->isA1in ){
+      pGroup->pInTail = pPage;
+      pGroup->pInHead = pPage;
     }else{
-      pcache1.pLruTail = pPage;
-      pcache1.pLruHead = pPage;
+      pGroup->pLruTail = pPage;
+      pGroup->pLruHead = pPage;
     }
     pCache->nRecyclable++;
   }
 
-  pcache1LeaveMutex();
+  pcache1LeaveMutex(pGroup);
 }
 
 /*
@@ -624,7 +1057,7 @@ static void pcache1Rekey(
   unsigned int h; 
   assert( pPage->iKey==iOld );
 
-  pcache1EnterMutex();
+  pcache1EnterMutex(pCache->pGroup);
 
   h = iOld%pCache->nHash;
   pp = &pCache->apHash[h];
@@ -642,7 +1075,7 @@ static void pcache1Rekey(
     pCache->iMaxKey = iNew;
   }
 
-  pcache1LeaveMutex();
+  pcache1LeaveMutex(pCache->pGroup);
 }
 
 /*
@@ -654,12 +1087,12 @@ static void pcache1Rekey(
 */
 static void pcache1Truncate(sqlite3_pcache *p, unsigned int iLimit){
   PCache1 *pCache = (PCache1 *)p;
-  pcache1EnterMutex();
+  pcache1EnterMutex(pCache->pGroup);
   if( iLimit<=pCache->iMaxKey ){
     pcache1TruncateUnsafe(pCache, iLimit);
     pCache->iMaxKey = iLimit-1;
   }
-  pcache1LeaveMutex();
+  pcache1LeaveMutex(pCache->pGroup);
 }
 
 /*
@@ -669,12 +1102,23 @@ static void pcache1Truncate(sqlite3_pcache *p, unsigned int iLimit){
 */
 static void pcache1Destroy(sqlite3_pcache *p){
   PCache1 *pCache = (PCache1 *)p;
-  pcache1EnterMutex();
+  PGroup *pGroup = pCache->pGroup;
+  PCache1 **pp;
+  int i;
+  sqlite3_mutex_enter(pcache1.mutex);
+  for(pp=&pcache1.pCacheList; *pp!=pCache; pp=&(*pp)->pNextCache);
+  *pp = pCache->pNextCache;
+  for(i=0; i<ArraySize(pCache->aCount); i++){
+    pcache1.aRetired[i] += pCache->aCount[i];
+  }
+  sqlite3_mutex_leave(pcache1.mutex);
+  pcache1EnterMutex(pGroup);
   pcache1TruncateUnsafe(pCache, 0);
-  pcache1.nMaxPage -= pCache->nMax;
-  pcache1.nMinPage -= pCache->nMin;
-  pcache1EnforceMaxPage();
-  pcache1LeaveMutex();
+  pGroup->nMaxPage -= pCache->nMax;
+  pGroup->nMinPage -= pCache->nMin;
+  pcache1EnforceMaxPage(pGroup);
+  pcache1LeaveMutex(pGroup);
+  sqlite3_free(pCache->aGhost);
   sqlite3_free(pCache->apHash);
   sqlite3_free(pCache);
 }
@@ -715,23 +1159,69 @@ int sqlite3PcacheReleaseMemory(int nReq){
   int nFree = 0;
   if( pcache1.pStart==0 ){
     PgHdr1 *p;
-    pcache1EnterMutex();
-    while( (nReq<0 || nFree<nReq) && (p=pcache1.pLruTail) ){
+    pcache1EnterMutex(&pcache1.grp);
+    while( (nReq<0 || nFree<nReq) && (p=pcache1Victim(&pcache1.grp))!=0 ){
       nFree += sqlite3MallocSize(p);
-      pcache1PinPage(p);
-      pcache1RemoveFromHash(p);
+      pcache1RemoveVictim(p);
       pcache1FreePage(p);
     }
-    pcache1LeaveMutex();
+    pcache1LeaveMutex(&pcache1.grp);
   }
   return nFree;
 }
 #endif /* SQLITE_ENABLE_MEMORY_MANAGEMENT */
 
+/*
+** Return the SQLITE_STATUS_PCACHE_* counter op, summed over all caches
+** that exist or have existed since the last reset. If resetFlag is true,
+** the counter is then reset to zero.
+**
+** The counters of other caches are read without their PGroup mutex,
+** which assumes that reading an aligned 32-bit integer is atomic, as
+** sqlite3_status() does.
+*/
+int sqlite3PcacheCounter(int op, int resetFlag){
+  int i = op - SQLITE_STATUS_PCACHE_HIT;
+  int n;
+  PCache1 *p;
+  assert( i>=0 && i<ArraySize(pcache1.aBase) );
+  sqlite3_mutex_enter(pcache1.mutex);
+  n = pcache1.aRetired[i];
+  for(p=pcache1.pCacheList; p; p=p->pNextCache){
+    n += p->aCount[i];
+  }
+  if( resetFlag ){
+    int nBase = pcache1.aBase[i];
+    pcache1.aBase[i] = n;
+    n -= nBase;
+  }else{
+    n -= pcache1.aBase[i];
+  }
+  sqlite3_mutex_leave(pcache1.mutex);
+  return n;
+}
+
+/*
+** Return the number of pages recycled from cache p since it was created
+** or the count was last reset. If resetFlag is true, reset the count to
+** zero. Zero is returned if p was not created by this module.
+*/
+int sqlite3Pcache1Evicted(sqlite3_pcache *p, int resetFlag){
+  PCache1 *pCache = (PCache1 *)p;
+  int n;
+  if( sqlite3GlobalConfig.pcache.xFetch!=pcache1Fetch ) return 0;
+  pcache1EnterMutex(pCache->pGroup);
+  n = pCache->nEvict;
+  if( resetFlag ) pCache->nEvict = 0;
+  pcache1LeaveMutex(pCache->pGroup);
+  return n;
+}
+
 #ifdef SQLITE_TEST
 /*
 ** This function is used by test procedures to inspect the internal state
-** of the global cache.
+** of the global cache. Caches that have a private PGroup (mode (1)) are
+** not included.
 */
 void sqlite3PcacheStats(
   int *pnCurrent,      /* OUT: Total number of pages cached */
@@ -741,12 +1231,12 @@ void sqlite3PcacheStats(
 ){
   PgHdr1 *p;
   int nRecyclable = 0;
-  for(p=pcache1.pLruHead; p; p=p->pLruNext){
+  for(p=pcache1.grp.pLruHead; p; p=p->pLruNext){
     nRecyclable++;
   }
-  *pnCurrent = pcache1.nCurrentPage;
-  *pnMax = pcache1.nMaxPage;
-  *pnMin = pcache1.nMinPage;
+  *pnCurrent = pcache1.grp.nCurrentPage;
+  *pnMax = pcache1.grp.nMaxPage;
+  *pnMin = pcache1.grp.nMinPage;
   *pnRecyclable = nRecyclable;
 }
 #endif
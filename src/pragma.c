@@ -175,6 +175,9 @@ static int flagPragma(Parse *pParse, const char *zLeft, const char *zRight){
     { "legacy_file_format",       SQLITE_LegacyFileFmt },
     { "fullfsync",                SQLITE_FullFSync     },
     { "reverse_unordered_selects", SQLITE_ReverseOrder  },
+#ifndef SQLITE_OMIT_AUTOMATIC_INDEX
+    { "automatic_index",          SQLITE_AutoIndex     },
+#endif
 #ifdef SQLITE_DEBUG
     { "sql_trace",                SQLITE_SqlTrace      },
     { "vdbe_listing",             SQLITE_VdbeListing   },
@@ -224,6 +227,26 @@ static int flagPragma(Parse *pParse, const char *zLeft, const char *zRight){
 }
 #endif /* SQLITE_OMIT_FLAG_PRAGMAS */
 
+#ifndef SQLITE_OMIT_PAGER_PRAGMAS
+/*
+** Return the name of journal mode eMode, one of the PAGER_JOURNALMODE_XXX
+** values other than _QUERY.
+*/
+const char *sqlite3JournalModename(int eMode){
+  static char * const azModeName[] = {
+    "delete", "persist", "off", "truncate", "memory", "wal"
+  };
+  assert( PAGER_JOURNALMODE_DELETE==0 );
+  assert( PAGER_JOURNALMODE_PERSIST==1 );
+  assert( PAGER_JOURNALMODE_OFF==2 );
+  assert( PAGER_JOURNALMODE_TRUNCATE==3 );
+  assert( PAGER_JOURNALMODE_MEMORY==4 );
+  assert( PAGER_JOURNALMODE_WAL==5 );
+  assert( eMode>=0 && eMode<ArraySize(azModeName) );
+  return azModeName[eMode];
+}
+#endif
+
 /*
 ** Return a human-readable name for a constraint resolution action.
 */
@@ -464,20 +487,21 @@ void sqlite3Pragma(
 
   /*
   **  PRAGMA [database.]journal_mode
-  **  PRAGMA [database.]journal_mode = (delete|persist|off|truncate|memory)
+  **  PRAGMA [database.]journal_mode =
+  **                      (delete|persist|off|truncate|memory|wal)
   */
   if( sqlite3StrICmp(zLeft,"journal_mode")==0 ){
     int eMode;
-    static char * const azModeName[] = {
-      "delete", "persist", "off", "truncate", "memory"
-    };
 
+    sqlite3VdbeSetNumCols(v, 1);
+    sqlite3VdbeSetColName(v, 0, COLNAME_NAME, "journal_mode", SQLITE_STATIC);
     if( zRight==0 ){
       eMode = PAGER_JOURNALMODE_QUERY;
     }else{
       int n = sqlite3Strlen30(zRight);
-      eMode = sizeof(azModeName)/sizeof(azModeName[0]) - 1;
-      while( eMode>=0 && sqlite3StrNICmp(zRight, azModeName[eMode], n)!=0 ){
+      eMode = PAGER_JOURNALMODE_WAL;
+      while( eMode>=0 && sqlite3StrNICmp(zRight, 
+                             sqlite3JournalModename(eMode), n)!=0 ){
         eMode--;
       }
     }
@@ -487,8 +511,10 @@ void sqlite3Pragma(
       ** the journal-mode of the main database).
       */
       eMode = db->dfltJournalMode;
+      sqlite3VdbeAddOp4(v, OP_String8, 0, 1, 0, 
+             sqlite3JournalModename(eMode), P4_STATIC);
     }else{
-      Pager *pPager;
+      int ii;
       if( pId2->n==0 ){
         /* This indicates that no database name was specified as part
         ** of the PRAGMA command. In this case the journal-mode must be
@@ -496,30 +522,26 @@ void sqlite3Pragma(
         **
         ** Also, the sqlite3.dfltJournalMode variable is set so that
         ** any subsequently attached databases also use the specified
-        ** journal mode.
+        ** journal mode. WAL mode is recorded in the database file, so
+        ** it is never made the default.
         */
-        int ii;
         assert(pDb==&db->aDb[0]);
-        for(ii=1; ii<db->nDb; ii++){
-          if( db->aDb[ii].pBt ){
-            pPager = sqlite3BtreePager(db->aDb[ii].pBt);
-            sqlite3PagerJournalMode(pPager, eMode);
-          }
+        if( eMode!=PAGER_JOURNALMODE_WAL ){
+          db->dfltJournalMode = (u8)eMode;
+        }
+      }
+
+      /* The mode is changed when the statement runs, as changing into or
+      ** out of WAL mode requires IO. The main database is visited last,
+      ** so its journal mode is the one returned.
+      */
+      for(ii=db->nDb-1; ii>=0; ii--){
+        if( db->aDb[ii].pBt && (ii==iDb || pId2->n==0) ){
+          sqlite3VdbeUsesBtree(v, ii);
+          sqlite3VdbeAddOp3(v, OP_JournalMode, ii, 1, eMode);
         }
-        db->dfltJournalMode = (u8)eMode;
       }
-      pPager = sqlite3BtreePager(pDb->pBt);
-      eMode = sqlite3PagerJournalMode(pPager, eMode);
     }
-    assert( eMode==PAGER_JOURNALMODE_DELETE
-              || eMode==PAGER_JOURNALMODE_TRUNCATE
-              || eMode==PAGER_JOURNALMODE_PERSIST
-              || eMode==PAGER_JOURNALMODE_OFF
-              || eMode==PAGER_JOURNALMODE_MEMORY );
-    sqlite3VdbeSetNumCols(v, 1);
-    sqlite3VdbeSetColName(v, 0, COLNAME_NAME, "journal_mode", SQLITE_STATIC);
-    sqlite3VdbeAddOp4(v, OP_String8, 0, 1, 0, 
-           azModeName[eMode], P4_STATIC);
     sqlite3VdbeAddOp2(v, OP_ResultRow, 1, 1);
   }else
 
@@ -540,6 +562,151 @@ void sqlite3Pragma(
     returnSingleInt(pParse, "journal_size_limit", iLimit);
   }else
 
+  /*
+  **  PRAGMA [database.]mmap_size
+  **  PRAGMA [database.]mmap_size=N
+  **
+  ** Get or set the number of bytes of the database file that may be
+  ** memory mapped and read without copying. Zero disables memory mapped
+  ** reads. Databases with an encryption key attached are always read
+  ** through a private buffer, whatever the setting.
+  */
+  if( sqlite3StrICmp(zLeft,"mmap_size")==0 ){
+    Pager *pPager = sqlite3BtreePager(pDb->pBt);
+    i64 sz = -1;
+    if( zRight ){
+      sqlite3Atoi64(zRight, &sz);
+      if( sz<0 ) sz = 0;
+    }
+    sz = sqlite3PagerMmapLimit(pPager, sz);
+    returnSingleInt(pParse, "mmap_size", sz);
+  }else
+
+  /*
+  **  PRAGMA [database.]read_ahead
+  **  PRAGMA [database.]read_ahead=N
+  **
+  ** Get or set the number of pages read ahead of a cursor that scans a
+  ** table or index in order. Zero turns read-ahead off.
+  */
+  if( sqlite3StrICmp(zLeft,"read_ahead")==0 ){
+    Pager *pPager = sqlite3BtreePager(pDb->pBt);
+    int nPage = -1;
+    if( zRight ){
+      nPage = atoi(zRight);
+      if( nPage<0 ) nPage = 0;
+    }
+    nPage = sqlite3PagerReadaheadLimit(pPager, nPage);
+    returnSingleInt(pParse, "read_ahead", nPage);
+  }else
+
+  /*
+  **  PRAGMA [database.]fill_factor
+  **  PRAGMA [database.]fill_factor=N
+  **
+  ** Get or set the percentage of each leaf page that is filled when rows
+  ** are appended to a table or index in key order, as by an INSERT that
+  ** allocates new rowids, before a new leaf page is started. Values
+  ** outside of the range 10 to 100 are ignored. The default is 100.
+  */
+  if( sqlite3StrICmp(zLeft,"fill_factor")==0 ){
+    Btree *pBt = pDb->pBt;
+    int n = -1;
+    assert( pBt!=0 );
+    if( zRight ){
+      n = atoi(zRight);
+    }
+    n = sqlite3BtreeFillFactor(pBt, n);
+    returnSingleInt(pParse, "fill_factor", n);
+  }else
+
+  /*
+  **  PRAGMA [database.]cache_stats
+  **
+  ** Return a single row holding the page cache counters of the database
+  ** (see SQLITE_DBSTATUS_CACHE_HIT): the number of hits, misses, pages
+  ** evicted and dirty pages spilled since the database was opened. The
+  ** counters are read when the statement is prepared, so the statement
+  ** expires itself each time it is run.
+  */
+  if( sqlite3StrICmp(zLeft,"cache_stats")==0 ){
+    static const char *azCol[] = { "hit", "miss", "evict", "spill" };
+    static const int aOp[] = {
+      SQLITE_DBSTATUS_CACHE_HIT,   SQLITE_DBSTATUS_CACHE_MISS,
+      SQLITE_DBSTATUS_CACHE_EVICT, SQLITE_DBSTATUS_CACHE_SPILL
+    };
+    Pager *pPager = sqlite3BtreePager(pDb->pBt);
+    int i;
+    sqlite3VdbeSetNumCols(v, ArraySize(azCol));
+    pParse->nMem = ArraySize(azCol);
+    for(i=0; i<ArraySize(azCol); i++){
+      sqlite3VdbeSetColName(v, i, COLNAME_NAME, azCol[i], SQLITE_STATIC);
+      sqlite3VdbeAddOp2(v, OP_Integer,
+                        sqlite3PagerCacheStat(pPager, aOp[i], 0), i+1);
+    }
+    sqlite3VdbeAddOp2(v, OP_ResultRow, 1, ArraySize(azCol));
+    sqlite3VdbeAddOp1(v, OP_Expire, 1);
+  }else
+
+#ifndef SQLITE_OMIT_WAL
+  /*
+  **  PRAGMA [database.]wal_checkpoint
+  **
+  ** Copy the content of the write-ahead log back into the database file.
+  ** If no database is named, all attached databases in WAL mode are
+  ** checkpointed.
+  */
+  if( sqlite3StrICmp(zLeft, "wal_checkpoint")==0 ){
+    int ii;
+    if( sqlite3ReadSchema(pParse) ) goto pragma_out;
+    for(ii=0; ii<db->nDb; ii++){
+      if( db->aDb[ii].pBt && (ii==iDb || pId2->n==0) ){
+        sqlite3VdbeUsesBtree(v, ii);
+        sqlite3VdbeAddOp1(v, OP_Checkpoint, ii);
+      }
+    }
+  }else
+
+  /*
+  **  PRAGMA [database.]wal_autocheckpoint
+  **  PRAGMA [database.]wal_autocheckpoint = N
+  **
+  ** Get or set the number of frames the write-ahead log may grow to
+  ** before it is checkpointed automatically. Zero turns automatic
+  ** checkpoints off.
+  */
+  if( sqlite3StrICmp(zLeft, "wal_autocheckpoint")==0 ){
+    Pager *pPager = sqlite3BtreePager(pDb->pBt);
+    int nFrame = -1;
+    if( zRight ){
+      nFrame = atoi(zRight);
+      if( nFrame<0 ) nFrame = 0;
+    }
+    nFrame = sqlite3PagerWalAutocheckpoint(pPager, nFrame);
+    returnSingleInt(pParse, "wal_autocheckpoint", nFrame);
+  }else
+
+  /*
+  **  PRAGMA [database.]group_commit
+  **  PRAGMA [database.]group_commit = N
+  **
+  ** Get or set the group commit window, in microseconds. When it is not
+  ** zero, a commit in WAL mode with "synchronous=FULL" waits up to N
+  ** microseconds for other connections in the process to commit to the
+  ** same database, and one sync of the log then makes all of them durable.
+  */
+  if( sqlite3StrICmp(zLeft, "group_commit")==0 ){
+    Pager *pPager = sqlite3BtreePager(pDb->pBt);
+    int nUsec = -1;
+    if( zRight ){
+      nUsec = atoi(zRight);
+      if( nUsec<0 ) nUsec = 0;
+    }
+    nUsec = sqlite3PagerGroupCommit(pPager, nUsec);
+    returnSingleInt(pParse, "group_commit", nUsec);
+  }else
+#endif
+
 #endif /* SQLITE_OMIT_PAGER_PRAGMAS */
 
   /*
@@ -719,6 +886,26 @@ void sqlite3Pragma(
     }
   }else
 
+  /*
+  **   PRAGMA threads
+  **   PRAGMA threads = N
+  **
+  ** Return or set the number of worker threads that a large sort may use
+  ** in addition to the thread running the statement.  Zero, the default,
+  ** sorts in the calling thread only.  N is limited to the compile-time
+  ** value SQLITE_MAX_WORKER_THREADS, which is zero in builds that are
+  ** not threadsafe.
+  */
+  if( sqlite3StrICmp(zLeft, "threads")==0 ){
+    if( zRight ){
+      int n = atoi(zRight);
+      if( n<0 ) n = 0;
+      if( n>SQLITE_MAX_WORKER_THREADS ) n = SQLITE_MAX_WORKER_THREADS;
+      db->nWorker = (u8)n;
+    }
+    returnSingleInt(pParse, "threads", db->nWorker);
+  }else
+
 #if !defined(SQLITE_ENABLE_LOCKING_STYLE)
 #  if defined(__APPLE__)
 #    define SQLITE_ENABLE_LOCKING_STYLE 1
@@ -1370,6 +1557,137 @@ void sqlite3Pragma(
   if( sqlite3StrICmp(zLeft, "rekey")==0 && zRight ){
     sqlite3_rekey(db, zRight, sqlite3Strlen30(zRight));
   }else
+  /*
+  **  PRAGMA [database.]cipher
+  **  PRAGMA [database.]cipher = aes-256-cfb|aes-256-ctr|aes-256-xts
+  **
+  ** Select the cipher used to encrypt pages after the key has been set.
+  ** Once any page of a database has been read or written its cipher can
+  ** no longer be changed. Without a database name the cipher of every
+  ** keyed database is set.
+  ** With no argument the cipher of the named (or main) database is
+  ** returned.
+  */
+  if( sqlite3StrICmp(zLeft, "cipher")==0 ){
+    extern int sqlite3CodecSetCipher(sqlite3*, int, const char*);
+    extern const char *sqlite3CodecGetCipher(sqlite3*, int);
+    if( zRight ){
+      int ii;
+      for(ii=0; ii<db->nDb; ii++){
+        if( pId2->n==0 ? sqlite3CodecGetCipher(db, ii)==0 : ii!=iDb ) continue;
+        if( db->aDb[ii].pBt && sqlite3CodecSetCipher(db, ii, zRight)!=SQLITE_OK ){
+          sqlite3ErrorMsg(pParse, "unable to set cipher: %s", zRight);
+          goto pragma_out;
+        }
+      }
+    }else{
+      const char *zCipher = sqlite3CodecGetCipher(db, iDb);
+      if( zCipher ){
+        sqlite3VdbeSetNumCols(v, 1);
+        sqlite3VdbeSetColName(v, 0, COLNAME_NAME, "cipher", SQLITE_STATIC);
+        sqlite3VdbeAddOp4(v, OP_String8, 0, 1, 0, zCipher, P4_STATIC);
+        sqlite3VdbeAddOp2(v, OP_ResultRow, 1, 1);
+      }
+    }
+  }else
+  /*
+  **  PRAGMA [database.]kdf_iter
+  **  PRAGMA [database.]kdf_iter = N
+  **  PRAGMA [database.]kdf_algorithm
+  **  PRAGMA [database.]kdf_algorithm = PBKDF2-SHA1|PBKDF2-SHA256|PBKDF2-SHA512
+  **
+  ** Set the PBKDF2 iteration count or PRF used to derive the key from
+  ** the passphrase. Like PRAGMA cipher, these must follow the key and 
+  ** precede any access to the database, and apply to every keyed
+  ** database unless a database name is given.
+  */
+  if( sqlite3StrICmp(zLeft, "kdf_iter")==0
+   || sqlite3StrICmp(zLeft, "kdf_algorithm")==0 ){
+    extern int sqlite3CodecSetKdfIter(sqlite3*, int, int);
+    extern int sqlite3CodecGetKdfIter(sqlite3*, int);
+    extern int sqlite3CodecSetKdfAlgorithm(sqlite3*, int, const char*);
+    extern const char *sqlite3CodecGetKdfAlgorithm(sqlite3*, int);
+    int isIter = zLeft[4]=='i' || zLeft[4]=='I';
+    if( zRight ){
+      int ii;
+      for(ii=0; ii<db->nDb; ii++){
+        if( pId2->n==0 ? sqlite3CodecGetKdfIter(db, ii)==0 : ii!=iDb ) continue;
+        if( db->aDb[ii].pBt && (isIter ?
+              sqlite3CodecSetKdfIter(db, ii, atoi(zRight)) :
+              sqlite3CodecSetKdfAlgorithm(db, ii, zRight))!=SQLITE_OK ){
+          sqlite3ErrorMsg(pParse, "unable to set %s: %s", zLeft, zRight);
+          goto pragma_out;
+        }
+      }
+    }else if( isIter ){
+      int iter = sqlite3CodecGetKdfIter(db, iDb);
+      if( iter>0 ) returnSingleInt(pParse, "kdf_iter", iter);
+    }else{
+      const char *zKdf = sqlite3CodecGetKdfAlgorithm(db, iDb);
+      if( zKdf ){
+        sqlite3VdbeSetNumCols(v, 1);
+        sqlite3VdbeSetColName(v, 0, COLNAME_NAME, "kdf_algorithm", SQLITE_STATIC);
+        sqlite3VdbeAddOp4(v, OP_String8, 0, 1, 0, zKdf, P4_STATIC);
+        sqlite3VdbeAddOp2(v, OP_ResultRow, 1, 1);
+      }
+    }
+  }else
+  /*
+  **  PRAGMA [database.]cipher_hmac
+  **  PRAGMA [database.]cipher_hmac = off|HMAC-SHA1|HMAC-SHA256
+  **
+  ** Store an HMAC of each page in its reserved space and verify it when
+  ** the page is read. Like PRAGMA cipher, this must follow the key and
+  ** precede any access to the database; a later change is refused.
+  */
+  if( sqlite3StrICmp(zLeft, "cipher_hmac")==0 ){
+    extern int sqlite3CodecSetHmac(sqlite3*, int, const char*);
+    extern const char *sqlite3CodecGetHmac(sqlite3*, int);
+    if( zRight ){
+      int ii;
+      for(ii=0; ii<db->nDb; ii++){
+        if( pId2->n==0 ? sqlite3CodecGetHmac(db, ii)==0 : ii!=iDb ) continue;
+        if( db->aDb[ii].pBt && sqlite3CodecSetHmac(db, ii, zRight)!=SQLITE_OK ){
+          sqlite3ErrorMsg(pParse, "unable to set cipher_hmac: %s", zRight);
+          goto pragma_out;
+        }
+      }
+    }else{
+      const char *zHmac = sqlite3CodecGetHmac(db, iDb);
+      if( zHmac ){
+        sqlite3VdbeSetNumCols(v, 1);
+        sqlite3VdbeSetColName(v, 0, COLNAME_NAME, "cipher_hmac", SQLITE_STATIC);
+        sqlite3VdbeAddOp4(v, OP_String8, 0, 1, 0, zHmac, P4_STATIC);
+        sqlite3VdbeAddOp2(v, OP_ResultRow, 1, 1);
+      }
+    }
+  }else
+  /*
+  **  PRAGMA [database.]cipher_hmac_check
+  **  PRAGMA [database.]cipher_hmac_check = ON|OFF
+  **
+  ** Turning the check off skips verification of the page HMAC on read,
+  ** for storage that is trusted not to be tampered with. Pages written
+  ** are still authenticated. This may be changed at any time.
+  */
+  if( sqlite3StrICmp(zLeft, "cipher_hmac_check")==0 ){
+    extern int sqlite3CodecSetHmacCheck(sqlite3*, int, int);
+    extern int sqlite3CodecGetHmacCheck(sqlite3*, int);
+    if( zRight ){
+      int ii;
+      for(ii=0; ii<db->nDb; ii++){
+        if( pId2->n==0 ? sqlite3CodecGetHmacCheck(db, ii)<0 : ii!=iDb ) continue;
+        if( db->aDb[ii].pBt
+         && sqlite3CodecSetHmacCheck(db, ii, getBoolean(zRight))!=SQLITE_OK ){
+          sqlite3ErrorMsg(pParse, "unable to set cipher_hmac_check: %s", zRight);
+          goto pragma_out;
+        }
+      }
+    }else{
+      int check = sqlite3CodecGetHmacCheck(db, iDb);
+      if( check>=0 ) returnSingleInt(pParse, "cipher_hmac_check", check);
+    }
+  }else
   if( zRight && (sqlite3StrICmp(zLeft, "hexkey")==0 ||
                  sqlite3StrICmp(zLeft, "hexrekey")==0) ){
     int i, h1, h2;
@@ -1683,6 +1683,8 @@ static int dump_callback(void *pArg, int nArg, char **azArg, char **azCol){
     fprintf(p->out, "DELETE FROM sqlite_sequence;\n");
   }else if( strcmp(zTable, "sqlite_stat1")==0 ){
     fprintf(p->out, "ANALYZE sqlite_master;\n");
+  }else if( strcmp(zTable, "sqlite_stat2")==0 ){
+    /* Created along with sqlite_stat1 by the ANALYZE above */
   }else if( strncmp(zTable, "sqlite_", 7)==0 ){
     return 0;
   }else if( strncmp(zSql, "CREATE VIRTUAL TABLE", 20)==0 ){
@@ -22,8 +22,8 @@
 */
 typedef struct sqlite3StatType sqlite3StatType;
 static SQLITE_WSD struct sqlite3StatType {
-  int nowValue[9];         /* Current value */
-  int mxValue[9];          /* Maximum value */
+  int nowValue[10];        /* Current value */
+  int mxValue[10];         /* Maximum value */
 } sqlite3Stat = { {0,}, {0,} };
 
 
@@ -84,6 +84,12 @@ void sqlite3StatusSet(int op, int X){
 */
 int sqlite3_status(int op, int *pCurrent, int *pHighwater, int resetFlag){
   wsdStatInit;
+  if( op>=SQLITE_STATUS_PCACHE_HIT && op<=SQLITE_STATUS_PCACHE_GHOST_HIT ){
+    /* These are counted by each page cache, see pcache1.c */
+    *pCurrent = sqlite3PcacheCounter(op, resetFlag);
+    *pHighwater = 0;
+    return SQLITE_OK;
+  }
   if( op<0 || op>=ArraySize(wsdStat.nowValue) ){
     return SQLITE_MISUSE;
   }
@@ -114,6 +120,49 @@ int sqlite3_db_status(
       }
       break;
     }
+#ifndef SQLITE_OMIT_WAL
+    case SQLITE_DBSTATUS_COMMIT_WAIT:
+    case SQLITE_DBSTATUS_COMMIT_BATCH: {
+      int i;
+      *pCurrent = 0;
+      *pHighwater = 0;
+      sqlite3_mutex_enter(db->mutex);
+      sqlite3BtreeEnterAll(db);
+      for(i=0; i<db->nDb; i++){
+        Btree *pBt = db->aDb[i].pBt;
+        if( pBt ){
+          Pager *pPager = sqlite3BtreePager(pBt);
+          int iCur, iHiwtr;
+          sqlite3PagerCommitStatus(pPager, op, &iCur, &iHiwtr, resetFlag);
+          if( iCur>*pCurrent ) *pCurrent = iCur;
+          if( iHiwtr>*pHighwater ) *pHighwater = iHiwtr;
+        }
+      }
+      sqlite3BtreeLeaveAll(db);
+      sqlite3_mutex_leave(db->mutex);
+      break;
+    }
+#endif
+    case SQLITE_DBSTATUS_CACHE_HIT:
+    case SQLITE_DBSTATUS_CACHE_MISS:
+    case SQLITE_DBSTATUS_CACHE_EVICT:
+    case SQLITE_DBSTATUS_CACHE_SPILL: {
+      int i;
+      *pCurrent = 0;
+      *pHighwater = 0;
+      sqlite3_mutex_enter(db->mutex);
+      sqlite3BtreeEnterAll(db);
+      for(i=0; i<db->nDb; i++){
+        Btree *pBt = db->aDb[i].pBt;
+        if( pBt ){
+          Pager *pPager = sqlite3BtreePager(pBt);
+          *pCurrent += sqlite3PagerCacheStat(pPager, op, resetFlag);
+        }
+      }
+      sqlite3BtreeLeaveAll(db);
+      sqlite3_mutex_leave(db->mutex);
+      break;
+    }
     default: {
       return SQLITE_ERROR;
     }
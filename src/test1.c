@@ -683,6 +683,36 @@ static int test_key(
   return TCL_OK;
 }
 
+/*
+** Usage:  sqlite3_key_v2 DB KEY CIPHER
+**
+** Set the codec key and cipher.
+*/
+static int test_key_v2(
+  void *NotUsed,
+  Tcl_Interp *interp,    /* The TCL interpreter that invoked this command */
+  int argc,              /* Number of arguments */
+  char **argv            /* Text of each argument */
+){
+  sqlite3 *db;
+  const char *zKey;
+  int nKey;
+  int rc = SQLITE_OK;
+  if( argc!=4 ){
+    Tcl_AppendResult(interp, "wrong # args: should be \"", argv[0],
+       " DB KEY CIPHER\"", 0);
+    return TCL_ERROR;
+  }
+  if( getDbPointer(interp, argv[1], &db) ) return TCL_ERROR;
+  zKey = argv[2];
+  nKey = strlen(zKey);
+#ifdef SQLITE_HAS_CODEC
+  rc = sqlite3_key_v2(db, zKey, nKey, argv[3]);
+#endif
+  Tcl_SetResult(interp, (char *)t1ErrorName(rc), TCL_STATIC);
+  return TCL_OK;
+}
+
 /*
 ** Usage:  sqlite3_rekey DB KEY
 **
@@ -711,6 +741,80 @@ static int test_rekey(
   return TCL_OK;
 }
 
+/*
+** Usage:  sqlite3_rekey_init DB DBNAME KEY
+**
+** Start an online rekey. Returns a handle for the commands below, or an
+** empty string if the handle could not be created.
+*/
+static int test_rekey_init(
+  void *NotUsed,
+  Tcl_Interp *interp,    /* The TCL interpreter that invoked this command */
+  int argc,              /* Number of arguments */
+  char **argv            /* Text of each argument */
+){
+  sqlite3 *db;
+  void *p = 0;
+  char zBuf[100];
+  if( argc!=4 ){
+    Tcl_AppendResult(interp, "wrong # args: should be \"", argv[0],
+       " DB DBNAME KEY\"", 0);
+    return TCL_ERROR;
+  }
+  if( getDbPointer(interp, argv[1], &db) ) return TCL_ERROR;
+#ifdef SQLITE_HAS_CODEC
+  p = sqlite3_rekey_init(db, argv[2], argv[3], strlen(argv[3]));
+#endif
+  if( p ){
+    if( sqlite3TestMakePointerStr(interp, zBuf, p) ) return TCL_ERROR;
+    Tcl_AppendResult(interp, zBuf, 0);
+  }
+  return TCL_OK;
+}
+
+/*
+** Usage:  sqlite3_rekey_op step HANDLE NPAGE
+**         sqlite3_rekey_op finish HANDLE
+**         sqlite3_rekey_op remaining HANDLE
+**         sqlite3_rekey_op pagecount HANDLE
+**
+** Drive an online rekey started by sqlite3_rekey_init.
+*/
+static int test_rekey_op(
+  void *NotUsed,
+  Tcl_Interp *interp,    /* The TCL interpreter that invoked this command */
+  int argc,              /* Number of arguments */
+  char **argv            /* Text of each argument */
+){
+  int nPage = 0;
+  if( argc<3 || (strcmp(argv[1], "step")==0 && argc!=4) ){
+    Tcl_AppendResult(interp, "wrong # args: should be \"", argv[0],
+       " step|finish|remaining|pagecount HANDLE ?NPAGE?\"", 0);
+    return TCL_ERROR;
+  }
+  if( argc==4 && Tcl_GetInt(interp, argv[3], &nPage) ) return TCL_ERROR;
+#ifdef SQLITE_HAS_CODEC
+  {
+    sqlite3_rekey_op *p = (sqlite3_rekey_op*)sqlite3TestTextToPtr(argv[2]);
+    if( strcmp(argv[1], "step")==0 ){
+      Tcl_SetResult(interp, (char *)t1ErrorName(sqlite3_rekey_step(p, nPage)),
+                    TCL_STATIC);
+    }else if( strcmp(argv[1], "finish")==0 ){
+      Tcl_SetResult(interp, (char *)t1ErrorName(sqlite3_rekey_finish(p)),
+                    TCL_STATIC);
+    }else if( strcmp(argv[1], "remaining")==0 ){
+      Tcl_SetObjResult(interp, Tcl_NewIntObj(sqlite3_rekey_remaining(p)));
+    }else if( strcmp(argv[1], "pagecount")==0 ){
+      Tcl_SetObjResult(interp, Tcl_NewIntObj(sqlite3_rekey_pagecount(p)));
+    }else{
+      Tcl_AppendResult(interp, "unknown method: ", argv[1], 0);
+      return TCL_ERROR;
+    }
+  }
+#endif
+  return TCL_OK;
+}
+
 /*
 ** Usage:  sqlite3_close DB
 **
@@ -4885,6 +4989,7 @@ int Sqlitetest1_Init(Tcl_Interp *interp){
   extern int sqlite3_interrupt_count;
   extern int sqlite3_open_file_count;
   extern int sqlite3_sort_count;
+  extern int sqlite3_sort_run_count;
   extern int sqlite3_current_time;
 #if SQLITE_OS_UNIX && defined(__APPLE__)
   extern int sqlite3_hostid_num;
@@ -4926,6 +5031,9 @@ int Sqlitetest1_Init(Tcl_Interp *interp){
      { "sqlite_bind",                   (Tcl_CmdProc*)test_bind             },
      { "breakpoint",                    (Tcl_CmdProc*)test_breakpoint       },
      { "sqlite3_key",                   (Tcl_CmdProc*)test_key              },
+     { "sqlite3_key_v2",                (Tcl_CmdProc*)test_key_v2           },
+     { "sqlite3_rekey_init",            (Tcl_CmdProc*)test_rekey_init       },
+     { "sqlite3_rekey_op",              (Tcl_CmdProc*)test_rekey_op         },
      { "sqlite3_rekey",                 (Tcl_CmdProc*)test_rekey            },
      { "sqlite_set_magic",              (Tcl_CmdProc*)sqlite_set_magic      },
      { "sqlite3_interrupt",             (Tcl_CmdProc*)test_interrupt        },
@@ -5074,6 +5182,9 @@ int Sqlitetest1_Init(Tcl_Interp *interp){
   extern int sqlite3_pager_readdb_count;
   extern int sqlite3_pager_writedb_count;
   extern int sqlite3_pager_writej_count;
+  extern int sqlite3_pager_readahead_count;
+  extern int sqlite3_pager_writev_count;
+  extern int sqlite3_pager_shared_count;
 #if defined(__linux__) && defined(SQLITE_TEST) && SQLITE_THREADSAFE
   extern int threadsOverrideEachOthersLocks;
 #endif
@@ -5104,6 +5215,8 @@ int Sqlitetest1_Init(Tcl_Interp *interp){
       (char*)&sqlite3_search_count, TCL_LINK_INT);
   Tcl_LinkVar(interp, "sqlite_sort_count", 
       (char*)&sqlite3_sort_count, TCL_LINK_INT);
+  Tcl_LinkVar(interp, "sqlite_sort_run_count", 
+      (char*)&sqlite3_sort_run_count, TCL_LINK_INT);
   Tcl_LinkVar(interp, "sqlite3_max_blobsize", 
       (char*)&sqlite3_max_blobsize, TCL_LINK_INT);
   Tcl_LinkVar(interp, "sqlite_like_count", 
@@ -5126,6 +5239,19 @@ int Sqlitetest1_Init(Tcl_Interp *interp){
       (char*)&sqlite3_pager_writedb_count, TCL_LINK_INT);
   Tcl_LinkVar(interp, "sqlite3_pager_writej_count",
       (char*)&sqlite3_pager_writej_count, TCL_LINK_INT);
+  Tcl_LinkVar(interp, "sqlite3_pager_readahead_count",
+      (char*)&sqlite3_pager_readahead_count, TCL_LINK_INT);
+  Tcl_LinkVar(interp, "sqlite3_pager_writev_count",
+      (char*)&sqlite3_pager_writev_count, TCL_LINK_INT);
+  Tcl_LinkVar(interp, "sqlite3_pager_shared_count",
+      (char*)&sqlite3_pager_shared_count, TCL_LINK_INT);
+#ifdef SQLITE_HAS_CODEC
+  {
+    extern int sqlite3_codec_kdf_hit_count;
+    Tcl_LinkVar(interp, "sqlite3_codec_kdf_hit_count",
+        (char*)&sqlite3_codec_kdf_hit_count, TCL_LINK_INT);
+  }
+#endif
 #ifndef SQLITE_OMIT_UTF16
   Tcl_LinkVar(interp, "unaligned_string_counter",
       (char*)&unaligned_string_counter, TCL_LINK_INT);
@@ -915,14 +915,17 @@ static int test_config_scratch(
 }
 
 /*
-** Usage:    sqlite3_config_pagecache SIZE N
+** Usage:    sqlite3_config_pagecache SIZE N ?MAPPED?
 **
 ** Set the page-cache memory buffer using SQLITE_CONFIG_PAGECACHE.
 ** The buffer is static and is of limited size.  N might be
 ** adjusted downward as needed to accomodate the requested size.
 ** The revised value of N is returned.
 **
-** A negative SIZE causes the buffer pointer to be NULL.
+** A negative SIZE causes the buffer pointer to be NULL, with -SIZE and N
+** passed as the size and number of buffers. If MAPPED is
+** true, SQLITE_CONFIG_PAGECACHE_MAP is used instead, so that SQLite maps
+** the buffer itself.
 */
 static int test_config_pagecache(
   void * clientData,
@@ -931,18 +934,25 @@ static int test_config_pagecache(
   Tcl_Obj *CONST objv[]
 ){
   int sz, N, rc;
+  int isMapped = 0;
   Tcl_Obj *pResult;
   static char *buf = 0;
-  if( objc!=3 ){
-    Tcl_WrongNumArgs(interp, 1, objv, "SIZE N");
+  if( objc!=3 && objc!=4 ){
+    Tcl_WrongNumArgs(interp, 1, objv, "SIZE N ?MAPPED?");
     return TCL_ERROR;
   }
   if( Tcl_GetIntFromObj(interp, objv[1], &sz) ) return TCL_ERROR;
   if( Tcl_GetIntFromObj(interp, objv[2], &N) ) return TCL_ERROR;
+  if( objc==4 && Tcl_GetBooleanFromObj(interp, objv[3], &isMapped) ){
+    return TCL_ERROR;
+  }
   free(buf);
   if( sz<0 ){
     buf = 0;
-    rc = sqlite3_config(SQLITE_CONFIG_PAGECACHE, 0, 0, 0);
+    rc = sqlite3_config(SQLITE_CONFIG_PAGECACHE, 0, -sz, N);
+  }else if( isMapped ){
+    buf = 0;
+    rc = sqlite3_config(SQLITE_CONFIG_PAGECACHE_MAP, sz, N);
   }else{
     buf = malloc( sz*N );
     rc = sqlite3_config(SQLITE_CONFIG_PAGECACHE, buf, sz, N);
@@ -1022,6 +1032,33 @@ static int test_config_memstatus(
   return TCL_OK;
 }
 
+/*
+** Usage:    sqlite3_config_pcache_policy  POLICY
+**
+** Select the replacement policy of the default page cache using
+** SQLITE_CONFIG_PCACHE_POLICY. POLICY is "lru" or "2q".
+*/
+static int test_config_pcache_policy(
+  void * clientData,
+  Tcl_Interp *interp,
+  int objc,
+  Tcl_Obj *CONST objv[]
+){
+  static const char *azPolicy[] = { "lru", "2q", 0 };
+  int iPolicy, rc;
+  if( objc!=2 ){
+    Tcl_WrongNumArgs(interp, 1, objv, "POLICY");
+    return TCL_ERROR;
+  }
+  if( Tcl_GetIndexFromObj(interp, objv[1], azPolicy, "policy", 0, &iPolicy) ){
+    return TCL_ERROR;
+  }
+  rc = sqlite3_config(SQLITE_CONFIG_PCACHE_POLICY,
+      iPolicy==0 ? SQLITE_PCACHE_POLICY_LRU : SQLITE_PCACHE_POLICY_2Q);
+  Tcl_SetObjResult(interp, Tcl_NewIntObj(rc));
+  return TCL_OK;
+}
+
 /*
 ** Usage:    sqlite3_config_lookaside  SIZE  COUNT
 **
@@ -1053,6 +1090,54 @@ static int test_config_lookaside(
   return TCL_OK;
 }
 
+/*
+** Usage:    sqlite3_config_codec_threads  NTHREAD
+**
+** Set the number of codec worker threads. Returns the previous setting.
+*/
+static int test_config_codec_threads(
+  void * clientData,
+  Tcl_Interp *interp,
+  int objc,
+  Tcl_Obj *CONST objv[]
+){
+  int nThread;
+  if( objc!=2 ){
+    Tcl_WrongNumArgs(interp, 1, objv, "NTHREAD");
+    return TCL_ERROR;
+  }
+  if( Tcl_GetIntFromObj(interp, objv[1], &nThread) ) return TCL_ERROR;
+#ifdef SQLITE_HAS_CODEC
+  Tcl_SetObjResult(interp, Tcl_NewIntObj(sqlite3GlobalConfig.nCodecThread));
+  sqlite3_config(SQLITE_CONFIG_CODEC_THREADS, nThread);
+#endif
+  return TCL_OK;
+}
+
+
+/*
+** Usage:    sqlite3_config_codec_kdf_cache  NENTRY  TTL
+**
+** Configure the derived key cache of the codec.
+*/
+static int test_config_codec_kdf_cache(
+  void * clientData,
+  Tcl_Interp *interp,
+  int objc,
+  Tcl_Obj *CONST objv[]
+){
+  int nEntry, nTtl;
+  if( objc!=3 ){
+    Tcl_WrongNumArgs(interp, 1, objv, "NENTRY TTL");
+    return TCL_ERROR;
+  }
+  if( Tcl_GetIntFromObj(interp, objv[1], &nEntry) ) return TCL_ERROR;
+  if( Tcl_GetIntFromObj(interp, objv[2], &nTtl) ) return TCL_ERROR;
+#ifdef SQLITE_HAS_CODEC
+  sqlite3_config(SQLITE_CONFIG_CODEC_KDF_CACHE, nEntry, nTtl);
+#endif
+  return TCL_OK;
+}
 
 /*
 ** Usage:    sqlite3_db_config_lookaside  CONNECTION  BUFID  SIZE  COUNT
@@ -1239,6 +1324,10 @@ static int test_status(
     { "SQLITE_STATUS_SCRATCH_OVERFLOW",    SQLITE_STATUS_SCRATCH_OVERFLOW    },
     { "SQLITE_STATUS_SCRATCH_SIZE",        SQLITE_STATUS_SCRATCH_SIZE        },
     { "SQLITE_STATUS_PARSER_STACK",        SQLITE_STATUS_PARSER_STACK        },
+    { "SQLITE_STATUS_GROUP_COMMIT",        SQLITE_STATUS_GROUP_COMMIT        },
+    { "SQLITE_STATUS_PCACHE_HIT",          SQLITE_STATUS_PCACHE_HIT          },
+    { "SQLITE_STATUS_PCACHE_MISS",         SQLITE_STATUS_PCACHE_MISS         },
+    { "SQLITE_STATUS_PCACHE_GHOST_HIT",    SQLITE_STATUS_PCACHE_GHOST_HIT    },
   };
   Tcl_Obj *pResult;
   if( objc!=3 ){
@@ -1289,6 +1378,12 @@ static int test_db_status(
     int op;
   } aOp[] = {
     { "SQLITE_DBSTATUS_LOOKASIDE_USED",    SQLITE_DBSTATUS_LOOKASIDE_USED   },
+    { "SQLITE_DBSTATUS_COMMIT_WAIT",       SQLITE_DBSTATUS_COMMIT_WAIT      },
+    { "SQLITE_DBSTATUS_COMMIT_BATCH",      SQLITE_DBSTATUS_COMMIT_BATCH     },
+    { "SQLITE_DBSTATUS_CACHE_HIT",         SQLITE_DBSTATUS_CACHE_HIT        },
+    { "SQLITE_DBSTATUS_CACHE_MISS",        SQLITE_DBSTATUS_CACHE_MISS       },
+    { "SQLITE_DBSTATUS_CACHE_EVICT",       SQLITE_DBSTATUS_CACHE_EVICT      },
+    { "SQLITE_DBSTATUS_CACHE_SPILL",       SQLITE_DBSTATUS_CACHE_SPILL      },
   };
   Tcl_Obj *pResult;
   if( objc!=4 ){
@@ -1374,8 +1469,11 @@ int Sqlitetest_malloc_Init(Tcl_Interp *interp){
      { "sqlite3_config_heap",        test_config_heap              ,0 },
      { "sqlite3_config_memstatus",   test_config_memstatus         ,0 },
      { "sqlite3_config_lookaside",   test_config_lookaside         ,0 },
+     { "sqlite3_config_pcache_policy",test_config_pcache_policy    ,0 },
      { "sqlite3_config_error",       test_config_error             ,0 },
      { "sqlite3_db_config_lookaside",test_db_config_lookaside      ,0 },
+     { "sqlite3_config_codec_threads",test_config_codec_threads    ,0 },
+     { "sqlite3_config_codec_kdf_cache",test_config_codec_kdf_cache,0 },
      { "sqlite3_dump_memsys3",       test_dump_memsys3             ,3 },
      { "sqlite3_dump_memsys5",       test_dump_memsys3             ,5 },
   };
@@ -0,0 +1,124 @@
+/*
+** 2009 May 12
+**
+** The author disclaims copyright to this source code.  In place of
+** a legal notice, here is a blessing:
+**
+**    May you do good and not evil.
+**    May you find forgiveness for yourself and forgive others.
+**    May you share freely, never taking more than you give.
+**
+*************************************************************************
+**
+** This file presents a simple cross-platform threading interface for
+** use internally by SQLite.  It is used by the sorter (vdbesort.c) to
+** run its worker threads.
+**
+** A "thread" is created using sqlite3ThreadCreate().  The thread runs
+** independently of its creator until it is joined using
+** sqlite3ThreadJoin(), at which point it terminates and the value it
+** returned is handed back to the joiner.
+**
+** Threads do not have to be real.  On platforms without thread support,
+** or in builds that are not threadsafe, sqlite3ThreadCreate() runs the
+** task to completion in the calling thread and sqlite3ThreadJoin()
+** merely returns the result.  A task must therefore never wait for
+** its creator.
+*/
+#include "sqliteInt.h"
+
+#if SQLITE_OS_UNIX && SQLITE_THREADSAFE && SQLITE_MAX_WORKER_THREADS>0
+/********************************* Unix Pthreads ****************************/
+#define SQLITE_THREADS_IMPLEMENTED 1  /* Prevent the single-thread code below */
+#include <pthread.h>
+
+/* A running thread */
+struct SQLiteThread {
+  pthread_t tid;                 /* Thread ID */
+  int done;                      /* Set to true when thread finishes */
+  void *pOut;                    /* Result returned by the thread */
+};
+
+/* Create a new thread */
+int sqlite3ThreadCreate(
+  SQLiteThread **ppThread,       /* OUT: Write the thread object here */
+  void *(*xTask)(void*),         /* Routine to run in a separate thread */
+  void *pIn                      /* Argument passed into xTask() */
+){
+  SQLiteThread *p;
+
+  assert( ppThread!=0 );
+  assert( xTask!=0 );
+  *ppThread = 0;
+  p = sqlite3MallocZero(sizeof(*p));
+  if( p==0 ) return SQLITE_NOMEM;
+  if( pthread_create(&p->tid, 0, xTask, pIn)!=0 ){
+    /* If no thread can be started, do the work in this one. */
+    p->done = 1;
+    p->pOut = xTask(pIn);
+  }
+  *ppThread = p;
+  return SQLITE_OK;
+}
+
+/* Get the results of the thread */
+int sqlite3ThreadJoin(SQLiteThread *p, void **ppOut){
+  int rc;
+
+  assert( ppOut!=0 );
+  if( p==0 ) return SQLITE_NOMEM;
+  if( p->done ){
+    *ppOut = p->pOut;
+    rc = SQLITE_OK;
+  }else{
+    rc = pthread_join(p->tid, ppOut) ? SQLITE_ERROR : SQLITE_OK;
+  }
+  sqlite3_free(p);
+  return rc;
+}
+
+#endif /* SQLITE_OS_UNIX && SQLITE_THREADSAFE */
+/******************************** End Unix Pthreads *************************/
+
+
+/********************************* Single-Threaded **************************/
+#ifndef SQLITE_THREADS_IMPLEMENTED
+/*
+** This implementation does not actually create a new thread.  It does the
+** work of the thread in the calling thread.
+*/
+
+/* A running thread */
+struct SQLiteThread {
+  void *pOut;                    /* Result returned by the task */
+};
+
+/* Create a new thread */
+int sqlite3ThreadCreate(
+  SQLiteThread **ppThread,       /* OUT: Write the thread object here */
+  void *(*xTask)(void*),         /* Routine to run in a separate thread */
+  void *pIn                      /* Argument passed into xTask() */
+){
+  SQLiteThread *p;
+
+  assert( ppThread!=0 );
+  assert( xTask!=0 );
+  *ppThread = 0;
+  p = sqlite3MallocZero(sizeof(*p));
+  if( p==0 ) return SQLITE_NOMEM;
+  p->pOut = xTask(pIn);
+  *ppThread = p;
+  return SQLITE_OK;
+}
+
+/* Get the results of the thread */
+int sqlite3ThreadJoin(SQLiteThread *p, void **ppOut){
+  assert( ppOut!=0 );
+  if( p==0 ) return SQLITE_NOMEM;
+  *ppOut = p->pOut;
+  sqlite3_free(p);
+  return SQLITE_OK;
+}
+
+#endif /* !defined(SQLITE_THREADS_IMPLEMENTED) */
+/****************************** End Single-Threaded *************************/
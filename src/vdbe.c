@@ -322,7 +322,8 @@ int sqlite3_value_numeric_type(sqlite3_value *pVal){
 
 /*
 ** Exported version of applyAffinity(). This one works on sqlite3_value*, 
-** not the internal Mem* type.
+** not the internal Mem* type.  The type reported by sqlite3_value_type()
+** is updated to match the converted value.
 */
 void sqlite3ValueApplyAffinity(
   sqlite3_value *pVal, 
@@ -330,6 +331,7 @@ void sqlite3ValueApplyAffinity(
   u8 enc
 ){
   applyAffinity((Mem *)pVal, affinity, enc);
+  storeTypeInfo((Mem *)pVal, enc);
 }
 
 #ifdef SQLITE_DEBUG
@@ -2036,6 +2038,17 @@ case OP_Column: {
       sqlite3BtreeDataSize(pCrsr, (u32 *)&payloadSize);
     }
     nField = pC->nField;
+  }else if( pC->pSorter ){
+    /* The record is the current entry of a sorter */
+    if( pC->nullRow ){
+      payloadSize = 0;
+      zRec = 0;
+    }else{
+      zRec = (char*)sqlite3VdbeSorterRowkey(pC, &payloadSize);
+    }
+    pC->cacheStatus = CACHE_STALE;
+    nField = pC->nField;
+    pCrsr = 0;
   }else{
     assert( pC->pseudoTable );
     /* The record is the sole entry of a pseudo-table */
@@ -2958,6 +2971,14 @@ case OP_OpenWrite: {
 ** this opcode.  Then this opcode was call OpenVirtual.  But
 ** that created confusion with the whole virtual-table idea.
 */
+/* Opcode: OpenAutoindex P1 P2 * P4 *
+**
+** This opcode works the same as OP_OpenEphemeral.  It has a
+** different name to distinguish its use.  Tables created using
+** this opcode are used for automatically created transient
+** indices in joins.
+*/
+case OP_OpenAutoindex: 
 case OP_OpenEphemeral: {
   int i = pOp->p1;
   VdbeCursor *pCx;
@@ -3004,6 +3025,31 @@ case OP_OpenEphemeral: {
   break;
 }
 
+/* Opcode: SorterOpen P1 P2 * P4 *
+**
+** This opcode works like OP_OpenEphemeral except that it opens
+** a transient index that is specifically designed to sort large
+** tables using an external merge-sort algorithm.  Keys are added
+** with OP_SorterInsert and read back, in order, after an
+** OP_SorterSort.  The sorter cannot be searched or modified in any
+** other way.
+*/
+case OP_SorterOpen: {
+  int i = pOp->p1;
+  VdbeCursor *pCx;
+
+  assert( i>=0 );
+  assert( pOp->p4type==P4_KEYINFO );
+  pCx = allocateCursor(p, i, pOp->p2, -1, 0);
+  if( pCx==0 ) goto no_mem;
+  pCx->pKeyInfo = pOp->p4.pKeyInfo;
+  pCx->pKeyInfo->enc = ENC(p->db);
+  pCx->isIndex = 1;
+  pCx->nullRow = 1;
+  rc = sqlite3VdbeSorterInit(db, pCx);
+  break;
+}
+
 /* Opcode: OpenPseudo P1 P2 P3 * *
 **
 ** Open a new cursor that points to a fake table that contains a single
@@ -3973,6 +4019,119 @@ case OP_Last: {        /* jump */
 }
 
 
+/* Opcode: SorterSort P1 P2 * * *
+**
+** After all records have been inserted into the sorter opened by
+** OP_SorterOpen on cursor P1, sort them and point the cursor at the
+** first record.  If the sorter is empty, jump to P2.
+**
+** This opcode is counted as a sort in the same way as OP_Sort.
+*/
+case OP_SorterSort: {        /* jump */
+  VdbeCursor *pC;
+  int res;
+
+#ifdef SQLITE_TEST
+  sqlite3_sort_count++;
+  sqlite3_search_count--;
+#endif
+  p->aCounter[SQLITE_STMTSTATUS_SORT-1]++;
+  assert( pOp->p1>=0 && pOp->p1<p->nCursor );
+  pC = p->apCsr[pOp->p1];
+  assert( pC!=0 && pC->pSorter!=0 );
+  res = 1;
+  rc = sqlite3VdbeSorterRewind(db, pC, &res);
+  pC->nullRow = (u8)res;
+  pC->cacheStatus = CACHE_STALE;
+  assert( pOp->p2>0 && pOp->p2<p->nOp );
+  if( res ){
+    pc = pOp->p2 - 1;
+  }
+  break;
+}
+
+/* Opcode: SorterNext P1 P2 * * *
+**
+** Advance the sorter cursor P1 to the next record.  If there is
+** another record, jump to P2.  Otherwise fall through to the
+** following instruction.
+*/
+case OP_SorterNext: {        /* jump */
+  VdbeCursor *pC;
+  int res;
+
+  CHECK_FOR_INTERRUPT;
+  assert( pOp->p1>=0 && pOp->p1<p->nCursor );
+  pC = p->apCsr[pOp->p1];
+  assert( pC!=0 && pC->pSorter!=0 );
+  res = 1;
+  rc = sqlite3VdbeSorterNext(db, pC, &res);
+  pC->nullRow = (u8)res;
+  pC->cacheStatus = CACHE_STALE;
+  if( res==0 ){
+    pc = pOp->p2 - 1;
+#ifdef SQLITE_TEST
+    sqlite3_search_count++;
+#endif
+  }
+  break;
+}
+
+/* Opcode: SorterData P1 P2 * * *
+**
+** Write into register P2 the record that the sorter cursor P1
+** currently points to.
+*/
+case OP_SorterData: {
+  VdbeCursor *pC;
+  const void *pKey;
+  int nKey;
+
+  pOut = &p->aMem[pOp->p2];
+  pC = p->apCsr[pOp->p1];
+  assert( pC!=0 && pC->pSorter!=0 );
+  assert( pC->nullRow==0 );
+  pKey = sqlite3VdbeSorterRowkey(pC, &nKey);
+  if( sqlite3VdbeMemGrow(pOut, nKey, 0) ){
+    goto no_mem;
+  }
+  pOut->n = nKey;
+  MemSetTypeFlag(pOut, MEM_Blob);
+  memcpy(pOut->z, pKey, nKey);
+  pOut->enc = SQLITE_UTF8;  /* In case the blob is ever cast to text */
+  UPDATE_MAX_BLOBSIZE(pOut);
+  break;
+}
+
+/* Opcode: SorterCompare P1 P2 P3 * *
+**
+** Register P3 holds an index key made using the MakeRecord
+** instruction.  Compare it with the record that the sorter cursor
+** P1 currently points to, ignoring the rowid at the end of both.
+** If the two keys differ, or if the key in P3 contains a NULL,
+** jump to P2.  Otherwise fall through to the next instruction.
+**
+** This is used by CREATE UNIQUE INDEX to find duplicate keys as
+** they are read back from the sorter.
+*/
+case OP_SorterCompare: {        /* jump, in3 */
+  VdbeCursor *pC;
+  int res;
+
+  pC = p->apCsr[pOp->p1];
+  assert( pC!=0 && pC->pSorter!=0 );
+  assert( pIn3->flags & MEM_Blob );
+  rc = ExpandBlob(pIn3);
+  if( rc==SQLITE_OK ){
+    res = 0;
+    rc = sqlite3VdbeSorterCompare(pC, pIn3, &res);
+    if( res ){
+      pc = pOp->p2 - 1;
+    }
+  }
+  break;
+}
+
 /* Opcode: Sort P1 P2 * * *
 **
 ** This opcode does exactly the same thing as OP_Rewind except that
@@ -4111,6 +4270,25 @@ case OP_IdxInsert: {        /* in2 */
   break;
 }
 
+/* Opcode: SorterInsert P1 P2 * * *
+**
+** Register P2 holds an SQL index key made using the MakeRecord
+** instruction.  Add it to the sorter opened on cursor P1 by
+** OP_SorterOpen.
+*/
+case OP_SorterInsert: {        /* in2 */
+  VdbeCursor *pC;
+  assert( pOp->p1>=0 && pOp->p1<p->nCursor );
+  pC = p->apCsr[pOp->p1];
+  assert( pC!=0 && pC->pSorter!=0 );
+  assert( pIn2->flags & MEM_Blob );
+  rc = ExpandBlob(pIn2);
+  if( rc==SQLITE_OK ){
+    rc = sqlite3VdbeSorterWrite(db, pC, pIn2);
+  }
+  break;
+}
+
 /* Opcode: IdxDelete P1 P2 P3 * *
 **
 ** The content of P3 registers starting at register P2 form
@@ -4787,6 +4965,120 @@ case OP_AggFinal: {
 }
 
 
+#ifndef SQLITE_OMIT_WAL
+/* Opcode: Checkpoint P1 * * * *
+**
+** Checkpoint database P1. This is a no-op if P1 is not currently in
+** WAL mode.
+*/
+case OP_Checkpoint: {
+  Btree *pBt;
+
+  assert( pOp->p1>=0 && pOp->p1<db->nDb );
+  assert( (p->btreeMask & (1<<pOp->p1))!=0 );
+  pBt = db->aDb[pOp->p1].pBt;
+  rc = sqlite3BtreeCheckpoint(pBt);
+  break;
+}
+#endif
+
+#if !defined(SQLITE_OMIT_PAGER_PRAGMAS) && !defined(SQLITE_OMIT_PRAGMA)
+/* Opcode: JournalMode P1 P2 P3 * *
+**
+** Change the journal mode of database P1 to P3. P3 must be one of the
+** PAGER_JOURNALMODE_XXX values, or PAGER_JOURNALMODE_QUERY to leave the
+** mode unchanged. Changing between the rollback modes (delete, truncate,
+** persist, off and memory) is a simple operation, no IO is required.
+**
+** Changing into or out of WAL mode rewrites the file-format version
+** numbers in the database header, within a write transaction that is
+** committed when the statement halts. Leaving WAL mode also checkpoints
+** and deletes the log, which fails with SQLITE_BUSY if other connections
+** are using the database. Neither is allowed within a transaction.
+**
+** Write a string containing the final journal-mode to register P2.
+*/
+case OP_JournalMode: {    /* out2-prerelease */
+  Btree *pBt;                     /* Btree to change journal mode of */
+  Pager *pPager;                  /* Pager associated with pBt */
+  int eNew;                       /* New journal mode */
+  const char *zMode;              /* Name of the resulting journal mode */
+
+  eNew = pOp->p3;
+  assert( eNew==PAGER_JOURNALMODE_DELETE 
+       || eNew==PAGER_JOURNALMODE_TRUNCATE 
+       || eNew==PAGER_JOURNALMODE_PERSIST 
+       || eNew==PAGER_JOURNALMODE_OFF
+       || eNew==PAGER_JOURNALMODE_MEMORY
+       || eNew==PAGER_JOURNALMODE_WAL
+       || eNew==PAGER_JOURNALMODE_QUERY
+  );
+  assert( pOp->p1>=0 && pOp->p1<db->nDb );
+  assert( (p->btreeMask & (1<<pOp->p1))!=0 );
+
+  pBt = db->aDb[pOp->p1].pBt;
+  pPager = sqlite3BtreePager(pBt);
+
+#ifndef SQLITE_OMIT_WAL
+  if( sqlite3PagerWalSupported(pPager) ){
+    int eOld;                     /* The old journal mode */
+
+    /* The pager only learns that a database uses WAL mode when it reads
+    ** the header. Open and close a read transaction so that it has done
+    ** so. Errors are not reported here, the statement that next reads
+    ** the database hits them too.
+    */
+    if( !sqlite3BtreeIsInReadTrans(pBt)
+     && sqlite3BtreeBeginTrans(pBt, 0)==SQLITE_OK
+    ){
+      sqlite3BtreeCommit(pBt);
+    }
+    eOld = sqlite3PagerJournalMode(pPager, PAGER_JOURNALMODE_QUERY);
+
+    if( eNew!=eOld && eNew!=PAGER_JOURNALMODE_QUERY
+     && (eOld==PAGER_JOURNALMODE_WAL || eNew==PAGER_JOURNALMODE_WAL)
+    ){
+      if( !db->autoCommit || db->activeVdbeCnt>1 ){
+        rc = SQLITE_ERROR;
+        sqlite3SetString(&p->zErrMsg, db, 
+            "cannot change %s wal mode from within a transaction",
+            (eNew==PAGER_JOURNALMODE_WAL ? "into" : "out of")
+        );
+        break;
+      }
+      if( eOld==PAGER_JOURNALMODE_WAL ){
+        /* Checkpoint and delete the log. The pager is then back in
+        ** rollback mode and the new journal mode can be set. */
+        rc = sqlite3PagerCloseWal(pPager);
+        if( rc==SQLITE_OK ){
+          sqlite3PagerJournalMode(pPager, eNew);
+        }
+      }
+      if( rc==SQLITE_OK ){
+        /* Write the new file-format version numbers. The next read
+        ** transaction opens the log if they are set to 2. */
+        rc = sqlite3BtreeSetVersion(pBt, (eNew==PAGER_JOURNALMODE_WAL?2:1));
+      }
+      if( rc!=SQLITE_OK ) break;
+    }
+  }else
+#endif
+  if( eNew==PAGER_JOURNALMODE_WAL ){
+    /* WAL mode is not available for this database. Report the current
+    ** journal mode instead. */
+    eNew = PAGER_JOURNALMODE_QUERY;
+  }
+
+  if( eNew!=PAGER_JOURNALMODE_WAL ){
+    eNew = sqlite3PagerJournalMode(pPager, eNew);
+  }
+  zMode = sqlite3JournalModename(eNew);
+  sqlite3VdbeMemSetStr(pOut, zMode, -1, SQLITE_UTF8, SQLITE_STATIC);
+  if( SQLITE_OK!=sqlite3VdbeChangeEncoding(pOut, encoding) ) goto no_mem;
+  break;
+}
+#endif /* !SQLITE_OMIT_PAGER_PRAGMAS && !SQLITE_OMIT_PRAGMA */
+
 #if !defined(SQLITE_OMIT_VACUUM) && !defined(SQLITE_OMIT_ATTACH)
 /* Opcode: Vacuum * * * * *
 **
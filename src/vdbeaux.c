@@ -1169,6 +1169,9 @@ void sqlite3VdbeFreeCursor(Vdbe *p, VdbeCursor *pCx){
   if( pCx==0 ){
     return;
   }
+  if( pCx->pSorter ){
+    sqlite3VdbeSorterClose(p->db, pCx);
+  }
   if( pCx->pBt ){
     sqlite3BtreeClose(pCx->pBt);
     /* The pCx->pCursor will be close automatically, if it exists, by
@@ -0,0 +1,1191 @@
+/*
+** 2009 May 12
+**
+** The author disclaims copyright to this source code.  In place of
+** a legal notice, here is a blessing:
+**
+**    May you do good and not evil.
+**    May you find forgiveness for yourself and forgive others.
+**    May you share freely, never taking more than you give.
+**
+*************************************************************************
+**
+** This file contains code for the VdbeSorter object, used in concert with
+** a VdbeCursor to sort large numbers of keys (as may be required, for
+** example, by CREATE INDEX statements on tables too large to fit in main
+** memory).
+**
+** Keys are accumulated in main memory as a linked list of records. When
+** the list grows larger than the sorter's budget, it is sorted with a
+** merge sort and written to a temporary file as a "Packed Memory Array"
+** (PMA). Once all keys have been added, the PMAs are merged with a
+** k-way merge, SORTER_MAX_MERGE_COUNT PMAs at a time, until there are
+** few enough left that the final merge can feed the VDBE directly. If
+** all keys fit within the budget, no temporary file is used at all.
+**
+** A PMA consists of a varint containing the size of the PMA in bytes
+** (not including the varint itself), followed by the records in key
+** order. Each record is a varint containing its size in bytes followed
+** by the record itself, as built by OP_MakeRecord.
+**
+** If "PRAGMA threads" allows worker threads, the work is divided among
+** one sub-task per thread, each with its own temporary file. While the
+** VDBE keeps adding keys, each full list is handed to the next sub-task
+** in turn, which sorts it and writes it out as a PMA in the background.
+** When the sorter is rewound, every sub-task merges its own PMAs down
+** to a few, all in parallel, and the final merge of what is left feeds
+** the VDBE. Without worker threads there is a single sub-task, and the
+** same work is done by the thread running the statement.
+**
+** Because records and buffers may be allocated by one thread and freed
+** by another, all memory other than the VdbeSorter object itself comes
+** from sqlite3Malloc(), never from the connection's lookaside allocator.
+*/
+
+#include "sqliteInt.h"
+#include "vdbeInt.h"
+
+typedef struct VdbeSorterIter VdbeSorterIter;
+typedef struct SorterRecord SorterRecord;
+typedef struct FileWriter FileWriter;
+typedef struct SortSubtask SortSubtask;
+typedef struct MergeEngine MergeEngine;
+
+/*
+** A sub-task sorts lists of records and writes them as PMAs to its own
+** temporary file pTemp1, and later merges those PMAs. If the sorter uses
+** worker threads, each sub-task runs in a thread of its own. pThread is
+** set while such a thread is running; no other thread may touch the
+** sub-task until it has been joined.
+**
+** Comparing keys needs space to unpack a record into. Each sub-task has
+** its own, so that several may compare keys at the same time.
+*/
+struct SortSubtask {
+  SQLiteThread *pThread;          /* Background thread, if any */
+  VdbeSorter *pSorter;            /* Sorter that owns this sub-task */
+  UnpackedRecord *pUnpacked;      /* Last key unpacked by vdbeSorterCompare() */
+  char *aSpace;                   /* Space for pUnpacked */
+  int nSpace;                     /* Size of aSpace[] in bytes */
+  SorterRecord *pList;            /* List of records to write as a PMA */
+  i64 nList;                      /* Size of pList as a PMA in bytes */
+  sqlite3_file *pTemp1;           /* File holding this sub-task's PMAs */
+  sqlite3_file *pTemp2;           /* Second file used by vdbeSorterMergeDown() */
+  i64 iWriteOff;                  /* End of the PMAs in pTemp1 */
+  int nPMA;                       /* Number of PMAs stored in pTemp1 */
+  int nTarget;                    /* Merge down to at most this many PMAs */
+};
+
+/*
+** A MergeEngine merges the keys of up to nTree PMAs, read through the
+** aIter[] iterators, into a single sorted stream.
+**
+** aTree[] is a tournament tree used to find the iterator that points to
+** the smallest key. nTree is a power of two no smaller than the number
+** of iterators. Entries aTree[nTree/2] to aTree[nTree-1] each hold the
+** winner (the index of the iterator with the smaller key) of comparing
+** a pair of adjacent iterators. Entries aTree[1] to aTree[nTree/2-1]
+** hold the winners of comparing pairs of the entries below them, so that
+** aTree[1] is the iterator with the smallest key of all. An iterator
+** at EOF always loses. aTree[0] is unused.
+**
+** When the iterator in aTree[1] is advanced, only the log2(nTree) entries
+** on the path from its leaf to the root need to be recomputed.
+*/
+struct MergeEngine {
+  int nTree;                      /* Used size of aTree/aIter (power of 2) */
+  SortSubtask *pTask;             /* Sub-task whose space is used to compare */
+  int *aTree;                     /* Current state of incremental merge */
+  VdbeSorterIter *aIter;          /* Array of iterators to merge */
+};
+
+/*
+** The sorter object. Records are added to the pRecord list until it
+** grows larger than mxPmaSize, at which point the list is given to one
+** of the nTask sub-tasks to be written out.
+*/
+struct VdbeSorter {
+  i64 nInMemory;                  /* Current size of pRecord list as PMA */
+  i64 mxPmaSize;                  /* Maximum PMA size, in bytes. 0==no limit */
+  int pgsz;                       /* Size of temp file I/O buffers */
+  int nSpill;                     /* Number of lists given to sub-tasks */
+  int bUseThreads;                /* True to use background threads */
+  int iPrev;                      /* Sub-task given the previous list */
+  SorterRecord *pRecord;          /* Head of in-memory record list */
+  KeyInfo *pKeyInfo;              /* How to compare records */
+  MergeEngine *pMerger;           /* Final merge, if keys went to disk */
+  int nTask;                      /* Number of entries in aTask[] */
+  SortSubtask aTask[1];           /* One or more sub-tasks */
+};
+
+/*
+** The following type is an iterator for a PMA. It reads the PMA through
+** a buffer of nBuffer bytes. Keys that straddle the end of the buffer
+** are assembled in aAlloc[].
+*/
+struct VdbeSorterIter {
+  i64 iReadOff;                   /* Current read offset */
+  i64 iEof;                       /* 1 byte past EOF for this iterator */
+  sqlite3_file *pFile;            /* File iterator is reading from */
+  int nAlloc;                     /* Bytes of space at aAlloc */
+  u8 *aAlloc;                     /* Allocated space */
+  int nKey;                       /* Number of bytes in key */
+  u8 *aKey;                       /* Pointer to current key */
+  int nBuffer;                    /* Size of read buffer in bytes */
+  u8 *aBuffer;                    /* Current read buffer */
+};
+
+/*
+** An instance of this structure is used to write a PMA to a file
+** through a buffer, so that the file is written in blocks of nBuffer
+** bytes aligned to nBuffer-byte boundaries.
+*/
+struct FileWriter {
+  int eFWErr;                     /* Non-zero if in an error state */
+  u8 *aBuffer;                    /* Pointer to write buffer */
+  int nBuffer;                    /* Size of write buffer in bytes */
+  int iBufStart;                  /* First byte of buffer to write */
+  int iBufEnd;                    /* Last byte of buffer to write */
+  i64 iWriteOff;                  /* Offset of start of buffer in file */
+  sqlite3_file *pFile;            /* File to write to */
+};
+
+/*
+** A structure to store a single record. All in-memory records are
+** connected together into a linked list headed at VdbeSorter.pRecord.
+** The record itself is stored in the same allocation, directly after
+** the structure.
+*/
+struct SorterRecord {
+  void *pVal;
+  int nVal;
+  SorterRecord *pNext;
+};
+
+/* Minimum allowable value for the VdbeSorter.mxPmaSize variable, in
+** pages. */
+#define SORTER_MIN_WORKING 10
+
+/* Maximum number of PMAs that a single MergeEngine can merge */
+#define SORTER_MAX_MERGE_COUNT 16
+
+/*
+** The following variable is incremented each time a sorted run (PMA) is
+** written to a temporary file. It is used by the test scripts to check
+** that large sorts are spilled to disk. This variable has no function
+** other than to help verify the correct operation of the library.
+*/
+#ifdef SQLITE_TEST
+int sqlite3_sort_run_count = 0;
+#endif
+
+/*
+** Free all memory belonging to the VdbeSorterIter object passed as the
+** argument. All structure fields are set to zero before returning.
+*/
+static void vdbeSorterIterZero(VdbeSorterIter *pIter){
+  sqlite3_free(pIter->aAlloc);
+  sqlite3_free(pIter->aBuffer);
+  memset(pIter, 0, sizeof(VdbeSorterIter));
+}
+
+/*
+** Read nByte bytes of data from the PMA that iterator p reads. Set *ppOut
+** to point to a buffer containing the data. The buffer remains valid
+** until the next call to this function for the same iterator. Return
+** SQLITE_OK if successful, or an SQLite error code otherwise.
+*/
+static int vdbeSorterIterRead(
+  VdbeSorterIter *p,              /* Iterator */
+  int nByte,                      /* Bytes of data to read */
+  u8 **ppOut                      /* OUT: Pointer to buffer containing data */
+){
+  int iBuf;                       /* Offset within buffer to read from */
+  int nAvail;                     /* Bytes of data available in buffer */
+  assert( p->aBuffer );
+
+  /* If there is no more data to be read from the buffer, read the next
+  ** p->nBuffer bytes of data from the file into it. Or, if there are less
+  ** than p->nBuffer bytes remaining in the PMA, read all remaining data.
+  */
+  iBuf = (int)(p->iReadOff % p->nBuffer);
+  if( iBuf==0 ){
+    int nRead;                    /* Bytes to read from disk */
+    int rc;                       /* sqlite3OsRead() return code */
+
+    if( (p->iEof - p->iReadOff) > (i64)p->nBuffer ){
+      nRead = p->nBuffer;
+    }else{
+      nRead = (int)(p->iEof - p->iReadOff);
+    }
+    assert( nRead>0 );
+    rc = sqlite3OsRead(p->pFile, p->aBuffer, nRead, p->iReadOff);
+    assert( rc!=SQLITE_IOERR_SHORT_READ );
+    if( rc!=SQLITE_OK ) return rc;
+  }
+  nAvail = p->nBuffer - iBuf;
+
+  if( nByte<=nAvail ){
+    /* The requested data is available in the in-memory buffer. */
+    *ppOut = &p->aBuffer[iBuf];
+    p->iReadOff += nByte;
+  }else{
+    /* The requested data is not all available in the in-memory buffer.
+    ** Assemble it in p->aAlloc[], growing that buffer if required.
+    */
+    int nRem;                     /* Bytes remaining to copy */
+
+    if( p->nAlloc<nByte ){
+      u8 *aNew;
+      int nNew = p->nAlloc*2;
+      while( nByte>nNew ) nNew = nNew*2;
+      aNew = sqlite3Realloc(p->aAlloc, nNew);
+      if( !aNew ) return SQLITE_NOMEM;
+      p->nAlloc = nNew;
+      p->aAlloc = aNew;
+    }
+
+    memcpy(p->aAlloc, &p->aBuffer[iBuf], nAvail);
+    p->iReadOff += nAvail;
+    nRem = nByte - nAvail;
+
+    /* The following loop copies up to p->nBuffer bytes per iteration into
+    ** the p->aAlloc[] buffer.  */
+    while( nRem>0 ){
+      int rc;                     /* vdbeSorterIterRead() return code */
+      int nCopy;                  /* Number of bytes to copy */
+      u8 *aNext;                  /* Pointer to buffer to copy data from */
+
+      nCopy = nRem;
+      if( nRem>p->nBuffer ) nCopy = p->nBuffer;
+      rc = vdbeSorterIterRead(p, nCopy, &aNext);
+      if( rc!=SQLITE_OK ) return rc;
+      assert( aNext!=p->aAlloc );
+      memcpy(&p->aAlloc[nByte - nRem], aNext, nCopy);
+      nRem -= nCopy;
+    }
+
+    *ppOut = p->aAlloc;
+  }
+
+  return SQLITE_OK;
+}
+
+/*
+** Read a varint from the stream of data accessed by p. Set *pnOut to
+** the value read.
+*/
+static int vdbeSorterIterVarint(VdbeSorterIter *p, u64 *pnOut){
+  int iBuf;
+
+  iBuf = (int)(p->iReadOff % p->nBuffer);
+  if( iBuf && (p->nBuffer-iBuf)>=9 ){
+    p->iReadOff += sqlite3GetVarint(&p->aBuffer[iBuf], pnOut);
+  }else{
+    u8 aVarint[16], *a;
+    int i = 0, rc;
+    do{
+      rc = vdbeSorterIterRead(p, 1, &a);
+      if( rc ) return rc;
+      aVarint[(i++)&0xf] = a[0];
+    }while( (a[0]&0x80)!=0 );
+    sqlite3GetVarint(aVarint, pnOut);
+  }
+
+  return SQLITE_OK;
+}
+
+/*
+** Advance iterator pIter to the next key in its PMA. Return SQLITE_OK if
+** no error occurs, or an SQLite error code if one does. If the iterator
+** is already at the end of its PMA, it is zeroed, which marks it as
+** being at EOF.
+*/
+static int vdbeSorterIterNext(VdbeSorterIter *pIter){
+  int rc;                         /* Return Code */
+  u64 nRec = 0;                   /* Size of record in bytes */
+
+  if( pIter->iReadOff>=pIter->iEof ){
+    /* This is an EOF condition */
+    vdbeSorterIterZero(pIter);
+    return SQLITE_OK;
+  }
+
+  rc = vdbeSorterIterVarint(pIter, &nRec);
+  if( rc==SQLITE_OK ){
+    pIter->nKey = (int)nRec;
+    rc = vdbeSorterIterRead(pIter, (int)nRec, &pIter->aKey);
+  }
+
+  return rc;
+}
+
+/*
+** Initialize iterator pIter to scan through the PMA stored in file pFile
+** starting at offset iStart, and move it to the first key. iEnd is the
+** offset of the end of the data in pFile. Add the size of the PMA in
+** bytes to *pnByte.
+*/
+static int vdbeSorterIterInit(
+  sqlite3_file *pFile,            /* File holding the PMA */
+  i64 iStart,                     /* Start offset in pFile */
+  i64 iEnd,                       /* End of data in pFile */
+  int nBuf,                       /* Size of read buffer in bytes */
+  VdbeSorterIter *pIter,          /* Iterator to populate */
+  i64 *pnByte                     /* IN/OUT: Increment this value by PMA size */
+){
+  int rc = SQLITE_OK;
+
+  assert( iEnd>iStart );
+  assert( pIter->aAlloc==0 );
+  assert( pIter->aBuffer==0 );
+  pIter->pFile = pFile;
+  pIter->iReadOff = iStart;
+  pIter->nAlloc = 128;
+  pIter->aAlloc = (u8 *)sqlite3Malloc(pIter->nAlloc);
+  pIter->nBuffer = nBuf;
+  pIter->aBuffer = (u8 *)sqlite3Malloc(nBuf);
+
+  if( !pIter->aBuffer || !pIter->aAlloc ){
+    rc = SQLITE_NOMEM;
+  }else{
+    int iBuf;
+
+    /* If the PMA does not start on a buffer boundary, read the rest of
+    ** the first buffer now. */
+    iBuf = (int)(iStart % nBuf);
+    if( iBuf ){
+      int nRead = nBuf - iBuf;
+      if( (iStart + nRead) > iEnd ){
+        nRead = (int)(iEnd - iStart);
+      }
+      rc = sqlite3OsRead(pFile, &pIter->aBuffer[iBuf], nRead, iStart);
+      assert( rc!=SQLITE_IOERR_SHORT_READ );
+    }
+
+    if( rc==SQLITE_OK ){
+      u64 nByte;                  /* Size of PMA in bytes */
+      pIter->iEof = iEnd;
+      rc = vdbeSorterIterVarint(pIter, &nByte);
+      pIter->iEof = pIter->iReadOff + nByte;
+      *pnByte += nByte;
+    }
+  }
+
+  if( rc==SQLITE_OK ){
+    rc = vdbeSorterIterNext(pIter);
+  }
+  return rc;
+}
+
+/*
+** Compare key1 (buffer pKey1, size nKey1 bytes) with key2 (buffer pKey2,
+** size nKey2 bytes), using the unpacked-record space of sub-task pTask.
+** Set *pRes to a negative, zero or positive value, depending on whether
+** key1 is smaller, equal to or larger than key2.
+**
+** If the bOmitRowid argument is non-zero, assume both keys end in a rowid
+** field. For the purposes of the comparison, ignore it. Also, if bOmitRowid
+** is true and key2 contains even a single NULL value, it is considered to
+** be greater than key1.
+**
+** If pKey2 is passed a NULL pointer, then it is assumed that the
+** pTask->pUnpacked structure already contains the unpacked key2. The
+** merge routines below rely on this to unpack each key only once, however
+** many keys it is compared with.
+*/
+static void vdbeSorterCompare(
+  SortSubtask *pTask,             /* Sub-task doing the comparison */
+  int bOmitRowid,                 /* Ignore rowid field at end of keys */
+  const void *pKey1, int nKey1,   /* Left side of comparison */
+  const void *pKey2, int nKey2,   /* Right side of comparison */
+  int *pRes                       /* OUT: Result of comparison */
+){
+  KeyInfo *pKeyInfo = pTask->pSorter->pKeyInfo;
+  UnpackedRecord *r2;
+  int i;
+
+  if( pKey2 ){
+    /* The aSpace[] buffer is large enough for any key, so this never
+    ** allocates memory. */
+    pTask->pUnpacked = sqlite3VdbeRecordUnpack(
+        pKeyInfo, nKey2, pKey2, pTask->aSpace, pTask->nSpace
+    );
+    assert( (pTask->pUnpacked->flags & UNPACKED_NEED_FREE)==0 );
+  }
+  r2 = pTask->pUnpacked;
+
+  if( bOmitRowid ){
+    if( r2->nField>pKeyInfo->nField ){
+      r2->nField = pKeyInfo->nField;
+    }
+    for(i=0; i<r2->nField; i++){
+      if( r2->aMem[i].flags & MEM_Null ){
+        *pRes = -1;
+        return;
+      }
+    }
+    r2->flags |= UNPACKED_PREFIX_MATCH;
+  }
+
+  *pRes = sqlite3VdbeRecordCompare(nKey1, pKey1, r2);
+}
+
+/*
+** Allocate a new MergeEngine object able to merge nIter iterators.
+** Return NULL if a malloc fails.
+*/
+static MergeEngine *vdbeMergeEngineNew(int nIter, SortSubtask *pTask){
+  int N = 2;                      /* Smallest power of two >= nIter */
+  int nByte;                      /* Total bytes of space to allocate */
+  MergeEngine *pNew;              /* Pointer to allocated object to return */
+
+  assert( nIter<=SORTER_MAX_MERGE_COUNT );
+  while( N<nIter ) N += N;
+  nByte = sizeof(MergeEngine) + N * (sizeof(int) + sizeof(VdbeSorterIter));
+
+  pNew = (MergeEngine*)sqlite3MallocZero(nByte);
+  if( pNew ){
+    pNew->nTree = N;
+    pNew->pTask = pTask;
+    pNew->aIter = (VdbeSorterIter*)&pNew[1];
+    pNew->aTree = (int*)&pNew->aIter[N];
+  }
+  return pNew;
+}
+
+/*
+** Close all the iterators of a MergeEngine, so that it may be reused.
+*/
+static void vdbeMergeEngineReset(MergeEngine *pMerger){
+  int i;
+  for(i=0; i<pMerger->nTree; i++){
+    vdbeSorterIterZero(&pMerger->aIter[i]);
+  }
+}
+
+/*
+** Free the MergeEngine object passed as the only argument.
+*/
+static void vdbeMergeEngineFree(MergeEngine *pMerger){
+  if( pMerger ){
+    vdbeMergeEngineReset(pMerger);
+    sqlite3_free(pMerger);
+  }
+}
+
+/*
+** Recompute aTree[iOut] of the merge engine: compare the two iterators
+** (or the winners of the two subtrees) below it.
+*/
+static void vdbeMergeEngineCompare(MergeEngine *pMerger, int iOut){
+  int i1;
+  int i2;
+  int iRes;
+  VdbeSorterIter *p1;
+  VdbeSorterIter *p2;
+
+  assert( iOut<pMerger->nTree && iOut>0 );
+
+  if( iOut>=(pMerger->nTree/2) ){
+    i1 = (iOut - pMerger->nTree/2) * 2;
+    i2 = i1 + 1;
+  }else{
+    i1 = pMerger->aTree[iOut*2];
+    i2 = pMerger->aTree[iOut*2+1];
+  }
+
+  p1 = &pMerger->aIter[i1];
+  p2 = &pMerger->aIter[i2];
+
+  if( p1->pFile==0 ){
+    iRes = i2;
+  }else if( p2->pFile==0 ){
+    iRes = i1;
+  }else{
+    int res;
+    vdbeSorterCompare(pMerger->pTask, 0,
+        p1->aKey, p1->nKey, p2->aKey, p2->nKey, &res
+    );
+    if( res<=0 ){
+      iRes = i1;
+    }else{
+      iRes = i2;
+    }
+  }
+
+  pMerger->aTree[iOut] = iRes;
+}
+
+/*
+** Build the tournament tree of a merge engine whose iterators have all
+** been initialized.
+*/
+static void vdbeMergeEngineInit(MergeEngine *pMerger){
+  int i;
+  for(i=pMerger->nTree-1; i>0; i--){
+    vdbeMergeEngineCompare(pMerger, i);
+  }
+}
+
+/*
+** Advance the merge engine to its next key. Set *pbEof to true if there
+** are no more keys.
+*/
+static int vdbeMergeEngineStep(MergeEngine *pMerger, int *pbEof){
+  int iPrev = pMerger->aTree[1];  /* Index of iterator to advance */
+  int i;                          /* Index of aTree[] to recalculate */
+  int rc;
+
+  rc = vdbeSorterIterNext(&pMerger->aIter[iPrev]);
+  for(i=(pMerger->nTree+iPrev)/2; rc==SQLITE_OK && i>0; i=i/2){
+    vdbeMergeEngineCompare(pMerger, i);
+  }
+  *pbEof = (pMerger->aIter[pMerger->aTree[1]].pFile==0);
+  return rc;
+}
+
+/*
+** Initialize the temporary index cursor just opened as a sorter cursor.
+**
+** The sorter keeps up to one page cache's worth of keys (the cache_size
+** of the main database times its page size) in memory before it writes
+** a sorted run to disk. If temporary files are stored in memory (see
+** sqlite3TempInMemory()), all keys are kept in memory and no worker
+** threads are used.
+*/
+int sqlite3VdbeSorterInit(sqlite3 *db, VdbeCursor *pCsr){
+  int nSpace;                     /* Bytes of space required for pUnpacked */
+  int nTask = 1;                  /* Number of sub-tasks */
+  int nKeyInfo = 0;               /* Size of KeyInfo copy, if any */
+  int nByte;                      /* Total bytes to allocate */
+  int i;
+  KeyInfo *pKeyInfo = pCsr->pKeyInfo;
+  VdbeSorter *pSorter;            /* The new sorter */
+  char *pSpace;
+
+  assert( pKeyInfo && pCsr->pBt==0 );
+#if SQLITE_MAX_WORKER_THREADS>0
+  if( db->nWorker>0 && !sqlite3TempInMemory(db) ){
+    nTask = db->nWorker;
+    if( nTask>SORTER_MAX_MERGE_COUNT ) nTask = SORTER_MAX_MERGE_COUNT;
+
+    /* Worker threads compare keys without holding the database mutex, so
+    ** they use a copy of the KeyInfo that is not tied to the connection.
+    ** Any memory needed to compare keys then comes from sqlite3Malloc(). */
+    nKeyInfo = ROUND8(sizeof(KeyInfo)
+             + (pKeyInfo->nField-1)*sizeof(pKeyInfo->aColl[0])
+             + pKeyInfo->nField);
+  }
+#endif
+  nSpace = ROUND8(ROUND8(sizeof(UnpackedRecord))
+         + sizeof(Mem)*(pKeyInfo->nField+1) + 8);
+  nByte = ROUND8(sizeof(VdbeSorter) + (nTask-1)*sizeof(SortSubtask))
+        + nKeyInfo + nTask*nSpace;
+  pCsr->pSorter = pSorter = sqlite3DbMallocZero(db, nByte);
+  if( pSorter==0 ){
+    return SQLITE_NOMEM;
+  }
+  pSpace = &((char*)pSorter)[
+      ROUND8(sizeof(VdbeSorter) + (nTask-1)*sizeof(SortSubtask))
+  ];
+
+  pSorter->pKeyInfo = pKeyInfo;
+  if( nKeyInfo ){
+    KeyInfo *pCopy = (KeyInfo*)pSpace;
+    memcpy(pCopy, pKeyInfo,
+        sizeof(KeyInfo) + (pKeyInfo->nField-1)*sizeof(pKeyInfo->aColl[0]));
+    if( pKeyInfo->aSortOrder ){
+      pCopy->aSortOrder = (u8*)&pCopy->aColl[pKeyInfo->nField];
+      memcpy(pCopy->aSortOrder, pKeyInfo->aSortOrder, pKeyInfo->nField);
+    }
+    pCopy->db = 0;
+    pSorter->pKeyInfo = pCopy;
+    pSorter->bUseThreads = 1;
+    pSpace += nKeyInfo;
+  }
+
+  pSorter->nTask = nTask;
+  pSorter->iPrev = nTask-1;
+  for(i=0; i<nTask; i++){
+    SortSubtask *pTask = &pSorter->aTask[i];
+    pTask->pSorter = pSorter;
+    pTask->aSpace = pSpace;
+    pTask->nSpace = nSpace;
+    pSpace += nSpace;
+  }
+
+  if( !sqlite3TempInMemory(db) ){
+    Db *pDb = &db->aDb[0];
+    int mxCache = pDb->pSchema->cache_size;
+    pSorter->pgsz = sqlite3BtreeGetPageSize(pDb->pBt);
+    if( mxCache<SORTER_MIN_WORKING ) mxCache = SORTER_MIN_WORKING;
+    pSorter->mxPmaSize = (i64)mxCache * pSorter->pgsz;
+  }
+
+  return SQLITE_OK;
+}
+
+/*
+** Free the list of sorted records starting at pRecord.
+*/
+static void vdbeSorterRecordFree(SorterRecord *pRecord){
+  SorterRecord *p;
+  SorterRecord *pNext;
+  for(p=pRecord; p; p=pNext){
+    pNext = p->pNext;
+    sqlite3_free(p);
+  }
+}
+
+/*
+** Wait for the background thread of sub-task pTask, if one is running,
+** to finish. Return the result code of the work it did.
+*/
+static int vdbeSorterJoinThread(SortSubtask *pTask){
+  int rc = SQLITE_OK;
+  if( pTask->pThread ){
+    void *pRet = 0;
+    rc = sqlite3ThreadJoin(pTask->pThread, &pRet);
+    pTask->pThread = 0;
+    if( rc==SQLITE_OK ) rc = SQLITE_PTR_TO_INT(pRet);
+  }
+  return rc;
+}
+
+/*
+** Wait for the background threads of all sub-tasks to finish. Return
+** rcin if it is not SQLITE_OK, or else the first error reported by a
+** thread.
+*/
+static int vdbeSorterJoinAll(VdbeSorter *pSorter, int rcin){
+  int rc = rcin;
+  int i;
+  for(i=0; i<pSorter->nTask; i++){
+    int rc2 = vdbeSorterJoinThread(&pSorter->aTask[i]);
+    if( rc==SQLITE_OK ) rc = rc2;
+  }
+  return rc;
+}
+
+/*
+** Start a background thread to run xTask on sub-task pTask or, if the
+** sorter does not use threads, run it in this one.
+*/
+static int vdbeSorterRunTask(SortSubtask *pTask, void *(*xTask)(void*)){
+  assert( pTask->pThread==0 );
+  if( pTask->pSorter->bUseThreads ){
+    return sqlite3ThreadCreate(&pTask->pThread, xTask, (void*)pTask);
+  }
+  return SQLITE_PTR_TO_INT(xTask((void*)pTask));
+}
+
+/*
+** Free any cursor components allocated by sqlite3VdbeSorterXXX routines.
+*/
+void sqlite3VdbeSorterClose(sqlite3 *db, VdbeCursor *pCsr){
+  VdbeSorter *pSorter = pCsr->pSorter;
+  if( pSorter ){
+    int i;
+    (void)vdbeSorterJoinAll(pSorter, SQLITE_OK);
+    vdbeMergeEngineFree(pSorter->pMerger);
+    for(i=0; i<pSorter->nTask; i++){
+      SortSubtask *pTask = &pSorter->aTask[i];
+      vdbeSorterRecordFree(pTask->pList);
+      if( pTask->pTemp1 ) sqlite3OsCloseFree(pTask->pTemp1);
+      if( pTask->pTemp2 ) sqlite3OsCloseFree(pTask->pTemp2);
+    }
+    vdbeSorterRecordFree(pSorter->pRecord);
+    sqlite3DbFree(db, pSorter);
+    pCsr->pSorter = 0;
+  }
+}
+
+/*
+** Allocate space for a file-handle and open a temporary file. If successful,
+** set *ppFile to point to the malloc'd file-handle and return SQLITE_OK.
+** Otherwise, set *ppFile to 0 and return an SQLite error code.
+*/
+static int vdbeSorterOpenTempFile(sqlite3 *db, sqlite3_file **ppFile){
+  int dummy;
+  *ppFile = 0;
+  return sqlite3OsOpenMalloc(db->pVfs, 0, ppFile,
+      SQLITE_OPEN_TEMP_JOURNAL |
+      SQLITE_OPEN_READWRITE    | SQLITE_OPEN_CREATE |
+      SQLITE_OPEN_EXCLUSIVE    | SQLITE_OPEN_DELETEONCLOSE, &dummy
+  );
+}
+
+/*
+** Merge the two sorted lists p1 and p2 into a single list.
+** Set *ppOut to the head of the new list.
+*/
+static void vdbeSorterMerge(
+  SortSubtask *pTask,             /* Sub-task doing the merge */
+  SorterRecord *p1,               /* First list to merge */
+  SorterRecord *p2,               /* Second list to merge */
+  SorterRecord **ppOut            /* OUT: Head of merged list */
+){
+  SorterRecord *pFinal = 0;
+  SorterRecord **pp = &pFinal;
+  void *pVal2 = p2 ? p2->pVal : 0;
+
+  while( p1 && p2 ){
+    int res;
+    vdbeSorterCompare(pTask, 0, p1->pVal, p1->nVal, pVal2, p2->nVal, &res);
+    if( res<=0 ){
+      *pp = p1;
+      pp = &p1->pNext;
+      p1 = p1->pNext;
+      pVal2 = 0;
+    }else{
+      *pp = p2;
+       pp = &p2->pNext;
+      p2 = p2->pNext;
+      if( p2==0 ) break;
+      pVal2 = p2->pVal;
+    }
+  }
+  *pp = p1 ? p1 : p2;
+  *ppOut = pFinal;
+}
+
+/*
+** Sort the linked list of records headed at *ppList. The list is merged
+** bottom-up, so that no recursion and no allocation is required.
+*/
+static void vdbeSorterSort(SortSubtask *pTask, SorterRecord **ppList){
+  int i;
+  SorterRecord *aSlot[64];
+  SorterRecord *p;
+
+  memset(aSlot, 0, sizeof(aSlot));
+  p = *ppList;
+  while( p ){
+    SorterRecord *pNext = p->pNext;
+    p->pNext = 0;
+    for(i=0; aSlot[i]; i++){
+      vdbeSorterMerge(pTask, p, aSlot[i], &p);
+      aSlot[i] = 0;
+    }
+    aSlot[i] = p;
+    p = pNext;
+  }
+
+  p = 0;
+  for(i=0; i<64; i++){
+    vdbeSorterMerge(pTask, p, aSlot[i], &p);
+  }
+  *ppList = p;
+}
+
+/*
+** Initialize a file-writer object.
+*/
+static void fileWriterInit(
+  sqlite3_file *pFile,            /* File to write to */
+  int nBuf,                       /* Size of the write buffer in bytes */
+  FileWriter *p,                  /* Object to populate */
+  i64 iStart                      /* Offset of pFile to begin writing at */
+){
+  memset(p, 0, sizeof(FileWriter));
+  p->aBuffer = (u8 *)sqlite3Malloc(nBuf);
+  if( !p->aBuffer ){
+    p->eFWErr = SQLITE_NOMEM;
+  }else{
+    p->iBufEnd = p->iBufStart = (int)(iStart % nBuf);
+    p->iWriteOff = iStart - p->iBufStart;
+    p->nBuffer = nBuf;
+    p->pFile = pFile;
+  }
+}
+
+/*
+** Write nData bytes of data to the file-write object. If an error
+** occurs, it is remembered and reported by fileWriterFinish().
+*/
+static void fileWriterWrite(FileWriter *p, const u8 *pData, int nData){
+  int nRem = nData;
+  while( nRem>0 && p->eFWErr==0 ){
+    int nCopy = nRem;
+    if( nCopy>(p->nBuffer - p->iBufEnd) ){
+      nCopy = p->nBuffer - p->iBufEnd;
+    }
+
+    memcpy(&p->aBuffer[p->iBufEnd], &pData[nData-nRem], nCopy);
+    p->iBufEnd += nCopy;
+    if( p->iBufEnd==p->nBuffer ){
+      p->eFWErr = sqlite3OsWrite(p->pFile,
+          &p->aBuffer[p->iBufStart], p->iBufEnd - p->iBufStart,
+          p->iWriteOff + p->iBufStart
+      );
+      p->iBufStart = p->iBufEnd = 0;
+      p->iWriteOff += p->nBuffer;
+    }
+    assert( p->iBufEnd<p->nBuffer );
+
+    nRem -= nCopy;
+  }
+}
+
+/*
+** Flush any buffered data to disk and clean up the file-writer object.
+** The results of using the file-writer after this call are undefined.
+** Return SQLITE_OK if flushing the buffered data succeeds or is not
+** required. Otherwise, return an SQLite error code.
+**
+** Before returning, set *piEof to the offset immediately following the
+** last byte written to the file.
+*/
+static int fileWriterFinish(FileWriter *p, i64 *piEof){
+  int rc;
+  if( p->eFWErr==0 && p->aBuffer && p->iBufEnd>p->iBufStart ){
+    p->eFWErr = sqlite3OsWrite(p->pFile,
+        &p->aBuffer[p->iBufStart], p->iBufEnd - p->iBufStart,
+        p->iWriteOff + p->iBufStart
+    );
+  }
+  *piEof = (p->iWriteOff + p->iBufEnd);
+  sqlite3_free(p->aBuffer);
+  rc = p->eFWErr;
+  memset(p, 0, sizeof(FileWriter));
+  return rc;
+}
+
+/*
+** Write value iVal encoded as a varint to the file-write object.
+*/
+static void fileWriterWriteVarint(FileWriter *p, u64 iVal){
+  int nByte;
+  u8 aByte[10];
+  nByte = sqlite3PutVarint(aByte, iVal);
+  fileWriterWrite(p, aByte, nByte);
+}
+
+/*
+** Sort the list of records pTask->pList and append it to the sub-task's
+** temporary file as a new PMA. The records are freed as they are
+** written. Return SQLITE_OK if successful, or an SQLite error code
+** otherwise.
+*/
+static int vdbeSorterListToPMA(SortSubtask *pTask){
+  VdbeSorter *pSorter = pTask->pSorter;
+  FileWriter writer;
+  SorterRecord *p;
+  SorterRecord *pNext = 0;
+
+  assert( pTask->pTemp1 && pTask->pList );
+  vdbeSorterSort(pTask, &pTask->pList);
+
+  fileWriterInit(pTask->pTemp1, pSorter->pgsz, &writer, pTask->iWriteOff);
+  pTask->nPMA++;
+  fileWriterWriteVarint(&writer, pTask->nList);
+  for(p=pTask->pList; p; p=pNext){
+    pNext = p->pNext;
+    fileWriterWriteVarint(&writer, p->nVal);
+    fileWriterWrite(&writer, p->pVal, p->nVal);
+    sqlite3_free(p);
+  }
+  pTask->pList = 0;
+  pTask->nList = 0;
+  return fileWriterFinish(&writer, &pTask->iWriteOff);
+}
+
+/*
+** The main routine of a background thread started to write a PMA.
+*/
+static void *vdbeSorterFlushThread(void *pCtx){
+  SortSubtask *pTask = (SortSubtask*)pCtx;
+  return SQLITE_INT_TO_PTR(vdbeSorterListToPMA(pTask));
+}
+
+/*
+** Hand the current in-memory list of records to a sub-task, which sorts
+** it and writes it to its temporary file as a new PMA. If the sorter uses
+** worker threads, the sub-tasks take turns and the work is done in the
+** background. If the sub-task is still busy with the previous list it
+** was given, wait for it first.
+*/
+static int vdbeSorterFlushPMA(sqlite3 *db, VdbeSorter *pSorter){
+  SortSubtask *pTask;
+  int rc;
+
+  if( pSorter->pRecord==0 ){
+    return SQLITE_OK;
+  }
+  pSorter->iPrev = (pSorter->iPrev + 1) % pSorter->nTask;
+  pTask = &pSorter->aTask[pSorter->iPrev];
+  rc = vdbeSorterJoinThread(pTask);
+  if( rc==SQLITE_OK && pTask->pTemp1==0 ){
+    rc = vdbeSorterOpenTempFile(db, &pTask->pTemp1);
+    assert( rc!=SQLITE_OK || pTask->pTemp1 );
+  }
+  if( rc==SQLITE_OK ){
+    assert( pTask->pList==0 );
+    pTask->pList = pSorter->pRecord;
+    pTask->nList = pSorter->nInMemory;
+    pSorter->pRecord = 0;
+    pSorter->nInMemory = 0;
+    pSorter->nSpill++;
+#ifdef SQLITE_TEST
+    sqlite3_sort_run_count++;
+#endif
+    rc = vdbeSorterRunTask(pTask, vdbeSorterFlushThread);
+  }
+  return rc;
+}
+
+/*
+** Add a record to the sorter.
+*/
+int sqlite3VdbeSorterWrite(
+  sqlite3 *db,                    /* Database handle */
+  const VdbeCursor *pCsr,         /* Sorter cursor */
+  Mem *pVal                       /* Memory cell containing record */
+){
+  VdbeSorter *pSorter = pCsr->pSorter;
+  SorterRecord *pNew;             /* New list element */
+  int rc = SQLITE_OK;
+
+  assert( pSorter );
+  assert( pSorter->pMerger==0 );
+  assert( pVal->flags & MEM_Blob );
+
+  pNew = (SorterRecord *)sqlite3Malloc(pVal->n+sizeof(SorterRecord));
+  if( pNew==0 ){
+    return SQLITE_NOMEM;
+  }
+  pNew->pVal = (void *)&pNew[1];
+  memcpy(pNew->pVal, pVal->z, pVal->n);
+  pNew->nVal = pVal->n;
+  pNew->pNext = pSorter->pRecord;
+  pSorter->pRecord = pNew;
+  pSorter->nInMemory += sqlite3VarintLen(pVal->n) + pVal->n;
+
+  /* If the in-memory list has grown larger than the budget, sort it and
+  ** write it to a temporary file as a new PMA.  */
+  if( pSorter->mxPmaSize>0 && pSorter->nInMemory>pSorter->mxPmaSize ){
+    rc = vdbeSorterFlushPMA(db, pSorter);
+  }
+
+  return rc;
+}
+
+/*
+** Merge the PMAs in the temporary file of sub-task pTask,
+** SORTER_MAX_MERGE_COUNT at a time, into PMAs in file pTask->pTemp2.
+** The two files are then swapped. Repeat until no more than
+** pTask->nTarget PMAs remain.
+*/
+static int vdbeSorterMergeDown(SortSubtask *pTask){
+  VdbeSorter *pSorter = pTask->pSorter;
+  MergeEngine *pMerger;
+  int rc = SQLITE_OK;
+
+  pMerger = vdbeMergeEngineNew(SORTER_MAX_MERGE_COUNT, pTask);
+  if( pMerger==0 ) return SQLITE_NOMEM;
+
+  while( rc==SQLITE_OK && pTask->nPMA>pTask->nTarget ){
+    i64 iRead = 0;                /* Read offset in pTemp1 */
+    i64 iWrite2 = 0;              /* Write offset in pTemp2 */
+    int nRem = pTask->nPMA;       /* PMAs not yet merged in this pass */
+    int nNew = 0;                 /* PMAs written to pTemp2 in this pass */
+
+    assert( pTask->pTemp2 );
+    while( rc==SQLITE_OK && nRem>0 ){
+      FileWriter writer;          /* Object used to write to disk */
+      i64 nWrite = 0;             /* Number of bytes in new PMA */
+      int nIter;                  /* Number of PMAs merged into this one */
+      int bEof = 0;
+      int i;
+      int rc2;
+
+      nIter = nRem;
+      if( nIter>SORTER_MAX_MERGE_COUNT ) nIter = SORTER_MAX_MERGE_COUNT;
+      for(i=0; rc==SQLITE_OK && i<nIter; i++){
+        VdbeSorterIter *pIter = &pMerger->aIter[i];
+        rc = vdbeSorterIterInit(pTask->pTemp1, iRead, pTask->iWriteOff,
+                                pSorter->pgsz, pIter, &nWrite);
+        iRead = pIter->iEof;
+      }
+      if( rc!=SQLITE_OK ) break;
+      vdbeMergeEngineInit(pMerger);
+
+      fileWriterInit(pTask->pTemp2, pSorter->pgsz, &writer, iWrite2);
+      fileWriterWriteVarint(&writer, nWrite);
+      while( rc==SQLITE_OK && bEof==0 ){
+        VdbeSorterIter *pIter = &pMerger->aIter[ pMerger->aTree[1] ];
+        assert( pIter->pFile );
+        fileWriterWriteVarint(&writer, pIter->nKey);
+        fileWriterWrite(&writer, pIter->aKey, pIter->nKey);
+        rc = vdbeMergeEngineStep(pMerger, &bEof);
+      }
+      rc2 = fileWriterFinish(&writer, &iWrite2);
+      if( rc==SQLITE_OK ) rc = rc2;
+      vdbeMergeEngineReset(pMerger);
+      nRem -= nIter;
+      nNew++;
+    }
+
+    if( rc==SQLITE_OK ){
+      sqlite3_file *pTmp = pTask->pTemp1;
+      pTask->pTemp1 = pTask->pTemp2;
+      pTask->pTemp2 = pTmp;
+      pTask->iWriteOff = iWrite2;
+      pTask->nPMA = nNew;
+    }
+  }
+
+  vdbeMergeEngineFree(pMerger);
+  return rc;
+}
+
+/*
+** The main routine of a background thread started to merge PMAs.
+*/
+static void *vdbeSorterMergeThread(void *pCtx){
+  SortSubtask *pTask = (SortSubtask*)pCtx;
+  return SQLITE_INT_TO_PTR(vdbeSorterMergeDown(pTask));
+}
+
+/*
+** Once the sorter has been populated, this function is called to prepare
+** for iterating through its contents in sorted order. Set *pbEof to true
+** if the sorter is empty.
+*/
+int sqlite3VdbeSorterRewind(sqlite3 *db, const VdbeCursor *pCsr, int *pbEof){
+  VdbeSorter *pSorter = pCsr->pSorter;
+  MergeEngine *pMerger;           /* Engine for the final merge */
+  int rc = SQLITE_OK;             /* Return code */
+  int nIter = 0;                  /* Number of PMAs left to merge */
+  int nTarget;                    /* PMAs each sub-task may leave */
+  int i;
+
+  assert( pSorter );
+
+  /* If no data has been written to disk, then do not do so now. Instead,
+  ** sort the VdbeSorter.pRecord list. The vdbe layer will read data directly
+  ** from the in-memory list.  */
+  if( pSorter->nSpill==0 ){
+    *pbEof = !pSorter->pRecord;
+    vdbeSorterSort(&pSorter->aTask[0], &pSorter->pRecord);
+    return SQLITE_OK;
+  }
+
+  /* Write the current in-memory list to a PMA, then wait for all the
+  ** sub-tasks to finish writing. */
+  rc = vdbeSorterFlushPMA(db, pSorter);
+  rc = vdbeSorterJoinAll(pSorter, rc);
+  if( rc!=SQLITE_OK ) return rc;
+
+  /* Have each sub-task merge its PMAs until there are few enough left,
+  ** in all, for a single merge engine. The sub-tasks do this in
+  ** parallel if they have threads of their own. */
+  nTarget = SORTER_MAX_MERGE_COUNT / pSorter->nTask;
+  for(i=0; rc==SQLITE_OK && i<pSorter->nTask; i++){
+    SortSubtask *pTask = &pSorter->aTask[i];
+    pTask->nTarget = nTarget;
+    if( pTask->nPMA>nTarget ){
+      if( pTask->pTemp2==0 ){
+        rc = vdbeSorterOpenTempFile(db, &pTask->pTemp2);
+      }
+      if( rc==SQLITE_OK ){
+        rc = vdbeSorterRunTask(pTask, vdbeSorterMergeThread);
+      }
+    }
+  }
+  rc = vdbeSorterJoinAll(pSorter, rc);
+  if( rc!=SQLITE_OK ) return rc;
+
+  /* Open an iterator on each of the remaining PMAs and begin the final
+  ** merge, which the VDBE reads through sqlite3VdbeSorterNext(). */
+  for(i=0; i<pSorter->nTask; i++){
+    nIter += pSorter->aTask[i].nPMA;
+  }
+  assert( nIter>0 && nIter<=SORTER_MAX_MERGE_COUNT );
+  pSorter->pMerger = pMerger = vdbeMergeEngineNew(nIter, &pSorter->aTask[0]);
+  if( pMerger==0 ) return SQLITE_NOMEM;
+  nIter = 0;
+  for(i=0; rc==SQLITE_OK && i<pSorter->nTask; i++){
+    SortSubtask *pTask = &pSorter->aTask[i];
+    i64 iRead = 0;
+    int j;
+    for(j=0; rc==SQLITE_OK && j<pTask->nPMA; j++){
+      VdbeSorterIter *pIter = &pMerger->aIter[nIter++];
+      i64 nDummy = 0;
+      rc = vdbeSorterIterInit(pTask->pTemp1, iRead, pTask->iWriteOff,
+                              pSorter->pgsz, pIter, &nDummy);
+      iRead = pIter->iEof;
+    }
+  }
+  if( rc==SQLITE_OK ){
+    vdbeMergeEngineInit(pMerger);
+    *pbEof = (pMerger->aIter[pMerger->aTree[1]].pFile==0);
+  }
+  return rc;
+}
+
+/*
+** Advance to the next element in the sorter. Set *pbEof to true if
+** there are no more elements.
+*/
+int sqlite3VdbeSorterNext(sqlite3 *db, const VdbeCursor *pCsr, int *pbEof){
+  VdbeSorter *pSorter = pCsr->pSorter;
+  int rc = SQLITE_OK;             /* Return code */
+
+  UNUSED_PARAMETER(db);
+  if( pSorter->pMerger ){
+    rc = vdbeMergeEngineStep(pSorter->pMerger, pbEof);
+  }else{
+    SorterRecord *pFree = pSorter->pRecord;
+    pSorter->pRecord = pFree->pNext;
+    pFree->pNext = 0;
+    vdbeSorterRecordFree(pFree);
+    *pbEof = !pSorter->pRecord;
+  }
+  return rc;
+}
+
+/*
+** Return a pointer to the key that the sorter cursor currently points
+** to, and set *pnKey to its size in bytes. The key remains valid until
+** the sorter is advanced or closed.
+*/
+const void *sqlite3VdbeSorterRowkey(const VdbeCursor *pCsr, int *pnKey){
+  VdbeSorter *pSorter = pCsr->pSorter;
+  const void *pKey;
+  if( pSorter->pMerger ){
+    MergeEngine *pMerger = pSorter->pMerger;
+    VdbeSorterIter *pIter;
+    pIter = &pMerger->aIter[ pMerger->aTree[1] ];
+    *pnKey = pIter->nKey;
+    pKey = pIter->aKey;
+  }else{
+    *pnKey = pSorter->pRecord->nVal;
+    pKey = pSorter->pRecord->pVal;
+  }
+  return pKey;
+}
+
+/*
+** Compare the key in memory cell pVal with the key that the sorter cursor
+** passed as the first argument currently points to. For the purposes of
+** the comparison, ignore the rowid field at the end of each record. Also,
+** a key that contains a NULL value never compares equal to another.
+**
+** Set *pRes to a negative, zero or positive value if the key in pVal is
+** smaller than, equal to or larger than the current sorter key, and
+** return SQLITE_OK.
+*/
+int sqlite3VdbeSorterCompare(
+  const VdbeCursor *pCsr,         /* Sorter cursor */
+  Mem *pVal,                      /* Value to compare to current sorter key */
+  int *pRes                       /* OUT: Result of comparison */
+){
+  VdbeSorter *pSorter = pCsr->pSorter;
+  const void *pKey;
+  int nKey;
+  pKey = sqlite3VdbeSorterRowkey(pCsr, &nKey);
+  vdbeSorterCompare(&pSorter->aTask[0], 1, pVal->z, pVal->n, pKey, nKey, pRes);
+  return SQLITE_OK;
+}
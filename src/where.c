@@ -241,6 +241,8 @@ struct WhereCost {
 #define WHERE_UNIQUE       0x04000000  /* Selects no more than one row */
 #define WHERE_VIRTUALTABLE 0x08000000  /* Use virtual-table processing */
 #define WHERE_MULTI_OR     0x10000000  /* OR using multiple indices */
+#define WHERE_TEMP_INDEX   0x20000000  /* Uses an automatic transient index */
+#define WHERE_NOT_FULLSCAN 0x18073000  /* Does not do a full table scan */
 
 /*
 ** Initialize a preallocated WhereClause structure.
@@ -1698,6 +1700,438 @@ static double bestVirtualIndex(
 }
 #endif /* SQLITE_OMIT_VIRTUALTABLE */
 
+#ifndef SQLITE_OMIT_AUTOMATIC_INDEX
+/*
+** Return TRUE if the WHERE clause term pTerm is of a form where it
+** could be used with an automatic index to access pSrc, assuming an
+** appropriate index existed: an equality comparison between a column
+** of pSrc and an expression that is available once the tables in
+** notReady have been excluded.
+*/
+static int termCanDriveIndex(
+  WhereTerm *pTerm,              /* WHERE clause term to check */
+  struct SrcList_item *pSrc,     /* Table we are trying to access */
+  Bitmask notReady               /* Tables in outer loops of the join */
+){
+  Expr *pX = pTerm->pExpr;
+  char aff;
+  if( pTerm->leftCursor!=pSrc->iCursor ) return 0;
+  if( pTerm->eOperator!=WO_EQ ) return 0;
+  if( (pTerm->prereqRight & notReady)!=0 ) return 0;
+  if( pTerm->u.leftColumn<0 ) return 0;
+  aff = pSrc->pTab->aCol[pTerm->u.leftColumn].affinity;
+  if( !sqlite3IndexAffinityOk(pX, aff) ) return 0;
+
+  /* Lookups apply the affinity of the column to the value sought.  If
+  ** the comparison itself would not, a lookup could find rows that a
+  ** full scan would reject, so only allow that when the column has no
+  ** affinity to apply. */
+  if( aff!=SQLITE_AFF_NONE
+   && sqlite3CompareAffinity(pX->pRight, sqlite3ExprAffinity(pX->pLeft))
+          ==SQLITE_AFF_NONE
+  ){
+    return 0;
+  }
+  return 1;
+}
+
+/*
+** If the query plan for pSrc is a full table scan, consider building
+** a transient index on the columns of pSrc that are compared for
+** equality with values from the outer loops of the join.
+**
+** Building the index costs about N*logN for a table of N rows, and it
+** is built once each time the WHERE loop runs.  Spread over the
+** pParse->nQueryLoop times the inner loop is expected to run, that
+** is compared against the N rows a full scan reads on every pass.
+** If the index wins, *pCost is changed to a WHERE_TEMP_INDEX plan.
+** The index itself is made by constructAutomaticIndex().
+*/
+static void bestAutomaticIndex(
+  Parse *pParse,              /* The parsing context */
+  WhereClause *pWC,           /* The WHERE clause */
+  struct SrcList_item *pSrc,  /* The FROM clause term to search */
+  Bitmask notReady,           /* Mask of cursors that are not available */
+  WhereCost *pCost            /* Lowest cost query plan */
+){
+  double nTableRow;           /* Rows in the input table */
+  double logN;                /* log(nTableRow) */
+  double costTempIdx;         /* Per-pass cost of using a transient index */
+  WhereTerm *pTerm;           /* A single term of the WHERE clause */
+  WhereTerm *pWCEnd;          /* End of pWC->a[] */
+  Table *pTable;              /* Table that might be indexed */
+
+  if( (pParse->db->flags & SQLITE_AutoIndex)==0 ){
+    /* Automatic indices are disabled by PRAGMA automatic_index */
+    return;
+  }
+  if( (pCost->plan.wsFlags & WHERE_NOT_FULLSCAN)!=0 ){
+    /* Some kind of index or rowid lookup is already in use */
+    return;
+  }
+  if( pSrc->notIndexed || pSrc->pIndex ){
+    /* The NOT INDEXED or INDEXED BY clause says what to do */
+    return;
+  }
+
+  assert( pParse->nQueryLoop>=(double)1 );
+  pTable = pSrc->pTab;
+  nTableRow = pTable->pIndex ? pTable->pIndex->aiRowEst[0] : 1000000;
+  logN = estLog(nTableRow);
+  costTempIdx = 2*logN*(nTableRow/pParse->nQueryLoop + 1);
+  if( costTempIdx>=nTableRow ){
+    /* Building the index costs more than it saves */
+    return;
+  }
+
+  /* Search for any equality comparison term */
+  pWCEnd = &pWC->a[pWC->nTerm];
+  for(pTerm=pWC->a; pTerm<pWCEnd; pTerm++){
+    if( termCanDriveIndex(pTerm, pSrc, notReady) ){
+      WHERETRACE(("... auto-index reduces cost from %.9g to %.9g\n",
+                  nTableRow, costTempIdx));
+      pCost->rCost = costTempIdx;
+      pCost->nRow = logN + 1;
+      pCost->plan.wsFlags = WHERE_TEMP_INDEX | WO_EQ;
+      pCost->plan.nEq = 0;
+      pCost->plan.u.pIdx = 0;
+      break;
+    }
+  }
+}
+
+/*
+** Generate code to build the automatic index chosen for pLevel by
+** bestAutomaticIndex().  The index holds one column for each column of
+** the table that an equality term can drive, followed by the rowid.
+** The code runs each time the WHERE loop is entered, before the
+** outermost loop starts, so the index always reflects the current
+** content of the table.
+**
+** Afterwards pLevel describes an ordinary index lookup with nEq
+** equality constraints.  The Index object belongs to pLevel and is
+** freed by whereInfoFree().
+*/
+static void constructAutomaticIndex(
+  Parse *pParse,              /* The parsing context */
+  WhereClause *pWC,           /* The WHERE clause */
+  struct SrcList_item *pSrc,  /* The FROM clause term to index */
+  Bitmask notReady,           /* Mask of cursors that are not available */
+  WhereLevel *pLevel          /* Write the new index here */
+){
+  sqlite3 *db = pParse->db;   /* Database connection */
+  Vdbe *v = pParse->pVdbe;    /* Prepared statement under construction */
+  Table *pTable = pSrc->pTab; /* The table being indexed */
+  int iCur = pSrc->iCursor;   /* Cursor open on pTable */
+  WhereTerm *pTerm;           /* A single term of the WHERE clause */
+  WhereTerm *pWCEnd;          /* End of pWC->a[] */
+  Index *pIdx;                /* Object describing the transient index */
+  KeyInfo *pKeyinfo;          /* Key information for the index */
+  int mxColumn;               /* Upper bound on the number of columns */
+  int nColumn;                /* Number of columns in the index */
+  int addrTop;                /* Top of the loop that fills the index */
+  int regRecord;              /* Register holding an index record */
+  int i;                      /* Loop counter */
+
+  /* Several terms may constrain the same column, so the number of
+  ** terms that can drive the index is only an upper bound.
+  */
+  mxColumn = 0;
+  pWCEnd = &pWC->a[pWC->nTerm];
+  for(pTerm=pWC->a; pTerm<pWCEnd; pTerm++){
+    if( termCanDriveIndex(pTerm, pSrc, notReady) ) mxColumn++;
+  }
+  assert( mxColumn>0 );
+
+  pIdx = sqlite3DbMallocZero(db, sizeof(*pIdx) + mxColumn*sizeof(char*)
+                      + (mxColumn+1)*(sizeof(int)+sizeof(unsigned)+1));
+  if( pIdx==0 ) return;
+  pLevel->plan.u.pIdx = pIdx;
+  pIdx->azColl = (char**)&pIdx[1];
+  pIdx->aiColumn = (int*)&pIdx->azColl[mxColumn];
+  pIdx->aiRowEst = (unsigned*)&pIdx->aiColumn[mxColumn+1];
+  pIdx->aSortOrder = (u8*)&pIdx->aiRowEst[mxColumn+1];
+  pIdx->zName = "auto-index";
+  pIdx->pTable = pTable;
+  pIdx->pSchema = pTable->pSchema;
+  pIdx->onError = OE_None;
+
+  /* Add one column for each table column that is constrained, using
+  ** the collating sequence of the first term that constrains it.
+  */
+  nColumn = 0;
+  for(pTerm=pWC->a; pTerm<pWCEnd; pTerm++){
+    if( termCanDriveIndex(pTerm, pSrc, notReady) ){
+      int iCol = pTerm->u.leftColumn;
+      Expr *pX = pTerm->pExpr;
+      CollSeq *pColl;
+      for(i=0; i<nColumn && pIdx->aiColumn[i]!=iCol; i++){}
+      if( i<nColumn ) continue;
+      pColl = sqlite3BinaryCompareCollSeq(pParse, pX->pLeft, pX->pRight);
+      pIdx->aiColumn[nColumn] = iCol;
+      pIdx->azColl[nColumn] = pColl ? pColl->zName : "BINARY";
+      nColumn++;
+    }
+  }
+  pIdx->nColumn = nColumn;
+  pIdx->aiRowEst[0] = pTable->pIndex ? pTable->pIndex->aiRowEst[0] : 1000000;
+  for(i=1; i<=nColumn; i++){
+    pIdx->aiRowEst[i] = 10;
+  }
+  pLevel->plan.wsFlags |= WHERE_COLUMN_EQ;
+  pLevel->plan.nEq = nColumn;
+  pLevel->iTabCur = iCur;
+
+  /* Create the transient index and fill it from the table */
+  pKeyinfo = sqlite3IndexKeyinfo(pParse, pIdx);
+  sqlite3VdbeAddOp4(v, OP_OpenAutoindex, pLevel->iIdxCur, nColumn+1, 0,
+                    (char*)pKeyinfo, P4_KEYINFO_HANDOFF);
+  VdbeComment((v, "auto-index on %s", pTable->zName));
+  addrTop = sqlite3VdbeAddOp1(v, OP_Rewind, iCur);
+  regRecord = sqlite3GetTempReg(pParse);
+  sqlite3GenerateIndexKey(pParse, pIdx, iCur, regRecord, 1);
+  sqlite3VdbeAddOp2(v, OP_IdxInsert, pLevel->iIdxCur, regRecord);
+  sqlite3VdbeAddOp2(v, OP_Next, iCur, addrTop+1);
+  sqlite3VdbeJumpHere(v, addrTop);
+  sqlite3ReleaseTempReg(pParse, regRecord);
+}
+#endif /* SQLITE_OMIT_AUTOMATIC_INDEX */
+
+#ifndef SQLITE_OMIT_ANALYZE
+/*
+** The order in which the storage classes sort in an index, indexed by
+** SQLITE_INTEGER, SQLITE_FLOAT, SQLITE_TEXT, SQLITE_BLOB and SQLITE_NULL.
+*/
+static const u8 aSortClass[] = { 0, 1, 1, 2, 3, 0 };
+
+/*
+** Set *pp to the value of expression pExpr with affinity aff applied,
+** or to NULL if pExpr is not a literal.  The literals in a WHERE clause
+** may already have been moved into registers by
+** sqlite3ExprCodeConstants(), in which case Expr.op2 records what they
+** were.
+*/
+static int valueFromExpr(
+  Parse *pParse,              /* Parsing & code generating context */
+  Expr *pExpr,                /* The expression to evaluate */
+  u8 aff,                     /* Affinity to apply to the value */
+  sqlite3_value **pp          /* OUT: The value, or NULL */
+){
+  int rc;
+  if( pExpr->op==TK_REGISTER ){
+    pExpr->op = pExpr->op2;
+    rc = sqlite3ValueFromExpr(pParse->db, pExpr, SQLITE_UTF8, aff, pp);
+    pExpr->op = TK_REGISTER;
+  }else{
+    rc = sqlite3ValueFromExpr(pParse->db, pExpr, SQLITE_UTF8, aff, pp);
+  }
+  return rc;
+}
+
+/*
+** Set *piRegion to the number of samples of index pIdx that are less
+** than pVal, or less than or equal to pVal if roundUp is true.  A NULL
+** pVal stands for an SQL NULL.  Because the samples are evenly spaced
+** through the index, this is the number of the SQLITE_INDEX_SAMPLES
+** equal parts of the index that lie before the value.
+**
+** Return SQLITE_OK on success or an error code if pVal cannot be
+** compared with the samples.
+*/
+static int whereRangeRegion(
+  Parse *pParse,              /* Parsing & code generating context */
+  Index *pIdx,                /* Index with samples */
+  sqlite3_value *pVal,        /* Value to locate, or NULL */
+  int roundUp,                /* Count samples equal to pVal as well */
+  int *piRegion               /* OUT: Number of samples before pVal */
+){
+  sqlite3 *db = pParse->db;
+  int eType = pVal ? sqlite3_value_type(pVal) : SQLITE_NULL;
+  CollSeq *pColl = 0;
+  const u8 *z = 0;
+  int n = 0;
+  double r = 0.0;
+  int nRegion = 0;
+  int i;
+
+  if( eType==SQLITE_INTEGER || eType==SQLITE_FLOAT ){
+    r = sqlite3_value_double(pVal);
+  }else if( eType==SQLITE_TEXT ){
+    pColl = sqlite3GetCollSeq(db, 0, pIdx->azColl[0], -1);
+    if( pColl==0 ){
+      return SQLITE_ERROR;
+    }
+    z = (const u8 *)sqlite3ValueText(pVal, pColl->enc);
+    if( z==0 ){
+      return SQLITE_NOMEM;
+    }
+    n = sqlite3ValueBytes(pVal, pColl->enc);
+  }else if( eType==SQLITE_BLOB ){
+    z = (const u8 *)sqlite3_value_blob(pVal);
+    n = sqlite3_value_bytes(pVal);
+  }
+
+  for(i=0; i<SQLITE_INDEX_SAMPLES; i++){
+    IndexSample *pSample = &pIdx->aSample[i];
+    int c = aSortClass[pSample->eType] - aSortClass[eType];
+    if( c==0 ){
+      if( eType==SQLITE_INTEGER || eType==SQLITE_FLOAT ){
+        c = (pSample->u.r<r) ? -1 : (pSample->u.r>r);
+      }else if( eType==SQLITE_TEXT ){
+#ifndef SQLITE_OMIT_UTF16
+        if( pColl->enc!=SQLITE_UTF8 ){
+          sqlite3_value *pSampleVal = sqlite3ValueNew(db);
+          const void *zSample;
+          if( pSampleVal==0 ){
+            return SQLITE_NOMEM;
+          }
+          sqlite3ValueSetStr(pSampleVal, pSample->nByte, pSample->u.z,
+                             SQLITE_UTF8, SQLITE_STATIC);
+          zSample = sqlite3ValueText(pSampleVal, pColl->enc);
+          if( zSample==0 ){
+            sqlite3ValueFree(pSampleVal);
+            return SQLITE_NOMEM;
+          }
+          c = pColl->xCmp(pColl->pUser,
+              sqlite3ValueBytes(pSampleVal, pColl->enc), zSample, n, z);
+          sqlite3ValueFree(pSampleVal);
+        }else
+#endif
+        {
+          c = pColl->xCmp(pColl->pUser, pSample->nByte, pSample->u.z, n, z);
+        }
+      }else if( eType==SQLITE_BLOB ){
+        c = memcmp(pSample->u.z, z, pSample->nByte<n ? pSample->nByte : n);
+        if( c==0 ) c = pSample->nByte - n;
+      }
+    }
+    if( c<0 || (c==0 && roundUp) ){
+      nRegion++;
+    }
+  }
+  *piRegion = nRegion;
+  return SQLITE_OK;
+}
+
+/*
+** Estimate the number of rows of index p that match the equality
+** constraint pTerm on its first column, using the samples in p->aSample.
+** A value that fills K of the parts of the index between samples is
+** expected to match about K/SQLITE_INDEX_SAMPLES of the rows.  A value
+** that is not one of the samples can match no more than a part, and is
+** guessed to match half of one.  If the value matches a single sample
+** it may match anything from one row to two parts, so the estimate from
+** the sqlite_stat1 table in *pnRow is left alone.  *pnRow is also left
+** alone if the right-hand side of pTerm is not a constant.
+*/
+static void whereEqualScanEst(
+  Parse *pParse,              /* Parsing & code generating context */
+  Index *p,                   /* The index whose first column is constrained */
+  WhereTerm *pTerm,           /* The x==EXPR or x IS NULL constraint */
+  double *pnRow               /* IN/OUT: Estimated number of matching rows */
+){
+  sqlite3_value *pVal = 0;
+  int iLower, iUpper;
+  int rc;
+
+  if( pTerm->eOperator!=WO_ISNULL ){
+    u8 aff = p->pTable->aCol[p->aiColumn[0]].affinity;
+    assert( pTerm->eOperator==WO_EQ );
+    rc = valueFromExpr(pParse, pTerm->pExpr->pRight, aff, &pVal);
+    if( rc!=SQLITE_OK || pVal==0 ) return;
+  }
+  rc = whereRangeRegion(pParse, p, pVal, 0, &iLower);
+  if( rc==SQLITE_OK ){
+    rc = whereRangeRegion(pParse, p, pVal, 1, &iUpper);
+  }
+  sqlite3ValueFree(pVal);
+  if( rc!=SQLITE_OK ) return;
+
+  if( iUpper-iLower>1 ){
+    *pnRow = (iUpper-iLower)*(double)p->aiRowEst[0]/SQLITE_INDEX_SAMPLES;
+  }else if( iUpper==iLower ){
+    double nRowEst = p->aiRowEst[0]/(double)(SQLITE_INDEX_SAMPLES*2);
+    if( nRowEst<1 ) nRowEst = 1;
+    if( nRowEst<*pnRow ) *pnRow = nRowEst;
+  }
+  WHERETRACE(("...... samples %d..%d give nRow=%.9g\n",
+              iLower, iUpper, *pnRow));
+}
+#endif /* SQLITE_OMIT_ANALYZE */
+
+/*
+** Return the factor by which the range constraints pLower (x>EXPR or
+** x>=EXPR) and pUpper (x<EXPR or x<=EXPR) on column nEq of index p are
+** expected to reduce the number of rows scanned.  Either of pLower or
+** pUpper may be NULL.
+**
+** If the range is on the first column of an index with samples from
+** the sqlite_stat2 table and at least one of the bounds is a constant,
+** the factor comes from the number of samples that fall between the
+** bounds.  Otherwise each bound is assumed to eliminate two-thirds of
+** the rows.
+*/
+static double whereRangeScanEst(
+  Parse *pParse,              /* Parsing & code generating context */
+  Index *p,                   /* The index containing the range-compared column */
+  int nEq,                    /* Index of the range-compared column */
+  WhereTerm *pLower,          /* Lower bound on the range.  Or NULL */
+  WhereTerm *pUpper           /* Upper bound on the range.  Or NULL */
+){
+  double rangeDiv = 1;
+#ifndef SQLITE_OMIT_ANALYZE
+  if( nEq==0 && p->aSample ){
+    sqlite3_value *pLowerVal = 0;
+    sqlite3_value *pUpperVal = 0;
+    int iLower = 0;
+    int iUpper = SQLITE_INDEX_SAMPLES;
+    u8 aff = p->pTable->aCol[p->aiColumn[0]].affinity;
+    int rc = SQLITE_OK;
+
+    if( pLower ){
+      rc = valueFromExpr(pParse, pLower->pExpr->pRight, aff, &pLowerVal);
+    }
+    if( rc==SQLITE_OK && pUpper ){
+      rc = valueFromExpr(pParse, pUpper->pExpr->pRight, aff, &pUpperVal);
+    }
+    if( rc==SQLITE_OK && pLowerVal ){
+      assert( pLower->eOperator==WO_GT || pLower->eOperator==WO_GE );
+      rc = whereRangeRegion(pParse, p, pLowerVal,
+                            pLower->eOperator==WO_GT, &iLower);
+    }
+    if( rc==SQLITE_OK && pUpperVal ){
+      assert( pUpper->eOperator==WO_LT || pUpper->eOperator==WO_LE );
+      rc = whereRangeRegion(pParse, p, pUpperVal,
+                            pUpper->eOperator==WO_LE, &iUpper);
+    }
+    if( rc==SQLITE_OK && (pLowerVal || pUpperVal) ){
+      int iEst = iUpper - iLower;
+      if( iEst<1 ){
+        rangeDiv = SQLITE_INDEX_SAMPLES*2;
+      }else{
+        rangeDiv = SQLITE_INDEX_SAMPLES/(double)iEst;
+      }
+      if( pLower && !pLowerVal ) rangeDiv *= 3;
+      if( pUpper && !pUpperVal ) rangeDiv *= 3;
+      WHERETRACE(("...... samples %d..%d give range factor %.9g\n",
+                  iLower, iUpper, rangeDiv));
+      sqlite3ValueFree(pLowerVal);
+      sqlite3ValueFree(pUpperVal);
+      return rangeDiv;
+    }
+    sqlite3ValueFree(pLowerVal);
+    sqlite3ValueFree(pUpperVal);
+  }
+#else
+  UNUSED_PARAMETER(pParse);
+  UNUSED_PARAMETER(p);
+  UNUSED_PARAMETER(nEq);
+#endif
+  if( pLower ) rangeDiv *= 3;
+  if( pUpper ) rangeDiv *= 3;
+  return rangeDiv;
+}
+
 /*
 ** Find the query plan for accessing a particular table.  Write the
 ** best query plan and its cost into the WhereCost object supplied as the
@@ -1745,6 +2179,7 @@ static void bestIndex(
   double nRow;                /* Estimated number of rows in result set */
   int i;                      /* Loop counter */
   Bitmask maskSrc;            /* Bitmask for the pSrc table */
+  WhereTerm *pFirstTerm;      /* The == constraint on the first index column */
 
   WHERETRACE(("bestIndex: tbl=%s notReady=%llx\n", pSrc->pTab->zName,notReady));
   pProbe = pSrc->pTab->pIndex;
@@ -1769,6 +2204,10 @@ static void bestIndex(
       */
       pCost->plan.wsFlags |= WHERE_REVERSE;
     }
+    pCost->nRow = 1000000;
+#ifndef SQLITE_OMIT_AUTOMATIC_INDEX
+    bestAutomaticIndex(pParse, pWC, pSrc, notReady, pCost);
+#endif
     return;
   }
   pCost->rCost = SQLITE_BIG_DBL;
@@ -1947,10 +2386,12 @@ static void bestIndex(
     ** binary searches needed.
     */
     wsFlags = 0;
+    pFirstTerm = 0;
     for(i=0; i<pProbe->nColumn; i++){
       int j = pProbe->aiColumn[i];
       pTerm = findTerm(pWC, iCur, j, notReady, eqTermMask, pProbe);
       if( pTerm==0 ) break;
+      if( i==0 ) pFirstTerm = pTerm;
       wsFlags |= WHERE_COLUMN_EQ;
       if( pTerm->eOperator & WO_IN ){
         Expr *pExpr = pTerm->pExpr;
@@ -1971,6 +2412,14 @@ static void bestIndex(
       nRow = pProbe->aiRowEst[0]/2;
       inMultiplier = nRow/pProbe->aiRowEst[i];
     }
+#ifndef SQLITE_OMIT_ANALYZE
+    /* If there is a single x==EXPR constraint on the first column,
+    ** see whether the samples say that EXPR is a common value or a rare
+    ** one. */
+    if( i==1 && pProbe->aSample && (wsFlags & WHERE_COLUMN_IN)==0 ){
+      whereEqualScanEst(pParse, pProbe, pFirstTerm, &nRow);
+    }
+#endif
     cost = nRow + inMultiplier*estLog(pProbe->aiRowEst[0]);
     nEq = i;
     if( pProbe->onError!=OE_None && (wsFlags & WHERE_COLUMN_IN)==0
@@ -1980,24 +2429,25 @@ static void bestIndex(
     WHERETRACE(("...... nEq=%d inMult=%.9g nRow=%.9g cost=%.9g\n",
                 nEq, inMultiplier, nRow, cost));
 
-    /* Look for range constraints.  Assume that each range constraint
-    ** makes the search space 1/3rd smaller.
+    /* Look for range constraints.  See whereRangeScanEst() for how much
+    ** smaller they are expected to make the search space.
     */
     if( nEq<pProbe->nColumn ){
       int j = pProbe->aiColumn[nEq];
       pTerm = findTerm(pWC, iCur, j, notReady, WO_LT|WO_LE|WO_GT|WO_GE, pProbe);
       if( pTerm ){
+        WhereTerm *pTop = findTerm(pWC, iCur, j, notReady, WO_LT|WO_LE, pProbe);
+        WhereTerm *pBtm = findTerm(pWC, iCur, j, notReady, WO_GT|WO_GE, pProbe);
+        double rangeDiv = whereRangeScanEst(pParse, pProbe, nEq, pBtm, pTop);
         wsFlags |= WHERE_COLUMN_RANGE;
-        if( findTerm(pWC, iCur, j, notReady, WO_LT|WO_LE, pProbe) ){
+        if( pTop ){
           wsFlags |= WHERE_TOP_LIMIT;
-          cost /= 3;
-          nRow /= 3;
         }
-        if( findTerm(pWC, iCur, j, notReady, WO_GT|WO_GE, pProbe) ){
+        if( pBtm ){
           wsFlags |= WHERE_BTM_LIMIT;
-          cost /= 3;
-          nRow /= 3;
         }
+        cost /= rangeDiv;
+        nRow /= rangeDiv;
         WHERETRACE(("...... range reduces nRow to %.9g and cost to %.9g\n",
                     nRow, cost));
       }
@@ -2062,6 +2512,9 @@ static void bestIndex(
   /* Report the best result
   */
   pCost->plan.wsFlags |= eqTermMask;
+#ifndef SQLITE_OMIT_AUTOMATIC_INDEX
+  bestAutomaticIndex(pParse, pWC, pSrc, notReady, pCost);
+#endif
   WHERETRACE(("best index is %s, cost=%.9g, nrow=%.9g, wsFlags=%x, nEq=%d\n",
         (pCost->plan.wsFlags & WHERE_INDEXED)!=0 ?
              pCost->plan.u.pIdx->zName : "(none)", pCost->nRow,
@@ -2888,6 +3341,13 @@ static void whereInfoFree(sqlite3 *db, WhereInfo *pWInfo){
         }
         sqlite3DbFree(db, pInfo);
       }
+      if( pWInfo->a[i].plan.wsFlags & WHERE_TEMP_INDEX ){
+        Index *pIdx = pWInfo->a[i].plan.u.pIdx;
+        if( pIdx ){
+          sqlite3DbFree(db, pIdx->zColAff);
+          sqlite3DbFree(db, pIdx);
+        }
+      }
     }
     whereClauseClear(pWInfo->pWC);
     sqlite3DbFree(db, pWInfo);
@@ -3041,6 +3501,7 @@ WhereInfo *sqlite3WhereBegin(
   pWInfo->regRowSet = (wctrlFlags & WHERE_FILL_ROWSET) ? regRowSet : -1;
   pWInfo->pWC = pWC = (WhereClause *)&((u8 *)pWInfo)[nByteWInfo];
   pWInfo->wctrlFlags = wctrlFlags;
+  pWInfo->savedNQueryLoop = pParse->nQueryLoop;
   pMaskSet = (WhereMaskSet*)&pWC[1];
 
   /* Split the WHERE clause into separate subexpressions where each
@@ -3113,6 +3574,7 @@ WhereInfo *sqlite3WhereBegin(
   pTabItem = pTabList->a;
   pLevel = pWInfo->a;
   andFlags = ~0;
+  pParse->nQueryLoop = (double)1;
   WHERETRACE(("*** Optimizer Start ***\n"));
   for(i=iFrom=0, pLevel=pWInfo->a; i<pTabList->nSrc; i++, pLevel++){
     WhereCost bestPlan;         /* Most efficient plan seen so far */
@@ -3180,7 +3642,7 @@ WhereInfo *sqlite3WhereBegin(
     }
     andFlags &= bestPlan.plan.wsFlags;
     pLevel->plan = bestPlan.plan;
-    if( bestPlan.plan.wsFlags & WHERE_INDEXED ){
+    if( bestPlan.plan.wsFlags & (WHERE_INDEXED|WHERE_TEMP_INDEX) ){
       pLevel->iIdxCur = pParse->nTab++;
     }else{
       pLevel->iIdxCur = -1;
@@ -3188,6 +3650,17 @@ WhereInfo *sqlite3WhereBegin(
     notReady &= ~getMask(pMaskSet, pTabList->a[bestJ].iCursor);
     pLevel->iFrom = (u8)bestJ;
 
+    /* Tables in inner loops are scanned once for each row produced by
+    ** the loops outside them.  bestAutomaticIndex() uses this estimate.
+    */
+    if( bestPlan.nRow>(double)1 ){
+      if( pParse->nQueryLoop<SQLITE_BIG_DBL/bestPlan.nRow ){
+        pParse->nQueryLoop *= bestPlan.nRow;
+      }else{
+        pParse->nQueryLoop = SQLITE_BIG_DBL;
+      }
+    }
+
     /* Check that if the table scanned by this loop iteration had an
     ** INDEXED BY clause attached to it, that the named index is being
     ** used for the scan. If not, then query compilation has failed.
@@ -3245,7 +3718,9 @@ WhereInfo *sqlite3WhereBegin(
       if( pItem->zAlias ){
         zMsg = sqlite3MAppendf(db, zMsg, "%s AS %s", zMsg, pItem->zAlias);
       }
-      if( (pLevel->plan.wsFlags & WHERE_INDEXED)!=0 ){
+      if( (pLevel->plan.wsFlags & WHERE_TEMP_INDEX)!=0 ){
+        zMsg = sqlite3MAppendf(db, zMsg, "%s WITH AUTOMATIC INDEX", zMsg);
+      }else if( (pLevel->plan.wsFlags & WHERE_INDEXED)!=0 ){
         zMsg = sqlite3MAppendf(db, zMsg, "%s WITH INDEX %s",
            zMsg, pLevel->plan.u.pIdx->zName);
       }else if( pLevel->plan.wsFlags & WHERE_MULTI_OR ){
@@ -3304,6 +3779,23 @@ WhereInfo *sqlite3WhereBegin(
     }
     sqlite3CodeVerifySchema(pParse, iDb);
   }
+
+#ifndef SQLITE_OMIT_AUTOMATIC_INDEX
+  /* Build any automatic indices now that all tables are open, so that
+  ** each one is rebuilt every time the WHERE loop runs.
+  */
+  notReady = ~(Bitmask)0;
+  for(i=0, pLevel=pWInfo->a; i<pTabList->nSrc; i++, pLevel++){
+    pTabItem = &pTabList->a[pLevel->iFrom];
+    if( pLevel->plan.wsFlags & WHERE_TEMP_INDEX ){
+      constructAutomaticIndex(pParse, pWC, pTabItem, notReady, pLevel);
+    }
+    notReady &= ~getMask(pMaskSet, pTabItem->iCursor);
+  }
+  if( db->mallocFailed ){
+    goto whereBeginError;
+  }
+#endif
   pWInfo->iTop = sqlite3VdbeCurrentAddr(v);
 
   /* Generate the code to do the search.  Each iteration of the for
@@ -3372,7 +3864,10 @@ WhereInfo *sqlite3WhereBegin(
 
   /* Jump here if malloc fails */
 whereBeginError:
-  whereInfoFree(db, pWInfo);
+  if( pWInfo ){
+    pParse->nQueryLoop = pWInfo->savedNQueryLoop;
+    whereInfoFree(db, pWInfo);
+  }
   return 0;
 }
 
@@ -3438,7 +3933,9 @@ void sqlite3WhereEnd(WhereInfo *pWInfo){
       if( !pWInfo->okOnePass && (pLevel->plan.wsFlags & WHERE_IDX_ONLY)==0 ){
         sqlite3VdbeAddOp1(v, OP_Close, pTabItem->iCursor);
       }
-      if( (pLevel->plan.wsFlags & WHERE_INDEXED)!=0 ){
+      if( (pLevel->plan.wsFlags & WHERE_INDEXED)!=0
+       && (pLevel->plan.wsFlags & WHERE_TEMP_INDEX)==0
+      ){
         sqlite3VdbeAddOp1(v, OP_Close, pLevel->iIdxCur);
       }
     }
@@ -3455,8 +3952,13 @@ void sqlite3WhereEnd(WhereInfo *pWInfo){
     ** directly.  This loop scans all that code looking for opcodes
     ** that reference the table and converts them into opcodes that
     ** reference the index.
+    **
+    ** Automatic indices are left alone.  The table cursor is always
+    ** positioned on the matching row, so reading it directly is safe.
     */
-    if( (pLevel->plan.wsFlags & WHERE_INDEXED)!=0 ){
+    if( (pLevel->plan.wsFlags & WHERE_INDEXED)!=0
+     && (pLevel->plan.wsFlags & WHERE_TEMP_INDEX)==0
+    ){
       int k, j, last;
       VdbeOp *pOp;
       Index *pIdx = pLevel->plan.u.pIdx;
@@ -3488,6 +3990,7 @@ void sqlite3WhereEnd(WhereInfo *pWInfo){
 
   /* Final cleanup
   */
+  pParse->nQueryLoop = pWInfo->savedNQueryLoop;
   whereInfoFree(db, pWInfo);
   return;
 }
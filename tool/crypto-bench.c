@@ -0,0 +1,434 @@
+/*
+** SQLite Cipher
+** crypto-bench.c developed by Stephen Lombardo (Zetetic LLC)
+** sjlombardo at zetetic dot net
+** http://zetetic.net
+**
+** Copyright (c) 2008, ZETETIC LLC
+** All rights reserved.
+**
+** Redistribution and use in source and binary forms, with or without
+** modification, are permitted provided that the following conditions are met:
+**     * Redistributions of source code must retain the above copyright
+**       notice, this list of conditions and the following disclaimer.
+**     * Redistributions in binary form must reproduce the above copyright
+**       notice, this list of conditions and the following disclaimer in the
+**       documentation and/or other materials provided with the distribution.
+**     * Neither the name of the ZETETIC LLC nor the
+**       names of its contributors may be used to endorse or promote products
+**       derived from this software without specific prior written permission.
+**
+** THIS SOFTWARE IS PROVIDED BY ZETETIC LLC ''AS IS'' AND ANY
+** EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+** WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+** DISCLAIMED. IN NO EVENT SHALL ZETETIC LLC BE LIABLE FOR ANY
+** DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+** (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+** LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+** ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+** (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+** SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+**
+*************************************************************************
+**
+** A standalone benchmark for the codec, built with "make crypto-bench"
+** against a library compiled with SQLITE_HAS_CODEC. For every combination
+** of page size, cipher, KDF iteration count and HMAC setting selected it
+** measures:
+**
+**   * raw sqlite3Codec() encryption and decryption throughput,
+**   * the rate at which pages are written by a bulk INSERT and read back
+**     by a full table scan through a minimal page cache,
+**   * the latency of opening the database (dominated by key derivation),
+**   * the median and 99th percentile latency of random point queries,
+**
+** and prints one CSV row per combination to stdout, so that runs from
+** different releases can be compared. Each option takes a comma separated
+** list, and the defaults cover the full matrix:
+**
+**   crypto-bench ?-pagesize LIST? ?-cipher LIST? ?-kdf-iter LIST?
+**                ?-hmac LIST? ?-mb N? ?-loop N? ?-query N? ?-open N?
+**                ?-threads N? ?-db FILE?
+**
+** Combinations the codec rejects, such as a page too small to hold the
+** reserved space, are reported on stderr and skipped.
+*/
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "sqliteInt.h"
+#include "btreeInt.h"
+
+#ifndef SQLITE_HAS_CODEC
+# error "crypto-bench requires a library built with SQLITE_HAS_CODEC"
+#endif
+
+extern void sqlite3pager_get_codec(Pager *pPager, void **ctx);
+extern void *sqlite3Codec(void *iCtx, void *pData, Pgno pgno, int mode);
+
+#define BENCH_NPAGE 64          /* pages run through sqlite3Codec() per loop */
+#define BENCH_ROWSZ 200         /* bytes of blob per row */
+
+/*
+** The benchmark settings, as given on the command line.
+*/
+static struct {
+  const char *zPagesize;        /* page sizes to test */
+  const char *zCipher;          /* ciphers to test */
+  const char *zKdfIter;         /* KDF iteration counts to test */
+  const char *zHmac;            /* HMAC settings to test */
+  const char *zDb;              /* database file used by each run */
+  int nMB;                      /* size of the database built by each run */
+  int nLoop;                    /* repetitions of the codec and scan tests */
+  int nQuery;                   /* point queries timed */
+  int nOpen;                    /* database opens timed */
+  int nThread;                  /* codec worker threads */
+} g = {
+  "512,1024,2048,4096,8192,16384,32768",
+  "aes-256-cfb,aes-256-ctr,aes-256-xts",
+  "4000,64000",
+  "off,HMAC-SHA1,HMAC-SHA256",
+  "crypto-bench.db",
+  4, 10, 2000, 5, 0
+};
+
+/*
+** One combination of settings and the figures measured for it.
+*/
+typedef struct Bench Bench;
+struct Bench {
+  int pgsz;                     /* page size */
+  const char *zCipher;          /* cipher */
+  int nKdfIter;                 /* KDF iteration count */
+  const char *zHmac;            /* HMAC setting */
+  int nPage;                    /* pages in the database */
+  double encPages;              /* sqlite3Codec() encryption, pages/sec */
+  double decPages;              /* sqlite3Codec() decryption, pages/sec */
+  double insertPages;           /* pages written by INSERT, pages/sec */
+  double scanPages;             /* pages read by a table scan, pages/sec */
+  double openMs;                /* mean time to open and read the schema */
+  double queryP50;              /* median point query, microseconds */
+  double queryP99;              /* 99th percentile point query, microseconds */
+};
+
+/*
+** Return a monotonic time in seconds.
+*/
+static double benchTime(void){
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec + t.tv_nsec/1e9;
+}
+
+/*
+** Return the i'th element of comma separated list zList, copied into
+** zBuf, or NULL if there are fewer elements.
+*/
+static const char *listItem(const char *zList, int i, char *zBuf, int nBuf){
+  const char *z = zList;
+  int n;
+  while( i>0 && z ){
+    z = strchr(z, ',');
+    if( z ) z++;
+    i--;
+  }
+  if( z==0 || *z==0 ) return 0;
+  n = (int)strcspn(z, ",");
+  if( n>=nBuf ) n = nBuf-1;
+  memcpy(zBuf, z, n);
+  zBuf[n] = 0;
+  return zBuf;
+}
+
+/*
+** Open the benchmark database and apply the settings of p, which have to
+** be repeated on every open. Return the handle or NULL after reporting
+** an error.
+*/
+static sqlite3 *benchOpen(Bench *p, int nCache){
+  sqlite3 *db;
+  char *zErr = 0;
+  char *zSql;
+  int rc;
+
+  if( sqlite3_open(g.zDb, &db)!=SQLITE_OK ){
+    fprintf(stderr, "cannot open %s: %s\n", g.zDb, sqlite3_errmsg(db));
+    sqlite3_close(db);
+    return 0;
+  }
+  zSql = sqlite3_mprintf(
+      "PRAGMA key = 'crypto-bench';"
+      "PRAGMA cipher = '%q';"
+      "PRAGMA kdf_iter = %d;"
+      "PRAGMA cipher_hmac = '%q';"
+      "PRAGMA page_size = %d;"
+      "PRAGMA cache_size = %d;"
+      "PRAGMA synchronous = OFF;",
+      p->zCipher, p->nKdfIter, p->zHmac, p->pgsz, nCache);
+  rc = sqlite3_exec(db, zSql, 0, 0, &zErr);
+  sqlite3_free(zSql);
+  if( rc!=SQLITE_OK ){
+    fprintf(stderr, "%d,%s,%d,%s: %s\n",
+            p->pgsz, p->zCipher, p->nKdfIter, p->zHmac, zErr);
+    sqlite3_free(zErr);
+    sqlite3_close(db);
+    return 0;
+  }
+  return db;
+}
+
+/*
+** Run SQL that is not expected to fail, reporting the error if it does.
+*/
+static int benchExec(Bench *p, sqlite3 *db, const char *zSql){
+  char *zErr = 0;
+  int rc = sqlite3_exec(db, zSql, 0, 0, &zErr);
+  if( rc!=SQLITE_OK ){
+    fprintf(stderr, "%d,%s,%d,%s: %s\n",
+            p->pgsz, p->zCipher, p->nKdfIter, p->zHmac, zErr);
+    sqlite3_free(zErr);
+  }
+  return rc;
+}
+
+static int benchCmpDouble(const void *a, const void *b){
+  double x = *(const double *)a;
+  double y = *(const double *)b;
+  return x<y ? -1 : x>y;
+}
+
+/*
+** Encrypt and decrypt BENCH_NPAGE pages g.nLoop times with the codec
+** attached to the main database of db. Each decryption works on a copy
+** of the ciphertext, as the codec decrypts in place.
+*/
+static int benchCodec(Bench *p, sqlite3 *db){
+  void *pCodec;
+  u8 *aPlain, *aCipher, *aWork;
+  double t;
+  int i, j;
+
+  sqlite3pager_get_codec(sqlite3BtreePager(db->aDb[0].pBt), &pCodec);
+  if( pCodec==0 ) return SQLITE_ERROR;
+  aPlain = malloc(p->pgsz*BENCH_NPAGE*2 + p->pgsz);
+  if( aPlain==0 ) return SQLITE_NOMEM;
+  aCipher = &aPlain[p->pgsz*BENCH_NPAGE];
+  aWork = &aCipher[p->pgsz*BENCH_NPAGE];
+  sqlite3_randomness(p->pgsz*BENCH_NPAGE, aPlain);
+
+  t = benchTime();
+  for(i=0; i<g.nLoop; i++){
+    for(j=0; j<BENCH_NPAGE; j++){
+      void *pOut = sqlite3Codec(pCodec, &aPlain[j*p->pgsz], j+2, 6);
+      memcpy(&aCipher[j*p->pgsz], pOut, p->pgsz);
+    }
+  }
+  p->encPages = g.nLoop*BENCH_NPAGE/(benchTime()-t);
+
+  t = benchTime();
+  for(i=0; i<g.nLoop; i++){
+    for(j=0; j<BENCH_NPAGE; j++){
+      memcpy(aWork, &aCipher[j*p->pgsz], p->pgsz);
+      if( sqlite3Codec(pCodec, aWork, j+2, 3)==0 ){
+        free(aPlain);
+        return SQLITE_CORRUPT;
+      }
+    }
+  }
+  p->decPages = g.nLoop*BENCH_NPAGE/(benchTime()-t);
+
+  free(aPlain);
+  return SQLITE_OK;
+}
+
+/*
+** Time g.nQuery lookups of random rows through a minimal page cache.
+*/
+static int benchQuery(Bench *p, sqlite3 *db, int nRow){
+  sqlite3_stmt *pStmt;
+  double *aTime;
+  int i;
+
+  aTime = malloc(sizeof(double)*g.nQuery);
+  if( aTime==0 ) return SQLITE_NOMEM;
+  if( sqlite3_prepare_v2(db, "SELECT b FROM t1 WHERE a=?", -1, &pStmt, 0) ){
+    free(aTime);
+    return SQLITE_ERROR;
+  }
+  for(i=0; i<g.nQuery; i++){
+    unsigned int r;
+    double t;
+    sqlite3_randomness(sizeof(r), &r);
+    t = benchTime();
+    sqlite3_bind_int(pStmt, 1, 1 + r%nRow);
+    sqlite3_step(pStmt);
+    sqlite3_reset(pStmt);
+    aTime[i] = (benchTime()-t)*1e6;
+  }
+  sqlite3_finalize(pStmt);
+  qsort(aTime, g.nQuery, sizeof(double), benchCmpDouble);
+  p->queryP50 = aTime[g.nQuery/2];
+  p->queryP99 = aTime[(g.nQuery*99)/100];
+  free(aTime);
+  return SQLITE_OK;
+}
+
+/*
+** Measure everything for one combination of settings. Return SQLITE_OK
+** if p is filled in.
+*/
+static int benchRun(Bench *p){
+  int nRow = (int)(((sqlite3_int64)g.nMB<<20)/BENCH_ROWSZ);
+  sqlite3 *db;
+  double t;
+  int rc;
+  int i;
+
+  remove(g.zDb);
+  db = benchOpen(p, 2000);
+  if( db==0 ) return SQLITE_ERROR;
+
+  /* Bulk INSERT in a single transaction, encrypted as it is committed. */
+  rc = benchExec(p, db, "CREATE TABLE t1(a INTEGER PRIMARY KEY, b)");
+  if( rc==SQLITE_OK ){
+    char *zSql = sqlite3_mprintf(
+        "BEGIN;"
+        "INSERT INTO t1 VALUES(1, randomblob(%d));"
+        "INSERT INTO t1 SELECT a+1, randomblob(%d) FROM t1;",
+        BENCH_ROWSZ, BENCH_ROWSZ);
+    t = benchTime();
+    rc = benchExec(p, db, zSql);
+    sqlite3_free(zSql);
+    for(i=2; rc==SQLITE_OK && i<nRow; i*=2){
+      zSql = sqlite3_mprintf(
+          "INSERT INTO t1 SELECT a+%d, randomblob(%d) FROM t1 WHERE a<=%d",
+          i, BENCH_ROWSZ, nRow-i);
+      rc = benchExec(p, db, zSql);
+      sqlite3_free(zSql);
+    }
+    if( rc==SQLITE_OK ) rc = benchExec(p, db, "COMMIT");
+    t = benchTime()-t;
+  }
+  if( rc==SQLITE_OK ){
+    sqlite3_stmt *pStmt;
+    sqlite3_prepare_v2(db, "PRAGMA page_count", -1, &pStmt, 0);
+    sqlite3_step(pStmt);
+    p->nPage = sqlite3_column_int(pStmt, 0);
+    sqlite3_finalize(pStmt);
+    p->insertPages = p->nPage/t;
+    rc = benchCodec(p, db);
+  }
+  sqlite3_close(db);
+  if( rc!=SQLITE_OK ) return rc;
+
+  /* Open latency: key derivation plus reading and decrypting the schema. */
+  t = benchTime();
+  for(i=0; rc==SQLITE_OK && i<g.nOpen; i++){
+    db = benchOpen(p, 10);
+    if( db==0 ) return SQLITE_ERROR;
+    rc = benchExec(p, db, "SELECT count(*) FROM sqlite_master");
+    sqlite3_close(db);
+  }
+  p->openMs = (benchTime()-t)*1000/g.nOpen;
+  if( rc!=SQLITE_OK ) return rc;
+
+  /* Full scans and point queries through a 10 page cache, so that almost
+  ** every page visited is read from the file and decrypted. */
+  db = benchOpen(p, 10);
+  if( db==0 ) return SQLITE_ERROR;
+  t = benchTime();
+  for(i=0; rc==SQLITE_OK && i<g.nLoop; i++){
+    rc = benchExec(p, db, "SELECT count(b) FROM t1");
+  }
+  p->scanPages = (double)p->nPage*g.nLoop/(benchTime()-t);
+  if( rc==SQLITE_OK ){
+    rc = benchQuery(p, db, nRow);
+  }
+  sqlite3_close(db);
+  return rc;
+}
+
+static void usage(const char *zArgv0){
+  fprintf(stderr,
+    "Usage: %s ?-pagesize LIST? ?-cipher LIST? ?-kdf-iter LIST? ?-hmac LIST?\n"
+    "          ?-mb N? ?-loop N? ?-query N? ?-open N? ?-threads N? ?-db FILE?\n",
+    zArgv0);
+  exit(1);
+}
+
+int main(int argc, char **argv){
+  char zPgsz[32], zCipher[64], zIter[32], zHmac[64];
+  int i, a, b, c, d;
+
+  for(i=1; i<argc; i++){
+    const char *z = argv[i];
+    if( i==argc-1 ) usage(argv[0]);
+    if( strcmp(z, "-pagesize")==0 ){
+      g.zPagesize = argv[++i];
+    }else if( strcmp(z, "-cipher")==0 ){
+      g.zCipher = argv[++i];
+    }else if( strcmp(z, "-kdf-iter")==0 ){
+      g.zKdfIter = argv[++i];
+    }else if( strcmp(z, "-hmac")==0 ){
+      g.zHmac = argv[++i];
+    }else if( strcmp(z, "-db")==0 ){
+      g.zDb = argv[++i];
+    }else if( strcmp(z, "-mb")==0 ){
+      g.nMB = atoi(argv[++i]);
+    }else if( strcmp(z, "-loop")==0 ){
+      g.nLoop = atoi(argv[++i]);
+    }else if( strcmp(z, "-query")==0 ){
+      g.nQuery = atoi(argv[++i]);
+    }else if( strcmp(z, "-open")==0 ){
+      g.nOpen = atoi(argv[++i]);
+    }else if( strcmp(z, "-threads")==0 ){
+      g.nThread = atoi(argv[++i]);
+    }else{
+      usage(argv[0]);
+    }
+  }
+  if( g.nMB<1 || g.nLoop<1 || g.nQuery<1 || g.nOpen<1 ) usage(argv[0]);
+
+  sqlite3_config(SQLITE_CONFIG_CODEC_THREADS, g.nThread);
+  sqlite3_initialize();
+
+  printf("page_size,cipher,kdf_iter,hmac,pages,"
+         "encrypt_pages_per_sec,encrypt_mb_per_sec,"
+         "decrypt_pages_per_sec,decrypt_mb_per_sec,"
+         "insert_pages_per_sec,insert_mb_per_sec,"
+         "scan_pages_per_sec,scan_mb_per_sec,"
+         "open_ms,query_p50_us,query_p99_us\n");
+  for(a=0; listItem(g.zPagesize, a, zPgsz, sizeof(zPgsz)); a++){
+    for(b=0; listItem(g.zCipher, b, zCipher, sizeof(zCipher)); b++){
+      for(c=0; listItem(g.zKdfIter, c, zIter, sizeof(zIter)); c++){
+        for(d=0; listItem(g.zHmac, d, zHmac, sizeof(zHmac)); d++){
+          Bench x;
+          double mb;
+          memset(&x, 0, sizeof(x));
+          x.pgsz = atoi(zPgsz);
+          x.zCipher = zCipher;
+          x.nKdfIter = atoi(zIter);
+          x.zHmac = zHmac;
+          if( benchRun(&x)!=SQLITE_OK ){
+            fprintf(stderr, "%d,%s,%d,%s: skipped\n",
+                    x.pgsz, x.zCipher, x.nKdfIter, x.zHmac);
+            continue;
+          }
+          mb = x.pgsz/1048576.0;
+          printf("%d,%s,%d,%s,%d,%.0f,%.2f,%.0f,%.2f,%.0f,%.2f,%.0f,%.2f,"
+                 "%.3f,%.1f,%.1f\n",
+                 x.pgsz, x.zCipher, x.nKdfIter, x.zHmac, x.nPage,
+                 x.encPages, x.encPages*mb, x.decPages, x.decPages*mb,
+                 x.insertPages, x.insertPages*mb, x.scanPages, x.scanPages*mb,
+                 x.openMs, x.queryP50, x.queryP99);
+          fflush(stdout);
+        }
+      }
+    }
+  }
+  remove(g.zDb);
+  sqlite3_shutdown();
+  return 0;
+}
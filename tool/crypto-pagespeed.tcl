@@ -0,0 +1,98 @@
+#!/usr/bin/tclsh
+#
+# SQLite Cipher
+# crypto-pagespeed.tcl developed by Stephen Lombardo (Zetetic LLC)
+# sjlombardo at zetetic dot net
+# http://zetetic.net
+#
+# Copyright (c) 2008, ZETETIC LLC
+# All rights reserved.
+#
+# Redistribution and use in source and binary forms, with or without
+# modification, are permitted provided that the following conditions are met:
+#     * Redistributions of source code must retain the above copyright
+#       notice, this list of conditions and the following disclaimer.
+#     * Redistributions in binary form must reproduce the above copyright
+#       notice, this list of conditions and the following disclaimer in the
+#       documentation and/or other materials provided with the distribution.
+#     * Neither the name of the ZETETIC LLC nor the
+#       names of its contributors may be used to endorse or promote products
+#       derived from this software without specific prior written permission.
+#
+# THIS SOFTWARE IS PROVIDED BY ZETETIC LLC ''AS IS'' AND ANY
+# EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+# WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+# DISCLAIMED. IN NO EVENT SHALL ZETETIC LLC BE LIABLE FOR ANY
+# DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+# (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+# LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+# ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+# (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+# SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+#
+# Run this script using the testfixture of a codec enabled build to
+# measure raw page encryption and decryption throughput:
+#
+#   ./testfixture crypto-pagespeed.tcl ?NPAGE? ?NLOOP? ?CIPHER? ?NTHREAD? ?HMAC? ?CHECK?
+#
+# The cache is kept at its minimum size so that every page visited by
+# a full table scan has to be read and decrypted, and every page
+# rewritten by the UPDATE has to be encrypted. Compare the pages/sec
+# figures between builds to measure changes to the codec itself.
+# NTHREAD sets the number of codec worker threads used at commit.
+# HMAC selects the page HMAC (off, HMAC-SHA1 or HMAC-SHA256) and CHECK
+# set to 0 skips its verification when pages are read.
+#
+
+set npage [expr {[llength $argv]>0 ? [lindex $argv 0] : 2000}]
+set nloop [expr {[llength $argv]>1 ? [lindex $argv 1] : 20}]
+set cipher [expr {[llength $argv]>2 ? [lindex $argv 2] : "aes-256-cfb"}]
+set nthread [expr {[llength $argv]>3 ? [lindex $argv 3] : 0}]
+set hmac [expr {[llength $argv]>4 ? [lindex $argv 4] : "off"}]
+set check [expr {[llength $argv]>5 ? [lindex $argv 5] : 1}]
+
+if {![sqlite3 -has-codec]} {
+  puts "this build was not compiled with SQLITE_HAS_CODEC"
+  exit 1
+}
+
+sqlite3_shutdown
+sqlite3_config_codec_threads $nthread
+sqlite3_initialize
+
+file delete -force pagespeed.db pagespeed.db-journal
+sqlite3 db pagespeed.db
+db eval "PRAGMA key = 'xyzzy'; PRAGMA cipher = '$cipher'; PRAGMA cipher_hmac = '$hmac';"
+db eval "PRAGMA cipher_hmac_check = $check"
+db eval {
+  PRAGMA cache_size = 10;
+  PRAGMA synchronous = OFF;
+  CREATE TABLE t1(a INTEGER PRIMARY KEY, b);
+}
+db eval BEGIN
+for {set i 1} {$i<=$npage} {incr i} {
+  db eval {INSERT INTO t1 VALUES($i, randomblob(900))}
+}
+db eval COMMIT
+set pgcnt [db one {PRAGMA page_count}]
+puts "cipher: [db one {PRAGMA cipher}], codec threads: $nthread,\
+ hmac: [db one {PRAGMA cipher_hmac}], hmac check: [db one {PRAGMA cipher_hmac_check}]"
+
+# Decrypt: each scan reads every page of t1 back through the codec.
+set t [lindex [time {
+  for {set i 0} {$i<$nloop} {incr i} { db eval {SELECT count(b) FROM t1} }
+} 1] 0]
+set secs [expr {$t/1000000.0}]
+puts [format "decrypt: %d pages in %.3f sec, %.0f pages/sec" \
+  [expr {$pgcnt*$nloop}] $secs [expr {$pgcnt*$nloop/$secs}]]
+
+# Encrypt: each UPDATE dirties every leaf page, which is encrypted on commit.
+set t [lindex [time {
+  for {set i 0} {$i<$nloop} {incr i} { db eval {UPDATE t1 SET b=b} }
+} 1] 0]
+set secs [expr {$t/1000000.0}]
+puts [format "encrypt: %d pages in %.3f sec, %.0f pages/sec" \
+  [expr {$pgcnt*$nloop}] $secs [expr {$pgcnt*$nloop/$secs}]]
+
+db close
+file delete -force pagespeed.db pagespeed.db-journal
@@ -112,6 +112,7 @@ foreach hdr {
    sqliteLimit.h
    vdbe.h
    vdbeInt.h
+   wal.h
 } {
   set available_hdr($hdr) 1
 }
@@ -209,12 +210,16 @@ proc copy_file {filename} {
 # used subroutines first in order to help the compiler find
 # inlining opportunities.
 #
+# crypto.c reads sqlite3GlobalConfig to size the codec worker pool,
+# so it must come after global.c, which defines sqlite3Config.
+#
 foreach file {
    sqliteInt.h
 
+   global.c
+
    crypto.c
 
-   global.c
    status.c
    date.c
    os.c
@@ -230,6 +235,7 @@ foreach file {
    mutex_os2.c
    mutex_unix.c
    mutex_w32.c
+   threads.c
    malloc.c
    printf.c
    random.c
@@ -247,6 +253,7 @@ foreach file {
    pcache1.c
    rowset.c
    pager.c
+   wal.c
 
    btmutex.c
    btree.c
@@ -257,6 +264,7 @@ foreach file {
    vdbeapi.c
    vdbe.c
    vdbeblob.c
+   vdbesort.c
    journal.c
    memjournal.c
 
@@ -144,6 +144,7 @@ proc main {argv} {
     SQLITE_OMIT_AUTHORIZATION          \
     SQLITE_OMIT_AUTOINCREMENT          \
     SQLITE_OMIT_AUTOINIT               \
+    SQLITE_OMIT_AUTOMATIC_INDEX        \
     SQLITE_OMIT_AUTOVACUUM             \
     SQLITE_OMIT_BETWEEN_OPTIMIZATION   \
     SQLITE_OMIT_BLOB_LITERAL           \
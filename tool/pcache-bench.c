@@ -0,0 +1,302 @@
+/*
+** 2009 May 5
+**
+** The author disclaims copyright to this source code.  In place of
+** a legal notice, here is a blessing:
+**
+**    May you do good and not evil.
+**    May you find forgiveness for yourself and forgive others.
+**    May you share freely, never taking more than you give.
+**
+*************************************************************************
+**
+** A standalone multi-threaded benchmark for the default page cache,
+** built with "make pcache-bench" against a threadsafe library. Each
+** thread creates its own purgeable cache, as each connection does, and
+** then fetches and unpins pages chosen at random from a key space a
+** little larger than the cache, holding a few pages pinned at a time
+** the way a b-tree cursor does. Misses recycle the least recently used
+** unpinned page.
+**
+** Two modes are measured:
+**
+**   separate   The library is configured for multi-threaded use, so
+**              each cache keeps a private LRU list and fetching or
+**              unpinning a page takes no lock.
+**
+**   shared     The library is configured for single-threaded use, so
+**              all caches share the one global LRU list, and every call
+**              is serialized by a single process-wide mutex. This is the
+**              behaviour of earlier releases.
+**
+** One CSV row is printed to stdout for each mode and thread count:
+**
+**   pcache-bench ?-mode LIST? ?-threads LIST? ?-cache N? ?-keys N?
+**                ?-ops N? ?-pagesize N? ?-pin N?
+*/
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <time.h>
+#include <pthread.h>
+#include "sqlite3.h"
+
+#define BENCH_MAXPIN 64         /* largest -pin value accepted */
+
+/*
+** The benchmark settings, as given on the command line.
+*/
+static struct {
+  const char *zMode;            /* modes to test */
+  const char *zThreads;         /* thread counts to test */
+  int nCache;                   /* cache_size of each thread's cache */
+  int nKey;                     /* distinct pages fetched by each thread */
+  int nOp;                      /* fetch/unpin pairs per thread */
+  int szPage;                   /* page size */
+  int nPin;                     /* pages each thread holds pinned */
+} g = {
+  "separate,shared",
+  "1,2,4,8,16,32",
+  2000, 2500, 1000000, 1024, 4
+};
+
+/*
+** State shared by the threads of one run.
+*/
+static sqlite3_pcache_methods methods;  /* the default page cache */
+static pthread_mutex_t lruMutex = PTHREAD_MUTEX_INITIALIZER;
+static int bSerialize;                  /* true to lock around each call */
+
+/*
+** Per-thread state and results.
+*/
+typedef struct Worker Worker;
+struct Worker {
+  pthread_t tid;                /* the thread */
+  unsigned int iSeed;           /* random number generator state */
+  int nHit;                     /* fetches that found the page cached */
+  int rc;                       /* SQLITE_OK, or SQLITE_NOMEM */
+};
+
+/*
+** Return a monotonic time in seconds.
+*/
+static double benchTime(void){
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec + t.tv_nsec/1e9;
+}
+
+/*
+** Return the i'th element of comma separated list zList, copied into
+** zBuf, or NULL if there are fewer elements.
+*/
+static const char *listItem(const char *zList, int i, char *zBuf, int nBuf){
+  const char *z = zList;
+  int n;
+  while( i>0 && z ){
+    z = strchr(z, ',');
+    if( z ) z++;
+    i--;
+  }
+  if( z==0 || *z==0 ) return 0;
+  n = (int)strcspn(z, ",");
+  if( n>=nBuf ) n = nBuf-1;
+  memcpy(zBuf, z, n);
+  zBuf[n] = 0;
+  return zBuf;
+}
+
+/*
+** Wrappers around the page cache methods, which take lruMutex in the
+** "shared" mode.
+*/
+static void *benchFetch(sqlite3_pcache *p, unsigned int iKey, int createFlag){
+  void *pPg;
+  if( bSerialize ) pthread_mutex_lock(&lruMutex);
+  pPg = methods.xFetch(p, iKey, createFlag);
+  if( bSerialize ) pthread_mutex_unlock(&lruMutex);
+  return pPg;
+}
+static void benchUnpin(sqlite3_pcache *p, void *pPg){
+  if( bSerialize ) pthread_mutex_lock(&lruMutex);
+  methods.xUnpin(p, pPg, 0);
+  if( bSerialize ) pthread_mutex_unlock(&lruMutex);
+}
+static sqlite3_pcache *benchCreate(void){
+  sqlite3_pcache *p;
+  if( bSerialize ) pthread_mutex_lock(&lruMutex);
+  p = methods.xCreate(g.szPage, 1);
+  if( p ) methods.xCachesize(p, g.nCache);
+  if( bSerialize ) pthread_mutex_unlock(&lruMutex);
+  return p;
+}
+static void benchDestroy(sqlite3_pcache *p){
+  if( bSerialize ) pthread_mutex_lock(&lruMutex);
+  methods.xDestroy(p);
+  if( bSerialize ) pthread_mutex_unlock(&lruMutex);
+}
+
+/*
+** The body of each thread. Page numbers start at 1, and a page is never
+** pinned twice by the same thread at once, as the pager guarantees.
+*/
+static void *benchWorker(void *pArg){
+  Worker *pW = (Worker *)pArg;
+  sqlite3_pcache *pCache;
+  unsigned int aKey[BENCH_MAXPIN];
+  void *apPin[BENCH_MAXPIN];
+  int i, j;
+
+  pCache = benchCreate();
+  if( pCache==0 ){
+    pW->rc = SQLITE_NOMEM;
+    return 0;
+  }
+  memset(apPin, 0, sizeof(apPin));
+  for(i=0; i<g.nOp; i++){
+    int iSlot = i % g.nPin;
+    unsigned int iKey;
+    void *pPg;
+
+    if( apPin[iSlot] ){
+      benchUnpin(pCache, apPin[iSlot]);
+      apPin[iSlot] = 0;
+    }
+    do{
+      pW->iSeed = pW->iSeed*1103515245 + 12345;
+      iKey = 1 + (pW->iSeed>>8) % g.nKey;
+      for(j=0; j<g.nPin && (apPin[j]==0 || aKey[j]!=iKey); j++);
+    }while( j<g.nPin );
+
+    pPg = benchFetch(pCache, iKey, 0);
+    if( pPg ){
+      pW->nHit++;
+    }else{
+      pPg = benchFetch(pCache, iKey, 2);
+      if( pPg==0 ){
+        pW->rc = SQLITE_NOMEM;
+        break;
+      }
+      memset(pPg, 0, sizeof(unsigned int));
+    }
+    aKey[iSlot] = iKey;
+    apPin[iSlot] = pPg;
+  }
+  for(j=0; j<g.nPin; j++){
+    if( apPin[j] ) benchUnpin(pCache, apPin[j]);
+  }
+  benchDestroy(pCache);
+  return 0;
+}
+
+/*
+** Configure the library for zMode and run nThread threads. Print the
+** results as one CSV row.
+*/
+static int benchRun(const char *zMode, int nThread){
+  Worker *aW;
+  double t;
+  int i, rc = SQLITE_OK;
+  int nHit = 0;
+
+  if( nThread<1 ) return SQLITE_MISUSE;
+  sqlite3_shutdown();
+  if( strcmp(zMode, "separate")==0 ){
+    rc = sqlite3_config(SQLITE_CONFIG_MULTITHREAD);
+    bSerialize = 0;
+  }else if( strcmp(zMode, "shared")==0 ){
+    rc = sqlite3_config(SQLITE_CONFIG_SINGLETHREAD);
+    bSerialize = 1;
+  }else{
+    rc = SQLITE_ERROR;
+  }
+  if( rc==SQLITE_OK ) rc = sqlite3_config(SQLITE_CONFIG_GETPCACHE, &methods);
+  if( rc==SQLITE_OK ) rc = sqlite3_initialize();
+  if( rc!=SQLITE_OK ) return rc;
+
+  aW = (Worker *)calloc(nThread, sizeof(Worker));
+  if( aW==0 ) return SQLITE_NOMEM;
+  t = benchTime();
+  for(i=0; i<nThread; i++){
+    aW[i].iSeed = i+1;
+    if( pthread_create(&aW[i].tid, 0, benchWorker, &aW[i]) ){
+      rc = SQLITE_ERROR;
+      nThread = i;
+      break;
+    }
+  }
+  for(i=0; i<nThread; i++){
+    pthread_join(aW[i].tid, 0);
+    if( aW[i].rc!=SQLITE_OK ) rc = aW[i].rc;
+    nHit += aW[i].nHit;
+  }
+  t = benchTime()-t;
+  if( rc==SQLITE_OK ){
+    double nOp = (double)g.nOp*nThread;
+    printf("%s,%d,%d,%d,%d,%.0f,%.3f,%.0f,%.1f\n",
+        zMode, nThread, g.nCache, g.nKey, g.nPin, nOp, t, nOp/t,
+        100.0*nHit/nOp);
+    fflush(stdout);
+  }
+  free(aW);
+  return rc;
+}
+
+static void usage(const char *zArgv0){
+  fprintf(stderr,
+    "Usage: %s ?-mode LIST? ?-threads LIST? ?-cache N? ?-keys N?\n"
+    "          ?-ops N? ?-pagesize N? ?-pin N?\n",
+    zArgv0);
+  exit(1);
+}
+
+int main(int argc, char **argv){
+  char zMode[32], zThread[32];
+  int i, a, b;
+
+  for(i=1; i<argc; i++){
+    const char *z = argv[i];
+    if( i==argc-1 ) usage(argv[0]);
+    if( strcmp(z, "-mode")==0 ){
+      g.zMode = argv[++i];
+    }else if( strcmp(z, "-threads")==0 ){
+      g.zThreads = argv[++i];
+    }else if( strcmp(z, "-cache")==0 ){
+      g.nCache = atoi(argv[++i]);
+    }else if( strcmp(z, "-keys")==0 ){
+      g.nKey = atoi(argv[++i]);
+    }else if( strcmp(z, "-ops")==0 ){
+      g.nOp = atoi(argv[++i]);
+    }else if( strcmp(z, "-pagesize")==0 ){
+      g.szPage = atoi(argv[++i]);
+    }else if( strcmp(z, "-pin")==0 ){
+      g.nPin = atoi(argv[++i]);
+    }else{
+      usage(argv[0]);
+    }
+  }
+  if( g.nCache<1 || g.nOp<1 || g.szPage<512
+   || g.nPin<1 || g.nPin>BENCH_MAXPIN || g.nKey<=g.nPin
+  ){
+    usage(argv[0]);
+  }
+  if( !sqlite3_threadsafe() ){
+    fprintf(stderr, "pcache-bench requires a threadsafe library\n");
+    return 1;
+  }
+
+  /* The default page cache is installed by the first initialization. */
+  sqlite3_initialize();
+  printf("mode,threads,cache_size,keys,pinned,ops,seconds,"
+         "ops_per_sec,hit_pct\n");
+  for(a=0; listItem(g.zMode, a, zMode, sizeof(zMode)); a++){
+    for(b=0; listItem(g.zThreads, b, zThread, sizeof(zThread)); b++){
+      if( benchRun(zMode, atoi(zThread))!=SQLITE_OK ){
+        fprintf(stderr, "%s,%s: failed\n", zMode, zThread);
+      }
+    }
+  }
+  sqlite3_shutdown();
+  return 0;
+}